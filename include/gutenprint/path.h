@@ -52,6 +52,8 @@ extern stp_list_t *stpi_list_files_on_data_path(const char *name);
 
 extern char *stpi_path_merge(const char *path, const char *file);
 
+extern char *stpi_cache_dir(void);
+
 
 #ifdef __cplusplus
   }
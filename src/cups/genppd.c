@@ -23,6 +23,7 @@
  *
  *   main()              - Process files on the command-line...
  *   cat_ppd()           - Copy the named PPD to stdout.
+ *   copy_ppd()          - Copy the rest of a file to stdout.
  *   generate_ppd()      - Generate a PPD file.
  *   getlangs()          - Get a list of available translations.
  *   help()              - Show detailed help.
@@ -53,6 +54,7 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
@@ -182,7 +184,13 @@ typedef _gpfile *gpFile;
  */
 
 #ifdef CUPS_DRIVER_INTERFACE
+static const char *program_path = NULL;	/* argv[0], for the PPD cache */
+
 static int	cat_ppd(const char *uri);
+static int	copy_ppd(FILE *fp);
+static char	*ppd_cache_file(const char *key);
+static void	ppd_cache_stamp(char **key, const char *lang);
+static int	ppd_cache_cat(const char *cache_file, const char *key);
 static int	list_ppds(const char *argv0);
 #else  /* !CUPS_DRIVER_INTERFACE */
 static int	generate_ppd(const char *prefix, int verbose,
@@ -191,6 +199,10 @@ static int	generate_ppd(const char *prefix, int verbose,
 static int	generate_model_ppds(const char *prefix, int verbose,
 				    const stp_printer_t *printer,
 				    const char *language, int which_ppds);
+static int	generate_all_ppds(const char *prefix, int verbose,
+				  const stp_printer_t **printers, int count,
+				  const char *language, int which_ppds,
+				  int jobs);
 static void	help(void);
 static void	printlangs(char** langs);
 static void	printmodels(int verbose);
@@ -247,19 +259,18 @@ main(int  argc,			    /* I - Number of command-line arguments */
   putenv(lang_c);
   putenv(lcall_c);
   putenv(lcnumeric_c);
+  program_path = argv[0];
 
  /*
-  * Initialise libgutenprint
-  */
-
-  stp_init();
-
- /*
-  * Process command-line...
+  * Process command-line...  cat_ppd() initialises libgutenprint itself,
+  * and only if the PPD isn't cached.
   */
 
   if (argc == 2 && !strcmp(argv[1], "list"))
-    return (list_ppds(argv[0]));
+    {
+      stp_init();
+      return (list_ppds(argv[0]));
+    }
   else if (argc == 3 && !strcmp(argv[1], "cat"))
     return (cat_ppd(argv[2]));
   else if (argc == 2 && !strcmp(argv[1], "org.gutenprint.multicat"))
@@ -298,6 +309,255 @@ main(int  argc,			    /* I - Number of command-line arguments */
 }
 
 
+/*
+ * PPDs served through the driver interface are cached on disk, since
+ * cups-driverd asks for one every time a queue is added or refreshed and
+ * generating it means loading every driver and data file.  Each PPD is
+ * stored in a file named after a hash of the Gutenprint version, driver,
+ * PPD type and language.  The file starts with the full key it was
+ * generated under, which adds a stamp of everything the PPD is built
+ * from (see ppd_cache_stamp()); if that no longer matches, or the entry
+ * merely collides in name, it is a miss and the new PPD replaces the
+ * file, so the cache holds at most one file per PPD.  The cache is
+ * $STP_CACHE_DIR if set (an empty value turns it off), and otherwise the
+ * gutenprint subdirectory of the $CUPS_CACHEDIR that cupsd passes to its
+ * helper programs.
+ */
+
+#define PPD_CACHE_PREFIX "ppd-"
+#define PPD_CACHE_MAX_DEPTH 4
+
+typedef struct
+{
+  long long	mtimes;			/* Sum of the modification times */
+  long long	bytes;			/* Total size of the files */
+  long		files;			/* Number of files and directories */
+} ppd_stamp_t;
+
+/*
+ * Add a file, or a directory and everything under it, to a stamp.  A
+ * directory's own time changes when entries are added, removed or
+ * renamed in it.
+ */
+
+static void
+stamp_path(ppd_stamp_t *stamp,		/* IO - Stamp */
+	   const char  *path,		/* I - File or directory */
+	   int         depth)		/* I - Directories left to descend */
+{
+  struct stat	st;
+  DIR		*dir;
+  struct dirent	*entry;
+  char		*child;
+
+  if (stat(path, &st) != 0)
+    return;
+  stamp->mtimes += st.st_mtime;
+  stamp->files++;
+  if (!S_ISDIR(st.st_mode))
+    {
+      stamp->bytes += st.st_size;
+      return;
+    }
+  if (depth <= 0 || (dir = opendir(path)) == NULL)
+    return;
+  while ((entry = readdir(dir)) != NULL)
+    {
+      if (entry->d_name[0] == '.')
+	continue;
+      stp_asprintf(&child, "%s/%s", path, entry->d_name);
+      stamp_path(stamp, child, depth - 1);
+      stp_free(child);
+    }
+  closedir(dir);
+}
+
+/*
+ * Add each directory of a colon-separated search path to a stamp.
+ */
+
+static void
+stamp_search_path(ppd_stamp_t *stamp,	/* IO - Stamp */
+		  const char  *path)	/* I - Search path */
+{
+  char		*dirs = stp_strdup(path);
+  char		*dir;
+  char		*next;
+
+  for (dir = dirs; dir; dir = next)
+    {
+      if ((next = strchr(dir, ':')) != NULL)
+	*next++ = '\0';
+      if (*dir)
+	stamp_path(stamp, dir, PPD_CACHE_MAX_DEPTH);
+    }
+  stp_free(dirs);
+}
+
+/*
+ * Add the message catalog stp_i18n_load() would read for a language.
+ */
+
+static void
+stamp_catalog(ppd_stamp_t *stamp,	/* IO - Stamp */
+	      const char  *localedir,	/* I - Locale directory */
+	      const char  *lang)	/* I - Language */
+{
+  char		ll_CC[6];
+  char		*poname;
+  char		*ptr;
+
+  strncpy(ll_CC, lang, sizeof(ll_CC) - 1);
+  ll_CC[sizeof(ll_CC) - 1] = '\0';
+  if ((ptr = strchr(ll_CC, '.')) != NULL)
+    *ptr = '\0';
+  stp_asprintf(&poname, "%s/%s/gutenprint_%s.po", localedir, ll_CC, ll_CC);
+  if (access(poname, 0) && strlen(ll_CC) > 2)
+    {
+      ll_CC[2] = '\0';
+      stp_free(poname);
+      stp_asprintf(&poname, "%s/%s/gutenprint_%s.po", localedir, ll_CC,
+		   ll_CC);
+    }
+  stamp_path(stamp, poname, 0);
+  stp_free(poname);
+}
+
+/*
+ * Append a stamp of what a PPD is generated from to its cache key: the
+ * XML data, the modules, the message catalogs and this program.  Each
+ * part is looked for where libgutenprint and stp_i18n_load() would look
+ * for it.  The stamp sums the modification times and sizes of the files
+ * and counts them, so changing any one of them changes it, and it
+ * doesn't need the library initialised.
+ */
+
+static void
+ppd_cache_stamp(char       **key,	/* IO - Cache key */
+		const char *lang)	/* I - Language of the PPD */
+{
+  ppd_stamp_t	stamp;
+  const char	*path;
+  char		**langs;
+  struct stat	st;
+  char		*old_key = *key;
+
+  memset(&stamp, 0, sizeof(stamp));
+  if ((path = getenv("STP_DATA_PATH")) == NULL)
+    path = PKGXMLDATADIR;
+  stamp_search_path(&stamp, path);
+  if ((path = getenv("STP_MODULE_PATH")) == NULL)
+    path = PKGMODULEDIR;
+  stamp_search_path(&stamp, path);
+
+  if ((path = getenv("STP_LOCALEDIR")) == NULL)
+    path = PACKAGE_LOCALE_DIR;
+  if (lang)
+    stamp_catalog(&stamp, path, lang);
+  for (langs = getlangs(); *langs; langs++)
+    stamp_catalog(&stamp, path, *langs);
+
+  if (stat("/proc/self/exe", &st) == 0)
+    stamp_path(&stamp, "/proc/self/exe", 0);
+  else if (program_path)
+    stamp_path(&stamp, program_path, 0);
+
+  stp_catprintf(key, "\t%lld\t%lld\t%ld", stamp.mtimes, stamp.bytes,
+		stamp.files);
+  stp_free(old_key);
+}
+
+static char *
+ppd_cache_file(const char *name)	/* I - Version, driver, type, language */
+{
+  const char		*dir = getenv("STP_CACHE_DIR");
+  char			*cache_dir;
+  char			*answer;
+  struct stat		st;
+  unsigned long long	hash = 14695981039346656037ULL;
+  const unsigned char	*p;
+
+  if (dir)
+    {
+      if (!*dir)
+	return (NULL);
+      cache_dir = stp_strdup(dir);
+    }
+  else if ((dir = getenv("CUPS_CACHEDIR")) != NULL && *dir)
+    stp_asprintf(&cache_dir, "%s/gutenprint", dir);
+  else
+    return (NULL);
+
+  if (mkdir(cache_dir, 0700) != 0 && errno != EEXIST)
+    {
+      stp_free(cache_dir);
+      return (NULL);
+    }
+
+ /*
+  * Don't trust a cache somebody else can write into...
+  */
+
+  if (stat(cache_dir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+      st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+      stp_free(cache_dir);
+      return (NULL);
+    }
+
+  for (p = (const unsigned char *) name; *p; p++)
+    {
+      hash ^= *p;
+      hash *= 1099511628211ULL;
+    }
+  stp_asprintf(&answer, "%s/" PPD_CACHE_PREFIX "%016llx", cache_dir, hash);
+  stp_free(cache_dir);
+  return (answer);
+}
+
+/*
+ * 'copy_ppd()' - Copy the rest of a file to stdout.
+ */
+
+static int				/* O - Exit status */
+copy_ppd(FILE *fp)			/* I - File to copy */
+{
+  char		buf[8192];
+  size_t	bytes;
+
+  while ((bytes = fread(buf, 1, sizeof(buf), fp)) > 0)
+    if (fwrite(buf, 1, bytes, stdout) != bytes)
+      return (1);
+  return (ferror(fp) ? 1 : 0);
+}
+
+/*
+ * Copy the PPD cached under key to stdout, if there is one.  Returns
+ * 1 if it was found.
+ */
+
+static int
+ppd_cache_cat(const char *cache_file,	/* I - Cache file */
+	      const char *key)		/* I - Cache key */
+{
+  FILE		*fp;
+  size_t	key_length = strlen(key);
+  char		*stored_key;
+  int		found;
+
+  if ((fp = fopen(cache_file, "rb")) == NULL)
+    return (0);
+  stored_key = stp_malloc(key_length + 1);
+  found = (fread(stored_key, 1, key_length + 1, fp) == key_length + 1 &&
+	   memcmp(stored_key, key, key_length) == 0 &&
+	   stored_key[key_length] == '\n');
+  stp_free(stored_key);
+  if (found)
+    (void) copy_ppd(fp);
+  fclose(fp);
+  return (found);
+}
+
 /*
  * 'cat_ppd()' - Copy the named PPD to stdout.
  */
@@ -318,6 +578,12 @@ cat_ppd(const char *uri)	/* I - Driver URI */
 			ppd_location[1024];	/* Installed location */
   const char 		*infix = "";
   ppd_type_t 		ppd_type = PPD_STANDARD;
+  char			*key;
+  char			*cache_file;
+  char			*tmpname = NULL;
+  FILE			*fp = NULL;
+  int			fd;
+  int			answer;
 
   if ((status = httpSeparateURI(HTTP_URI_CODING_ALL, uri,
                                 scheme, sizeof(scheme),
@@ -343,12 +609,6 @@ cat_ppd(const char *uri)	/* I - Driver URI */
       *s = '\0';
     }
 
-  if ((p = stp_get_printer_by_driver(hostname)) == NULL)
-  {
-    fprintf(stderr, "ERROR: Unable to find driver \"%s\"!\n", hostname);
-    return (1);
-  }
-
   if (strcmp(resource + 1, "simple") == 0)
     {
       infix = ".sim";
@@ -374,7 +634,64 @@ cat_ppd(const char *uri)	/* I - Driver URI */
 	   lang ? lang : "C",
 	   filename, gpext);
 
-  return (write_ppd(stdout, p, lang, ppd_location, ppd_type, filename));
+  stp_asprintf(&key, "%s\t%s\t%d\t%s", VERSION, hostname, (int) ppd_type,
+	       lang ? lang : "C");
+  cache_file = ppd_cache_file(key);
+  if (cache_file)
+    ppd_cache_stamp(&key, lang);
+  if (cache_file && ppd_cache_cat(cache_file, key))
+    {
+      stp_free(cache_file);
+      stp_free(key);
+      return (0);
+    }
+
+  stp_init();
+  if ((p = stp_get_printer_by_driver(hostname)) == NULL)
+  {
+    fprintf(stderr, "ERROR: Unable to find driver \"%s\"!\n", hostname);
+    stp_free(cache_file);
+    stp_free(key);
+    return (1);
+  }
+
+ /*
+  * Generate the PPD into a private file in the cache, copy it out, and
+  * only then rename it into place, so nobody ever reads a partial one.
+  */
+
+  if (cache_file)
+    {
+      stp_asprintf(&tmpname, "%s.XXXXXX", cache_file);
+      if ((fd = mkstemp(tmpname)) >= 0 && (fp = fdopen(fd, "w+b")) == NULL)
+	{
+	  close(fd);
+	  unlink(tmpname);
+	}
+    }
+
+  if (!fp)
+    answer = write_ppd(stdout, p, lang, ppd_location, ppd_type, filename);
+  else
+    {
+      fprintf(fp, "%s\n", key);
+      answer = write_ppd(fp, p, lang, ppd_location, ppd_type, filename);
+      if (fflush(fp) != 0 || ferror(fp))
+	answer = 1;
+      if (!answer)
+	{
+	  if (fseek(fp, strlen(key) + 1, SEEK_SET) != 0 || copy_ppd(fp))
+	    answer = 1;
+	}
+      fclose(fp);
+      if (answer || rename(tmpname, cache_file) != 0)
+	unlink(tmpname);
+    }
+
+  stp_free(tmpname);
+  stp_free(cache_file);
+  stp_free(key);
+  return (answer);
 }
 
 /*
@@ -465,6 +782,10 @@ main(int  argc,			    /* I - Number of command-line arguments */
   int           opt_printmodels = 0;/* Print available models */
   int           which_ppds = 2;	    /* Simplified PPD's = 1, full = 2,
 				       no color opts = 4 */
+  int           jobs = 1;	    /* Processes writing PPD files */
+  const stp_printer_t **printers;   /* Printers to write PPD files for */
+  int           count = 0;	    /* Number of printers */
+  int           status;		    /* Exit status */
 
  /*
   * Parse command-line args...
@@ -474,7 +795,7 @@ main(int  argc,			    /* I - Number of command-line arguments */
 
   for (;;)
   {
-    if ((i = getopt(argc, argv, "23hvqc:p:l:LMVd:saNCbZz")) == -1)
+    if ((i = getopt(argc, argv, "23hvqc:p:l:LMVd:saNCbZzj:")) == -1)
       break;
 
     switch (i)
@@ -558,6 +879,14 @@ main(int  argc,			    /* I - Number of command-line arguments */
       use_compression = 0;
 #endif
       break;
+    case 'j':
+      jobs = atoi(optarg);
+      if (jobs < 1)
+	{
+	  usage();
+	  exit(EXIT_FAILURE);
+	}
+      break;
     default:
       usage();
       exit(EXIT_FAILURE);
@@ -612,6 +941,9 @@ main(int  argc,			    /* I - Number of command-line arguments */
   if (models)
     {
       int n;
+      for (n=0; models[n]; n++)
+	;
+      printers = stp_malloc(n * sizeof(const stp_printer_t *));
       for (n=0; models[n]; n++)
 	{
 	  printer = stp_get_printer_by_driver(models[n]);
@@ -619,11 +951,7 @@ main(int  argc,			    /* I - Number of command-line arguments */
 	    printer = stp_get_printer_by_long_name(models[n]);
 
 	  if (printer)
-	    {
-	      if (generate_model_ppds(prefix, verbose, printer, language,
-				      which_ppds))
-		return 1;
-	    }
+	    printers[count++] = printer;
 	  else
 	    {
 	      printf("Driver not found: %s\n", models[n]);
@@ -634,24 +962,97 @@ main(int  argc,			    /* I - Number of command-line arguments */
     }
   else
     {
+      printers = stp_malloc(stp_printer_model_count() *
+			    sizeof(const stp_printer_t *));
       for (i = 0; i < stp_printer_model_count(); i++)
 	{
 	  printer = stp_get_printer_by_index(i);
 
 	  if (printer)
-	    {
-	      if (generate_model_ppds(prefix, verbose, printer, language,
-				      which_ppds))
-		return 1;
-	    }
+	    printers[count++] = printer;
 	}
     }
+  status = generate_all_ppds(prefix, verbose, printers, count, language,
+			     which_ppds, jobs);
+  stp_free(printers);
+  if (status)
+    return (1);
   if (!verbose)
     fprintf(stderr, " done.\n");
 
   return (0);
 }
 
+/*
+ * 'generate_all_ppds()' - Generate the PPD files for a list of printers.
+ *
+ * With more than one job, the printers are dealt out to that many child
+ * processes, which share the library as initialized by the parent.  Each
+ * printer's files are written (and compressed) by one child, so they
+ * come out the same however many jobs are used.
+ */
+
+static int
+generate_all_ppds(const char *prefix, int verbose,
+		  const stp_printer_t **printers, int count,
+		  const char *language, int which_ppds, int jobs)
+{
+  pid_t		*children;
+  int		started;
+  int		status = 0;
+  int		i;
+
+  if (jobs > count)
+    jobs = count;
+  if (jobs <= 1)
+    {
+      for (i = 0; i < count; i++)
+	if (generate_model_ppds(prefix, verbose, printers[i], language,
+				which_ppds))
+	  return (1);
+      return (0);
+    }
+
+  fflush(stdout);
+  fflush(stderr);
+  children = stp_malloc(jobs * sizeof(pid_t));
+  for (started = 0; started < jobs; started++)
+    {
+      pid_t pid = fork();
+      if (pid == 0)
+	{
+	  int child_status = 0;
+	  for (i = started; i < count; i += jobs)
+	    if (generate_model_ppds(prefix, verbose, printers[i], language,
+				    which_ppds))
+	      {
+		child_status = 1;
+		break;
+	      }
+	  fflush(stdout);
+	  _exit(child_status);
+	}
+      else if (pid < 0)
+	{
+	  fprintf(stderr, "cups-genppd: Unable to start job: %s\n",
+		  strerror(errno));
+	  status = 1;
+	  break;
+	}
+      children[started] = pid;
+    }
+
+  for (i = 0; i < started; i++)
+    {
+      int child_status;
+      if (waitpid(children[i], &child_status, 0) < 0 ||
+	  !WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0)
+	status = 1;
+    }
+  stp_free(children);
+  return (status);
+}
+
 static int
 generate_model_ppds(const char *prefix, int verbose,
 		    const stp_printer_t *printer, const char *language,
@@ -703,7 +1104,7 @@ generate_ppd(
 
   if (stat(prefix, &dir) && !S_ISDIR(dir.st_mode))
   {
-    if (mkdir(prefix, 0777))
+    if (mkdir(prefix, 0777) && errno != EEXIST)
     {
       printf("cups-genppd: Cannot create directory %s: %s\n",
 	     prefix, strerror(errno));
@@ -798,7 +1199,8 @@ help(void)
        "  -s            Generate simplified PPD files.\n"
        "  -a            Generate all (simplified and full) PPD files.\n"
        "  -q            Quiet mode.\n"
-       "  -v            Verbose mode.\n");
+       "  -v            Verbose mode.\n"
+       "  -j jobs       Write PPD files with this many processes.\n");
   puts(
 #ifdef HAVE_LIBZ
        "  -z            Compress PPD files.\n"
@@ -816,7 +1218,7 @@ void
 usage(void)
 {
   puts("Usage: cups-genppd "
-        "[-l locale] [-p prefix] [-s | -a] [-q] [-v] models...\n"
+        "[-l locale] [-p prefix] [-s | -a] [-q] [-v] [-j jobs] models...\n"
         "       cups-genppd -L\n"
 	"       cups-genppd -M [-v]\n"
 	"       cups-genppd -h\n"
@@ -52,7 +52,6 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <sys/times.h>
 #ifdef HAVE_LIMITS_H
 #include <limits.h>
 #endif
@@ -350,6 +349,8 @@ initialize_page(cups_image_t *cups, const stp_vars_t *default_settings,
   stp_set_errfunc(v, cups_errfunc);
   stp_set_outdata(v, stdout);
   stp_set_errdata(v, stderr);
+  /* Report the time spent in each stage of printing at the end of the job */
+  stp_set_boolean_parameter(v, "STPIStatistics", 1);
 
   if (cups->header.cupsBitsPerColor == 16)
     set_string_parameter(v, "ChannelBitDepth", "16");
@@ -1092,8 +1093,6 @@ main(int  argc,				/* I - Number of command-line arguments */
   int			initialized_job = 0;
   const char            *version_id;
   const char            *release_version_id;
-  struct tms		tms;
-  long			clocks_per_sec;
   struct timeval	t1, t2;
   struct timezone	tz;
   char			*page_size_name = NULL;
@@ -1400,18 +1399,16 @@ main(int  argc,				/* I - Number of command-line arguments */
       if (! suppress_messages)
 	fprintf(stderr, "DEBUG: Gutenprint: %s job\n",
 		aborted ? "Aborted" : "Ending");
+      /* An aborted page leaves this set; the statistics aren't errors */
+      print_messages_as_errors = 0;
       stp_end_job(v, &theImage);
       fflush(stdout);
       stp_vars_destroy(v);
     }
   cupsRasterClose(cups.ras);
-  (void) times(&tms);
   (void) gettimeofday(&t2, &tz);
-  clocks_per_sec = sysconf(_SC_CLK_TCK);
-  fprintf(stderr, "DEBUG: Gutenprint: stats %.0fB, %.3fu, %.3fs, %.3fel\n",
+  fprintf(stderr, "DEBUG: Gutenprint: stats %.0fB, %.3fel\n",
 	  total_bytes_printed,
-	  (double) tms.tms_utime / clocks_per_sec,
-	  (double) tms.tms_stime / clocks_per_sec,
 	  (double) (t2.tv_sec - t1.tv_sec) +
 	  ((double) (t2.tv_usec - t1.tv_usec)) / 1000000.0);
   if (!suppress_messages)
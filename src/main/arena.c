@@ -0,0 +1,279 @@
+/*
+ * "$Id$"
+ *
+ *   Per-job scratch memory for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Every page of a job allocates the same dither, weave and color
+ * buffers again.  An arena carves them out of large chunks instead,
+ * in power of two size classes, and keeps freed blocks on a list per
+ * class so that the next page gets the same memory back.  Nothing goes
+ * back to the heap until the last vars object sharing the arena is
+ * destroyed, normally by stp_end_job().
+ *
+ * Each block starts with a header naming its arena (NULL for blocks
+ * that came straight from the heap) and size class, so stpi_arena_free()
+ * needs nothing but the pointer.  Setting STP_NO_ARENA in the
+ * environment makes every block come from the heap, which is what
+ * memory checkers want to see.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#define ARENA_ALIGN		16
+#define ARENA_ROUND(x)		(((x) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_MIN_CLASS		6	/* Smallest block is 64 bytes */
+#define ARENA_CLASSES		(sizeof(size_t) * 8 - 2)
+#define ARENA_CHUNK_SIZE	(256 * 1024)
+
+typedef struct
+{
+  stpi_arena_t *arena;
+  size_t size_class;
+} arena_header_t;
+
+#define ARENA_HEADER		ARENA_ROUND(sizeof(arena_header_t))
+
+typedef struct arena_chunk
+{
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+} arena_chunk_t;
+
+#define ARENA_CHUNK_HEADER	ARENA_ROUND(sizeof(arena_chunk_t))
+
+struct stpi_arena
+{
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock;
+#endif
+  int refcount;
+  arena_chunk_t *chunks;	/* The first one is being carved up */
+  void *free_blocks[ARENA_CLASSES];
+  unsigned long in_use;
+  stpi_arena_stats_t stats;
+};
+
+#ifdef HAVE_PTHREAD_H
+#define ARENA_LOCK(arena) pthread_mutex_lock(&((arena)->lock))
+#define ARENA_UNLOCK(arena) pthread_mutex_unlock(&((arena)->lock))
+#else
+#define ARENA_LOCK(arena) do { } while (0)
+#define ARENA_UNLOCK(arena) do { } while (0)
+#endif
+
+stpi_arena_t *
+stpi_arena_create(void)
+{
+  stpi_arena_t *arena = stp_zalloc(sizeof(stpi_arena_t));
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init(&(arena->lock), NULL);
+#endif
+  arena->refcount = 1;
+  return arena;
+}
+
+stpi_arena_t *
+stpi_arena_ref(stpi_arena_t *arena)
+{
+  if (arena)
+    {
+      ARENA_LOCK(arena);
+      arena->refcount++;
+      ARENA_UNLOCK(arena);
+    }
+  return arena;
+}
+
+void
+stpi_arena_unref(stpi_arena_t *arena)
+{
+  int refcount;
+  if (!arena)
+    return;
+  ARENA_LOCK(arena);
+  refcount = --arena->refcount;
+  ARENA_UNLOCK(arena);
+  if (refcount > 0)
+    return;
+  while (arena->chunks)
+    {
+      arena_chunk_t *next = arena->chunks->next;
+      stp_free(arena->chunks);
+      arena->chunks = next;
+    }
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_destroy(&(arena->lock));
+#endif
+  stp_free(arena);
+}
+
+static void *
+heap_block(size_t size)
+{
+  arena_header_t *header = stp_malloc(ARENA_HEADER + size);
+  header->arena = NULL;
+  header->size_class = 0;
+  return (char *) header + ARENA_HEADER;
+}
+
+/* Carve a block of 1 << size_class bytes; called with the arena locked */
+static arena_header_t *
+carve_block(stpi_arena_t *arena, size_t size_class)
+{
+  size_t block_size = (size_t) 1 << size_class;
+  arena_chunk_t *chunk = arena->chunks;
+  arena_header_t *header;
+
+  if (!chunk || chunk->size - chunk->used < block_size)
+    {
+      size_t size = ARENA_CHUNK_SIZE;
+      arena_chunk_t *new_chunk;
+      if (block_size > size)
+	size = block_size;
+      new_chunk = stp_malloc(ARENA_CHUNK_HEADER + size);
+      new_chunk->size = size;
+      new_chunk->used = 0;
+      arena->stats.reserved_bytes += ARENA_CHUNK_HEADER + size;
+      /*
+       * A block too big for a normal chunk gets a chunk of its own,
+       * which goes behind the one still being carved up.
+       */
+      if (chunk && size == block_size)
+	{
+	  new_chunk->next = chunk->next;
+	  chunk->next = new_chunk;
+	}
+      else
+	{
+	  new_chunk->next = chunk;
+	  arena->chunks = new_chunk;
+	}
+      chunk = new_chunk;
+    }
+  header = (arena_header_t *) ((char *) chunk + ARENA_CHUNK_HEADER +
+			       chunk->used);
+  chunk->used += block_size;
+  return header;
+}
+
+void *
+stpi_arena_malloc(stpi_arena_t *arena, size_t size)
+{
+  size_t size_class = ARENA_MIN_CLASS;
+  arena_header_t *header;
+
+  if (!arena)
+    return heap_block(size);
+  while (size_class < ARENA_CLASSES &&
+	 ((size_t) 1 << size_class) < size + ARENA_HEADER)
+    size_class++;
+  if (size_class >= ARENA_CLASSES)
+    return heap_block(size);
+
+  ARENA_LOCK(arena);
+  if (arena->free_blocks[size_class])
+    {
+      header = arena->free_blocks[size_class];
+      arena->free_blocks[size_class] =
+	*(void **) ((char *) header + ARENA_HEADER);
+      arena->stats.reused++;
+    }
+  else
+    header = carve_block(arena, size_class);
+  header->arena = arena;
+  header->size_class = size_class;
+  arena->stats.allocations++;
+  arena->stats.total_bytes += size;
+  arena->in_use += (size_t) 1 << size_class;
+  if (arena->in_use > arena->stats.peak_bytes)
+    arena->stats.peak_bytes = arena->in_use;
+  ARENA_UNLOCK(arena);
+  return (char *) header + ARENA_HEADER;
+}
+
+void *
+stpi_arena_zalloc(stpi_arena_t *arena, size_t size)
+{
+  void *memory = stpi_arena_malloc(arena, size);
+  memset(memory, 0, size);
+  return memory;
+}
+
+void
+stpi_arena_free(void *ptr)
+{
+  arena_header_t *header;
+  stpi_arena_t *arena;
+  if (!ptr)
+    return;
+  header = (arena_header_t *) ((char *) ptr - ARENA_HEADER);
+  arena = header->arena;
+  if (!arena)
+    {
+      stp_free(header);
+      return;
+    }
+  ARENA_LOCK(arena);
+  *(void **) ptr = arena->free_blocks[header->size_class];
+  arena->free_blocks[header->size_class] = header;
+  arena->in_use -= (size_t) 1 << header->size_class;
+  ARENA_UNLOCK(arena);
+}
+
+void
+stpi_arena_get_stats(const stpi_arena_t *arena, stpi_arena_stats_t *stats)
+{
+  if (arena)
+    *stats = arena->stats;
+  else
+    memset(stats, 0, sizeof(stpi_arena_stats_t));
+}
+
+void
+stpi_arena_start_job(const stp_vars_t *v)
+{
+  if (stpi_get_arena(v) || getenv("STP_NO_ARENA"))
+    return;
+  stpi_set_arena((stp_vars_t *) v, stpi_arena_create());
+}
+
+void
+stpi_arena_end_job(const stp_vars_t *v)
+{
+  stpi_arena_t *arena = stpi_get_arena(v);
+  if (!arena)
+    return;
+  stp_dprintf(STP_DBG_MEMORY, v,
+	      "arena: %lu allocations (%lu reused), %lu bytes total, "
+	      "%lu peak, %lu reserved\n", arena->stats.allocations,
+	      arena->stats.reused, arena->stats.total_bytes,
+	      arena->stats.peak_bytes, arena->stats.reserved_bytes);
+  stpi_set_arena((stp_vars_t *) v, NULL);
+}
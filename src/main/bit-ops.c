@@ -35,18 +35,20 @@
 #ifdef HAVE_LIMITS_H
 #include <limits.h>
 #endif
+#ifdef STPI_X86_SIMD
+#include <immintrin.h>
+#endif
 
-void
-stp_fold(const unsigned char *line,
-	 int single_length,
-	 unsigned char *outbuf)
+static void
+fold_2bit_c(const unsigned char *line, int stride, int length,
+	    unsigned char *outbuf)
 {
   int i;
-  memset(outbuf, 0, single_length * 2);
-  for (i = 0; i < single_length; i++)
+  memset(outbuf, 0, length * 2);
+  for (i = 0; i < length; i++)
     {
       unsigned char l0 = line[0];
-      unsigned char l1 = line[single_length];
+      unsigned char l1 = line[stride];
       if (l0 || l1)
 	{
 	  outbuf[0] =		/* B7 A7 B6 A6 B5 A5 B4 A4 */
@@ -73,18 +75,17 @@ stp_fold(const unsigned char *line,
     }
 }
 
-void
-stp_fold_3bit(const unsigned char *line,
-                int single_length,
-                unsigned char *outbuf)
+static void
+fold_3bit_c(const unsigned char *line, int stride, int length,
+	    unsigned char *outbuf)
 {
   int i;
-  memset(outbuf, 0, single_length * 3);
-  for (i = 0; i < single_length; i++)
+  memset(outbuf, 0, length * 3);
+  for (i = 0; i < length; i++)
     {
       unsigned char l0 = line[0];
-      unsigned char l1 = line[single_length];
-      unsigned char l2 = line[single_length * 2];
+      unsigned char l1 = line[stride];
+      unsigned char l2 = line[stride * 2];
       if (l0 || l1 || l2)
 	{
 	  outbuf[0] =		/* C7 B7 A7 C6 B6 A6 C5 B5  */
@@ -219,19 +220,18 @@ stp_fold_3bit_323(const unsigned char *line,
     }
 }
 
-void
-stp_fold_4bit(const unsigned char *line,
-                int single_length,
-                unsigned char *outbuf)
+static void
+fold_4bit_c(const unsigned char *line, int stride, int length,
+	    unsigned char *outbuf)
 {
   int i;
-  memset(outbuf, 0, single_length * 4);
-  for (i = 0; i < single_length; i++)
+  memset(outbuf, 0, length * 4);
+  for (i = 0; i < length; i++)
     {
       unsigned char l0 = line[0];
-      unsigned char l1 = line[single_length];
-      unsigned char l2 = line[single_length*2];
-      unsigned char l3 = line[single_length*3];
+      unsigned char l1 = line[stride];
+      unsigned char l2 = line[stride * 2];
+      unsigned char l3 = line[stride * 3];
       if (l0 || l1 || l2 || l3)
 	{
 	  outbuf[0] =		/* D7 C7 B7 A7 D6 C6 B6 A6 */
@@ -279,23 +279,22 @@ stp_fold_4bit(const unsigned char *line,
     }
 }
 
-void
-stp_fold_8bit(const unsigned char *line,
-                int single_length,
-                unsigned char *outbuf)
+static void
+fold_8bit_c(const unsigned char *line, int stride, int length,
+	    unsigned char *outbuf)
 {
   int i;
-  memset(outbuf, 0, single_length * 8);
-  for (i = 0; i < single_length; i++)
+  memset(outbuf, 0, length * 8);
+  for (i = 0; i < length; i++)
     {
       unsigned char l0 = line[0];
-      unsigned char l1 = line[single_length];
-      unsigned char l2 = line[single_length*2];
-      unsigned char l3 = line[single_length*3];
-      unsigned char l4 = line[single_length*4];
-      unsigned char l5 = line[single_length*5];
-      unsigned char l6 = line[single_length*6];
-      unsigned char l7 = line[single_length*7];
+      unsigned char l1 = line[stride];
+      unsigned char l2 = line[stride * 2];
+      unsigned char l3 = line[stride * 3];
+      unsigned char l4 = line[stride * 4];
+      unsigned char l5 = line[stride * 5];
+      unsigned char l6 = line[stride * 6];
+      unsigned char l7 = line[stride * 7];
       if (l0 || l1 || l2 || l3 || l4 || l5 || l6 || l7)
 	{
 	  outbuf[0] =		/* H7 G7 F7 E7 D7 C7 B7 A7 */
@@ -382,6 +381,320 @@ stp_fold_8bit(const unsigned char *line,
     }
 }
 
+/*
+ * Vectorized folds and unpacks.  Folding interleaves the bits of two,
+ * four or eight planes, and unpacking is the reverse.  The SSE2 versions
+ * do the interleaving with delta swaps, each of which exchanges the bits
+ * selected by a mask with the bits a fixed distance above them; three
+ * swaps interleave the two halves of each 16, 32 or 64 bit lane, and the
+ * same swaps in the opposite order take them apart again.  The BMI2
+ * versions move the bits of each plane directly with PDEP and PEXT.
+ * Anything left over at the end of a line goes to the portable code, so
+ * every version produces exactly the same output.
+ */
+#ifdef STPI_X86_SIMD
+#ifdef __x86_64__
+#define USE_BMI2 1
+#endif
+
+STPI_TARGET("sse2") static inline __m128i
+delta_swap_sse2(__m128i x, long long mask, int shift)
+{
+  __m128i t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, shift)),
+			    _mm_set1_epi64x(mask));
+  return _mm_xor_si128(x, _mm_xor_si128(t, _mm_slli_epi64(t, shift)));
+}
+
+/* Interleave the bits of the low (even) and high (odd) bytes of 16 bits */
+STPI_TARGET("sse2") static inline __m128i
+interleave_bits_sse2(__m128i x)
+{
+  x = delta_swap_sse2(x, 0x00f000f000f000f0LL, 4);
+  x = delta_swap_sse2(x, 0x0c0c0c0c0c0c0c0cLL, 2);
+  return delta_swap_sse2(x, 0x2222222222222222LL, 1);
+}
+
+STPI_TARGET("sse2") static inline __m128i
+deinterleave_bits_sse2(__m128i x)
+{
+  x = delta_swap_sse2(x, 0x2222222222222222LL, 1);
+  x = delta_swap_sse2(x, 0x0c0c0c0c0c0c0c0cLL, 2);
+  return delta_swap_sse2(x, 0x00f000f000f000f0LL, 4);
+}
+
+/* Interleave bit pairs of the low and high halves of 32 bits */
+STPI_TARGET("sse2") static inline __m128i
+interleave_pairs_sse2(__m128i x)
+{
+  x = delta_swap_sse2(x, 0x0000ff000000ff00LL, 8);
+  x = delta_swap_sse2(x, 0x00f000f000f000f0LL, 4);
+  return delta_swap_sse2(x, 0x0c0c0c0c0c0c0c0cLL, 2);
+}
+
+STPI_TARGET("sse2") static inline __m128i
+deinterleave_pairs_sse2(__m128i x)
+{
+  x = delta_swap_sse2(x, 0x0c0c0c0c0c0c0c0cLL, 2);
+  x = delta_swap_sse2(x, 0x00f000f000f000f0LL, 4);
+  return delta_swap_sse2(x, 0x0000ff000000ff00LL, 8);
+}
+
+/* Interleave the nibbles of the low and high halves of 64 bits */
+STPI_TARGET("sse2") static inline __m128i
+interleave_nibbles_sse2(__m128i x)
+{
+  x = delta_swap_sse2(x, 0x00000000ffff0000LL, 16);
+  x = delta_swap_sse2(x, 0x0000ff000000ff00LL, 8);
+  return delta_swap_sse2(x, 0x00f000f000f000f0LL, 4);
+}
+
+/* Byte order reversal within 16, 32 and 64 bit lanes */
+STPI_TARGET("sse2") static inline __m128i
+bswap16_sse2(__m128i x)
+{
+  return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+STPI_TARGET("sse2") static inline __m128i
+bswap32_sse2(__m128i x)
+{
+  x = _mm_shufflelo_epi16(_mm_shufflehi_epi16(x, 0xb1), 0xb1);
+  return bswap16_sse2(x);
+}
+
+STPI_TARGET("sse2") static inline __m128i
+bswap64_sse2(__m128i x)
+{
+  x = _mm_shufflelo_epi16(_mm_shufflehi_epi16(x, 0x1b), 0x1b);
+  return bswap16_sse2(x);
+}
+
+STPI_TARGET("sse2") static void
+fold_2bit_sse2(const unsigned char *line, int stride, int length,
+	       unsigned char *outbuf)
+{
+  int i;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *) (line + i));
+      __m128i b = _mm_loadu_si128((const __m128i *) (line + stride + i));
+      __m128i lo = interleave_bits_sse2(_mm_unpacklo_epi8(a, b));
+      __m128i hi = interleave_bits_sse2(_mm_unpackhi_epi8(a, b));
+      _mm_storeu_si128((__m128i *) (outbuf + i * 2), bswap16_sse2(lo));
+      _mm_storeu_si128((__m128i *) (outbuf + i * 2 + 16), bswap16_sse2(hi));
+    }
+  fold_2bit_c(line + i, stride, length - i, outbuf + i * 2);
+}
+
+STPI_TARGET("sse2") static void
+fold_4bit_sse2(const unsigned char *line, int stride, int length,
+	       unsigned char *outbuf)
+{
+  int i, j;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *) (line + i));
+      __m128i b = _mm_loadu_si128((const __m128i *) (line + stride + i));
+      __m128i c = _mm_loadu_si128((const __m128i *) (line + stride * 2 + i));
+      __m128i d = _mm_loadu_si128((const __m128i *) (line + stride * 3 + i));
+      __m128i ab_lo = interleave_bits_sse2(_mm_unpacklo_epi8(a, b));
+      __m128i ab_hi = interleave_bits_sse2(_mm_unpackhi_epi8(a, b));
+      __m128i cd_lo = interleave_bits_sse2(_mm_unpacklo_epi8(c, d));
+      __m128i cd_hi = interleave_bits_sse2(_mm_unpackhi_epi8(c, d));
+      __m128i abcd[4];
+      abcd[0] = _mm_unpacklo_epi16(ab_lo, cd_lo);
+      abcd[1] = _mm_unpackhi_epi16(ab_lo, cd_lo);
+      abcd[2] = _mm_unpacklo_epi16(ab_hi, cd_hi);
+      abcd[3] = _mm_unpackhi_epi16(ab_hi, cd_hi);
+      for (j = 0; j < 4; j++)
+	_mm_storeu_si128((__m128i *) (outbuf + i * 4 + j * 16),
+			 bswap32_sse2(interleave_pairs_sse2(abcd[j])));
+    }
+  fold_4bit_c(line + i, stride, length - i, outbuf + i * 4);
+}
+
+STPI_TARGET("sse2") static void
+fold_8bit_sse2(const unsigned char *line, int stride, int length,
+	       unsigned char *outbuf)
+{
+  int i, j;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i planes[8];
+      __m128i pairs[8];		/* AB, CD, EF, GH for pixels 0-7, 8-15 */
+      __m128i quads[8];		/* ABCD, EFGH for pixels 0-3 ... 12-15 */
+      for (j = 0; j < 8; j++)
+	planes[j] = _mm_loadu_si128((const __m128i *) (line + stride * j + i));
+      for (j = 0; j < 4; j++)
+	{
+	  pairs[j] = interleave_bits_sse2
+	    (_mm_unpacklo_epi8(planes[j * 2], planes[j * 2 + 1]));
+	  pairs[j + 4] = interleave_bits_sse2
+	    (_mm_unpackhi_epi8(planes[j * 2], planes[j * 2 + 1]));
+	}
+      for (j = 0; j < 2; j++)
+	{
+	  quads[j * 4] = _mm_unpacklo_epi16(pairs[j * 4], pairs[j * 4 + 1]);
+	  quads[j * 4 + 1] = _mm_unpackhi_epi16(pairs[j * 4], pairs[j * 4 + 1]);
+	  quads[j * 4 + 2] = _mm_unpacklo_epi16(pairs[j * 4 + 2],
+						pairs[j * 4 + 3]);
+	  quads[j * 4 + 3] = _mm_unpackhi_epi16(pairs[j * 4 + 2],
+						pairs[j * 4 + 3]);
+	}
+      for (j = 0; j < 8; j++)
+	quads[j] = interleave_pairs_sse2(quads[j]);
+      for (j = 0; j < 4; j++)
+	{
+	  __m128i abcd = quads[(j / 2) * 4 + (j & 1)];
+	  __m128i efgh = quads[(j / 2) * 4 + (j & 1) + 2];
+	  __m128i lo = interleave_nibbles_sse2(_mm_unpacklo_epi32(abcd, efgh));
+	  __m128i hi = interleave_nibbles_sse2(_mm_unpackhi_epi32(abcd, efgh));
+	  _mm_storeu_si128((__m128i *) (outbuf + i * 8 + j * 32),
+			   bswap64_sse2(lo));
+	  _mm_storeu_si128((__m128i *) (outbuf + i * 8 + j * 32 + 16),
+			   bswap64_sse2(hi));
+	}
+    }
+  fold_8bit_c(line + i, stride, length - i, outbuf + i * 8);
+}
+
+#ifdef USE_BMI2
+STPI_TARGET("bmi2") static void
+fold_2bit_bmi2(const unsigned char *line, int stride, int length,
+	       unsigned char *outbuf)
+{
+  int i;
+  for (i = 0; i + 4 <= length; i += 4)
+    {
+      unsigned a, b;
+      unsigned long long w;
+      memcpy(&a, line + i, 4);
+      memcpy(&b, line + stride + i, 4);
+      w = _pdep_u64(a, 0x5555555555555555ULL) |
+	_pdep_u64(b, 0xaaaaaaaaaaaaaaaaULL);
+      w = ((w >> 8) & 0x00ff00ff00ff00ffULL) |
+	((w & 0x00ff00ff00ff00ffULL) << 8);
+      memcpy(outbuf + i * 2, &w, 8);
+    }
+  fold_2bit_c(line + i, stride, length - i, outbuf + i * 2);
+}
+
+STPI_TARGET("bmi2") static void
+fold_3bit_bmi2(const unsigned char *line, int stride, int length,
+	       unsigned char *outbuf)
+{
+  int i;
+  for (i = 0; i + 2 <= length; i += 2)
+    {
+      unsigned long long w =
+	_pdep_u64((line[i] << 8) | line[i + 1], 0x249249249249ULL) |
+	_pdep_u64((line[stride + i] << 8) | line[stride + i + 1],
+		  0x492492492492ULL) |
+	_pdep_u64((line[stride * 2 + i] << 8) | line[stride * 2 + i + 1],
+		  0x924924924924ULL);
+      w = __builtin_bswap64(w << 16);
+      memcpy(outbuf + i * 3, &w, 6);
+    }
+  fold_3bit_c(line + i, stride, length - i, outbuf + i * 3);
+}
+
+STPI_TARGET("bmi2") static void
+fold_4bit_bmi2(const unsigned char *line, int stride, int length,
+	       unsigned char *outbuf)
+{
+  int i, j;
+  for (i = 0; i + 2 <= length; i += 2)
+    {
+      unsigned long long w = 0;
+      for (j = 0; j < 4; j++)
+	w |= _pdep_u64(line[stride * j + i] | (line[stride * j + i + 1] << 8),
+		       0x1111111111111111ULL << j);
+      w = __builtin_bswap64(w);
+      w = (w >> 32) | (w << 32);
+      memcpy(outbuf + i * 4, &w, 8);
+    }
+  fold_4bit_c(line + i, stride, length - i, outbuf + i * 4);
+}
+#endif /* USE_BMI2 */
+#endif /* STPI_X86_SIMD */
+
+void
+stp_fold(const unsigned char *line,
+	 int single_length,
+	 unsigned char *outbuf)
+{
+#ifdef STPI_X86_SIMD
+  unsigned features = stpi_cpu_features();
+#ifdef USE_BMI2
+  if (features & STPI_CPU_BMI2)
+    {
+      fold_2bit_bmi2(line, single_length, single_length, outbuf);
+      return;
+    }
+#endif
+  if (features & STPI_CPU_SSE2)
+    {
+      fold_2bit_sse2(line, single_length, single_length, outbuf);
+      return;
+    }
+#endif
+  fold_2bit_c(line, single_length, single_length, outbuf);
+}
+
+void
+stp_fold_3bit(const unsigned char *line,
+	      int single_length,
+	      unsigned char *outbuf)
+{
+#ifdef USE_BMI2
+  if (stpi_cpu_features() & STPI_CPU_BMI2)
+    {
+      fold_3bit_bmi2(line, single_length, single_length, outbuf);
+      return;
+    }
+#endif
+  fold_3bit_c(line, single_length, single_length, outbuf);
+}
+
+void
+stp_fold_4bit(const unsigned char *line,
+	      int single_length,
+	      unsigned char *outbuf)
+{
+#ifdef STPI_X86_SIMD
+  unsigned features = stpi_cpu_features();
+#ifdef USE_BMI2
+  if (features & STPI_CPU_BMI2)
+    {
+      fold_4bit_bmi2(line, single_length, single_length, outbuf);
+      return;
+    }
+#endif
+  if (features & STPI_CPU_SSE2)
+    {
+      fold_4bit_sse2(line, single_length, single_length, outbuf);
+      return;
+    }
+#endif
+  fold_4bit_c(line, single_length, single_length, outbuf);
+}
+
+/* PDEP can only fold one pixel at a time here, so SSE2 is faster */
+void
+stp_fold_8bit(const unsigned char *line,
+	      int single_length,
+	      unsigned char *outbuf)
+{
+#ifdef STPI_X86_SIMD
+  if (stpi_cpu_features() & STPI_CPU_SSE2)
+    {
+      fold_8bit_sse2(line, single_length, single_length, outbuf);
+      return;
+    }
+#endif
+  fold_8bit_c(line, single_length, single_length, outbuf);
+}
+
 #define SPLIT_MASK(k, b) (((1 << (b)) - 1) << ((k) * (b)))
 
 #define SPLIT_STEP(k, b, i, o, in, r, inc, rl)	\
@@ -994,6 +1307,258 @@ stpi_unpack_16_2(int length,
       *outs[j]++ = temp[j];
 }
 
+#ifdef STPI_X86_SIMD
+/*
+ * 2 and 4 channel unpacks take whole 16 or 32 bit big-endian groups apart
+ * (see the interleave functions above) and then gather the bytes of each
+ * group into the outputs.  8 and 16 channel unpacks are bit transposes,
+ * which PMOVMSKB does a bit plane at a time.
+ */
+
+/* Store 8 outputs of a 2-channel unpack from 16 big-endian words */
+STPI_TARGET("sse2") static inline void
+gather_16_sse2(__m128i v0, __m128i v1, unsigned char **outs)
+{
+  const __m128i low = _mm_set1_epi16(0xff);
+  _mm_storeu_si128((__m128i *) outs[0],
+		   _mm_packus_epi16(_mm_srli_epi16(v0, 8),
+				    _mm_srli_epi16(v1, 8)));
+  _mm_storeu_si128((__m128i *) outs[1],
+		   _mm_packus_epi16(_mm_and_si128(v0, low),
+				    _mm_and_si128(v1, low)));
+  outs[0] += 16;
+  outs[1] += 16;
+}
+
+/* Store 8 outputs of a 4-channel unpack; outs[j] gets byte 3 - j */
+STPI_TARGET("sse2") static inline void
+gather_32_sse2(__m128i v0, __m128i v1, unsigned char **outs)
+{
+  const __m128i low = _mm_set1_epi32(0xff);
+  int j;
+  for (j = 0; j < 4; j++)
+    {
+      __m128i b0 = _mm_and_si128(_mm_srli_epi32(v0, (3 - j) * 8), low);
+      __m128i b1 = _mm_and_si128(_mm_srli_epi32(v1, (3 - j) * 8), low);
+      __m128i b = _mm_packs_epi32(b0, b1);
+      _mm_storel_epi64((__m128i *) outs[j], _mm_packus_epi16(b, b));
+      outs[j] += 8;
+    }
+}
+
+/* Byte 0 or 1 of each 16 bit word of v0 and v1 */
+STPI_TARGET("sse2") static inline __m128i
+even_bytes_sse2(__m128i v0, __m128i v1, int byte)
+{
+  const __m128i low = _mm_set1_epi16(0xff);
+  return _mm_packus_epi16(_mm_and_si128(_mm_srli_epi16(v0, byte * 8), low),
+			  _mm_and_si128(_mm_srli_epi16(v1, byte * 8), low));
+}
+
+/* Byte 0, 1, 2 or 3 of each 32 bit word of v[0] through v[3] */
+STPI_TARGET("sse2") static inline __m128i
+fourth_bytes_sse2(const __m128i *v, int byte)
+{
+  const __m128i low = _mm_set1_epi32(0xff);
+  __m128i b0 = _mm_packs_epi32
+    (_mm_and_si128(_mm_srli_epi32(v[0], byte * 8), low),
+     _mm_and_si128(_mm_srli_epi32(v[1], byte * 8), low));
+  __m128i b1 = _mm_packs_epi32
+    (_mm_and_si128(_mm_srli_epi32(v[2], byte * 8), low),
+     _mm_and_si128(_mm_srli_epi32(v[3], byte * 8), low));
+  return _mm_packus_epi16(b0, b1);
+}
+
+/* Unpack 32 bytes of 2-bit 4-channel data into 8 bytes per channel */
+STPI_TARGET("sse2") static inline void
+unpack_4_2_block_sse2(__m128i v0, __m128i v1, unsigned char **outs)
+{
+  v0 = bswap32_sse2(v0);
+  v1 = bswap32_sse2(v1);
+  v0 = delta_swap_sse2(v0, 0x00f000f000f000f0LL, 4);
+  v1 = delta_swap_sse2(v1, 0x00f000f000f000f0LL, 4);
+  v0 = delta_swap_sse2(v0, 0x0000ff000000ff00LL, 8);
+  v1 = delta_swap_sse2(v1, 0x0000ff000000ff00LL, 8);
+  v0 = delta_swap_sse2(v0, 0x0c0c0c0c0c0c0c0cLL, 2);
+  v1 = delta_swap_sse2(v1, 0x0c0c0c0c0c0c0c0cLL, 2);
+  v0 = delta_swap_sse2(v0, 0x00f000f000f000f0LL, 4);
+  v1 = delta_swap_sse2(v1, 0x00f000f000f000f0LL, 4);
+  gather_32_sse2(v0, v1, outs);
+}
+
+/* Unpack 16 bytes of 1-bit 8-channel data into 2 bytes per channel */
+STPI_TARGET("sse2") static inline void
+unpack_8_1_block_sse2(__m128i v, unsigned char **outs)
+{
+  int j;
+  v = bswap64_sse2(v);
+  for (j = 0; j < 8; j++)
+    {
+      unsigned short bits = _mm_movemask_epi8(v);
+      memcpy(outs[j], &bits, 2);
+      outs[j] += 2;
+      v = _mm_add_epi8(v, v);
+    }
+}
+
+STPI_TARGET("sse2") static void
+stpi_unpack_2_1_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  for (; length >= 32; length -= 32, in += 32)
+    {
+      __m128i v0 = _mm_loadu_si128((const __m128i *) in);
+      __m128i v1 = _mm_loadu_si128((const __m128i *) (in + 16));
+      gather_16_sse2(deinterleave_bits_sse2(bswap16_sse2(v0)),
+		     deinterleave_bits_sse2(bswap16_sse2(v1)), outs);
+    }
+  stpi_unpack_2_1(length, in, outs);
+}
+
+STPI_TARGET("sse2") static void
+stpi_unpack_2_2_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  for (; length >= 16; length -= 16, in += 32)
+    {
+      __m128i v0 = bswap16_sse2(_mm_loadu_si128((const __m128i *) in));
+      __m128i v1 = bswap16_sse2(_mm_loadu_si128((const __m128i *) (in + 16)));
+      v0 = delta_swap_sse2(v0, 0x0c0c0c0c0c0c0c0cLL, 2);
+      v1 = delta_swap_sse2(v1, 0x0c0c0c0c0c0c0c0cLL, 2);
+      v0 = delta_swap_sse2(v0, 0x00f000f000f000f0LL, 4);
+      v1 = delta_swap_sse2(v1, 0x00f000f000f000f0LL, 4);
+      gather_16_sse2(v0, v1, outs);
+    }
+  stpi_unpack_2_2(length, in, outs);
+}
+
+STPI_TARGET("sse2") static void
+stpi_unpack_4_1_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  for (; length >= 32; length -= 32, in += 32)
+    {
+      __m128i v0 = bswap32_sse2(_mm_loadu_si128((const __m128i *) in));
+      __m128i v1 = bswap32_sse2(_mm_loadu_si128((const __m128i *) (in + 16)));
+      gather_32_sse2(deinterleave_bits_sse2(deinterleave_pairs_sse2(v0)),
+		     deinterleave_bits_sse2(deinterleave_pairs_sse2(v1)), outs);
+    }
+  stpi_unpack_4_1(length, in, outs);
+}
+
+STPI_TARGET("sse2") static void
+stpi_unpack_4_2_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  for (; length >= 16; length -= 16, in += 32)
+    unpack_4_2_block_sse2(_mm_loadu_si128((const __m128i *) in),
+			  _mm_loadu_si128((const __m128i *) (in + 16)), outs);
+  stpi_unpack_4_2(length, in, outs);
+}
+
+STPI_TARGET("sse2") static void
+stpi_unpack_8_1_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  for (; length >= 16; length -= 16, in += 16)
+    unpack_8_1_block_sse2(_mm_loadu_si128((const __m128i *) in), outs);
+  stpi_unpack_8_1(length, in, outs);
+}
+
+STPI_TARGET("sse2") static void
+stpi_unpack_8_2_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  for (; length >= 32; length -= 32, in += 64)
+    {
+      __m128i v[4];
+      int j;
+      for (j = 0; j < 4; j++)
+	v[j] = _mm_loadu_si128((const __m128i *) (in + j * 16));
+      unpack_4_2_block_sse2(even_bytes_sse2(v[0], v[1], 0),
+			    even_bytes_sse2(v[2], v[3], 0), outs);
+      unpack_4_2_block_sse2(even_bytes_sse2(v[0], v[1], 1),
+			    even_bytes_sse2(v[2], v[3], 1), outs + 4);
+    }
+  stpi_unpack_8_2(length, in, outs);
+}
+
+STPI_TARGET("sse2") static void
+stpi_unpack_16_1_sse2(int length, const unsigned char *in,
+		      unsigned char **outs)
+{
+  for (; length >= 16; length -= 16, in += 32)
+    {
+      __m128i v0 = _mm_loadu_si128((const __m128i *) in);
+      __m128i v1 = _mm_loadu_si128((const __m128i *) (in + 16));
+      unpack_8_1_block_sse2(even_bytes_sse2(v0, v1, 0), outs);
+      unpack_8_1_block_sse2(even_bytes_sse2(v0, v1, 1), outs + 8);
+    }
+  stpi_unpack_16_1(length, in, outs);
+}
+
+STPI_TARGET("sse2") static void
+stpi_unpack_16_2_sse2(int length, const unsigned char *in,
+		      unsigned char **outs)
+{
+  for (; length >= 64; length -= 64, in += 128)
+    {
+      __m128i v[8];
+      int j;
+      for (j = 0; j < 8; j++)
+	v[j] = _mm_loadu_si128((const __m128i *) (in + j * 16));
+      for (j = 0; j < 4; j++)
+	unpack_4_2_block_sse2(fourth_bytes_sse2(v, j),
+			      fourth_bytes_sse2(v + 4, j), outs + j * 4);
+    }
+  stpi_unpack_16_2(length, in, outs);
+}
+
+#ifdef USE_BMI2
+STPI_TARGET("bmi2") static inline unsigned long long
+load_be64(const unsigned char *in)
+{
+  unsigned long long w;
+  memcpy(&w, in, 8);
+  return __builtin_bswap64(w);
+}
+
+STPI_TARGET("bmi2") static inline void
+store_be16(unsigned char **out, unsigned val)
+{
+  (*out)[0] = val >> 8;
+  (*out)[1] = val;
+  *out += 2;
+}
+
+STPI_TARGET("bmi2") static void
+stpi_unpack_4_1_bmi2(int length, const unsigned char *in, unsigned char **outs)
+{
+  int j;
+  for (; length >= 8; length -= 8, in += 8)
+    {
+      unsigned long long w = load_be64(in);
+      for (j = 0; j < 4; j++)
+	store_be16(&outs[j], _pext_u64(w, 0x8888888888888888ULL >> j));
+    }
+  stpi_unpack_4_1(length, in, outs);
+}
+
+#endif /* USE_BMI2 */
+#endif /* STPI_X86_SIMD */
+
+typedef void (*unpack_func_t)(int length, const unsigned char *in,
+			      unsigned char **outs);
+
+#ifdef STPI_X86_SIMD
+#define SELECT_UNPACK(name)				\
+  ((features & STPI_CPU_SSE2) ? name##_sse2 : name)
+#else
+#define SELECT_UNPACK(name) (name)
+#endif
+
+/* Measured, PEXT only beats SSE2 for the 4 channel 1 bit unpack */
+#ifdef USE_BMI2
+#define SELECT_UNPACK_BMI2(name)				\
+  ((features & STPI_CPU_BMI2) ? name##_bmi2 : SELECT_UNPACK(name))
+#else
+#define SELECT_UNPACK_BMI2(name) SELECT_UNPACK(name)
+#endif
+
 void
 stp_unpack(int length,
 	   int bits,
@@ -1001,45 +1566,51 @@ stp_unpack(int length,
 	   const unsigned char *in,
 	   unsigned char **outs)
 {
+  unsigned features = stpi_cpu_features();
+  unpack_func_t unpack = NULL;
   unsigned char **touts;
   int i;
   if (n < 2)
     return;
-  touts = stp_malloc(sizeof(unsigned char *) * n);
-  for (i = 0; i < n; i++)
-    touts[i] = outs[i];
+  (void) features;
   if (bits == 1)
     switch (n)
       {
       case 2:
-	stpi_unpack_2_1(length, in, touts);
+	unpack = SELECT_UNPACK(stpi_unpack_2_1);
 	break;
       case 4:
-	stpi_unpack_4_1(length, in, touts);
+	unpack = SELECT_UNPACK_BMI2(stpi_unpack_4_1);
 	break;
       case 8:
-	stpi_unpack_8_1(length, in, touts);
+	unpack = SELECT_UNPACK(stpi_unpack_8_1);
 	break;
       case 16:
-	stpi_unpack_16_1(length, in, touts);
+	unpack = SELECT_UNPACK(stpi_unpack_16_1);
 	break;
       }
   else
     switch (n)
       {
       case 2:
-	stpi_unpack_2_2(length, in, touts);
+	unpack = SELECT_UNPACK(stpi_unpack_2_2);
 	break;
       case 4:
-	stpi_unpack_4_2(length, in, touts);
+	unpack = SELECT_UNPACK(stpi_unpack_4_2);
 	break;
       case 8:
-	stpi_unpack_8_2(length, in, touts);
+	unpack = SELECT_UNPACK(stpi_unpack_8_2);
 	break;
       case 16:
-	stpi_unpack_16_2(length, in, touts);
+	unpack = SELECT_UNPACK(stpi_unpack_16_2);
 	break;
       }
+  if (!unpack)
+    return;
+  touts = stp_malloc(sizeof(unsigned char *) * n);
+  for (i = 0; i < n; i++)
+    touts[i] = outs[i];
+  (*unpack)(length, in, touts);
   stp_free(touts);
 }
 
@@ -1139,29 +1710,250 @@ stp_unpack_16(int length,
   stp_unpack(length, bits, 16, in, outs);
 }
 
+/*
+ * Byte scanners used by the run length encoders.  The SSE2 and AVX2
+ * versions examine 16 or 32 bytes per step and finish the tail with the
+ * portable version, so every variant returns the same answer.
+ */
+
+/* Index of the first nonzero byte, or length if there is none */
+static int
+scan_nonzero_forward_c(const unsigned char *line, int length)
+{
+  int i;
+  for (i = 0; i < length; i++)
+    if (line[i])
+      break;
+  return i;
+}
+
+/* Index of the last nonzero byte, or -1 if there is none */
+static int
+scan_nonzero_backward_c(const unsigned char *line, int length)
+{
+  int i;
+  for (i = length - 1; i >= 0; i--)
+    if (line[i])
+      break;
+  return i;
+}
+
+/* Index of the first run of three equal bytes, or -1 if there is none */
+static int
+scan_triple_c(const unsigned char *line, int length)
+{
+  int i;
+  for (i = 0; i + 2 < length; i++)
+    if (line[i] == line[i + 1] && line[i + 1] == line[i + 2])
+      return i;
+  return -1;
+}
+
+/* Number of leading bytes equal to value */
+static int
+scan_repeat_c(const unsigned char *line, int length, unsigned char value)
+{
+  int i;
+  for (i = 0; i < length; i++)
+    if (line[i] != value)
+      break;
+  return i;
+}
+
+#ifdef STPI_X86_SIMD
+STPI_TARGET("sse2") static int
+scan_nonzero_forward_sse2(const unsigned char *line, int length)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i *) (line + i));
+      unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) ^ 0xffff;
+      if (mask)
+	return i + __builtin_ctz(mask);
+    }
+  return i + scan_nonzero_forward_c(line + i, length - i);
+}
+
+STPI_TARGET("sse2") static int
+scan_nonzero_backward_sse2(const unsigned char *line, int length)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i;
+  for (i = length; i >= 16; i -= 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i *) (line + i - 16));
+      unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) ^ 0xffff;
+      if (mask)
+	return i - 16 + 31 - __builtin_clz(mask);
+    }
+  return scan_nonzero_backward_c(line, i);
+}
+
+STPI_TARGET("sse2") static int
+scan_triple_sse2(const unsigned char *line, int length)
+{
+  int i;
+  int ret;
+  for (i = 0; i + 18 <= length; i += 16)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *) (line + i));
+      __m128i b = _mm_loadu_si128((const __m128i *) (line + i + 1));
+      __m128i c = _mm_loadu_si128((const __m128i *) (line + i + 2));
+      unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, b),
+						      _mm_cmpeq_epi8(b, c)));
+      if (mask)
+	return i + __builtin_ctz(mask);
+    }
+  ret = scan_triple_c(line + i, length - i);
+  return ret < 0 ? ret : i + ret;
+}
+
+STPI_TARGET("sse2") static int
+scan_repeat_sse2(const unsigned char *line, int length, unsigned char value)
+{
+  const __m128i v = _mm_set1_epi8((char) value);
+  int i;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i *) (line + i));
+      unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, v)) ^ 0xffff;
+      if (mask)
+	return i + __builtin_ctz(mask);
+    }
+  return i + scan_repeat_c(line + i, length - i, value);
+}
+
+STPI_TARGET("avx2") static int
+scan_nonzero_forward_avx2(const unsigned char *line, int length)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  int i;
+  for (i = 0; i + 32 <= length; i += 32)
+    {
+      __m256i x = _mm256_loadu_si256((const __m256i *) (line + i));
+      unsigned mask = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, zero));
+      if (mask)
+	return i + __builtin_ctz(mask);
+    }
+  return i + scan_nonzero_forward_sse2(line + i, length - i);
+}
+
+STPI_TARGET("avx2") static int
+scan_nonzero_backward_avx2(const unsigned char *line, int length)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  int i;
+  for (i = length; i >= 32; i -= 32)
+    {
+      __m256i x = _mm256_loadu_si256((const __m256i *) (line + i - 32));
+      unsigned mask = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, zero));
+      if (mask)
+	return i - 32 + 31 - __builtin_clz(mask);
+    }
+  return scan_nonzero_backward_sse2(line, i);
+}
+
+STPI_TARGET("avx2") static int
+scan_triple_avx2(const unsigned char *line, int length)
+{
+  int i;
+  int ret;
+  for (i = 0; i + 34 <= length; i += 32)
+    {
+      __m256i a = _mm256_loadu_si256((const __m256i *) (line + i));
+      __m256i b = _mm256_loadu_si256((const __m256i *) (line + i + 1));
+      __m256i c = _mm256_loadu_si256((const __m256i *) (line + i + 2));
+      unsigned mask =
+	_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, b),
+					      _mm256_cmpeq_epi8(b, c)));
+      if (mask)
+	return i + __builtin_ctz(mask);
+    }
+  ret = scan_triple_sse2(line + i, length - i);
+  return ret < 0 ? ret : i + ret;
+}
+
+STPI_TARGET("avx2") static int
+scan_repeat_avx2(const unsigned char *line, int length, unsigned char value)
+{
+  const __m256i v = _mm256_set1_epi8((char) value);
+  int i;
+  for (i = 0; i + 32 <= length; i += 32)
+    {
+      __m256i x = _mm256_loadu_si256((const __m256i *) (line + i));
+      unsigned mask = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, v));
+      if (mask)
+	return i + __builtin_ctz(mask);
+    }
+  return i + scan_repeat_sse2(line + i, length - i, value);
+}
+#endif /* STPI_X86_SIMD */
+
+static int
+scan_nonzero_forward(const unsigned char *line, int length)
+{
+#ifdef STPI_X86_SIMD
+  unsigned features = stpi_cpu_features();
+  if (features & STPI_CPU_AVX2)
+    return scan_nonzero_forward_avx2(line, length);
+  else if (features & STPI_CPU_SSE2)
+    return scan_nonzero_forward_sse2(line, length);
+#endif
+  return scan_nonzero_forward_c(line, length);
+}
+
+static int
+scan_nonzero_backward(const unsigned char *line, int length)
+{
+#ifdef STPI_X86_SIMD
+  unsigned features = stpi_cpu_features();
+  if (features & STPI_CPU_AVX2)
+    return scan_nonzero_backward_avx2(line, length);
+  else if (features & STPI_CPU_SSE2)
+    return scan_nonzero_backward_sse2(line, length);
+#endif
+  return scan_nonzero_backward_c(line, length);
+}
+
+static int
+scan_triple(const unsigned char *line, int length)
+{
+#ifdef STPI_X86_SIMD
+  unsigned features = stpi_cpu_features();
+  if (features & STPI_CPU_AVX2)
+    return scan_triple_avx2(line, length);
+  else if (features & STPI_CPU_SSE2)
+    return scan_triple_sse2(line, length);
+#endif
+  return scan_triple_c(line, length);
+}
+
+static int
+scan_repeat(const unsigned char *line, int length, unsigned char value)
+{
+#ifdef STPI_X86_SIMD
+  unsigned features = stpi_cpu_features();
+  if (features & STPI_CPU_AVX2)
+    return scan_repeat_avx2(line, length, value);
+  else if (features & STPI_CPU_SSE2)
+    return scan_repeat_sse2(line, length, value);
+#endif
+  return scan_repeat_c(line, length, value);
+}
+
 static void
 find_first_and_last(const unsigned char *line, int length,
 		    int *first, int *last)
 {
-  int i;
-  int found_first = 0;
   if (!first || !last)
     return;
-  *first = 0;
-  *last = 0;
-  for (i = 0; i < length; i++)
-    {
-      if (line[i] == 0)
-	{
-	  if (!found_first)
-	    (*first)++;
-	}
-      else
-	{
-	  *last = i;
-	  found_first = 1;
-	}
-    }
+  *first = scan_nonzero_forward(line, length);
+  if (*first < length)
+    *last = scan_nonzero_backward(line, length);
+  else
+    *last = 0;
 }
 
 int
@@ -1173,9 +1965,11 @@ stp_pack_uncompressed(stp_vars_t *v,
 		      int *first,
 		      int *last)
 {
+  unsigned long long stats_start = STPI_STATS_BEGIN();
   find_first_and_last(line, length, first, last);
   memcpy(comp_buf, line, length);
   *comp_ptr = comp_buf + length;
+  STPI_STATS_END(STPI_STATS_PACK, stats_start, length);
   if (first && last && *first > *last)
     return 0;
   else
@@ -1197,6 +1991,7 @@ stp_pack_tiff(stp_vars_t *v,
   int tcount;			/* Temporary count < 128 */
   register const unsigned char *xline = line;
   register int xlength = length;
+  unsigned long long stats_start = STPI_STATS_BEGIN();
   find_first_and_last(line, length, first, last);
 
   /*
@@ -1212,18 +2007,19 @@ stp_pack_tiff(stp_vars_t *v,
        */
 
       start  = xline;
-      xline   += 2;
-      xlength -= 2;
-
-      while (xlength > 0 && (xline[-2] != xline[-1] || xline[-1] != xline[0]))
+      if (xlength > 2)
 	{
-	  xline ++;
-	  xlength --;
+	  /*
+	   * If there is no run of three, the last two bytes are left
+	   * for the repeat code below.
+	   */
+	  int run = scan_triple(xline, xlength);
+	  if (run < 0)
+	    run = xlength - 2;
+	  xline   += run;
+	  xlength -= run;
 	}
 
-      xline   -= 2;
-      xlength += 2;
-
       /*
        * Output the non-repeated sequences (max 128 at a time).
        */
@@ -1256,13 +2052,9 @@ stp_pack_tiff(stp_vars_t *v,
 
       if (xlength > 0)
 	{
-	  int ylength = xlength;
-	  while (ylength && *xline == repeat)
-	    {
-	      xline ++;
-	      ylength --;
-	    }
-	  xlength = ylength;
+	  int run = scan_repeat(xline, xlength, repeat);
+	  xline   += run;
+	  xlength -= run;
 	}
 
       /*
@@ -1281,6 +2073,7 @@ stp_pack_tiff(stp_vars_t *v,
 	  count    -= tcount;
 	}
     }
+  STPI_STATS_END(STPI_STATS_PACK, stats_start, length);
   if (first && last && *first > *last)
     return 0;
   else
@@ -23,11 +23,40 @@
 #endif
 #include <gutenprint/gutenprint.h>
 #include "gutenprint-internal.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && defined(HAVE_MKSTEMP)
+#include <sys/mman.h>
+#define USE_MMAP 1
+#endif
+#ifdef STPI_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Pages larger than this many megabytes are buffered in a temporary
+ * file rather than on the heap.  STP_IMAGE_BUFFER_MB overrides it;
+ * 0 always uses a file.
+ */
+#define DEFAULT_BUFFER_LIMIT_MB	256
+
+/*
+ * How much of a file backed buffer we keep mapped in while it is being
+ * filled or read back.
+ */
+#define RELEASE_CHUNK	(8 << 20)
 
 struct buffered_image_priv
 {
 	stp_image_t* image;
-	unsigned char** buf;
+	unsigned char* buf;
+	size_t row_bytes;
+	size_t buf_size;
+	int mapped;
+	size_t resident_end;
 	unsigned int flags;
 };
 
@@ -61,6 +90,216 @@ buffered_image_get_appname(stp_image_t *image)
 	return priv->image->get_appname(priv->image);
 }
 
+#ifdef USE_MMAP
+static size_t
+buffer_limit(void)
+{
+	const char *val = getenv("STP_IMAGE_BUFFER_MB");
+	if(val && *val){
+		char *end;
+		unsigned long mb = strtoul(val, &end, 10);
+		if(*end == '\0')
+			return (size_t) mb << 20;
+	}
+	return (size_t) DEFAULT_BUFFER_LIMIT_MB << 20;
+}
+
+/*
+ * Back the buffer with an unlinked temporary file, so the kernel can page
+ * it out instead of it counting against the heap.
+ */
+static unsigned char*
+map_temporary_buffer(size_t size)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	char *name;
+	void *map;
+	int fd;
+
+	stp_asprintf(&name, "%s/gutenprint-bufferXXXXXX",
+		     (tmpdir && *tmpdir) ? tmpdir : "/tmp");
+	fd = mkstemp(name);
+	if(fd < 0){
+		stp_free(name);
+		return NULL;
+	}
+	unlink(name);
+	stp_free(name);
+	if(ftruncate(fd, size) != 0){
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return NULL;
+	return map;
+}
+#endif
+
+/*
+ * Drop the pages of a file backed buffer between start and end from our
+ * address space.  They stay in the file and fault back in if touched.
+ */
+static void
+release_pages(struct buffered_image_priv *priv, size_t start, size_t end)
+{
+#if defined(USE_MMAP) && defined(MADV_DONTNEED)
+	size_t page = sysconf(_SC_PAGESIZE);
+	if(!priv->mapped)
+		return;
+	start = (start + page - 1) / page * page;
+	end = end / page * page;
+	if(end > start)
+		(void) madvise(priv->buf + start, end - start, MADV_DONTNEED);
+#endif
+}
+
+/*
+ * Allocate size bytes for a page's worth of data, in an unlinked
+ * temporary file if it is larger than STP_IMAGE_BUFFER_MB.  *mapped is
+ * set to whether it is file backed, and must be passed back to
+ * stpi_page_buffer_free().
+ */
+void *
+stpi_page_buffer_allocate(size_t size, int *mapped)
+{
+	*mapped = 0;
+#ifdef USE_MMAP
+	if(size > buffer_limit()){
+		void *buf = map_temporary_buffer(size);
+		if(buf){
+			*mapped = 1;
+			return buf;
+		}
+		stp_deprintf(STP_DBG_MEMORY,
+			     "page buffer: cannot map %lu byte temporary file\n",
+			     (unsigned long) size);
+	}
+#endif
+	return stp_malloc(size);
+}
+
+void
+stpi_page_buffer_free(void *buf, size_t size, int mapped)
+{
+	if(!buf)
+		return;
+#ifdef USE_MMAP
+	if(mapped){
+		munmap(buf, size);
+		return;
+	}
+#endif
+	stp_free(buf);
+}
+
+static int
+allocate_buffer(struct buffered_image_priv *priv, size_t row_bytes, int height)
+{
+	priv->row_bytes = row_bytes;
+	priv->buf_size = row_bytes * height;
+	priv->buf = stpi_page_buffer_allocate(priv->buf_size, &priv->mapped);
+	return priv->buf != NULL;
+}
+
+/*
+ * Copy width pixels of bpp bytes each from src to dst in reverse order.
+ * Constant sized copies let the compiler use plain loads and stores.
+ */
+#define REVERSE_PIXELS(bpp)				\
+do {							\
+	for(i = 0; i < width; i++){			\
+		s -= (bpp);				\
+		memcpy(dst, s, (bpp));			\
+		dst += (bpp);				\
+	}						\
+} while(0)
+
+static void
+reverse_pixels_c(unsigned char *dst, const unsigned char *src,
+		 int width, int bpp)
+{
+	const unsigned char *s = src + (size_t) width * bpp;
+	int i;
+	switch(bpp){
+	case 1:
+		REVERSE_PIXELS(1);
+		break;
+	case 2:
+		REVERSE_PIXELS(2);
+		break;
+	case 3:
+		REVERSE_PIXELS(3);
+		break;
+	case 4:
+		REVERSE_PIXELS(4);
+		break;
+	case 6:
+		REVERSE_PIXELS(6);
+		break;
+	case 8:
+		REVERSE_PIXELS(8);
+		break;
+	default:
+		REVERSE_PIXELS(bpp);
+		break;
+	}
+}
+
+#ifdef STPI_X86_SIMD
+/*
+ * Reverse 16 bytes at a time for pixel sizes that divide 16.
+ */
+STPI_TARGET("sse2") static void
+reverse_pixels_sse2(unsigned char *dst, const unsigned char *src,
+		    int width, int bpp)
+{
+	size_t bytes = (size_t) width * bpp;
+	size_t blocks = bytes / 16;
+	const unsigned char *s = src + bytes;
+
+	while(blocks--){
+		__m128i v;
+		s -= 16;
+		v = _mm_loadu_si128((const __m128i *) s);
+		switch(bpp){
+		case 1:
+			v = _mm_or_si128(_mm_slli_epi16(v, 8),
+					 _mm_srli_epi16(v, 8));
+			/* FALLTHROUGH */
+		case 2:
+			v = _mm_shufflelo_epi16(v, 0x1b);
+			v = _mm_shufflehi_epi16(v, 0x1b);
+			v = _mm_shuffle_epi32(v, 0x4e);
+			break;
+		case 4:
+			v = _mm_shuffle_epi32(v, 0x1b);
+			break;
+		default:
+			v = _mm_shuffle_epi32(v, 0x4e);
+			break;
+		}
+		_mm_storeu_si128((__m128i *) dst, v);
+		dst += 16;
+	}
+	reverse_pixels_c(dst, src, (s - src) / bpp, bpp);
+}
+#endif
+
+static void
+reverse_pixels(unsigned char *dst, const unsigned char *src,
+	       int width, int bpp)
+{
+#ifdef STPI_X86_SIMD
+	if((bpp == 1 || bpp == 2 || bpp == 4 || bpp == 8) &&
+	   (stpi_cpu_features() & STPI_CPU_SSE2)){
+		reverse_pixels_sse2(dst, src, width, bpp);
+		return;
+	}
+#endif
+	reverse_pixels_c(dst, src, width, bpp);
+}
 
 static stp_image_status_t
 buffered_image_get_row(stp_image_t* image,unsigned char *data, size_t byte_limit, int row)
@@ -70,37 +309,58 @@ buffered_image_get_row(stp_image_t* image,unsigned char *data, size_t byte_limit
 	int height = buffered_image_height(image);
 	/* FIXME this will break with padding bytes */
 	int bytes_per_pixel = byte_limit / width;
-	int inc = bytes_per_pixel;
-	unsigned char* src;
+	const unsigned char* src;
 	int i;
+
+	if(!(priv->flags & BUFFER_FLAG_FLIP_Y)){
+		/* Rows come out in order, so there's nothing to buffer */
+		if(!(priv->flags & BUFFER_FLAG_FLIP_X))
+			return priv->image->get_row(priv->image,data,byte_limit,row);
+		if(!priv->buf){
+			priv->buf = stp_malloc(byte_limit);
+			if(!priv->buf)
+				return STP_IMAGE_STATUS_ABORT;
+			priv->row_bytes = priv->buf_size = byte_limit;
+		}
+		if(byte_limit > priv->row_bytes)
+			return STP_IMAGE_STATUS_ABORT;
+		if(STP_IMAGE_STATUS_OK != priv->image->get_row(priv->image,priv->buf,byte_limit,row))
+			return STP_IMAGE_STATUS_ABORT;
+		reverse_pixels(data, priv->buf, width, bytes_per_pixel);
+		return STP_IMAGE_STATUS_OK;
+	}
+
 	/* fill buffer */
 	if(!priv->buf){
-		priv->buf = stp_zalloc((sizeof(unsigned short*) + 1) * height);
-		if(!priv->buf){
+		size_t released = 0;
+		if(!allocate_buffer(priv, byte_limit, height))
 			return STP_IMAGE_STATUS_ABORT;
-		}
 		for(i=0;i<height;i++){
-			priv->buf[i] = stp_malloc(byte_limit);
-			if(STP_IMAGE_STATUS_OK != priv->image->get_row(priv->image,priv->buf[i],byte_limit,i))
+			size_t offset = (size_t) i * priv->row_bytes;
+			if(STP_IMAGE_STATUS_OK != priv->image->get_row(priv->image,priv->buf + offset,byte_limit,i))
 				return STP_IMAGE_STATUS_ABORT;
+			if(offset - released >= RELEASE_CHUNK){
+				release_pages(priv, released, offset);
+				released = offset;
+			}
 		}
+		priv->resident_end = priv->buf_size;
 	}
-	if(priv->flags & BUFFER_FLAG_FLIP_Y)
-		row = height - row - 1;
-
-	src = priv->buf[row];
+	if(byte_limit > priv->row_bytes)
+		return STP_IMAGE_STATUS_ABORT;
 
-	if(priv->flags & BUFFER_FLAG_FLIP_X){
-		src += byte_limit - bytes_per_pixel;
-		inc = -bytes_per_pixel;
+	src = priv->buf + (size_t) (height - row - 1) * priv->row_bytes;
+	if(priv->resident_end - (src - priv->buf) >= RELEASE_CHUNK + priv->row_bytes){
+		/* Rows are read back bottom up; drop the ones we're done with */
+		release_pages(priv, src - priv->buf + priv->row_bytes,
+			      priv->resident_end);
+		priv->resident_end = src - priv->buf + priv->row_bytes;
 	}
 
-	/* copy data */
-	for( i = 0 ; i < width ; i++){
-		memcpy(data,src,bytes_per_pixel);
-		src += inc;
-		data += bytes_per_pixel;
-	}
+	if(priv->flags & BUFFER_FLAG_FLIP_X)
+		reverse_pixels(data, src, width, bytes_per_pixel);
+	else
+		memcpy(data, src, (size_t) width * bytes_per_pixel);
 	return STP_IMAGE_STATUS_OK;
 }
 
@@ -109,12 +369,12 @@ buffered_image_conclude(stp_image_t * image)
 {
 	struct buffered_image_priv *priv = image->rep;
 	if(priv->buf){
-		int i = 0;
-		while(priv->buf[i]){
-			stp_free(priv->buf[i]);
-			++i;
-		}
-		stp_free(priv->buf);
+		stp_deprintf(STP_DBG_MEMORY,
+			     "buffered image: %lu bytes in %s, peak RSS %ld kB\n",
+			     (unsigned long) priv->buf_size,
+			     priv->mapped ? "temporary file" : "memory",
+			     stpi_peak_rss_kb());
+		stpi_page_buffer_free(priv->buf, priv->buf_size, priv->mapped);
 		priv->buf = NULL;
 	}
 	if(priv->image->conclude)
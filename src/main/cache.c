@@ -0,0 +1,255 @@
+/*
+ * "$Id$"
+ *
+ *   On-disk cache of data derived from Gutenprint data files.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Each cache entry is one file in the cache directory (see
+ * stpi_cache_dir()), named after its kind and a hash of its key.  The
+ * file holds a cache_header_t, the key padded to a multiple of 8 bytes,
+ * and the data.  An entry is only returned if it was written by the same
+ * version of Gutenprint, for the same kind and key, and if the source
+ * file it was derived from (if any) hasn't changed since.  Entries are
+ * in host byte order, since the cache is never shared between machines.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#include <sys/mman.h>
+#define USE_MMAP 1
+#endif
+
+#define CACHE_MAGIC		"STPCACH"
+#define CACHE_BYTE_ORDER	0x01020304u
+
+typedef struct
+{
+  char magic[8];
+  unsigned byte_order;
+  unsigned key_length;		/* Including NUL and padding */
+  char kind[16];
+  char version[32];		/* Gutenprint version that wrote the entry */
+  long long source_mtime;
+  long long source_size;
+  long long source_inode;
+  unsigned long long data_length;
+} cache_header_t;
+
+static char *
+cache_file_name(const char *kind, const char *key)
+{
+  char *dir = stpi_cache_dir();
+  char *answer;
+  char *name;
+  unsigned long long hash = 14695981039346656037ULL;
+  const unsigned char *p;
+
+  if (!dir)
+    return NULL;
+  for (p = (const unsigned char *) key; *p; p++)
+    {
+      hash ^= *p;
+      hash *= 1099511628211ULL;
+    }
+  stp_asprintf(&name, "%s-%016llx", kind, hash);
+  answer = stpi_path_merge(dir, name);
+  stp_free(name);
+  stp_free(dir);
+  return answer;
+}
+
+static int
+fill_header(cache_header_t *header, const char *kind, const char *key,
+	    const char *source)
+{
+  struct stat st;
+  memset(header, 0, sizeof(cache_header_t));
+  if (source && stat(source, &st) != 0)
+    return 0;
+  strcpy(header->magic, CACHE_MAGIC);
+  header->byte_order = CACHE_BYTE_ORDER;
+  header->key_length = (strlen(key) + 8) & ~7;
+  strncpy(header->kind, kind, sizeof(header->kind) - 1);
+  strncpy(header->version, VERSION, sizeof(header->version) - 1);
+  if (source)
+    {
+      header->source_mtime = st.st_mtime;
+      header->source_size = st.st_size;
+      header->source_inode = st.st_ino;
+    }
+  return 1;
+}
+
+/*
+ * Look up the entry of the given kind for key.  If source is not NULL,
+ * the entry is discarded if that file has changed since it was stored.
+ * On success the entry's data is mapped at entry->data until
+ * stpi_cache_release() is called.
+ */
+int
+stpi_cache_load(const char *kind, const char *key, const char *source,
+		stpi_cache_entry_t *entry)
+{
+  cache_header_t expected;
+  const cache_header_t *header;
+  char *cache_file;
+  struct stat st;
+  unsigned char *map = NULL;
+  size_t length = 0;
+  int fd;
+
+  memset(entry, 0, sizeof(stpi_cache_entry_t));
+  if (!fill_header(&expected, kind, key, source) ||
+      (cache_file = cache_file_name(kind, key)) == NULL)
+    return 0;
+  fd = open(cache_file, O_RDONLY);
+  if (fd < 0)
+    {
+      stp_free(cache_file);
+      return 0;
+    }
+  if (fstat(fd, &st) == 0 && st.st_size >= sizeof(cache_header_t))
+    {
+      length = st.st_size;
+#ifdef USE_MMAP
+      map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED)
+	map = NULL;
+#else
+      map = stp_malloc(length);
+      if (read(fd, map, length) != length)
+	{
+	  stp_free(map);
+	  map = NULL;
+	}
+#endif
+    }
+  close(fd);
+  if (!map)
+    {
+      stp_free(cache_file);
+      return 0;
+    }
+
+  header = (const cache_header_t *) map;
+  if (memcmp(header, &expected,
+	     (const char *) &(expected.data_length) - (const char *) &expected) ||
+      length != sizeof(cache_header_t) + header->key_length +
+      header->data_length ||
+      strcmp((const char *) map + sizeof(cache_header_t), key) != 0)
+    {
+      stp_deprintf(STP_DBG_XML, "cache: %s is stale\n", cache_file);
+#ifdef USE_MMAP
+      munmap(map, length);
+#else
+      stp_free(map);
+#endif
+      stp_free(cache_file);
+      return 0;
+    }
+  stp_deprintf(STP_DBG_XML, "cache: loaded %s for %s\n", cache_file, key);
+  stp_free(cache_file);
+  entry->data = map + sizeof(cache_header_t) + header->key_length;
+  entry->bytes = header->data_length;
+  entry->map = map;
+  entry->map_bytes = length;
+  return 1;
+}
+
+void
+stpi_cache_release(stpi_cache_entry_t *entry)
+{
+  if (entry->map)
+    {
+#ifdef USE_MMAP
+      munmap(entry->map, entry->map_bytes);
+#else
+      stp_free(entry->map);
+#endif
+    }
+  memset(entry, 0, sizeof(stpi_cache_entry_t));
+}
+
+/*
+ * Store an entry.  Failure to write the cache isn't an error; the data
+ * will just be recomputed next time.
+ */
+void
+stpi_cache_store(const char *kind, const char *key, const char *source,
+		 const void *data, size_t bytes)
+{
+  cache_header_t header;
+  char *cache_file;
+  char *tmpname;
+  FILE *fp = NULL;
+  int fd;
+  int status;
+
+  if (!fill_header(&header, kind, key, source) ||
+      (cache_file = cache_file_name(kind, key)) == NULL)
+    return;
+  header.data_length = bytes;
+
+  /* Write a private file and rename it so readers never see a partial one */
+  stp_asprintf(&tmpname, "%s.XXXXXX", cache_file);
+  fd = mkstemp(tmpname);
+  if (fd >= 0)
+    fp = fdopen(fd, "wb");
+  if (!fp)
+    {
+      stp_deprintf(STP_DBG_XML, "cache: cannot write %s: %s\n",
+		   tmpname, strerror(errno));
+      if (fd >= 0)
+	{
+	  close(fd);
+	  unlink(tmpname);
+	}
+      stp_free(tmpname);
+      stp_free(cache_file);
+      return;
+    }
+  status = fwrite(&header, sizeof(header), 1, fp) == 1;
+  status = status && fwrite(key, strlen(key), 1, fp) == 1;
+  status = status && fwrite("\0\0\0\0\0\0\0\0",
+			    header.key_length - strlen(key), 1, fp) == 1;
+  status = status && (bytes == 0 || fwrite(data, bytes, 1, fp) == 1);
+  status = (fclose(fp) == 0) && status;
+  if (status && rename(tmpname, cache_file) == 0)
+    stp_deprintf(STP_DBG_XML, "cache: wrote %s for %s\n", cache_file, key);
+  else
+    unlink(tmpname);
+  stp_free(tmpname);
+  stp_free(cache_file);
+}
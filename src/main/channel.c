@@ -35,6 +35,9 @@
 #endif
 #include <math.h>
 #include <string.h>
+#ifdef STPI_X86_SIMD
+#include <immintrin.h>
+#endif
 
 #ifdef __GNUC__
 #define inline __inline__
@@ -91,6 +94,7 @@ typedef struct
   double cyan_balance;
   double magenta_balance;
   double yellow_balance;
+  int balance[3];		/* The balances in 16.16 fixed point */
 } stpi_channel_group_t;
 
 
@@ -616,6 +620,9 @@ stp_channel_initialize(stp_vars_t *v, stp_image_t *image,
   cg->cyan_balance = stp_get_float_parameter(v, "CyanBalance");
   cg->magenta_balance = stp_get_float_parameter(v, "MagentaBalance");
   cg->yellow_balance = stp_get_float_parameter(v, "YellowBalance");
+  cg->balance[0] = (int) floor(cg->cyan_balance * 65536.0 + 0.5);
+  cg->balance[1] = (int) floor(cg->magenta_balance * 65536.0 + 0.5);
+  cg->balance[2] = (int) floor(cg->yellow_balance * 65536.0 + 0.5);
   stp_dprintf(STP_DBG_INK, v, "stp_channel_initialize:\n");
   stp_dprintf(STP_DBG_INK, v, "   channel_count  %d\n", cg->channel_count);
   stp_dprintf(STP_DBG_INK, v, "   total_channels %d\n", cg->total_channels);
@@ -730,28 +737,103 @@ ink_sum(const unsigned short *data, int total_channels)
   return total_ink;
 }
 
+/*
+ * The ratio by which to scale a pixel with total_ink > ink_limit to bring
+ * it within the limit, in 0.16 fixed point.  Scaling with it gives at
+ * most 1 less than scaling exactly.
+ */
+static inline unsigned
+ink_limit_ratio(unsigned ink_limit, unsigned total_ink)
+{
+  return (unsigned) (((unsigned long long) ink_limit << 16) / total_ink);
+}
+
+#ifdef STPI_X86_SIMD
+/*
+ * Pixels of up to 8 channels are handled one to a vector: the sum of
+ * the lanes that belong to the pixel, selected by mask, is broadcast
+ * back into every lane.  Each load reads past the end of the pixel, so
+ * the caller leaves the last few pixels of the row to the scalar code.
+ */
+STPI_TARGET("sse2") static inline __m128i
+sum_pixel_sse2(__m128i pixel, __m128i mask)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i in = _mm_and_si128(pixel, mask);
+  __m128i sum = _mm_add_epi32(_mm_unpacklo_epi16(in, zero),
+			      _mm_unpackhi_epi16(in, zero));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  return _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+STPI_TARGET("sse2") static inline __m128i
+pixel_mask_sse2(int channels, int skip)
+{
+  unsigned short lanes[8];
+  int i;
+  for (i = 0; i < 8; i++)
+    lanes[i] = (i < channels && i != skip) ? 0xffff : 0;
+  return _mm_loadu_si128((const __m128i *) lanes);
+}
+
+STPI_TARGET("sse2") static int
+limit_ink_sse2(unsigned short *ptr, int pixels, int channels,
+	       unsigned ink_limit)
+{
+  __m128i mask = pixel_mask_sse2(channels, -1);
+  int retval = 0;
+  int i;
+  for (i = 0; i < pixels; i++, ptr += channels)
+    {
+      __m128i pixel = _mm_loadu_si128((const __m128i *) ptr);
+      unsigned total_ink =
+	_mm_cvtsi128_si32(sum_pixel_sse2(pixel, mask));
+      if (total_ink > ink_limit)
+	{
+	  __m128i ratio =
+	    _mm_set1_epi16((short) ink_limit_ratio(ink_limit, total_ink));
+	  __m128i scaled = _mm_mulhi_epu16(pixel, ratio);
+	  scaled = _mm_or_si128(_mm_and_si128(scaled, mask),
+				_mm_andnot_si128(mask, pixel));
+	  _mm_storeu_si128((__m128i *) ptr, scaled);
+	  retval = 1;
+	}
+    }
+  return retval;
+}
+#endif /* STPI_X86_SIMD */
+
 static int
 limit_ink(const stp_vars_t *v)
 {
-  int i;
+  int i = 0;
   int retval = 0;
   stpi_channel_group_t *cg = get_channel_group(v);
   unsigned short *ptr;
   if (!cg || cg->ink_limit == 0 || cg->ink_limit >= cg->max_density)
     return 0;
   ptr = cg->output_data;
-  for (i = 0; i < cg->width; i++)
+#ifdef STPI_X86_SIMD
+  if (cg->total_channels <= 8 && cg->width > 8 &&
+      (stpi_cpu_features() & STPI_CPU_SSE2))
+    {
+      i = cg->width - 8;
+      retval = limit_ink_sse2(ptr, i, cg->total_channels, cg->ink_limit);
+      ptr += i * cg->total_channels;
+    }
+#endif
+  for (; i < cg->width; i++)
     {
-      int total_ink = ink_sum(ptr, cg->total_channels);
+      unsigned total_ink = ink_sum(ptr, cg->total_channels);
       if (total_ink > cg->ink_limit) /* Need to limit ink? */
 	{
 	  int j;
 	  /*
 	   * FIXME we probably should first try to convert light ink to dark
 	   */
-	  double ratio = (double) cg->ink_limit / (double) total_ink;
+	  unsigned ratio = ink_limit_ratio(cg->ink_limit, total_ink);
 	  for (j = 0; j < cg->total_channels; j++)
-	    ptr[j] *= ratio;
+	    ptr[j] = (ptr[j] * ratio) >> 16;
 	  retval = 1;
 	}
       ptr += cg->total_channels;
@@ -762,27 +844,7 @@ limit_ink(const stp_vars_t *v)
 static inline int
 short_eq(const unsigned short *i1, const unsigned short *i2, size_t count)
 {
-#if 1
-  int i;
-  for (i = 0; i < count; i++)
-    if (i1[i] != i2[i])
-      return 0;
-  return 1;
-#else
   return !memcmp(i1, i2, count * sizeof(unsigned short));
-#endif
-}
-
-static inline void
-short_copy(unsigned short *out, const unsigned short *in, size_t count)
-{
-#if 1
-  int i;
-  for (i = 0; i < count; i++)
-    out[i] = in[i];
-#else
-  (void) memcpy(out, in, count * sizeof(unsigned short));
-#endif
 }
 
 static void
@@ -803,10 +865,15 @@ copy_channels(const stp_vars_t *v)
 	  stpi_channel_t *ch = &(cg->c[j]);
 	  for (k = 0; k < ch->subchannel_count; k++)
 	    {
+	      /*
+	       * The gloss channel is generated later, but clear it now so
+	       * that the ink limit doesn't see whatever row the buffer
+	       * last held.
+	       */
 	      if (cg->gloss_channel != j)
-		{
-		  *output = *input++;
-		}
+		*output = *input++;
+	      else
+		*output = 0;
 	      output++;
 	    }
 	}	  
@@ -1017,6 +1084,70 @@ split_channels(const stp_vars_t *v, unsigned *zero_mask)
     }
 }
 
+#ifdef STPI_X86_SIMD
+/*
+ * Scale every channel of the row at once.  densities holds the density
+ * of each physical channel, repeated so that the 8 lanes of a vector
+ * starting at any channel can be loaded from it.  The scaling is the
+ * same as scale_channel()'s: (x * density + 32767) / 65535, with the
+ * division done as (n + 1 + (n >> 16)) >> 16, which is exact for any
+ * n this can produce.  Sets nonzero[c] if channel c is left with any
+ * ink.
+ */
+STPI_TARGET("sse2") static void
+scale_channels_sse2(unsigned short *data, size_t count, unsigned channels,
+		    const unsigned short *densities, unsigned short *nonzero)
+{
+  __m128i found[STP_CHANNEL_LIMIT];
+  const __m128i half = _mm_set1_epi32(32767);
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i bias = _mm_set1_epi16((short) 0x8000);
+  size_t i;
+  unsigned phase = 0;
+  unsigned c;
+
+  for (c = 0; c < channels; c++)
+    found[c] = _mm_setzero_si128();
+  for (i = 0; i + 8 <= count; i += 8)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i *) (data + i));
+      __m128i d = _mm_loadu_si128((const __m128i *) (densities + phase));
+      __m128i lo = _mm_mullo_epi16(x, d);
+      __m128i hi = _mm_mulhi_epu16(x, d);
+      __m128i n0 = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), half);
+      __m128i n1 = _mm_add_epi32(_mm_unpackhi_epi16(lo, hi), half);
+      __m128i q0, q1, q;
+      n0 = _mm_add_epi32(_mm_add_epi32(n0, one), _mm_srli_epi32(n0, 16));
+      n1 = _mm_add_epi32(_mm_add_epi32(n1, one), _mm_srli_epi32(n1, 16));
+      /* Bias the quotients into signed range to pack them */
+      q0 = _mm_sub_epi32(_mm_srli_epi32(n0, 16), _mm_slli_epi32(one, 15));
+      q1 = _mm_sub_epi32(_mm_srli_epi32(n1, 16), _mm_slli_epi32(one, 15));
+      q = _mm_xor_si128(_mm_packs_epi32(q0, q1), bias);
+      _mm_storeu_si128((__m128i *) (data + i), q);
+      found[phase] = _mm_or_si128(found[phase], q);
+      phase += 8;
+      while (phase >= channels)
+	phase -= channels;
+    }
+  for (c = 0; c < channels; c++)
+    {
+      unsigned short lanes[8];
+      int l;
+      _mm_storeu_si128((__m128i *) lanes, found[c]);
+      for (l = 0; l < 8; l++)
+	nonzero[(c + l) % channels] |= lanes[l];
+    }
+  for (; i < count; i++)
+    {
+      unsigned density = densities[phase];
+      data[i] = (32767u + data[i] * density) / 65535u;
+      nonzero[phase] |= data[i];
+      if (++phase == channels)
+	phase = 0;
+    }
+}
+#endif /* STPI_X86_SIMD */
+
 static void
 scale_channels(const stp_vars_t *v, unsigned *zero_mask)
 {
@@ -1025,6 +1156,45 @@ scale_channels(const stp_vars_t *v, unsigned *zero_mask)
   int physical_channel = 0;
   if (!cg)
     return;
+#ifdef STPI_X86_SIMD
+  if (cg->total_channels > 0 && cg->total_channels <= STP_CHANNEL_LIMIT &&
+      (stpi_cpu_features() & STPI_CPU_SSE2))
+    {
+      unsigned short densities[STP_CHANNEL_LIMIT + 8];
+      unsigned short nonzero[STP_CHANNEL_LIMIT];
+      unsigned short skip[STP_CHANNEL_LIMIT];
+      int scaled = 0;
+      for (i = 0; i < cg->channel_count; i++)
+	for (j = 0; j < cg->c[i].subchannel_count; j++)
+	  {
+	    /* The gloss channel is left alone, as a density of 65535 does */
+	    skip[physical_channel] = (cg->gloss_channel == i);
+	    densities[physical_channel] =
+	      skip[physical_channel] ? 65535 : cg->c[i].sc[j].s_density;
+	    if (densities[physical_channel] != 65535)
+	      scaled = 1;
+	    nonzero[physical_channel] = 0;
+	    physical_channel++;
+	  }
+      /* Rows at full density are only scanned, which the loop below does */
+      if (scaled)
+	{
+	  for (i = 0; i < 8; i++)
+	    densities[physical_channel + i] = densities[i % physical_channel];
+	  scale_channels_sse2(cg->output_data, cg->width * cg->total_channels,
+			      cg->total_channels, densities, nonzero);
+	  if (zero_mask)
+	    {
+	      *zero_mask = 0;
+	      for (i = 0; i < physical_channel; i++)
+		if (!skip[i] && !nonzero[i])
+		  *zero_mask |= 1 << i;
+	    }
+	  return;
+	}
+      physical_channel = 0;
+    }
+#endif
   if (zero_mask)
     *zero_mask = 0;
   for (i = 0; i < cg->channel_count; i++)
@@ -1062,18 +1232,58 @@ scale_channels(const stp_vars_t *v, unsigned *zero_mask)
     }
 }
 
+#ifdef STPI_X86_SIMD
+STPI_TARGET("sse2") static int
+generate_gloss_sse2(unsigned short *output, int pixels, int channels,
+		    int gloss_channel, unsigned gloss_limit)
+{
+  __m128i mask = pixel_mask_sse2(channels, gloss_channel);
+  int retval = 0;
+  int i;
+  for (i = 0; i < pixels; i++, output += channels)
+    {
+      __m128i pixel = _mm_loadu_si128((const __m128i *) output);
+      unsigned channel_sum = _mm_cvtsi128_si32(sum_pixel_sse2(pixel, mask));
+      if (channel_sum < gloss_limit)
+	{
+	  unsigned gloss_required = gloss_limit - channel_sum;
+	  if (gloss_required > 65535)
+	    gloss_required = 65535;
+	  output[gloss_channel] = gloss_required;
+	  retval = 1;
+	}
+      else
+	output[gloss_channel] = 0;
+    }
+  return retval;
+}
+#endif /* STPI_X86_SIMD */
+
 static void
 generate_gloss(const stp_vars_t *v, unsigned *zero_mask)
 {
   stpi_channel_group_t *cg = get_channel_group(v);
   unsigned short *output;
   unsigned gloss_mask;
-  int i, j, k;
+  int i = 0, j, k;
   if (!cg || cg->gloss_channel == -1 || cg->gloss_limit <= 0)
     return;
   output = cg->output_data;
   gloss_mask = ~(1 << cg->gloss_physical_channel);
-  for (i = 0; i < cg->width; i++)
+#ifdef STPI_X86_SIMD
+  if (cg->total_channels <= 8 && cg->width > 8 &&
+      cg->c[cg->gloss_channel].subchannel_count == 1 &&
+      (stpi_cpu_features() & STPI_CPU_SSE2))
+    {
+      i = cg->width - 8;
+      if (generate_gloss_sse2(output, i, cg->total_channels,
+			      cg->gloss_physical_channel, cg->gloss_limit) &&
+	  zero_mask)
+	*zero_mask &= gloss_mask;
+      output += i * cg->total_channels;
+    }
+#endif
+  for (; i < cg->width; i++)
     {
       int physical_channel = 0;
       unsigned channel_sum = 0;
@@ -1132,9 +1342,9 @@ do_gcr(const stp_vars_t *v)
 	    kk = k;
 	  ck = k - kk;
 	  output[0] = kk;
-	  output[1] += ck * cg->cyan_balance;
-	  output[2] += ck * cg->magenta_balance;
-	  output[3] += ck * cg->yellow_balance;
+	  output[1] += ((long long) ck * cg->balance[0]) >> 16;
+	  output[2] += ((long long) ck * cg->balance[1]) >> 16;
+	  output[3] += ((long long) ck * cg->balance[2]) >> 16;
 	}
       output += cg->gcr_channels;
     }
@@ -1174,3 +1384,60 @@ stp_channel_get_output(const stp_vars_t *v)
     return NULL;
   return cg->output_data;
 }
+
+size_t
+stpi_channel_get_output_size(const stp_vars_t *v)
+{
+  stpi_channel_group_t *cg = get_channel_group(v);
+  if (!cg)
+    return 0;
+  return cg->total_channels * cg->width;
+}
+
+/*
+ * Row buffers let the caller hand converted rows to the dither code
+ * without copying them out of the channel's own buffer.  A buffer from
+ * stpi_channel_alloc_row() belongs to the caller, who frees it with
+ * stpi_channel_free_row().  After stpi_channel_set_row(), color
+ * conversion writes into that buffer (and stp_channel_get_input() and
+ * stp_channel_get_output() return it where they would have returned the
+ * channel's buffer) until another row is set.  Setting NULL goes back to
+ * the channel's own buffer, which must be done before the current row is
+ * freed.  Buffers may only be set after the channels are initialized.
+ */
+unsigned short *
+stpi_channel_alloc_row(const stp_vars_t *v)
+{
+  size_t size = stpi_channel_get_output_size(v);
+  if (size == 0)
+    return NULL;
+  return stp_malloc(size * sizeof(unsigned short));
+}
+
+void
+stpi_channel_free_row(unsigned short *row)
+{
+  if (row)
+    stp_free(row);
+}
+
+void
+stpi_channel_set_row(const stp_vars_t *v, unsigned short *row)
+{
+  stpi_channel_group_t *cg = get_channel_group(v);
+  unsigned short *old;
+  if (!cg || !cg->alloc_data_1)
+    return;
+  if (!row)
+    row = cg->alloc_data_1;
+  old = cg->output_data;
+  if (cg->input_data == old)
+    cg->input_data = row;
+  if (cg->gcr_data == old)
+    cg->gcr_data = row;
+  if (cg->multi_tmp == old)
+    cg->multi_tmp = row;
+  if (cg->split_input == old)
+    cg->split_input = row;
+  cg->output_data = row;
+}
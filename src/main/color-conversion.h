@@ -134,6 +134,41 @@ typedef struct
   size_t bits;
 } channel_depth_t;
 
+/*
+ * A lookup table resolved from a cached curve at a particular number of
+ * steps.
+ */
+typedef struct
+{
+  const unsigned short *data;
+  size_t steps;
+} color_plan_lut_t;
+
+/*
+ * Per-job state used by the row conversion functions.  The parameter
+ * dependent values are computed once when the color module is
+ * initialized, and each lookup table is resolved the first time it is
+ * used, so converting a row does no parameter lookups or curve
+ * resampling.
+ */
+typedef struct
+{
+  int compiled;
+  double saturation;		/* Saturation as requested */
+  double isat;			/* 1 / saturation, if saturation > 1 */
+  double hsl_saturation;	/* Saturation applied in HSL space */
+  double hsl_isat;		/* 1 / hsl_saturation, if > 1 */
+  int split_saturation;
+  int compute_saturation;
+  int do_user_adjustment;
+  int bright_color_adjustment;
+  int hue_only_color_adjustment;
+  color_plan_lut_t channel_luts[STP_CHANNEL_LIMIT];
+  color_plan_lut_t brightness;
+  color_plan_lut_t contrast;
+  color_plan_lut_t user;
+} color_plan_t;
+
 typedef struct
 {
   unsigned steps;
@@ -165,8 +200,12 @@ typedef struct
   unsigned short *gray_tmp;	/* Color -> Gray */
   unsigned short *cmy_tmp;	/* CMY -> CMYK */
   unsigned char *in_data;
+  stpi_arena_t *arena;		/* Where the row buffers above come from */
+  color_plan_t plan;
 } lut_t;
 
+extern void stpi_color_compile_plan(const stp_vars_t *v, lut_t *lut);
+
 extern unsigned stpi_color_convert_to_gray(const stp_vars_t *v,
 					   const unsigned char *,
 					   unsigned short *);
@@ -365,6 +365,65 @@ short_copy(unsigned short *out, const unsigned short *in, size_t count)
 #endif
 }
 
+void
+stpi_color_compile_plan(const stp_vars_t *v, lut_t *lut)
+{
+  color_plan_t *plan = &(lut->plan);
+  double sbright = stp_get_float_parameter(v, "Brightness");
+
+  memset(plan, 0, sizeof(color_plan_t));
+  plan->saturation = stp_get_float_parameter(v, "Saturation");
+  plan->isat = 1.0;
+  if (plan->saturation > 1)
+    plan->isat = 1.0 / plan->saturation;
+  plan->do_user_adjustment = (sbright != 1);
+  plan->compute_saturation =
+    (plan->saturation <= .99999 || plan->saturation >= 1.00001 ||
+     plan->do_user_adjustment);
+  plan->split_saturation = plan->saturation > 1.4;
+  plan->hsl_saturation = plan->saturation;
+  if (plan->split_saturation)
+    plan->hsl_saturation = sqrt(plan->saturation);
+  plan->hsl_isat = 1.0;
+  if (plan->hsl_saturation > 1)
+    plan->hsl_isat = 1.0 / plan->hsl_saturation;
+  if (lut->color_correction)
+    {
+      plan->bright_color_adjustment =
+	lut->color_correction->correction == COLOR_CORRECTION_BRIGHT;
+      plan->hue_only_color_adjustment =
+	lut->color_correction->correction == COLOR_CORRECTION_HUE;
+    }
+  (void) stp_curve_cache_get_double_data(&(lut->hue_map));
+  (void) stp_curve_cache_get_double_data(&(lut->lum_map));
+  (void) stp_curve_cache_get_double_data(&(lut->sat_map));
+  plan->compiled = 1;
+}
+
+static inline color_plan_t *
+get_color_plan(const stp_vars_t *v, lut_t *lut)
+{
+  if (!lut->plan.compiled)
+    stpi_color_compile_plan(v, lut);
+  return &(lut->plan);
+}
+
+/*
+ * Different conversion paths resample the same curve to different sizes,
+ * so the table is only built once we know which path wants it.
+ */
+static inline const unsigned short *
+plan_lut(stp_cached_curve_t *cache, color_plan_lut_t *entry, size_t steps)
+{
+  if (!entry->data || entry->steps != steps)
+    {
+      stp_curve_resample(stp_curve_cache_get_curve(cache), steps);
+      entry->data = stp_curve_cache_get_ushort_data(cache);
+      entry->steps = steps;
+    }
+  return entry->data;
+}
+
 static unsigned
 raw_cmy_to_kcmy(const stp_vars_t *vars, const unsigned short *in,
 		unsigned short *out)
@@ -442,9 +501,6 @@ color_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,     \
 			unsigned short *out)				     \
 {									     \
   int i;								     \
-  double isat = 1.0;							     \
-  double ssat = stp_get_float_parameter(vars, "Saturation");		     \
-  double sbright = stp_get_float_parameter(vars, "Brightness");		     \
   int i0 = -1;								     \
   int i1 = -1;								     \
   int i2 = -1;								     \
@@ -461,44 +517,25 @@ color_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,     \
   const unsigned short *contrast;					     \
   const T *s_in = (const T *) in;					     \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	     \
-  int compute_saturation = ssat <= .99999 || ssat >= 1.00001;		     \
-  int split_saturation = ssat > 1.4;					     \
-  int bright_color_adjustment = 0;					     \
-  int hue_only_color_adjustment = 0;					     \
-  int do_user_adjustment = 0;						     \
-  if (lut->color_correction->correction == COLOR_CORRECTION_BRIGHT)	     \
-    bright_color_adjustment = 1;					     \
-  if (lut->color_correction->correction == COLOR_CORRECTION_HUE)	     \
-    hue_only_color_adjustment = 1;					     \
-  if (sbright != 1)							     \
-    do_user_adjustment = 1;						     \
-  compute_saturation |= do_user_adjustment;				     \
+  color_plan_t *plan = get_color_plan(vars, lut);			     \
+  double ssat = plan->hsl_saturation;					     \
+  double isat = plan->hsl_isat;						     \
+  int compute_saturation = plan->compute_saturation;			     \
+  int split_saturation = plan->split_saturation;			     \
+  int bright_color_adjustment = plan->bright_color_adjustment;		     \
+  int hue_only_color_adjustment = plan->hue_only_color_adjustment;	     \
+  int do_user_adjustment = plan->do_user_adjustment;			     \
 									     \
-  for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				     \
-    stp_curve_resample(stp_curve_cache_get_curve(&(lut->channel_curves[i])), \
-		       1 << bits);					     \
-  stp_curve_resample							     \
-    (stp_curve_cache_get_curve(&(lut->brightness_correction)), 65536);	     \
-  stp_curve_resample							     \
-    (stp_curve_cache_get_curve(&(lut->contrast_correction)), 1 << bits);     \
-  red =									     \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_C]));	     \
-  green =								     \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_M]));	     \
-  blue =								     \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_Y]));	     \
-  brightness=								     \
-    stp_curve_cache_get_ushort_data(&(lut->brightness_correction));	     \
-  contrast =								     \
-    stp_curve_cache_get_ushort_data(&(lut->contrast_correction));	     \
-  (void) stp_curve_cache_get_double_data(&(lut->hue_map));		     \
-  (void) stp_curve_cache_get_double_data(&(lut->lum_map));		     \
-  (void) stp_curve_cache_get_double_data(&(lut->sat_map));		     \
-									     \
-  if (split_saturation)							     \
-    ssat = sqrt(ssat);							     \
-  if (ssat > 1)								     \
-    isat = 1.0 / ssat;							     \
+  red = plan_lut(&(lut->channel_curves[CHANNEL_C]),			     \
+		 &(plan->channel_luts[CHANNEL_C]), 1 << bits);		     \
+  green = plan_lut(&(lut->channel_curves[CHANNEL_M]),			     \
+		   &(plan->channel_luts[CHANNEL_M]), 1 << bits);	     \
+  blue = plan_lut(&(lut->channel_curves[CHANNEL_Y]),			     \
+		  &(plan->channel_luts[CHANNEL_Y]), 1 << bits);		     \
+  brightness = plan_lut(&(lut->brightness_correction),			     \
+			&(plan->brightness), 65536);			     \
+  contrast = plan_lut(&(lut->contrast_correction),			     \
+		      &(plan->contrast), 1 << bits);			     \
   for (i = 0; i < lut->image_width; i++)				     \
     {									     \
       if (i0 == s_in[0] && i1 == s_in[1] && i2 == s_in[2])		     \
@@ -565,34 +602,21 @@ color_##bits##_to_color_fast(const stp_vars_t *vars, const unsigned char *in, \
   const unsigned short *blue;						      \
   const unsigned short *brightness;					      \
   const unsigned short *contrast;					      \
-  double isat = 1.0;							      \
-  double saturation = stp_get_float_parameter(vars, "Saturation");	      \
-  double sbright = stp_get_float_parameter(vars, "Brightness");		      \
-  int compute_saturation = saturation <= .99999 || saturation >= 1.00001;     \
-  int do_user_adjustment = 0;						      \
-  if (sbright != 1)							      \
-    do_user_adjustment = 1;						      \
-  compute_saturation |= do_user_adjustment;				      \
-									      \
-  for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				      \
-    stp_curve_resample(lut->channel_curves[i].curve, 65536);		      \
-  stp_curve_resample							      \
-    (stp_curve_cache_get_curve(&(lut->brightness_correction)), 65536);	      \
-  stp_curve_resample							      \
-    (stp_curve_cache_get_curve(&(lut->contrast_correction)), 1 << bits);      \
-  red =									      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_C]));	      \
-  green =								      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_M]));	      \
-  blue =								      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_Y]));	      \
-  brightness=								      \
-    stp_curve_cache_get_ushort_data(&(lut->brightness_correction));	      \
-  contrast =								      \
-    stp_curve_cache_get_ushort_data(&(lut->contrast_correction));	      \
+  color_plan_t *plan = get_color_plan(vars, lut);			      \
+  double saturation = plan->saturation;					      \
+  double isat = plan->isat;						      \
+  int compute_saturation = plan->compute_saturation;			      \
 									      \
-  if (saturation > 1)							      \
-    isat = 1.0 / saturation;						      \
+  red = plan_lut(&(lut->channel_curves[CHANNEL_C]),			      \
+		 &(plan->channel_luts[CHANNEL_C]), 65536);		      \
+  green = plan_lut(&(lut->channel_curves[CHANNEL_M]),			      \
+		   &(plan->channel_luts[CHANNEL_M]), 65536);		      \
+  blue = plan_lut(&(lut->channel_curves[CHANNEL_Y]),			      \
+		  &(plan->channel_luts[CHANNEL_Y]), 65536);		      \
+  brightness = plan_lut(&(lut->brightness_correction),			      \
+			&(plan->brightness), 65536);			      \
+  contrast = plan_lut(&(lut->contrast_correction),			      \
+		      &(plan->contrast), 1 << bits);			      \
   for (i = 0; i < lut->image_width; i++)				      \
     {									      \
       if (i0 == s_in[0] && i1 == s_in[1] && i2 == s_in[2])		      \
@@ -688,18 +712,16 @@ gray_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,	    \
   const unsigned short *blue;						    \
   const unsigned short *user;						    \
 									    \
-  for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				    \
-    stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-  stp_curve_resample							    \
-    (stp_curve_cache_get_curve(&(lut->user_color_correction)), 1 << bits);  \
-  red =									    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_C]));	    \
-  green =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_M]));	    \
-  blue =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_Y]));	    \
-  user =								    \
-    stp_curve_cache_get_ushort_data(&(lut->user_color_correction));	    \
+  color_plan_t *plan = get_color_plan(vars, lut);			    \
+									    \
+  red = plan_lut(&(lut->channel_curves[CHANNEL_C]),			    \
+		 &(plan->channel_luts[CHANNEL_C]), 65536);		    \
+  green = plan_lut(&(lut->channel_curves[CHANNEL_M]),			    \
+		   &(plan->channel_luts[CHANNEL_M]), 65536);		    \
+  blue = plan_lut(&(lut->channel_curves[CHANNEL_Y]),			    \
+		  &(plan->channel_luts[CHANNEL_Y]), 65536);		    \
+  user = plan_lut(&(lut->user_color_correction), &(plan->user),		    \
+		  1 << bits);						    \
 									    \
   for (i = 0; i < lut->image_width; i++)				    \
     {									    \
@@ -772,7 +794,7 @@ name##_##bits##_to_##name2(const stp_vars_t *vars, const unsigned char *in, \
   size_t real_steps = lut->steps;					    \
   unsigned status;							    \
   if (!lut->cmy_tmp)							    \
-    lut->cmy_tmp = stp_malloc(4 * 2 * lut->image_width);		    \
+    lut->cmy_tmp = stpi_arena_malloc(lut->arena, 4 * 2 * lut->image_width);  \
   name##_##bits##_to_##name3(vars, in, lut->cmy_tmp);			    \
   lut->steps = 65536;							    \
   status = name4##_cmy_to_kcmy(vars, lut->cmy_tmp, out);		    \
@@ -1091,7 +1113,7 @@ namein##_##bits##_to_##name2(const stp_vars_t *vars, const unsigned char *in, \
   unsigned mask = 0;							      \
 									      \
   if (!lut->cmy_tmp)							      \
-    lut->cmy_tmp = stp_malloc(3 * 2 * lut->image_width);		      \
+    lut->cmy_tmp = stpi_arena_malloc(lut->arena, 3 * 2 * lut->image_width);   \
   tmp = lut->cmy_tmp;							      \
   memset(lut->cmy_tmp, 0, width * 3 * sizeof(unsigned short));		      \
   if (lut->invert_output)						      \
@@ -1159,16 +1181,15 @@ cmyk_##size##_to_kcmy(const stp_vars_t *vars,				    \
   int nz[4];								    \
   const T *s_in = (const T *) in;					    \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
+  color_plan_t *plan = get_color_plan(vars, lut);			    \
   const unsigned short *user;						    \
   const unsigned short *maps[4];					    \
 									    \
   for (i = 0; i < 4; i++)						    \
-    {									    \
-      stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-      maps[i] = stp_curve_cache_get_ushort_data(&(lut->channel_curves[i])); \
-    }									    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << size);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+    maps[i] = plan_lut(&(lut->channel_curves[i]),			    \
+		       &(plan->channel_luts[i]), 65536);		    \
+  user = plan_lut(&(lut->user_color_correction), &(plan->user),		    \
+		  1 << size);						    \
 									    \
   memset(nz, 0, sizeof(nz));						    \
 									    \
@@ -1204,16 +1225,15 @@ kcmy_##size##_to_kcmy(const stp_vars_t *vars,				    \
   int nz[4];								    \
   const T *s_in = (const T *) in;					    \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
+  color_plan_t *plan = get_color_plan(vars, lut);			    \
   const unsigned short *user;						    \
   const unsigned short *maps[4];					    \
 									    \
   for (i = 0; i < 4; i++)						    \
-    {									    \
-      stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-      maps[i] = stp_curve_cache_get_ushort_data(&(lut->channel_curves[i])); \
-    }									    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << size);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+    maps[i] = plan_lut(&(lut->channel_curves[i]),			    \
+		       &(plan->channel_luts[i]), 65536);		    \
+  user = plan_lut(&(lut->user_color_correction), &(plan->user),		    \
+		  1 << size);						    \
 									    \
   memset(nz, 0, sizeof(nz));						    \
 									    \
@@ -1249,16 +1269,15 @@ gray_##bits##_to_gray(const stp_vars_t *vars,				   \
   int nz = 0;								   \
   const T *s_in = (const T *) in;					   \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	   \
+  color_plan_t *plan = get_color_plan(vars, lut);			   \
   int width = lut->image_width;						   \
   const unsigned short *composite;					   \
   const unsigned short *user;						   \
 									   \
-  stp_curve_resample							   \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536); \
-  composite =								   \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	   \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	   \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));   \
+  composite = plan_lut(&(lut->channel_curves[CHANNEL_K]),		   \
+		       &(plan->channel_luts[CHANNEL_K]), 65536);	   \
+  user = plan_lut(&(lut->user_color_correction), &(plan->user),		   \
+		  1 << bits);						   \
 									   \
   memset(out, 0, width * sizeof(unsigned short));			   \
 									   \
@@ -1295,18 +1314,17 @@ color_##bits##_to_gray(const stp_vars_t *vars,				      \
   int nz = 0;								      \
   const T *s_in = (const T *) in;					      \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	      \
+  color_plan_t *plan = get_color_plan(vars, lut);			      \
   int l_red = LUM_RED;							      \
   int l_green = LUM_GREEN;						      \
   int l_blue = LUM_BLUE;						      \
   const unsigned short *composite;					      \
   const unsigned short *user;						      \
 									      \
-  stp_curve_resample							      \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536);    \
-  composite =								      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	      \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	      \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));      \
+  composite = plan_lut(&(lut->channel_curves[CHANNEL_K]),		      \
+		       &(plan->channel_luts[CHANNEL_K]), 65536);	      \
+  user = plan_lut(&(lut->user_color_correction), &(plan->user),		      \
+		  1 << bits);						      \
 									      \
   if (lut->input_color_description->color_model == COLOR_BLACK)		      \
     {									      \
@@ -1353,6 +1371,7 @@ cmyk_##bits##_to_gray(const stp_vars_t *vars,				    \
   int nz = 0;								    \
   const T *s_in = (const T *) in;					    \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
+  color_plan_t *plan = get_color_plan(vars, lut);			    \
   int l_red = LUM_RED;							    \
   int l_green = LUM_GREEN;						    \
   int l_blue = LUM_BLUE;						    \
@@ -1360,12 +1379,10 @@ cmyk_##bits##_to_gray(const stp_vars_t *vars,				    \
   const unsigned short *composite;					    \
   const unsigned short *user;						    \
 									    \
-  stp_curve_resample							    \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536);  \
-  composite =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+  composite = plan_lut(&(lut->channel_curves[CHANNEL_K]),		    \
+		       &(plan->channel_luts[CHANNEL_K]), 65536);	    \
+  user = plan_lut(&(lut->user_color_correction), &(plan->user),		    \
+		  1 << bits);						    \
 									    \
   if (lut->input_color_description->color_model == COLOR_BLACK)		    \
     {									    \
@@ -1413,6 +1430,7 @@ kcmy_##bits##_to_gray(const stp_vars_t *vars,				    \
   int nz = 0;								    \
   const T *s_in = (const T *) in;					    \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
+  color_plan_t *plan = get_color_plan(vars, lut);			    \
   int l_red = LUM_RED;							    \
   int l_green = LUM_GREEN;						    \
   int l_blue = LUM_BLUE;						    \
@@ -1420,12 +1438,10 @@ kcmy_##bits##_to_gray(const stp_vars_t *vars,				    \
   const unsigned short *composite;					    \
   const unsigned short *user;						    \
 									    \
-  stp_curve_resample							    \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536);  \
-  composite =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+  composite = plan_lut(&(lut->channel_curves[CHANNEL_K]),		    \
+		       &(plan->channel_luts[CHANNEL_K]), 65536);	    \
+  user = plan_lut(&(lut->user_color_correction), &(plan->user),		    \
+		  1 << bits);						    \
 									    \
   if (lut->input_color_description->color_model == COLOR_BLACK)		    \
     {									    \
@@ -1741,7 +1757,7 @@ name##_##bits##_to_##name2##_desaturated(const stp_vars_t *vars,	   \
   size_t real_steps = lut->steps;					   \
   unsigned status;							   \
   if (!lut->gray_tmp)							   \
-    lut->gray_tmp = stp_malloc(2 * lut->image_width);			   \
+    lut->gray_tmp = stpi_arena_malloc(lut->arena, 2 * lut->image_width);   \
   name##_##bits##_to_gray_noninvert(vars, in, lut->gray_tmp);		   \
   lut->steps = 65536;							   \
   status = gray_16_to_##name2(vars, (unsigned char *) lut->gray_tmp, out); \
@@ -1853,16 +1869,15 @@ raw_##size##_to_raw(const stp_vars_t *vars,				    \
   int nz[STP_CHANNEL_LIMIT];						    \
   const T *s_in = (const T *) in;					    \
   lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
+  color_plan_t *plan = get_color_plan(vars, lut);			    \
   const unsigned short *maps[STP_CHANNEL_LIMIT];			    \
   const unsigned short *user;						    \
 									    \
   for (i = 0; i < lut->out_channels; i++)				    \
-    {									    \
-      stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-      maps[i] = stp_curve_cache_get_ushort_data(&(lut->channel_curves[i])); \
-    }									    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << size);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+    maps[i] = plan_lut(&(lut->channel_curves[i]),			    \
+		       &(plan->channel_luts[i]), 65536);		    \
+  user = plan_lut(&(lut->user_color_correction), &(plan->user),		    \
+		  1 << size);						    \
 									    \
   memset(nz, 0, sizeof(nz));						    \
 									    \
@@ -190,7 +190,11 @@ stp_color_get_row(stp_vars_t *v,
 {
   const stp_colorfuncs_t *colorfuncs =
     stpi_get_colorfuncs(stp_get_color_by_name(stp_get_color_conversion(v)));
-  return colorfuncs->get_row(v, image, row, zero_mask);
+  unsigned long long stats_start = STPI_STATS_BEGIN();
+  int status = colorfuncs->get_row(v, image, row, zero_mask);
+  STPI_STATS_END(STPI_STATS_COLOR, stats_start,
+		 stpi_channel_get_output_size(v) * sizeof(unsigned short));
+  return status;
 }
 
 stp_parameter_list_t
@@ -121,8 +121,8 @@ update_dither(stpi_dither_t *d, int channel, int width,
 
 static inline int
 print_color(const stpi_dither_t *d, stpi_dither_channel_t *dc, int x, int y,
-	    unsigned char bit, int length, int dontprint, int stpi_dither_type,
-	    const unsigned char *mask)
+	    unsigned char bit, int ptr_offset, int length, int dontprint,
+	    int stpi_dither_type, const unsigned char *mask)
 {
   int base = dc->b;
   int density = dc->o;
@@ -293,11 +293,11 @@ print_color(const stpi_dither_t *d, stpi_dither_channel_t *dc, int x, int y,
 		subc = lower;
 	    }
 	  v = subc->value;
-	  if (!mask || (*(mask + d->ptr_offset) & bit))
+	  if (!mask || (*(mask + ptr_offset) & bit))
 	    {
 	      if (dc->ptr)
 		{
-		  tptr = dc->ptr + d->ptr_offset;
+		  tptr = dc->ptr + ptr_offset;
 
 		  /*
 		   * Lay down all of the bits in the pixel.
@@ -398,6 +398,64 @@ shared_ed_deinitializer(stpi_dither_t *d,
   STP_SAFE_FREE(ndither);
 }
 
+/*
+ * The channels are dithered independently of each other, so each one is
+ * a separate task for the dither's worker pool, with its own position in
+ * the row and its own error rows.
+ */
+typedef struct
+{
+  stpi_dither_t *d;
+  int row;
+  const unsigned short *raw;
+  const unsigned char *mask;
+  int length;
+  int direction;
+  int ***error;
+  int *ndither;
+  int *channels;
+} ed_row_t;
+
+static void
+ed_dither_channel(void *arg, int task)
+{
+  const ed_row_t *r = (const ed_row_t *) arg;
+  stpi_dither_t *d = r->d;
+  int i = r->channels[task];
+  stpi_dither_channel_t *dc = &(CHANNEL(d, i));
+  int direction = r->direction;
+  int *error0 = r->error[i][0];
+  int *error1 = r->error[i][1];
+  int ndither = r->ndither[i];
+  const unsigned short *raw = r->raw + i;
+  int x = (direction == 1) ? 0 : d->dst_width - 1;
+  int terminate = (direction == 1) ? d->dst_width : -1;
+  int ptr_offset = (direction == 1) ? 0 : r->length - 1;
+  unsigned char bit = 1 << (7 - (x & 7));
+  int xstep  = CHANNEL_COUNT(d) * (d->src_width / d->dst_width);
+  int xmod   = d->src_width % d->dst_width;
+  int xerror = (xmod * x) % d->dst_width;
+
+  for (; x != terminate; x += direction)
+    {
+      dc->v = raw[0];
+      dc->o = dc->v;
+      dc->b = dc->v;
+      dc->v = UPDATE_COLOR(dc->v, ndither);
+      dc->v = print_color(d, dc, x, r->row, bit, ptr_offset, r->length, 0,
+			  d->stpi_dither_type, r->mask);
+      ndither = update_dither(d, i, d->src_width, direction, error0, error1);
+      error0 += direction;
+      error1 += direction;
+      if (direction == 1)
+	ADVANCE_FORWARD(d, ptr_offset, bit, raw, CHANNEL_COUNT(d), xerror,
+			xstep, xmod);
+      else
+	ADVANCE_BACKWARD(d, ptr_offset, bit, raw, CHANNEL_COUNT(d), xerror,
+			 xstep, xmod);
+    }
+}
+
 void
 stpi_dither_ed(stp_vars_t *v,
 	       int row,
@@ -407,18 +465,12 @@ stpi_dither_ed(stp_vars_t *v,
 	       const unsigned char *mask)
 {
   stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
-  int		x,
-    		length;
-  unsigned char	bit;
+  ed_row_t r;
   int		i;
-  int		*ndither;
-  int		***error;
-
-  int		terminate;
+  int		nchannels = 0;
   int		direction = row & 1 ? 1 : -1;
-  int xerror, xstep, xmod;
 
-  length = (d->dst_width + 7) / 8;
+  r.length = (d->dst_width + 7) / 8;
   if (d->stpi_dither_type & D_ADAPTIVE_BASE)
     for (i = 0; i < CHANNEL_COUNT(d); i++)
       if (CHANNEL(d, i).nlevels > 1)
@@ -426,41 +478,25 @@ stpi_dither_ed(stp_vars_t *v,
 	  stpi_dither_ordered(v, row, raw, duplicate_line, zero_mask, mask);
 	  return;
 	}
-  if (!shared_ed_initializer(d, row, duplicate_line, zero_mask, length,
-			     direction, &error, &ndither))
+  if (!shared_ed_initializer(d, row, duplicate_line, zero_mask, r.length,
+			     direction, &(r.error), &(r.ndither)))
     return;
 
-  x = (direction == 1) ? 0 : d->dst_width - 1;
-  bit = 1 << (7 - (x & 7));
-  xstep  = CHANNEL_COUNT(d) * (d->src_width / d->dst_width);
-  xmod   = d->src_width % d->dst_width;
-  xerror = (xmod * x) % d->dst_width;
-  terminate = (direction == 1) ? d->dst_width : -1;
-
   if (direction == -1)
     raw += (CHANNEL_COUNT(d) * (d->src_width - 1));
+  r.d = d;
+  r.row = row;
+  r.raw = raw;
+  r.mask = mask;
+  r.direction = direction;
+  r.channels = stp_malloc(CHANNEL_COUNT(d) * sizeof(int));
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    if (CHANNEL(d, i).ptr)
+      r.channels[nchannels++] = i;
+  stpi_worker_pool_run(d->workers, nchannels, ed_dither_channel, &r);
 
-  for (; x != terminate; x += direction)
-    {
-      for (i = 0; i < CHANNEL_COUNT(d); i++)
-	{
-	  if (CHANNEL(d, i).ptr)
-	    {
-	      CHANNEL(d, i).v = raw[i];
-	      CHANNEL(d, i).o = CHANNEL(d, i).v;
-	      CHANNEL(d, i).b = CHANNEL(d, i).v;
-	      CHANNEL(d, i).v = UPDATE_COLOR(CHANNEL(d, i).v, ndither[i]);
-	      CHANNEL(d, i).v = print_color(d, &(CHANNEL(d, i)), x, row, bit,
-					    length, 0, d->stpi_dither_type,
-					    mask);
-	      ndither[i] = update_dither(d, i, d->src_width,
-					 direction, error[i][0], error[i][1]);
-	    }
-	}
-      ADVANCE_BIDIRECTIONAL(d, bit, raw, direction, CHANNEL_COUNT(d), xerror,
-			    xstep, xmod, error, d->error_rows);
-    }
-  shared_ed_deinitializer(d, error, ndither);
+  stp_free(r.channels);
+  shared_ed_deinitializer(d, r.error, r.ndither);
   if (direction == -1)
     stpi_dither_reverse_row_ends(d);
 }
@@ -57,6 +57,10 @@ typedef struct
   stpi_dither_channel_t *dummy_channel;
   double transition;		/* Exponential scaling for transition region */
   stp_dither_matrix_impl_t transition_matrix;
+  int *comparison;		/* Threshold for each pixel of the row */
+  int *point_error;		/* Error carried from channel to channel */
+  int *progress;		/* Pixels of the row each channel has done */
+  int *channels;		/* Channels with output */
 } eventone_t;
 
 typedef struct shade_segment
@@ -99,6 +103,10 @@ free_eventone_data(stpi_dither_t *d)
     }
   if (d->stpi_dither_type & D_UNITONE)
     stp_dither_matrix_destroy(&(et->transition_matrix));
+  STP_SAFE_FREE(et->comparison);
+  STP_SAFE_FREE(et->point_error);
+  STP_SAFE_FREE(et->progress);
+  STP_SAFE_FREE(et->channels);
   STP_SAFE_FREE(et);
 }
 
@@ -114,7 +122,7 @@ et_setup(stpi_dither_t *d)
     {
       CHANNEL(d, i).error_rows = 1;
       CHANNEL(d, i).errs = stp_zalloc(1 * sizeof(int *));
-      CHANNEL(d, i).errs[0] = stp_zalloc(size * sizeof(int));
+      CHANNEL(d, i).errs[0] = stpi_arena_zalloc(d->arena, size * sizeof(int));
     }
   if (d->stpi_dither_type & D_UNITONE)
     {
@@ -127,7 +135,7 @@ et_setup(stpi_dither_t *d)
       stp_dither_matrix_clone(&(et->transition_matrix), &(dc->pick), 0, 0);
       dc->error_rows = 1;
       dc->errs = stp_zalloc(1 * sizeof(int *));
-      dc->errs[0] = stp_zalloc(size * sizeof(int));
+      dc->errs[0] = stpi_arena_zalloc(d->arena, size * sizeof(int));
       et->dummy_channel = dc;
     }
 
@@ -181,6 +189,11 @@ et_setup(stpi_dither_t *d)
 
   et->diff_factor = diff_factors[et->physical_aspect];
 
+  et->comparison = stp_malloc(sizeof(int) * d->dst_width);
+  et->point_error = stp_malloc(sizeof(int) * d->dst_width * CHANNEL_COUNT(d));
+  et->progress = stp_malloc(sizeof(int) * CHANNEL_COUNT(d));
+  et->channels = stp_malloc(sizeof(int) * CHANNEL_COUNT(d));
+
   d->aux_data = et;
   d->aux_freefunc = free_eventone_data;
 }
@@ -367,14 +380,14 @@ find_segment_and_ditherpoint(stpi_dither_channel_t *dc, unsigned inkval,
 }
 
 static inline void
-print_ink(stpi_dither_t *d, unsigned char *tptr, const stpi_ink_defn_t *ink,
+print_ink(unsigned char *tptr, int ptr_offset, const stpi_ink_defn_t *ink,
 	  unsigned char bit, int length)
 {
   int j;
 
   if (tptr != 0)
     {
-      tptr += d->ptr_offset;
+      tptr += ptr_offset;
       switch(ink->bits)
 	{
 	case 1:
@@ -398,6 +411,127 @@ print_ink(stpi_dither_t *d, unsigned char *tptr, const stpi_ink_defn_t *ink,
     }
 }
 
+/*
+ * Within each pixel EvenTone carries the error of its decision from
+ * channel to channel, so channel n can only dither a pixel once channel
+ * n - 1 has.  Each channel is a separate task for the dither's worker
+ * pool, which follows the channel before it along the row, picking up
+ * the error it left at each pixel and reporting its own progress every
+ * ET_CHUNK pixels.  The channels therefore run as a wavefront and make
+ * exactly the same decisions as they would one pixel at a time.
+ */
+#define ET_CHUNK 64
+
+typedef struct
+{
+  stpi_dither_t *d;
+  eventone_t *et;
+  const unsigned short *raw;
+  const unsigned char *mask;
+  int length;
+  int direction;
+  int nchannels;
+} et_row_t;
+
+static void
+et_dither_channel(void *arg, int task)
+{
+  const et_row_t *r = (const et_row_t *) arg;
+  stpi_dither_t *d = r->d;
+  eventone_t *et = r->et;
+  int i = et->channels[task];
+  stpi_dither_channel_t *dc = &CHANNEL(d, i);
+  shade_distance_t *sp = (shade_distance_t *) dc->aux_data;
+  const int *error_in =
+    task > 0 ? et->point_error + (task - 1) * d->dst_width : NULL;
+  int *error_out =
+    task < r->nchannels - 1 ? et->point_error + task * d->dst_width : NULL;
+  int direction = r->direction;
+  int length = r->length;
+  const unsigned short *raw = r->raw + i;
+  int x = (direction == 1) ? 0 : d->dst_width - 1;
+  int ptr_offset = (direction == 1) ? 0 : length - 1;
+  unsigned char bit = 1 << (7 - (x & 7));
+  int xstep  = CHANNEL_COUNT(d) * (d->src_width / d->dst_width);
+  int xmod   = d->src_width % d->dst_width;
+  int xerror = (xmod * x) % d->dst_width;
+  int available = 0;
+  int n;
+
+  for (n = 0; n < d->dst_width; n++, x += direction)
+    {
+      int inkspot;
+      int range_point;
+      int point_error = 0;
+      stpi_ink_defn_t *inkp;
+      stpi_ink_defn_t lower, upper;
+
+      if (error_in)
+	{
+	  if (n >= available)
+	    available = stpi_worker_pool_wait(d->workers,
+					      &(et->progress[task - 1]), n + 1);
+	  point_error = error_in[n];
+	}
+
+      advance_eventone_pre(sp, et, x);
+
+      /*
+       * Find which are the two candidate dot sizes.
+       * Rather than use the absolute value of the point to compute
+       * the error, we will use the relative value of the point within
+       * the range to find the two candidate dot sizes.
+       */
+      range_point =
+	find_segment_and_ditherpoint(dc, raw[0], &lower, &upper);
+
+      /* Incorporate error data from previous line */
+      dc->v += 2 * range_point + (dc->errs[0][x + MAX_SPREAD] + 8) / 16;
+      inkspot = dc->v - range_point;
+
+      point_error += eventone_adjust(dc, et, inkspot, range_point);
+
+      /* Determine whether to print the larger or smaller dot */
+      inkp = &lower;
+      if (point_error >= et->comparison[n])
+	{
+	  point_error -= 65535;
+	  inkp = &upper;
+	  dc->v -= 131070;
+	  sp->dis = et->d_sq;
+	}
+
+      /* Adjust the error to reflect the dot choice */
+      if (inkp->bits)
+	{
+	  if (!r->mask || (*(r->mask + ptr_offset) & bit))
+	    {
+	      set_row_ends(dc, x);
+
+	      /* Do the printing */
+	      print_ink(dc->ptr, ptr_offset, inkp, bit, length);
+	    }
+	}
+
+      /* Spread the error around to the adjacent dots */
+      eventone_update(dc, et, x, direction);
+      diffuse_error(dc, et, x, direction);
+
+      if (error_out)
+	{
+	  error_out[n] = point_error;
+	  if ((n + 1) % ET_CHUNK == 0 || n + 1 == d->dst_width)
+	    stpi_worker_pool_post(d->workers, &(et->progress[task]), n + 1);
+	}
+      if (direction == 1)
+	ADVANCE_FORWARD(d, ptr_offset, bit, raw, CHANNEL_COUNT(d), xerror,
+			xstep, xmod);
+      else
+	ADVANCE_BACKWARD(d, ptr_offset, bit, raw, CHANNEL_COUNT(d), xerror,
+			 xstep, xmod);
+    }
+}
+
 void
 stpi_dither_et(stp_vars_t *v,
 	       int row,
@@ -408,16 +542,10 @@ stpi_dither_et(stp_vars_t *v,
 {
   stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
   eventone_t *et;
-
+  et_row_t r;
   int		x;
-  int	        length;
-  unsigned char	bit;
   int		i;
-
-  int		terminate;
-  int		direction;
-  int		xerror, xstep, xmod;
-  int		channel_count = CHANNEL_COUNT(d);
+  int		n;
 
   if (!et_initializer(d, duplicate_line, zero_mask))
     return;
@@ -426,98 +554,35 @@ stpi_dither_et(stp_vars_t *v,
   if (d->stpi_dither_type & D_UNITONE)
     stp_dither_matrix_set_row(&(et->transition_matrix), row);
 
-  length = (d->dst_width + 7) / 8;
-
-  if (row & 1)
-    {
-      direction = 1;
-      x = 0;
-      terminate = d->dst_width;
-      d->ptr_offset = 0;
-    }
-  else
-    {
-      direction = -1;
-      x = d->dst_width - 1;
-      terminate = -1;
-      d->ptr_offset = length - 1;
-      raw += channel_count * (d->src_width - 1);
-    }
-  bit = 1 << (7 - (x & 7));
-  xstep  = channel_count * (d->src_width / d->dst_width);
-  xmod   = d->src_width % d->dst_width;
-  xerror = (xmod * x) % d->dst_width;
-
-  for (; x != terminate; x += direction)
+  r.d = d;
+  r.et = et;
+  r.mask = mask;
+  r.length = (d->dst_width + 7) / 8;
+  r.direction = (row & 1) ? 1 : -1;
+  r.raw = raw;
+  if (r.direction == -1)
+    r.raw += CHANNEL_COUNT(d) * (d->src_width - 1);
+
+  /* The threshold depends only on the position, so do it up front */
+  x = (r.direction == 1) ? 0 : d->dst_width - 1;
+  for (n = 0; n < d->dst_width; n++, x += r.direction)
     {
-
-      int point_error = 0;
-      int comparison = 32768;
-
+      et->comparison[n] = 32768;
       if (d->stpi_dither_type & D_ORDERED_BASE)
-	comparison += (ditherpoint(d, &(d->dither_matrix), x) / 16) - 2048;
-
-      for (i=0; i < channel_count; i++)
-	{
-	  if (CHANNEL(d, i).ptr)
-	    {
-	      int inkspot;
-	      int range_point;
-	      stpi_dither_channel_t *dc = &CHANNEL(d, i);
-	      shade_distance_t *sp = (shade_distance_t *) dc->aux_data;
-	      stpi_ink_defn_t *inkp;
-	      stpi_ink_defn_t lower, upper;
-
-	      advance_eventone_pre(sp, et, x);
-
-	      /*
-	       * Find which are the two candidate dot sizes.
-	       * Rather than use the absolute value of the point to compute
-	       * the error, we will use the relative value of the point within
-	       * the range to find the two candidate dot sizes.
-	       */
-	      range_point =
-		find_segment_and_ditherpoint(dc, raw[i], &lower, &upper);
-
-	      /* Incorporate error data from previous line */
-	      dc->v += 2 * range_point + (dc->errs[0][x + MAX_SPREAD] + 8) / 16;
-	      inkspot = dc->v - range_point;
-
-	      point_error += eventone_adjust(dc, et, inkspot, range_point);
-
-	      /* Determine whether to print the larger or smaller dot */
-	      inkp = &lower;
-	      if (point_error >= comparison)
-		{
-		  point_error -= 65535;
-		  inkp = &upper;
-		  dc->v -= 131070;
-		  sp->dis = et->d_sq;
-		}
-
-	      /* Adjust the error to reflect the dot choice */
-	      if (inkp->bits)
-		{
-		  if (!mask || (*(mask + d->ptr_offset) & bit))
-		    {
-		      set_row_ends(dc, x);
-
-		      /* Do the printing */
-		      print_ink(d, dc->ptr, inkp, bit, length);
-		    }
-		}
-
-	      /* Spread the error around to the adjacent dots */
-	      eventone_update(dc, et, x, direction);
-	      diffuse_error(dc, et, x, direction);
-	    }
-	}
-      if (direction == 1)
-	ADVANCE_UNIDIRECTIONAL(d, bit, raw, channel_count, xerror, xstep, xmod);
-      else
-	ADVANCE_REVERSE(d, bit, raw, channel_count, xerror, xstep, xmod);
+	et->comparison[n] +=
+	  (ditherpoint(d, &(d->dither_matrix), x) / 16) - 2048;
     }
-  if (direction == -1)
+
+  r.nchannels = 0;
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    if (CHANNEL(d, i).ptr)
+      {
+	et->progress[r.nchannels] = 0;
+	et->channels[r.nchannels++] = i;
+      }
+  stpi_worker_pool_run(d->workers, r.nchannels, et_dither_channel, &r);
+
+  if (r.direction == -1)
     stpi_dither_reverse_row_ends(d);
 }
 
@@ -723,7 +788,7 @@ stpi_dither_ut(stp_vars_t *v,
 		      set_row_ends(dc, x);
 
 		      /* Do the printing */
-		      print_ink(d, dc->ptr, inkp, bit, length);
+		      print_ink(dc->ptr, d->ptr_offset, inkp, bit, length);
 		    }
 		}
 	    }
@@ -172,6 +172,8 @@ typedef struct dither
   unsigned *subchannel_count;
 
   stpi_ditherfunc_t *ditherfunc;
+  stpi_worker_pool_t *workers;	/* Threads for channel-parallel dithering */
+  stpi_arena_t *arena;		/* Where error rows are allocated */
   void *aux_data;
   void (*aux_freefunc)(struct dither *);
 } stpi_dither_t;
@@ -197,13 +199,17 @@ extern void stpi_dither_finalize(stp_vars_t *v);
 extern int *stpi_dither_get_errline(stpi_dither_t *d, int row, int color);
 
 
-#define ADVANCE_UNIDIRECTIONAL(d, bit, input, width, xerror, xstep, xmod) \
+/*
+ * Step to the next (or previous) output pixel, given the byte offset of
+ * the output pixel, its bit within the byte and the input pointer.
+ */
+#define ADVANCE_FORWARD(d, offset, bit, input, width, xerror, xstep, xmod) \
 do									  \
 {									  \
   bit >>= 1;								  \
   if (bit == 0)								  \
     {									  \
-      d->ptr_offset++;							  \
+      (offset)++;							  \
       bit = 128;							  \
     }									  \
   input += xstep;							  \
@@ -218,12 +224,12 @@ do									  \
     }									  \
 } while (0)
 
-#define ADVANCE_REVERSE(d, bit, input, width, xerror, xstep, xmod)	\
+#define ADVANCE_BACKWARD(d, offset, bit, input, width, xerror, xstep, xmod) \
 do									\
 {									\
   if (bit == 128)							\
     {									\
-      d->ptr_offset--;							\
+      (offset)--;							\
       bit = 1;								\
     }									\
   else									\
@@ -240,19 +246,11 @@ do									\
     }									\
 } while (0)
 
-#define ADVANCE_BIDIRECTIONAL(d,bit,in,dir,width,xer,xstep,xmod,err,S)	\
-do									\
-{									\
-  int ii;								\
-  int jj;								\
-  for (ii = 0; ii < width; ii++)					\
-    for (jj = 0; jj < S; jj++)						\
-      err[ii][jj] += dir;						\
-  if (dir == 1)								\
-    ADVANCE_UNIDIRECTIONAL(d, bit, in, width, xer, xstep, xmod);	\
-  else									\
-    ADVANCE_REVERSE(d, bit, in, width, xer, xstep, xmod);		\
-} while (0)
+#define ADVANCE_UNIDIRECTIONAL(d, bit, input, width, xerror, xstep, xmod) \
+  ADVANCE_FORWARD(d, d->ptr_offset, bit, input, width, xerror, xstep, xmod)
+
+#define ADVANCE_REVERSE(d, bit, input, width, xerror, xstep, xmod)	\
+  ADVANCE_BACKWARD(d, d->ptr_offset, bit, input, width, xerror, xstep, xmod)
 
 #ifdef __cplusplus
   }
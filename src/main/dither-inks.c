@@ -94,7 +94,7 @@ stpi_dither_channel_destroy(stpi_dither_channel_t *channel)
   if (channel->errs)
     {
       for (i = 0; i < channel->error_rows; i++)
-	STP_SAFE_FREE(channel->errs[i]);
+	stpi_arena_free(channel->errs[i]);
       STP_SAFE_FREE(channel->errs);
     }
   STP_SAFE_FREE(channel->ranges);
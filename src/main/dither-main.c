@@ -327,6 +327,7 @@ stpi_dither_free(void *vd)
 {
   stpi_dither_t *d = (stpi_dither_t *) vd;
   int j;
+  stpi_worker_pool_destroy(d->workers);
   if (d->aux_freefunc)
     (d->aux_freefunc)(d);
   for (j = 0; j < CHANNEL_COUNT(d); j++)
@@ -349,6 +350,7 @@ stp_dither_init(stp_vars_t *v, stp_image_t *image, int out_width,
 
   stp_allocate_component_data(v, "Dither", NULL, stpi_dither_free, d);
 
+  d->arena = stpi_get_arena(v);
   d->finalized = 0;
   d->error_rows = ERROR_ROWS;
   d->d_cutoff = 4096;
@@ -368,6 +370,14 @@ stp_dither_init(stp_vars_t *v, stp_image_t *image, int out_width,
   d->ditherfunc = stpi_set_dither_function(v);
   d->adaptive_limit = .75 * 65535;
 
+  /*
+   * Error diffusion and EvenTone can dither the channels of a row on
+   * separate threads.
+   */
+  if ((d->ditherfunc == stpi_dither_ed || d->ditherfunc == stpi_dither_et) &&
+      stp_check_int_parameter(v, "Threads", STP_PARAMETER_ACTIVE))
+    d->workers = stpi_worker_pool_create(stp_get_int_parameter(v, "Threads"));
+
   /*
    * For hybrid EvenTone we want to use the good matrix.  For regular
    * EvenTone, we don't need to pay the cost.
@@ -453,7 +463,8 @@ stpi_dither_get_errline(stpi_dither_t *d, int row, int color)
   if (!dc->errs[row % dc->error_rows])
     {
       int size = 2 * MAX_SPREAD + (16 * ((d->dst_width + 7) / 8));
-      dc->errs[row % dc->error_rows] = stp_zalloc(size * sizeof(int));
+      dc->errs[row % dc->error_rows] =
+	stpi_arena_zalloc(d->arena, size * sizeof(int));
     }
   return dc->errs[row % dc->error_rows] + MAX_SPREAD;
 }
@@ -465,6 +476,7 @@ stp_dither_internal(stp_vars_t *v, int row, const unsigned short *input,
 {
   int i;
   stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  unsigned long long stats_start = STPI_STATS_BEGIN();
   stpi_dither_finalize(v);
   stp_dither_matrix_set_row(&(d->dither_matrix), row);
   for (i = 0; i < CHANNEL_COUNT(d); i++)
@@ -481,6 +493,8 @@ stp_dither_internal(stp_vars_t *v, int row, const unsigned short *input,
     }
   d->ptr_offset = 0;
   (d->ditherfunc)(v, row, input, duplicate_line, zero_mask, mask);
+  STPI_STATS_END(STPI_STATS_DITHER, stats_start,
+		 stpi_channel_get_output_size(v) * sizeof(unsigned short));
 }
 
 void
@@ -33,6 +33,10 @@
 #include <gutenprint/gutenprint-intl-internal.h>
 #include "dither-impl.h"
 #include "dither-inlined-functions.h"
+#include <string.h>
+#ifdef STPI_X86_SIMD
+#include <immintrin.h>
+#endif
 
 
 typedef struct {
@@ -48,6 +52,23 @@ typedef struct {
   stpi_new_ordered_t *ord_new;
 } stpi_ordered_t;
 
+/*
+ * Per-dither state, kept in d->aux_data.  The strips hold one channel's
+ * input and dither thresholds for each output pixel of the row, padded
+ * to a multiple of ORDERED_BLOCK pixels.
+ */
+#define ORDERED_BLOCK 16
+
+typedef struct {
+  int channels_initialized;
+  int use_strips;		/* The vector kernel can be used */
+  int strip_length;
+  int *src_index;		/* Input pixel for each output pixel */
+  unsigned short *values;
+  unsigned short *thresholds;
+  unsigned short *matrix_row;
+} stpi_ordered_row_t;
+
 static int
 compare_channels(const stpi_dither_channel_t *dc1,
 		 const stpi_dither_channel_t *dc2)
@@ -262,7 +283,7 @@ free_dither_ordered(stpi_dither_t *d)
 {
   int i;
   stpi_dither_channel_t *dc0 = &CHANNEL(d, 0);
-  stpi_ordered_t *o0 = dc0->aux_data;
+  stpi_ordered_t *o0 = CHANNEL_COUNT(d) > 0 ? dc0->aux_data : NULL;
   stpi_new_ordered_t *no0 = NULL;
   if (o0)
     no0 = o0->ord_new;
@@ -285,15 +306,22 @@ free_dither_ordered(stpi_dither_t *d)
 	  dc->aux_data = NULL;
 	}
     }
-  stp_free(d->aux_data);
+  if (d->aux_data)
+    {
+      stpi_ordered_row_t *r = (stpi_ordered_row_t *) d->aux_data;
+      STP_SAFE_FREE(r->src_index);
+      STP_SAFE_FREE(r->values);
+      STP_SAFE_FREE(r->thresholds);
+      STP_SAFE_FREE(r->matrix_row);
+      stp_free(r);
+      d->aux_data = NULL;
+    }
 }
 
 static void
 init_dither_ordered(stpi_dither_t *d, stp_vars_t *v)
 {
   int i;
-  d->aux_data = stp_malloc(1);
-  d->aux_freefunc = &free_dither_ordered;
   stp_dprintf(STP_DBG_INK, v, "init_dither_ordered\n");
   for (i = 0; i < CHANNEL_COUNT(d); i++)
     {
@@ -328,6 +356,280 @@ init_dither_ordered(stpi_dither_t *d, stp_vars_t *v)
     }
 }
 
+/*
+ * The vector kernel works on one channel at a time.  For each row the
+ * channel's input is gathered into a strip with one value per output
+ * pixel, and the channel's row of the dither matrix is expanded into a
+ * matching strip of thresholds.  The kernel then compares ORDERED_BLOCK
+ * pixels at a time against every segment of the channel and writes
+ * whole output bytes.
+ *
+ * Within a segment the scalar code prints the upper ink when
+ *
+ *   (val - lower) * 65535 / span >= threshold
+ *
+ * (without the scaling when span is 65535).  Since all of the terms are
+ * integers this is exactly (val - lower) * 65535 >= threshold * span,
+ * which the kernel evaluates as 32 bit products split across pairs of
+ * 16 bit lanes.
+ */
+static void
+setup_ordered_strips(stpi_dither_t *d, stpi_ordered_row_t *r)
+{
+  int i;
+  int x;
+  int xstep = d->src_width / d->dst_width;
+  int xmod = d->src_width % d->dst_width;
+  int xerror = 0;
+  int src = 0;
+
+  r->use_strips = 0;
+#ifdef STPI_X86_SIMD
+  if (!(stpi_cpu_features() & STPI_CPU_SSE2))
+    return;
+#else
+  return;
+#endif
+  if (d->dither_matrix.x_size <= 0)
+    return;
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    {
+      stpi_dither_channel_t *dc = &(CHANNEL(d, i));
+      int j;
+      if (dc->dithermat.matrix != d->dither_matrix.matrix ||
+	  dc->dithermat.x_size != d->dither_matrix.x_size)
+	return;
+      for (j = 0; j < dc->nlevels; j++)
+	if ((dc->ranges[j].value_span == 0 &&
+	     dc->ranges[j].lower->value < 65535) ||
+	    dc->ranges[j].value_span > 65535 ||
+	    dc->ranges[j].lower->value > 65535 ||
+	    dc->ranges[j].lower->bits > 255 ||
+	    dc->ranges[j].upper->bits > 255)
+	  return;
+    }
+  for (i = 0; i < d->dither_matrix.total_size; i++)
+    if (d->dither_matrix.matrix[i] > 65535)
+      return;
+
+  r->strip_length = (d->dst_width + ORDERED_BLOCK - 1) & ~(ORDERED_BLOCK - 1);
+  r->src_index = stp_malloc(sizeof(int) * d->dst_width);
+  r->values = stp_zalloc(sizeof(unsigned short) * r->strip_length);
+  r->thresholds = stp_zalloc(sizeof(unsigned short) * r->strip_length);
+  r->matrix_row =
+    stp_malloc(sizeof(unsigned short) * d->dither_matrix.x_size);
+  for (x = 0; x < d->dst_width; x++)
+    {
+      r->src_index[x] = src;
+      src += xstep;
+      if (xmod)
+	{
+	  xerror += xmod;
+	  if (xerror >= d->dst_width)
+	    {
+	      xerror -= d->dst_width;
+	      src++;
+	    }
+	}
+    }
+  r->use_strips = 1;
+}
+
+/*
+ * Fill the strips for one channel.  The matrix row is the one
+ * stp_dither_matrix_set_row() selected; ditherpoint() would return
+ * row[(x + x_offset) % x_size] for pixel x.
+ */
+static void
+fill_ordered_strips(const stpi_dither_t *d, stpi_ordered_row_t *r,
+		    const unsigned short *raw, int channel)
+{
+  const stp_dither_matrix_impl_t *mat = &(CHANNEL(d, channel).dithermat);
+  const unsigned *row = mat->matrix + mat->last_y_mod;
+  int x_size = mat->x_size;
+  int start = mat->x_offset % x_size;
+  int channels = CHANNEL_COUNT(d);
+  int x;
+
+  if (start < 0)
+    start += x_size;
+  for (x = 0; x < x_size; x++)
+    r->matrix_row[x] = row[x];
+  for (x = 0; x < d->dst_width; )
+    {
+      int count = x_size - start;
+      if (count > d->dst_width - x)
+	count = d->dst_width - x;
+      memcpy(r->thresholds + x, r->matrix_row + start,
+	     count * sizeof(unsigned short));
+      x += count;
+      start = 0;
+    }
+  for (x = 0; x < d->dst_width; x++)
+    r->values[x] = raw[r->src_index[x] * channels + channel];
+}
+
+#ifdef STPI_X86_SIMD
+static const unsigned char reverse_bits[256] =
+{
+#define R2(n) n, n + 2*64, n + 1*64, n + 3*64
+#define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
+  R6(0), R6(2), R6(1), R6(3)
+#undef R6
+#undef R4
+#undef R2
+};
+
+/* Unsigned a > b, 16 bit lanes */
+STPI_TARGET("sse2") static inline __m128i
+cmpgt_epu16(__m128i a, __m128i b)
+{
+  const __m128i bias = _mm_set1_epi16((short) 0x8000);
+  return _mm_cmpgt_epi16(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+}
+
+/*
+ * Dither one channel's strips into its output planes.  Returns the
+ * first and last pixels printed in *first and *last (-1 if none).
+ */
+STPI_TARGET("sse2") static void
+dither_ordered_strip_sse2(const stpi_dither_t *d, const stpi_ordered_row_t *r,
+			  stpi_dither_channel_t *dc, int length, int one_bit,
+			  const unsigned char *mask, int *first, int *last)
+{
+  const __m128i scale = _mm_set1_epi16((short) 65535);
+  int nsegs = one_bit ? 1 : dc->nlevels;
+  int planes = one_bit ? 1 : 0;
+  int x;
+  int i;
+
+  for (i = 0; i < nsegs && !one_bit; i++)
+    {
+      unsigned bits = dc->ranges[i].lower->bits | dc->ranges[i].upper->bits;
+      while (bits >> planes)
+	planes++;
+    }
+  *first = -1;
+  *last = -1;
+  if (planes == 0)
+    return;
+
+  for (x = 0; x < r->strip_length; x += ORDERED_BLOCK)
+    {
+      int byte = x / 8;
+      int p;
+      unsigned any = 0;
+      unsigned maskbits = 0xffff;
+      __m128i chosen[2];
+
+      for (p = 0; p < 2; p++)
+	{
+	  __m128i val = _mm_loadu_si128((const __m128i *) (r->values + x + p*8));
+	  __m128i thr =
+	    _mm_loadu_si128((const __m128i *) (r->thresholds + x + p*8));
+	  __m128i lower = _mm_setzero_si128();
+	  __m128i span = _mm_setzero_si128();
+	  __m128i lbits = _mm_setzero_si128();
+	  __m128i ubits = _mm_setzero_si128();
+	  __m128i a_hi, a_lo, b_hi, b_lo, ge;
+	  /*
+	   * Pick the highest segment whose lower value is below the input.
+	   * A channel with a single one bit ink is treated as one segment
+	   * from 0 to 65535.
+	   */
+	  for (i = 0; i < nsegs; i++)
+	    {
+	      const stpi_dither_segment_t *dd = &(dc->ranges[i]);
+	      unsigned short lv = one_bit ? 0 : dd->lower->value;
+	      unsigned short sv = one_bit ? 65535 : dd->value_span;
+	      unsigned short lb = one_bit ? 0 : dd->lower->bits;
+	      unsigned short ub = one_bit ? 1 : dd->upper->bits;
+	      __m128i in = cmpgt_epu16(val, _mm_set1_epi16((short) lv));
+	      lower = _mm_or_si128(_mm_andnot_si128(in, lower),
+				   _mm_and_si128(in, _mm_set1_epi16((short) lv)));
+	      span = _mm_or_si128(_mm_andnot_si128(in, span),
+				  _mm_and_si128(in, _mm_set1_epi16((short) sv)));
+	      lbits = _mm_or_si128(_mm_andnot_si128(in, lbits),
+				   _mm_and_si128(in, _mm_set1_epi16((short) lb)));
+	      ubits = _mm_or_si128(_mm_andnot_si128(in, ubits),
+				   _mm_and_si128(in, _mm_set1_epi16((short) ub)));
+	    }
+	  val = _mm_sub_epi16(val, lower);
+	  a_hi = _mm_mulhi_epu16(val, scale);
+	  a_lo = _mm_mullo_epi16(val, scale);
+	  b_hi = _mm_mulhi_epu16(thr, span);
+	  b_lo = _mm_mullo_epi16(thr, span);
+	  ge = _mm_or_si128(cmpgt_epu16(a_hi, b_hi),
+			    _mm_andnot_si128(cmpgt_epu16(b_lo, a_lo),
+					     _mm_cmpeq_epi16(a_hi, b_hi)));
+	  chosen[p] = _mm_or_si128(_mm_and_si128(ge, ubits),
+				   _mm_andnot_si128(ge, lbits));
+	}
+
+      if (mask)
+	{
+	  maskbits = reverse_bits[mask[byte]];
+	  if (byte + 1 < length)
+	    maskbits |= reverse_bits[mask[byte + 1]] << 8;
+	}
+      for (p = 0; p < planes; p++)
+	{
+	  const __m128i plane = _mm_set1_epi16((short) (1 << p));
+	  __m128i m0 = _mm_cmpeq_epi16(_mm_and_si128(chosen[0], plane), plane);
+	  __m128i m1 = _mm_cmpeq_epi16(_mm_and_si128(chosen[1], plane), plane);
+	  unsigned bits = _mm_movemask_epi8(_mm_packs_epi16(m0, m1)) & maskbits;
+	  if (bits)
+	    {
+	      unsigned char *tptr = dc->ptr + p * length + byte;
+	      any |= bits;
+	      tptr[0] |= reverse_bits[bits & 0xff];
+	      if (byte + 1 < length)
+		tptr[1] |= reverse_bits[bits >> 8];
+	    }
+	}
+      if (any)
+	{
+	  int lo = 0;
+	  int hi = ORDERED_BLOCK - 1;
+	  while (!(any & (1u << lo)))
+	    lo++;
+	  while (!(any & (1u << hi)))
+	    hi--;
+	  if (*first < 0)
+	    *first = x + lo;
+	  *last = x + hi;
+	}
+    }
+}
+#endif
+
+static void
+dither_ordered_strips(stpi_dither_t *d, stpi_ordered_row_t *r,
+		      const unsigned short *raw, int length, int one_bit,
+		      const unsigned char *mask)
+{
+#ifdef STPI_X86_SIMD
+  int i;
+  for (i = 0; i < CHANNEL_COUNT(d); i++)
+    {
+      stpi_dither_channel_t *dc = &(CHANNEL(d, i));
+      int first, last;
+      if (!dc->ptr)
+	continue;
+      fill_ordered_strips(d, r, raw, i);
+      dither_ordered_strip_sse2(d, r, dc, length, one_bit, mask,
+				&first, &last);
+      if (first >= 0)
+	{
+	  if (dc->row_ends[0] == -1)
+	    dc->row_ends[0] = first;
+	  dc->row_ends[1] = last;
+	}
+    }
+#endif
+}
+
 void
 stpi_dither_ordered(stp_vars_t *v,
 		    int row,
@@ -343,6 +645,7 @@ stpi_dither_ordered(stp_vars_t *v,
   int i;
   int one_bit_only = 1;
   int one_level_only = 1;
+  stpi_ordered_row_t *rowdata;
 
   int xerror, xstep, xmod;
 
@@ -365,11 +668,26 @@ stpi_dither_ordered(stp_vars_t *v,
       if (dc->nlevels != 1 || dc->ranges[0].upper->bits != 1)
 	one_bit_only = 0;
     }
-  if (! one_bit_only && ! d->aux_data &&
+  if (! d->aux_data)
+    {
+      d->aux_data = stp_zalloc(sizeof(stpi_ordered_row_t));
+      d->aux_freefunc = &free_dither_ordered;
+      setup_ordered_strips(d, (stpi_ordered_row_t *) d->aux_data);
+    }
+  rowdata = (stpi_ordered_row_t *) d->aux_data;
+  if (! one_bit_only && ! rowdata->channels_initialized &&
       (d->stpi_dither_type & (D_ORDERED_SEGMENTED | D_ORDERED_NEW)))
-    init_dither_ordered(d, v);
+    {
+      init_dither_ordered(d, v);
+      rowdata->channels_initialized = 1;
+    }
 
-  if (one_bit_only)
+  if (rowdata->use_strips &&
+      (one_bit_only || (!(d->stpi_dither_type & D_ORDERED_SEGMENTED) &&
+			(one_level_only ||
+			 !(d->stpi_dither_type == D_ORDERED_NEW)))))
+    dither_ordered_strips(d, rowdata, raw, length, one_bit_only, mask);
+  else if (one_bit_only)
     {
       for (x = 0; x < d->dst_width; x ++)
 	{
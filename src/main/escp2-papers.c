@@ -49,7 +49,7 @@ stp_escp2_load_media_sizes(const stp_vars_t *v, const char *name)
       const char *dn = (const char *) stp_list_item_get_data(item);
       char *ffn = stpi_path_merge(dn, name);
       stp_mxml_node_t *sizes =
-	stp_mxmlLoadFromFile(NULL, ffn, STP_MXML_NO_CALLBACK);
+	stpi_xml_load_file(ffn);
       stp_free(ffn);
       if (sizes)
 	{
@@ -110,7 +110,7 @@ stp_escp2_load_media(const stp_vars_t *v, const char *name)
       const char *dn = (const char *) stp_list_item_get_data(item);
       char *ffn = stpi_path_merge(dn, name);
       stp_mxml_node_t *media =
-	stp_mxmlLoadFromFile(NULL, ffn, STP_MXML_NO_CALLBACK);
+	stpi_xml_load_file(ffn);
       stp_free(ffn);
       if (media)
 	{
@@ -335,7 +335,7 @@ stp_escp2_load_input_slots(const stp_vars_t *v, const char *name)
       const char *dn = (const char *) stp_list_item_get_data(item);
       char *ffn = stpi_path_merge(dn, name);
       stp_mxml_node_t *slots =
-	stp_mxmlLoadFromFile(NULL, ffn, STP_MXML_NO_CALLBACK);
+	stpi_xml_load_file(ffn);
       stp_free(ffn);
       if (slots)
 	{
@@ -57,6 +57,190 @@ extern void stpi_vars_print_error(const stp_vars_t *v, const char *prefix);
 #define BUFFER_FLAG_FLIP_X	0x1
 #define BUFFER_FLAG_FLIP_Y	0x2
 extern stp_image_t* stpi_buffer_image(stp_image_t* image, unsigned int flags);
+extern void *stpi_page_buffer_allocate(size_t size, int *mapped);
+extern void stpi_page_buffer_free(void *buf, size_t size, int mapped);
+extern size_t stpi_channel_get_output_size(const stp_vars_t *v);
+extern unsigned short *stpi_channel_alloc_row(const stp_vars_t *v);
+extern void stpi_channel_free_row(unsigned short *row);
+extern void stpi_channel_set_row(const stp_vars_t *v, unsigned short *row);
+extern stp_mxml_node_t *stpi_xml_load_file(const char *file);
+extern unsigned stpi_hash_string(const char *name);
+extern void stpi_weave_parameters_by_row_direct(const stp_vars_t *v, int row,
+						int vertical_subpass,
+						stp_weave_t *w);
+
+/*
+ * On-disk cache of data derived from the data files (cache.c).
+ */
+typedef struct
+{
+  const void *data;
+  size_t bytes;
+  void *map;
+  size_t map_bytes;
+} stpi_cache_entry_t;
+
+extern int stpi_cache_load(const char *kind, const char *key,
+			   const char *source, stpi_cache_entry_t *entry);
+extern void stpi_cache_release(stpi_cache_entry_t *entry);
+extern void stpi_cache_store(const char *kind, const char *key,
+			     const char *source, const void *data,
+			     size_t bytes);
+
+/*
+ * Process-wide cache of color lookup tables, keyed by the parameters
+ * they were computed from (lut-cache.c).
+ */
+typedef struct stpi_lut_cache_entry stpi_lut_cache_entry_t;
+
+typedef struct
+{
+  unsigned long hits;		/* Found in memory */
+  unsigned long disk_hits;	/* Loaded from the on-disk cache */
+  unsigned long misses;		/* Not found; computed by the caller */
+  unsigned long entries;	/* Entries held in memory */
+  unsigned long bytes;		/* ...and their total size */
+} stpi_lut_cache_stats_t;
+
+extern stpi_lut_cache_entry_t *stpi_lut_cache_find(const char *key);
+extern const void *stpi_lut_cache_get_data(const stpi_lut_cache_entry_t *entry,
+					   size_t *bytes);
+extern void stpi_lut_cache_release(stpi_lut_cache_entry_t *entry);
+extern void stpi_lut_cache_add(const char *key, void *data, size_t bytes);
+extern void stpi_lut_cache_get_stats(stpi_lut_cache_stats_t *stats);
+
+/*
+ * Cache of parameter descriptions (print-vars.c).
+ */
+typedef struct
+{
+  unsigned long hits;
+  unsigned long misses;		/* Described by the driver or a component */
+  unsigned long entries;
+} stpi_describe_cache_stats_t;
+
+extern void stpi_describe_uncacheable(void);
+extern void stpi_describe_cache_get_stats(stpi_describe_cache_stats_t *stats);
+
+/*
+ * Pool of worker threads (worker-pool.c).
+ */
+typedef struct stpi_worker_pool stpi_worker_pool_t;
+typedef void (*stpi_worker_func_t)(void *arg, int task);
+
+extern stpi_worker_pool_t *stpi_worker_pool_create(int threads);
+extern void stpi_worker_pool_destroy(stpi_worker_pool_t *pool);
+extern void stpi_worker_pool_run(stpi_worker_pool_t *pool, int ntasks,
+				 stpi_worker_func_t func, void *arg);
+extern void stpi_worker_pool_post(stpi_worker_pool_t *pool, int *counter,
+				  int value);
+extern int stpi_worker_pool_wait(stpi_worker_pool_t *pool, const int *counter,
+				 int value);
+
+/*
+ * Scratch memory for a job (arena.c).  stp_start_job() gives the job's
+ * vars an arena, which copies of them share, and stp_end_job() drops it.
+ * Blocks from stpi_arena_malloc() and stpi_arena_zalloc() must be
+ * released with stpi_arena_free(), and must not outlive every vars
+ * object that shares the arena.  A NULL arena allocates from the heap.
+ */
+typedef struct stpi_arena stpi_arena_t;
+
+typedef struct
+{
+  unsigned long allocations;	/* Blocks handed out */
+  unsigned long reused;		/* ...of which were freed earlier in the job */
+  unsigned long total_bytes;	/* Bytes requested over the job */
+  unsigned long peak_bytes;	/* Most bytes in use at once */
+  unsigned long reserved_bytes;	/* Bytes obtained from the heap */
+} stpi_arena_stats_t;
+
+extern stpi_arena_t *stpi_arena_create(void);
+extern stpi_arena_t *stpi_arena_ref(stpi_arena_t *arena);
+extern void stpi_arena_unref(stpi_arena_t *arena);
+extern void *stpi_arena_malloc(stpi_arena_t *arena, size_t size);
+extern void *stpi_arena_zalloc(stpi_arena_t *arena, size_t size);
+extern void stpi_arena_free(void *ptr);
+extern void stpi_arena_get_stats(const stpi_arena_t *arena,
+				 stpi_arena_stats_t *stats);
+extern void stpi_arena_start_job(const stp_vars_t *v);
+extern void stpi_arena_end_job(const stp_vars_t *v);
+extern stpi_arena_t *stpi_get_arena(const stp_vars_t *v);
+extern void stpi_set_arena(stp_vars_t *v, stpi_arena_t *arena);
+
+/*
+ * Buffering of the output of a job (print-util.c).  Each call into a
+ * driver is bracketed by stpi_output_buffer_begin() and
+ * stpi_output_buffer_end(); stpi_flush_output() writes out whatever is
+ * buffered so far.
+ */
+typedef struct stpi_output_buffer stpi_output_buffer_t;
+
+extern stpi_output_buffer_t *stpi_output_buffer_begin(const stp_vars_t *v);
+extern void stpi_output_buffer_end(const stp_vars_t *v,
+				   stpi_output_buffer_t *ob);
+extern void stpi_flush_output(const stp_vars_t *v);
+
+/*
+ * Append to a string from stp_asprintf(); unlike stp_catprintf(), the
+ * old string is freed (print-util.c).
+ */
+extern void stpi_catprintf(char **strp, const char *format, ...)
+       __attribute__((format(__printf__, 2, 3)));
+
+/*
+ * Per-stage statistics for the print pipeline (print-stats.c).  Wrap a
+ * stage with
+ *
+ *   unsigned long long stats_start = STPI_STATS_BEGIN();
+ *   ...
+ *   STPI_STATS_END(STPI_STATS_COLOR, stats_start, bytes);
+ *
+ * which costs one test of a global when statistics are off.
+ */
+typedef enum
+{
+  STPI_STATS_PRINT,
+  STPI_STATS_COLOR,
+  STPI_STATS_DITHER,
+  STPI_STATS_WEAVE,
+  STPI_STATS_PACK,
+  STPI_STATS_OUTPUT,
+  STPI_STATS_WRITE,
+  STPI_STATS_STAGES
+} stpi_stats_stage_t;
+
+extern int stpi_stats_active;
+extern unsigned long long stpi_stats_clock(void);
+extern void stpi_stats_record(stpi_stats_stage_t stage,
+			      unsigned long long start, size_t bytes);
+extern void stpi_stats_start_job(const stp_vars_t *v);
+extern void stpi_stats_end_job(const stp_vars_t *v);
+extern void stpi_stats_start_page(unsigned long long start);
+extern long stpi_peak_rss_kb(void);
+
+#define STPI_STATS_BEGIN() (stpi_stats_active ? stpi_stats_clock() : 0)
+#define STPI_STATS_END(stage, start, bytes)			\
+do								\
+  {								\
+    if (start)							\
+      stpi_stats_record((stage), (start), (bytes));		\
+  } while (0)
+
+/*
+ * Vectorized kernels are compiled with per-function target attributes
+ * and selected at run time from the features the CPU reports.
+ */
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) && \
+  (defined(__i386__) || defined(__x86_64__))
+#define STPI_X86_SIMD 1
+#define STPI_TARGET(isa) __attribute__((target(isa)))
+#endif
+#define STPI_CPU_SSE2		0x1
+#define STPI_CPU_AVX2		0x2
+#define STPI_CPU_BMI2		0x4	/* Only where PDEP and PEXT are fast */
+extern unsigned stpi_cpu_features(void);
+extern unsigned stpi_set_cpu_features(unsigned features);
 
 #define STPI_ASSERT(x,v)						\
 do									\
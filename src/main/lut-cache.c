@@ -0,0 +1,269 @@
+/*
+ * "$Id$"
+ *
+ *   Process-wide cache of color lookup tables for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * The color module computes its curves from the job's color parameters
+ * at the start of every job.  Jobs with the same settings get the same
+ * curves, so the module stores them here, flattened into a block of
+ * memory, under a key naming every parameter they depend on.
+ *
+ * The most recently used STP_LUT_CACHE_SIZE entries (default
+ * LUT_CACHE_DEFAULT_SIZE; 0 turns the cache off) are kept in memory.
+ * If STP_LUT_CACHE_DISK is set, entries are also written to the on-disk
+ * cache (see cache.c) so that later processes can load them.  Entries
+ * are reference counted, so one dropped from the cache while a job is
+ * still reading it stays around until the job releases it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#define LUT_CACHE_KIND		"lut"
+#define LUT_CACHE_DEFAULT_SIZE	8
+
+struct stpi_lut_cache_entry
+{
+  struct stpi_lut_cache_entry *next;
+  unsigned hash;
+  char *key;
+  void *data;
+  size_t bytes;
+  int refcount;			/* Including the cache's own reference */
+};
+
+static stpi_lut_cache_entry_t *lut_cache = NULL; /* Most recently used first */
+static stpi_lut_cache_stats_t lut_cache_stats;
+static int lut_cache_size = -1;
+static int lut_cache_disk = 0;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t lut_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LUT_CACHE_LOCK() pthread_mutex_lock(&lut_cache_lock)
+#define LUT_CACHE_UNLOCK() pthread_mutex_unlock(&lut_cache_lock)
+#else
+#define LUT_CACHE_LOCK() do { } while (0)
+#define LUT_CACHE_UNLOCK() do { } while (0)
+#endif
+
+/* Called with the cache locked */
+static void
+check_environment(void)
+{
+  if (lut_cache_size < 0)
+    {
+      const char *size = getenv("STP_LUT_CACHE_SIZE");
+      lut_cache_size = size ? atoi(size) : LUT_CACHE_DEFAULT_SIZE;
+      if (lut_cache_size < 0)
+	lut_cache_size = 0;
+      lut_cache_disk = getenv("STP_LUT_CACHE_DISK") != NULL;
+    }
+}
+
+static void
+unref_entry(stpi_lut_cache_entry_t *entry)
+{
+  if (--entry->refcount > 0)
+    return;
+  stp_free(entry->key);
+  stp_free(entry->data);
+  stp_free(entry);
+}
+
+/*
+ * Insert a new entry at the front, dropping the least recently used
+ * ones beyond the size limit.  Called with the cache locked.
+ */
+static stpi_lut_cache_entry_t *
+insert_entry(const char *key, unsigned hash, void *data, size_t bytes)
+{
+  stpi_lut_cache_entry_t *entry = stp_zalloc(sizeof(stpi_lut_cache_entry_t));
+  stpi_lut_cache_entry_t **link = &(entry->next);
+  int count = 1;
+
+  entry->hash = hash;
+  entry->key = stp_strdup(key);
+  entry->data = data;
+  entry->bytes = bytes;
+  entry->refcount = 1;
+  entry->next = lut_cache;
+  lut_cache = entry;
+  lut_cache_stats.entries++;
+  lut_cache_stats.bytes += bytes;
+  while (*link)
+    {
+      stpi_lut_cache_entry_t *old = *link;
+      if (count < lut_cache_size)
+	{
+	  count++;
+	  link = &(old->next);
+	  continue;
+	}
+      *link = old->next;
+      lut_cache_stats.entries--;
+      lut_cache_stats.bytes -= old->bytes;
+      unref_entry(old);
+    }
+  return entry;
+}
+
+/* Called with the cache locked */
+static stpi_lut_cache_entry_t *
+find_entry(const char *key, unsigned hash)
+{
+  stpi_lut_cache_entry_t **link;
+  for (link = &lut_cache; *link; link = &((*link)->next))
+    {
+      stpi_lut_cache_entry_t *entry = *link;
+      if (entry->hash == hash && strcmp(entry->key, key) == 0)
+	{
+	  *link = entry->next;
+	  entry->next = lut_cache;
+	  lut_cache = entry;
+	  return entry;
+	}
+    }
+  return NULL;
+}
+
+/*
+ * Look up the tables stored under key.  Returns NULL, and counts a miss,
+ * if there are none; the caller is expected to compute them and hand
+ * them to stpi_lut_cache_add().  A non-NULL entry must be released with
+ * stpi_lut_cache_release().
+ */
+stpi_lut_cache_entry_t *
+stpi_lut_cache_find(const char *key)
+{
+  unsigned hash = stpi_hash_string(key);
+  stpi_lut_cache_entry_t *entry;
+  stpi_cache_entry_t disk_entry;
+
+  LUT_CACHE_LOCK();
+  check_environment();
+  if (lut_cache_size == 0)
+    {
+      lut_cache_stats.misses++;
+      LUT_CACHE_UNLOCK();
+      return NULL;
+    }
+  entry = find_entry(key, hash);
+  if (entry)
+    {
+      entry->refcount++;
+      lut_cache_stats.hits++;
+      LUT_CACHE_UNLOCK();
+      return entry;
+    }
+  if (!lut_cache_disk)
+    {
+      lut_cache_stats.misses++;
+      LUT_CACHE_UNLOCK();
+      return NULL;
+    }
+  LUT_CACHE_UNLOCK();
+
+  if (!stpi_cache_load(LUT_CACHE_KIND, key, NULL, &disk_entry))
+    {
+      LUT_CACHE_LOCK();
+      lut_cache_stats.misses++;
+      LUT_CACHE_UNLOCK();
+      return NULL;
+    }
+
+  LUT_CACHE_LOCK();
+  /* Another thread may have loaded it meanwhile */
+  entry = find_entry(key, hash);
+  if (!entry)
+    {
+      void *data = stp_malloc(disk_entry.bytes);
+      memcpy(data, disk_entry.data, disk_entry.bytes);
+      entry = insert_entry(key, hash, data, disk_entry.bytes);
+    }
+  entry->refcount++;
+  lut_cache_stats.disk_hits++;
+  LUT_CACHE_UNLOCK();
+  stpi_cache_release(&disk_entry);
+  return entry;
+}
+
+const void *
+stpi_lut_cache_get_data(const stpi_lut_cache_entry_t *entry, size_t *bytes)
+{
+  *bytes = entry->bytes;
+  return entry->data;
+}
+
+void
+stpi_lut_cache_release(stpi_lut_cache_entry_t *entry)
+{
+  if (!entry)
+    return;
+  LUT_CACHE_LOCK();
+  unref_entry(entry);
+  LUT_CACHE_UNLOCK();
+}
+
+/*
+ * Store the tables computed for key.  The cache takes over data, which
+ * must have come from stp_malloc().
+ */
+void
+stpi_lut_cache_add(const char *key, void *data, size_t bytes)
+{
+  unsigned hash = stpi_hash_string(key);
+  stpi_lut_cache_entry_t *entry = NULL;
+
+  LUT_CACHE_LOCK();
+  check_environment();
+  if (lut_cache_size > 0 && !find_entry(key, hash))
+    {
+      entry = insert_entry(key, hash, data, bytes);
+      /* Keep it while it's written out, in case another job drops it */
+      if (lut_cache_disk)
+	entry->refcount++;
+      else
+	entry = NULL;
+    }
+  else
+    stp_free(data);
+  LUT_CACHE_UNLOCK();
+  if (entry)
+    {
+      stpi_cache_store(LUT_CACHE_KIND, key, NULL, entry->data, entry->bytes);
+      stpi_lut_cache_release(entry);
+    }
+}
+
+void
+stpi_lut_cache_get_stats(stpi_lut_cache_stats_t *stats)
+{
+  LUT_CACHE_LOCK();
+  *stats = lut_cache_stats;
+  LUT_CACHE_UNLOCK();
+}
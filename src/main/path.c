@@ -171,6 +171,56 @@ stpi_list_files_on_data_path(const char *name)
   return file_list;
 }
 
+/*
+ * Directory for caches of data derived from the data path, creating it
+ * if need be.  STP_CACHE_DIR overrides the default of
+ * $XDG_CACHE_HOME/gutenprint or ~/.cache/gutenprint; setting it to an
+ * empty string disables caching.  Returns NULL if there's no usable
+ * directory.
+ */
+char *
+stpi_cache_dir(void)
+{
+  const char *dir = getenv("STP_CACHE_DIR");
+  char *answer;
+  struct stat st;
+
+  if (dir)
+    {
+      if (!*dir)
+	return NULL;
+      answer = stp_strdup(dir);
+    }
+  else if ((dir = getenv("XDG_CACHE_HOME")) != NULL && *dir)
+    answer = stpi_path_merge(dir, "gutenprint");
+  else if ((dir = getenv("HOME")) != NULL && *dir)
+    {
+      char *parent = stpi_path_merge(dir, ".cache");
+      (void) mkdir(parent, 0700);
+      answer = stpi_path_merge(parent, "gutenprint");
+      stp_free(parent);
+    }
+  else
+    return NULL;
+
+  if (mkdir(answer, 0700) != 0 && errno != EEXIST)
+    {
+      stp_deprintf(STP_DBG_PATH, "stp-path: cannot create cache %s: %s\n",
+		   answer, strerror(errno));
+      stp_free(answer);
+      return NULL;
+    }
+  /* Don't trust a cache somebody else can write into */
+  if (stat(answer, &st) != 0 || !S_ISDIR(st.st_mode) ||
+      st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+      stp_deprintf(STP_DBG_PATH, "stp-path: not using cache %s\n", answer);
+      stp_free(answer);
+      return NULL;
+    }
+  return answer;
+}
+
 /*
  * Join a path and filename together.
  */
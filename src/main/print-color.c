@@ -844,11 +844,11 @@ copy_lut(void *vlut)
   stp_curve_cache_copy(&(dest->sat_map), &(src->sat_map));
   /* Don't copy gray_tmp */
   /* Don't copy cmy_tmp */
+  /* Don't copy plan; it points into the source's curves */
+  dest->arena = src->arena;
   if (src->in_data)
-    {
-      dest->in_data = stp_malloc(src->image_width * src->in_channels);
-      memset(dest->in_data, 0, src->image_width * src->in_channels);
-    }
+    dest->in_data = stpi_arena_zalloc(dest->arena,
+				      src->image_width * src->in_channels);
   return dest;
 }
 
@@ -863,9 +863,9 @@ free_lut(void *vlut)
   stp_curve_free_curve_cache(&(lut->hue_map));
   stp_curve_free_curve_cache(&(lut->lum_map));
   stp_curve_free_curve_cache(&(lut->sat_map));
-  STP_SAFE_FREE(lut->gray_tmp);
-  STP_SAFE_FREE(lut->cmy_tmp);
-  STP_SAFE_FREE(lut->in_data);
+  stpi_arena_free(lut->gray_tmp);
+  stpi_arena_free(lut->cmy_tmp);
+  stpi_arena_free(lut->in_data);
   memset(lut, 0, sizeof(lut_t));
   stp_free(lut);
 }
@@ -1388,44 +1388,23 @@ stpi_dump_lut_to_file(stp_vars_t *v, const char *dump_file)
     }
 }
 
+static int
+lut_needs_gcr_curve(const lut_t *lut)
+{
+  return (((lut->output_color_description->channels & CMASK_CMYK) ==
+	   CMASK_CMYK) &&
+	  (lut->color_correction->correction == COLOR_CORRECTION_DESATURATED ||
+	   lut->input_color_description->color_id == COLOR_ID_GRAY ||
+	   lut->input_color_description->color_id == COLOR_ID_WHITE ||
+	   lut->input_color_description->color_id == COLOR_ID_RGB ||
+	   lut->input_color_description->color_id == COLOR_ID_CMY));
+}
+
 static void
-stpi_compute_lut(stp_vars_t *v)
+compute_lut_curves(stp_vars_t *v, lut_t *lut)
 {
   int i;
-  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
   stp_curve_t *curve;
-  stp_dprintf(STP_DBG_LUT, v, "stpi_compute_lut\n");
-
-  if (lut->input_color_description->color_model == COLOR_UNKNOWN ||
-      lut->output_color_description->color_model == COLOR_UNKNOWN ||
-      lut->input_color_description->color_model ==
-      lut->output_color_description->color_model)
-    lut->invert_output = 0;
-  else
-    lut->invert_output = 1;
-
-  lut->linear_contrast_adjustment = 0;
-  lut->print_gamma = 1.0;
-  lut->app_gamma = 1.0;
-  lut->contrast = 1.0;
-  lut->brightness = 1.0;
-  lut->simple_gamma_correction = 0;
-
-  if (stp_check_boolean_parameter(v, "LinearContrast", STP_PARAMETER_DEFAULTED))
-    lut->linear_contrast_adjustment =
-      stp_get_boolean_parameter(v, "LinearContrast");
-  if (stp_check_float_parameter(v, "Gamma", STP_PARAMETER_DEFAULTED))
-    lut->print_gamma = stp_get_float_parameter(v, "Gamma");
-  if (stp_check_float_parameter(v, "Contrast", STP_PARAMETER_DEFAULTED))
-    lut->contrast = stp_get_float_parameter(v, "Contrast");
-  if (stp_check_float_parameter(v, "Brightness", STP_PARAMETER_DEFAULTED))
-    lut->brightness = stp_get_float_parameter(v, "Brightness");
-
-  if (stp_check_float_parameter(v, "AppGamma", STP_PARAMETER_ACTIVE))
-    lut->app_gamma = stp_get_float_parameter(v, "AppGamma");
-  if (stp_check_boolean_parameter(v, "SimpleGamma", STP_PARAMETER_ACTIVE))
-    lut->simple_gamma_correction = stp_get_boolean_parameter(v, "SimpleGamma");
-  lut->screen_gamma = lut->app_gamma / 4.0; /* "Empirical" */
   curve = stp_curve_create_copy(color_curve_bounds);
   stp_curve_rescale(curve, 65535.0, STP_CURVE_COMPOSE_MULTIPLY,
 		    STP_CURVE_BOUNDS_RESCALE);
@@ -1469,11 +1448,6 @@ stpi_compute_lut(stp_vars_t *v)
 	}
     }
 
-  stp_dprintf(STP_DBG_LUT, v, " print_gamma %.3f\n", lut->print_gamma);
-  stp_dprintf(STP_DBG_LUT, v, " contrast %.3f\n", lut->contrast);
-  stp_dprintf(STP_DBG_LUT, v, " brightness %.3f\n", lut->brightness);
-  stp_dprintf(STP_DBG_LUT, v, " screen_gamma %.3f\n", lut->screen_gamma);
-
   for (i = 0; i < STP_CHANNEL_LIMIT; i++)
     {
       if (lut->output_color_description->channel_count < 1 &&
@@ -1483,13 +1457,325 @@ stpi_compute_lut(stp_vars_t *v)
 	       lut->output_color_description->channels & (1 << i))
 	setup_channel(v, i, &(channel_params[i]));
     }
-  if (((lut->output_color_description->channels & CMASK_CMYK) == CMASK_CMYK) &&
-      (lut->color_correction->correction == COLOR_CORRECTION_DESATURATED ||
-       lut->input_color_description->color_id == COLOR_ID_GRAY ||
-       lut->input_color_description->color_id == COLOR_ID_WHITE ||
-       lut->input_color_description->color_id == COLOR_ID_RGB ||
-       lut->input_color_description->color_id == COLOR_ID_CMY))
+  if (lut_needs_gcr_curve(lut))
     initialize_gcr_curve(v);
+}
+
+/*
+ * The curves computed by compute_lut_curves() depend only on the color
+ * parameters and the input and output color descriptions, so they're
+ * kept in the LUT cache (see lut-cache.c) for later jobs with the same
+ * settings.  The key names all of them.  An entry is a
+ * lut_cache_header_t followed by each of the lut's curves, in
+ * get_lut_curves() order, and then the GCR curve if the job needs one;
+ * each curve is a lut_cache_curve_t followed by its points.
+ */
+#define LUT_CACHE_VERSION	1
+#define LUT_CACHE_CURVES	(6 + STP_CHANNEL_LIMIT)
+
+typedef struct
+{
+  unsigned version;
+  unsigned curve_count;
+  double gamma_values[STP_CHANNEL_LIMIT];
+} lut_cache_header_t;
+
+typedef struct
+{
+  int present;
+  int wrap_mode;
+  int interpolation_type;
+  int unused;
+  double low;
+  double high;
+  unsigned long long count;
+} lut_cache_curve_t;
+
+static void
+get_lut_curves(lut_t *lut, stp_cached_curve_t **curves)
+{
+  int i;
+  curves[0] = &(lut->user_color_correction);
+  curves[1] = &(lut->brightness_correction);
+  curves[2] = &(lut->contrast_correction);
+  curves[3] = &(lut->hue_map);
+  curves[4] = &(lut->lum_map);
+  curves[5] = &(lut->sat_map);
+  for (i = 0; i < STP_CHANNEL_LIMIT; i++)
+    curves[6 + i] = &(lut->channel_curves[i]);
+}
+
+static char *
+lut_cache_key(const stp_vars_t *v, const lut_t *lut)
+{
+  char *key;
+  int i;
+  stp_asprintf(&key, "%u %s %s %s %d", lut->steps,
+	       lut->input_color_description->name,
+	       lut->output_color_description->name,
+	       lut->color_correction->name, lut->out_channels);
+  for (i = 0; i < float_parameter_count; i++)
+    {
+      const char *name = float_parameters[i].param.name;
+      switch (float_parameters[i].param.p_type)
+	{
+	case STP_PARAMETER_TYPE_DOUBLE:
+	  if (stp_check_float_parameter(v, name, STP_PARAMETER_INACTIVE))
+	    stpi_catprintf(&key, " %s/%d=%.17g", name,
+			   stp_get_float_parameter_active(v, name),
+			   stp_get_float_parameter(v, name));
+	  break;
+	case STP_PARAMETER_TYPE_INT:
+	  if (stp_check_int_parameter(v, name, STP_PARAMETER_INACTIVE))
+	    stpi_catprintf(&key, " %s/%d=%d", name,
+			   stp_get_int_parameter_active(v, name),
+			   stp_get_int_parameter(v, name));
+	  break;
+	case STP_PARAMETER_TYPE_BOOLEAN:
+	  if (stp_check_boolean_parameter(v, name, STP_PARAMETER_INACTIVE))
+	    stpi_catprintf(&key, " %s/%d=%d", name,
+			   stp_get_boolean_parameter_active(v, name),
+			   stp_get_boolean_parameter(v, name));
+	  break;
+	case STP_PARAMETER_TYPE_STRING_LIST:
+	  if (stp_check_string_parameter(v, name, STP_PARAMETER_INACTIVE))
+	    stpi_catprintf(&key, " %s/%d=%s", name,
+			   stp_get_string_parameter_active(v, name),
+			   stp_get_string_parameter(v, name));
+	  break;
+	default:
+	  break;
+	}
+    }
+  for (i = 0; i < curve_parameter_count; i++)
+    {
+      const char *name = curve_parameters[i].param.name;
+      if (stp_check_curve_parameter(v, name, STP_PARAMETER_INACTIVE))
+	{
+	  char *curve =
+	    stp_curve_write_string(stp_get_curve_parameter(v, name));
+	  stpi_catprintf(&key, " %s/%d=%s", name,
+			 stp_get_curve_parameter_active(v, name), curve);
+	  stp_free(curve);
+	}
+    }
+  return key;
+}
+
+/*
+ * Flatten a curve into out, if it isn't NULL, and return the number of
+ * bytes it takes, or 0 if it can't be stored.
+ */
+static size_t
+flatten_curve(const stp_curve_t *curve, char *out)
+{
+  lut_cache_curve_t header;
+  const double *data = NULL;
+  size_t count = 0;
+
+  memset(&header, 0, sizeof(lut_cache_curve_t));
+  if (curve)
+    {
+      if (stp_curve_get_gamma(curve) != 0 ||
+	  (data = stp_curve_get_data(curve, &count)) == NULL)
+	return 0;
+      header.present = 1;
+      header.wrap_mode = stp_curve_get_wrap(curve);
+      header.interpolation_type = stp_curve_get_interpolation_type(curve);
+      stp_curve_get_bounds(curve, &(header.low), &(header.high));
+      header.count = count;
+    }
+  if (out)
+    {
+      memcpy(out, &header, sizeof(lut_cache_curve_t));
+      if (count)
+	memcpy(out + sizeof(lut_cache_curve_t), data, count * sizeof(double));
+    }
+  return sizeof(lut_cache_curve_t) + count * sizeof(double);
+}
+
+/*
+ * Rebuild a curve flattened at *in, which may be NULL if the curve was
+ * absent, and advance *in past it.  Returns 0 if the data is bad.
+ */
+static int
+unflatten_curve(const char **in, const char *end, stp_curve_t **curve)
+{
+  lut_cache_curve_t header;
+  *curve = NULL;
+  if (end - *in < sizeof(lut_cache_curve_t))
+    return 0;
+  memcpy(&header, *in, sizeof(lut_cache_curve_t));
+  *in += sizeof(lut_cache_curve_t);
+  if (!header.present)
+    return 1;
+  if ((end - *in) / sizeof(double) < header.count)
+    return 0;
+  *curve = stp_curve_create(header.wrap_mode);
+  if (!*curve ||
+      !stp_curve_set_bounds(*curve, header.low, header.high) ||
+      !stp_curve_set_interpolation_type(*curve, header.interpolation_type) ||
+      !stp_curve_set_data(*curve, header.count, (const double *) *in))
+    {
+      if (*curve)
+	stp_curve_destroy(*curve);
+      *curve = NULL;
+      return 0;
+    }
+  *in += header.count * sizeof(double);
+  return 1;
+}
+
+static void
+store_lut_curves(stp_vars_t *v, lut_t *lut, const char *key)
+{
+  stp_cached_curve_t *curves[LUT_CACHE_CURVES];
+  const stp_curve_t *gcr_curve = NULL;
+  lut_cache_header_t header;
+  size_t bytes = sizeof(lut_cache_header_t);
+  size_t curve_bytes;
+  char *data;
+  char *out;
+  int i;
+
+  get_lut_curves(lut, curves);
+  memset(&header, 0, sizeof(lut_cache_header_t));
+  header.version = LUT_CACHE_VERSION;
+  header.curve_count = LUT_CACHE_CURVES;
+  for (i = 0; i < STP_CHANNEL_LIMIT; i++)
+    header.gamma_values[i] = lut->gamma_values[i];
+  if (lut_needs_gcr_curve(lut))
+    {
+      gcr_curve = stp_channel_get_gcr_curve(v);
+      header.curve_count++;
+    }
+  for (i = 0; i < LUT_CACHE_CURVES; i++)
+    {
+      if (!(curve_bytes =
+	    flatten_curve(stp_curve_cache_get_curve(curves[i]), NULL)))
+	return;
+      bytes += curve_bytes;
+    }
+  if (header.curve_count > LUT_CACHE_CURVES)
+    {
+      if (!(curve_bytes = flatten_curve(gcr_curve, NULL)))
+	return;
+      bytes += curve_bytes;
+    }
+
+  data = stp_malloc(bytes);
+  memcpy(data, &header, sizeof(lut_cache_header_t));
+  out = data + sizeof(lut_cache_header_t);
+  for (i = 0; i < LUT_CACHE_CURVES; i++)
+    out += flatten_curve(stp_curve_cache_get_curve(curves[i]), out);
+  if (header.curve_count > LUT_CACHE_CURVES)
+    out += flatten_curve(gcr_curve, out);
+  stpi_lut_cache_add(key, data, bytes);
+}
+
+static int
+load_lut_curves(stp_vars_t *v, lut_t *lut, const stpi_lut_cache_entry_t *entry)
+{
+  stp_cached_curve_t *curves[LUT_CACHE_CURVES];
+  stp_curve_t *loaded[LUT_CACHE_CURVES + 1];
+  lut_cache_header_t header;
+  size_t bytes;
+  const char *in = stpi_lut_cache_get_data(entry, &bytes);
+  const char *end = in + bytes;
+  unsigned expected_count = LUT_CACHE_CURVES + lut_needs_gcr_curve(lut);
+  int i;
+
+  if (bytes < sizeof(lut_cache_header_t))
+    return 0;
+  memcpy(&header, in, sizeof(lut_cache_header_t));
+  in += sizeof(lut_cache_header_t);
+  if (header.version != LUT_CACHE_VERSION ||
+      header.curve_count != expected_count)
+    return 0;
+  for (i = 0; i < expected_count; i++)
+    if (!unflatten_curve(&in, end, &(loaded[i])))
+      {
+	while (i-- > 0)
+	  if (loaded[i])
+	    stp_curve_destroy(loaded[i]);
+	return 0;
+      }
+
+  get_lut_curves(lut, curves);
+  for (i = 0; i < LUT_CACHE_CURVES; i++)
+    {
+      if (loaded[i])
+	stp_curve_cache_set_curve(curves[i], loaded[i]);
+      else
+	stp_curve_free_curve_cache(curves[i]);
+    }
+  for (i = 0; i < STP_CHANNEL_LIMIT; i++)
+    lut->gamma_values[i] = header.gamma_values[i];
+  if (expected_count > LUT_CACHE_CURVES)
+    {
+      stp_channel_set_gcr_curve(v, loaded[LUT_CACHE_CURVES]);
+      if (loaded[LUT_CACHE_CURVES])
+	stp_curve_destroy(loaded[LUT_CACHE_CURVES]);
+    }
+  return 1;
+}
+
+static void
+stpi_compute_lut(stp_vars_t *v)
+{
+  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
+  stpi_lut_cache_entry_t *entry;
+  char *key;
+  stp_dprintf(STP_DBG_LUT, v, "stpi_compute_lut\n");
+
+  if (lut->input_color_description->color_model == COLOR_UNKNOWN ||
+      lut->output_color_description->color_model == COLOR_UNKNOWN ||
+      lut->input_color_description->color_model ==
+      lut->output_color_description->color_model)
+    lut->invert_output = 0;
+  else
+    lut->invert_output = 1;
+
+  lut->linear_contrast_adjustment = 0;
+  lut->print_gamma = 1.0;
+  lut->app_gamma = 1.0;
+  lut->contrast = 1.0;
+  lut->brightness = 1.0;
+  lut->simple_gamma_correction = 0;
+
+  if (stp_check_boolean_parameter(v, "LinearContrast", STP_PARAMETER_DEFAULTED))
+    lut->linear_contrast_adjustment =
+      stp_get_boolean_parameter(v, "LinearContrast");
+  if (stp_check_float_parameter(v, "Gamma", STP_PARAMETER_DEFAULTED))
+    lut->print_gamma = stp_get_float_parameter(v, "Gamma");
+  if (stp_check_float_parameter(v, "Contrast", STP_PARAMETER_DEFAULTED))
+    lut->contrast = stp_get_float_parameter(v, "Contrast");
+  if (stp_check_float_parameter(v, "Brightness", STP_PARAMETER_DEFAULTED))
+    lut->brightness = stp_get_float_parameter(v, "Brightness");
+
+  if (stp_check_float_parameter(v, "AppGamma", STP_PARAMETER_ACTIVE))
+    lut->app_gamma = stp_get_float_parameter(v, "AppGamma");
+  if (stp_check_boolean_parameter(v, "SimpleGamma", STP_PARAMETER_ACTIVE))
+    lut->simple_gamma_correction = stp_get_boolean_parameter(v, "SimpleGamma");
+  lut->screen_gamma = lut->app_gamma / 4.0; /* "Empirical" */
+
+  stp_dprintf(STP_DBG_LUT, v, " print_gamma %.3f\n", lut->print_gamma);
+  stp_dprintf(STP_DBG_LUT, v, " contrast %.3f\n", lut->contrast);
+  stp_dprintf(STP_DBG_LUT, v, " brightness %.3f\n", lut->brightness);
+  stp_dprintf(STP_DBG_LUT, v, " screen_gamma %.3f\n", lut->screen_gamma);
+
+  key = lut_cache_key(v, lut);
+  entry = stpi_lut_cache_find(key);
+  if (entry && load_lut_curves(v, lut, entry))
+    stp_dprintf(STP_DBG_LUT, v, " curves from cache\n");
+  else
+    {
+      compute_lut_curves(v, lut);
+      store_lut_curves(v, lut, key);
+    }
+  stpi_lut_cache_release(entry);
+  stp_free(key);
+
   if (stp_check_file_parameter(v, "LUTDumpFile", STP_PARAMETER_ACTIVE))
     stpi_dump_lut_to_file(v, stp_get_file_parameter(v, "LUTDumpFile"));
 }
@@ -1561,11 +1847,13 @@ stpi_color_traditional_init(stp_vars_t *v,
        (lut->output_color_description->default_correction));
 
   stpi_compute_lut(v);
+  stpi_color_compile_plan(v, lut);
 
   lut->image_width = stp_image_width(image);
   total_channel_bits = lut->in_channels * lut->channel_depth;
-  lut->in_data = stp_malloc(((lut->image_width * total_channel_bits) + 7)/8);
-  memset(lut->in_data, 0, ((lut->image_width * total_channel_bits) + 7) / 8);
+  lut->arena = stpi_get_arena(v);
+  lut->in_data = stpi_arena_zalloc
+    (lut->arena, ((lut->image_width * total_channel_bits) + 7) / 8);
   return lut->out_channels;
 }
 
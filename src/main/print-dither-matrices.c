@@ -33,6 +33,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #include "dither-impl.h"
 
 #ifdef __GNUC__
@@ -620,14 +623,122 @@ xml_doc_get_dither_array(stp_mxml_node_t *doc, int x, int y)
   return stpi_dither_array_create_from_xmltree(xmlseq, x, y);
 }
 
+/*
+ * Converted dither matrices are kept in the on-disk cache, so that
+ * neither the matrix nor the file's aspect ratio needs to be parsed
+ * again.  An entry is a dither_cache_header_t followed by the matrix
+ * values.
+ */
+#define DITHER_CACHE_KIND "dither1"
+
+typedef struct
+{
+  int x_aspect;
+  int y_aspect;
+  int x_size;
+  int y_size;
+  double lower;
+  double upper;
+} dither_cache_header_t;
+
+static void
+stpi_dither_array_store(const char *file, int x, int y,
+			const stp_array_t *array)
+{
+  const stp_sequence_t *seq = stp_array_get_sequence(array);
+  dither_cache_header_t header;
+  const double *data;
+  size_t count;
+  size_t bytes;
+  char *buf;
+
+  header.x_aspect = x;
+  header.y_aspect = y;
+  stp_array_get_size(array, &(header.x_size), &(header.y_size));
+  stp_sequence_get_bounds(seq, &(header.lower), &(header.upper));
+  stp_sequence_get_data(seq, &count, &data);
+  if (count != (size_t) header.x_size * header.y_size)
+    return;
+  bytes = sizeof(header) + count * sizeof(double);
+  buf = stp_malloc(bytes);
+  memcpy(buf, &header, sizeof(header));
+  memcpy(buf + sizeof(header), data, count * sizeof(double));
+  stpi_cache_store(DITHER_CACHE_KIND, file, file, buf, bytes);
+  stp_free(buf);
+}
+
+/*
+ * Register the dither matrix in file from the cache, as parsing the file
+ * would.  Returns 0 if there's no valid cache entry for the file.
+ */
+static int
+stpi_dither_array_load(const char *file)
+{
+  stpi_cache_entry_t entry;
+  dither_cache_header_t header;
+  stp_xml_dither_cache_t *cachedval;
+  stp_array_t *array;
+
+  if (!stpi_cache_load(DITHER_CACHE_KIND, file, file, &entry))
+    return 0;
+  if (entry.bytes < sizeof(header))
+    {
+      stpi_cache_release(&entry);
+      return 0;
+    }
+  memcpy(&header, entry.data, sizeof(header));
+  if (header.x_aspect <= 0 || header.y_aspect <= 0 ||
+      header.x_size <= 0 || header.y_size <= 0 ||
+      entry.bytes != (sizeof(header) + (size_t) header.x_size *
+		      header.y_size * sizeof(double)))
+    {
+      stpi_cache_release(&entry);
+      return 0;
+    }
+  array = stp_array_create(header.x_size, header.y_size);
+  stp_sequence_set_bounds
+    ((stp_sequence_t *) stpi_cast_safe(stp_array_get_sequence(array)),
+     header.lower, header.upper);
+  stp_array_set_data(array, (const double *)
+		     ((const char *) entry.data + sizeof(header)));
+  stpi_cache_release(&entry);
+
+  stp_xml_dither_cache_set(header.x_aspect, header.y_aspect, file);
+  cachedval = stp_xml_dither_cache_get(header.x_aspect, header.y_aspect);
+  if (!cachedval->dither_array && strcmp(cachedval->filename, file) == 0)
+    cachedval->dither_array = array;
+  else
+    stp_array_destroy(array);
+  return 1;
+}
+
+/*
+ * Register the dither matrices in every file with the given name on the
+ * data path, in order.  Returns 0 as soon as a file isn't in the cache.
+ */
+static int
+stpi_dither_arrays_load(const char *name)
+{
+  stp_list_t *file_list = stpi_list_files_on_data_path(name);
+  stp_list_item_t *item = stp_list_get_start(file_list);
+  int status = item != NULL;
+  while (item && status)
+    {
+      status = stpi_dither_array_load
+	((const char *) stp_list_item_get_data(item));
+      item = stp_list_item_next(item);
+    }
+  stp_list_destroy(file_list);
+  return status;
+}
+
 static stp_array_t *
 stpi_dither_array_create_from_file(const char* file, int x, int y)
 {
   stp_mxml_node_t *doc;
   stp_array_t *ret = NULL;
 
-  FILE *fp = fopen(file, "r");
-  if (!fp)
+  if (access(file, R_OK) != 0)
     {
       stp_erprintf("stp_curve_create_from_file: unable to open %s: %s\n",
 		   file, strerror(errno));
@@ -639,13 +750,14 @@ stpi_dither_array_create_from_file(const char* file, int x, int y)
   stp_deprintf(STP_DBG_XML,
 	       "stpi_dither_array_create_from_file: reading `%s'...\n", file);
 
-  doc = stp_mxmlLoadFile(NULL, fp, STP_MXML_NO_CALLBACK);
-  (void) fclose(fp);
+  doc = stpi_xml_load_file(file);
 
   if (doc)
     {
       ret = xml_doc_get_dither_array(doc, x, y);
       stp_mxmlDelete(doc);
+      if (ret)
+	stpi_dither_array_store(file, x, y, ret);
     }
 
   stp_xml_exit();
@@ -668,12 +780,15 @@ stp_xml_get_dither_array(int x, int y)
     {
       char buf[1024];
       (void) sprintf(buf, "dither-matrix-%dx%d.xml", x, y);
-      stp_xml_parse_file_named(buf);
+      if (!stpi_dither_arrays_load(buf))
+	stp_xml_parse_file_named(buf);
       cachedval = stp_xml_dither_cache_get(x, y);
       if (cachedval == NULL || cachedval->filename == NULL)
 	{
 	  return NULL;
 	}
+      if (cachedval->dither_array)
+	return stp_array_create_copy(cachedval->dither_array);
     }
 
   ret = stpi_dither_array_create_from_file(cachedval->filename, x, y);
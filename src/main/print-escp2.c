@@ -35,6 +35,9 @@
 #include <string.h>
 #include <math.h>
 #include <limits.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include "print-escp2.h"
 
 #ifdef __GNUC__
@@ -1016,6 +1019,17 @@ static const int_param_t int_parameters[] =
       STP_PARAMETER_LEVEL_ADVANCED3, 0, 1, STP_CHANNEL_NONE, 1, 0
     }, 0, 255, 0
   },
+  {
+    {
+      "Threads", N_("Rendering Threads"), "Color=No,Category=Advanced Printer Functionality",
+      N_("Number of threads used to render the page.  With more than one "
+	 "thread, color conversion, dithering and output run concurrently, "
+	 "and error diffusion and EvenTone dither several channels at once; "
+	 "the output is identical."),
+      STP_PARAMETER_TYPE_INT, STP_PARAMETER_CLASS_FEATURE,
+      STP_PARAMETER_LEVEL_ADVANCED4, 0, 1, STP_CHANNEL_NONE, 1, 0
+    }, 1, 64, 1
+  },
 };
 
 static const int int_parameter_count =
@@ -2804,6 +2818,14 @@ escp2_parameters(const stp_vars_t *v, const char *name,
     {
       description->is_active = 1;
     }
+  else if (strcmp(name, "Threads") == 0)
+    {
+#ifdef HAVE_PTHREAD_H
+      description->is_active = 1;
+#else
+      description->is_active = 0;
+#endif
+    }
 }
 
 const res_t *
@@ -3714,6 +3736,9 @@ setup_misc(stp_vars_t *v)
   pd->input_slot = stp_escp2_get_input_slot(v);
   pd->paper_type = stp_escp2_get_media_type(v, 0);
   pd->ink_group = escp2_inkgroup(v);
+  pd->threads = 1;
+  if (stp_check_int_parameter(v, "Threads", STP_PARAMETER_ACTIVE))
+    pd->threads = stp_get_int_parameter(v, "Threads");
   pd->media_settings = stp_vars_create_copy(pd->paper_type->v);
   stp_escp2_set_media_size(pd->media_settings, v);
   if (stp_check_float_parameter(v, "PageDryTime", STP_PARAMETER_ACTIVE))
@@ -3753,8 +3778,10 @@ allocate_channels(stp_vars_t *v, int line_length)
   int i, j, k;
   int channel_id = 0;
   int split_id = 0;
+  stpi_arena_t *arena = stpi_get_arena(v);
 
-  pd->cols = stp_zalloc(sizeof(unsigned char *) * pd->channels_in_use);
+  pd->cols = stpi_arena_zalloc(arena,
+			       sizeof(unsigned char *) * pd->channels_in_use);
   pd->channels =
     stp_zalloc(sizeof(physical_subchannel_t *) * pd->channels_in_use);
   if (pd->split_channel_count)
@@ -3769,7 +3796,7 @@ allocate_channels(stp_vars_t *v, int line_length)
 	  for (j = 0; j < channel->n_subchannels; j++)
 	    {
 	      const physical_subchannel_t *sc = &(channel->subchannels[j]);
-	      pd->cols[channel_id] = stp_zalloc(line_length);
+	      pd->cols[channel_id] = stpi_arena_zalloc(arena, line_length);
 	      pd->channels[channel_id] = sc;
 	      stp_dither_add_channel(v, pd->cols[channel_id], i, j);
 	      if (pd->split_channel_count)
@@ -3789,7 +3816,7 @@ allocate_channels(stp_vars_t *v, int line_length)
 	  for (j = 0; j < channel->n_subchannels; j++)
 	    {
 	      const physical_subchannel_t *sc = &(channel->subchannels[j]);
-	      pd->cols[channel_id] = stp_zalloc(line_length);
+	      pd->cols[channel_id] = stpi_arena_zalloc(arena, line_length);
 	      pd->channels[channel_id] = sc;
 	      stp_dither_add_channel(v, pd->cols[channel_id],
 				     i + pd->logical_channels, j);
@@ -4267,6 +4294,300 @@ set_mask(unsigned char *cd_mask, int x_center, int scaled_x_where,
     }
 }
 
+static void
+fill_cd_mask(const escp2_privdata_t *pd, unsigned char *cd_mask, int y)
+{
+  int x_center = pd->cd_x_offset * pd->res->printed_hres / pd->micro_units;
+  int y_distance_from_center =
+    pd->cd_outer_radius -
+    ((y + pd->cd_y_offset) * pd->micro_units / pd->res->printed_vres);
+  if (y_distance_from_center < 0)
+    y_distance_from_center = -y_distance_from_center;
+  memset(cd_mask, 0, (pd->image_printed_width + 7) / 8);
+  if (y_distance_from_center < pd->cd_outer_radius)
+    {
+      double outer_r_sq =
+	(double) pd->cd_outer_radius * (double) pd->cd_outer_radius;
+      double inner_r_sq =
+	(double) pd->cd_inner_radius * (double) pd->cd_inner_radius;
+      double y_sq = (double) y_distance_from_center *
+	(double) y_distance_from_center;
+      int x_where = sqrt(outer_r_sq - y_sq) + .5;
+      int scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
+      set_mask(cd_mask, x_center, scaled_x_where,
+	       pd->image_printed_width, 1, 0);
+      if (y_distance_from_center < pd->cd_inner_radius)
+	{
+	  x_where = sqrt(inner_r_sq - y_sq) + .5;
+	  scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
+	  set_mask(cd_mask, x_center, scaled_x_where,
+		   pd->image_printed_width, 1, 1);
+	}
+    }
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Pipelined rendering.  Color conversion runs ahead on a worker thread,
+ * writing straight into a ring of row buffers that the dither stage
+ * reads; with three or more threads, dithering runs on a second worker.
+ * Weaving and output always stay on the calling thread, so the output
+ * function is never called from a worker.  Every stage handles the rows
+ * strictly in order, so the output is identical to that of the serial
+ * loop.
+ */
+
+#define PIPELINE_DEPTH 8
+
+typedef struct
+{
+  int duplicate_line;
+  unsigned zero_mask;
+  unsigned short *data;		/* Color converted row */
+  unsigned char **cols;		/* Dithered row (threaded dither only) */
+} pipeline_row_t;
+
+typedef struct
+{
+  stp_vars_t *v;
+  stp_image_t *image;
+  pipeline_row_t rows[PIPELINE_DEPTH];
+  size_t row_size;		/* Bytes of color converted data per row */
+  int line_width;		/* Bytes of dithered data per channel */
+  int limit;			/* Rows that will be produced */
+  int colored;			/* Rows color converted */
+  int dithered;			/* Rows dithered */
+  int written;			/* Rows passed to the weave */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} pipeline_t;
+
+static void
+pipeline_advance(pipeline_t *pl, int *counter)
+{
+  pthread_mutex_lock(&(pl->lock));
+  (*counter)++;
+  pthread_cond_broadcast(&(pl->cond));
+  pthread_mutex_unlock(&(pl->lock));
+}
+
+/*
+ * Wait until row y is available in the stage feeding *counter.  Returns
+ * 0 if the pipeline was cut short before reaching row y.
+ */
+static int
+pipeline_wait_for_row(pipeline_t *pl, const int *counter, int y)
+{
+  int ret;
+  pthread_mutex_lock(&(pl->lock));
+  while (y >= *counter && y < pl->limit)
+    pthread_cond_wait(&(pl->cond), &(pl->lock));
+  ret = y < *counter;
+  pthread_mutex_unlock(&(pl->lock));
+  return ret;
+}
+
+static void *
+pipeline_color_thread(void *arg)
+{
+  pipeline_t *pl = (pipeline_t *) arg;
+  stp_vars_t *v = pl->v;
+  escp2_privdata_t *pd = get_privdata(v);
+  int errdiv  = stp_image_height(pl->image) / pd->image_printed_height;
+  int errmod  = stp_image_height(pl->image) % pd->image_printed_height;
+  int errval  = 0;
+  int errlast = -1;
+  int errline  = 0;
+  unsigned zero_mask = 0;
+  int y, i;
+
+  for (y = 0; y < pd->image_printed_height; y++)
+    {
+      pipeline_row_t *row = &(pl->rows[y % PIPELINE_DEPTH]);
+      pthread_mutex_lock(&(pl->lock));
+      while (y - pl->written >= PIPELINE_DEPTH)
+	pthread_cond_wait(&(pl->cond), &(pl->lock));
+      pthread_mutex_unlock(&(pl->lock));
+
+      row->duplicate_line = 1;
+      if (errline != errlast)
+	{
+	  errlast = errline;
+	  row->duplicate_line = 0;
+	  /* Convert straight into the buffer the dither stage will read */
+	  if (row->data)
+	    stpi_channel_set_row(v, row->data);
+	  if (stp_color_get_row(v, pl->image, errline, &zero_mask))
+	    {
+	      stpi_channel_set_row(v, NULL);
+	      pthread_mutex_lock(&(pl->lock));
+	      pl->limit = y;
+	      pthread_cond_broadcast(&(pl->cond));
+	      pthread_mutex_unlock(&(pl->lock));
+	      return NULL;
+	    }
+	}
+      else
+	memcpy(row->data, pl->rows[(y - 1) % PIPELINE_DEPTH].data,
+	       pl->row_size);
+      /*
+       * The channels are only set up by the first stp_color_get_row,
+       * so the row buffers can't be allocated until then, and the first
+       * row has to be copied out of the channel's own buffer.
+       */
+      if (!row->data)
+	{
+	  pl->row_size =
+	    stpi_channel_get_output_size(v) * sizeof(unsigned short);
+	  for (i = 0; i < PIPELINE_DEPTH; i++)
+	    pl->rows[i].data = stpi_channel_alloc_row(v);
+	  memcpy(row->data, stp_channel_get_output(v), pl->row_size);
+	}
+      row->zero_mask = zero_mask;
+      pipeline_advance(pl, &(pl->colored));
+
+      errval += errmod;
+      errline += errdiv;
+      if (errval >= pd->image_printed_height)
+	{
+	  errval -= pd->image_printed_height;
+	  errline ++;
+	}
+    }
+  stpi_channel_set_row(v, NULL);
+  return NULL;
+}
+
+static void
+pipeline_dither_row(pipeline_t *pl, int y, unsigned char *cd_mask)
+{
+  stp_vars_t *v = pl->v;
+  escp2_privdata_t *pd = get_privdata(v);
+  pipeline_row_t *row = &(pl->rows[y % PIPELINE_DEPTH]);
+  if (cd_mask)
+    fill_cd_mask(pd, cd_mask, y);
+  stp_dither_internal(v, y, row->data, row->duplicate_line, row->zero_mask,
+		      cd_mask);
+}
+
+static void *
+pipeline_dither_thread(void *arg)
+{
+  pipeline_t *pl = (pipeline_t *) arg;
+  escp2_privdata_t *pd = get_privdata(pl->v);
+  unsigned char *cd_mask = NULL;
+  int y, i;
+  if (pd->cd_outer_radius > 0)
+    cd_mask = stp_malloc(1 + (pd->image_printed_width + 7) / 8);
+  for (y = 0; pipeline_wait_for_row(pl, &(pl->colored), y); y++)
+    {
+      pipeline_row_t *row = &(pl->rows[y % PIPELINE_DEPTH]);
+      pipeline_dither_row(pl, y, cd_mask);
+      for (i = 0; i < pd->channels_in_use; i++)
+	memcpy(row->cols[i], pd->cols[i], pl->line_width);
+      pipeline_advance(pl, &(pl->dithered));
+    }
+  if (cd_mask)
+    stp_free(cd_mask);
+  return NULL;
+}
+
+static int
+escp2_print_data_pipelined(stp_vars_t *v, stp_image_t *image, int *status)
+{
+  escp2_privdata_t *pd = get_privdata(v);
+  pipeline_t pl;
+  pthread_t color_thread;
+  pthread_t dither_thread;
+  int threaded_dither = pd->threads > 2;
+  unsigned char *cd_mask = NULL;
+  int y, i, j;
+
+  pl.v = v;
+  pl.image = image;
+  pl.row_size = 0;
+  pl.line_width = (pd->image_printed_width + 7) / 8 * pd->bitwidth;
+  pl.limit = pd->image_printed_height;
+  pl.colored = 0;
+  pl.dithered = 0;
+  pl.written = 0;
+  for (i = 0; i < PIPELINE_DEPTH; i++)
+    {
+      pl.rows[i].data = NULL;
+      pl.rows[i].cols = NULL;
+      if (threaded_dither)
+	{
+	  pl.rows[i].cols =
+	    stp_zalloc(sizeof(unsigned char *) * pd->channels_in_use);
+	  for (j = 0; j < pd->channels_in_use; j++)
+	    pl.rows[i].cols[j] = stp_zalloc(pl.line_width);
+	}
+    }
+  pthread_mutex_init(&(pl.lock), NULL);
+  pthread_cond_init(&(pl.cond), NULL);
+
+  if (pthread_create(&color_thread, NULL, pipeline_color_thread, &pl) != 0)
+    {
+      stp_dprintf(STP_DBG_ESCP2, v,
+		  "escp2: cannot start color thread, printing serially\n");
+      pthread_cond_destroy(&(pl.cond));
+      pthread_mutex_destroy(&(pl.lock));
+      for (i = 0; i < PIPELINE_DEPTH; i++)
+	{
+	  if (pl.rows[i].cols)
+	    {
+	      for (j = 0; j < pd->channels_in_use; j++)
+		stp_free(pl.rows[i].cols[j]);
+	      stp_free(pl.rows[i].cols);
+	    }
+	}
+      return 0;
+    }
+  if (threaded_dither &&
+      pthread_create(&dither_thread, NULL, pipeline_dither_thread, &pl) != 0)
+    threaded_dither = 0;
+
+  if (threaded_dither)
+    {
+      for (y = 0; pipeline_wait_for_row(&pl, &(pl.dithered), y); y++)
+	{
+	  stp_write_weave(v, pl.rows[y % PIPELINE_DEPTH].cols);
+	  pipeline_advance(&pl, &(pl.written));
+	}
+      pthread_join(dither_thread, NULL);
+    }
+  else
+    {
+      if (pd->cd_outer_radius > 0)
+	cd_mask = stp_malloc(1 + (pd->image_printed_width + 7) / 8);
+      for (y = 0; pipeline_wait_for_row(&pl, &(pl.colored), y); y++)
+	{
+	  pipeline_dither_row(&pl, y, cd_mask);
+	  stp_write_weave(v, pd->cols);
+	  pipeline_advance(&pl, &(pl.written));
+	}
+      if (cd_mask)
+	stp_free(cd_mask);
+    }
+  pthread_join(color_thread, NULL);
+
+  *status = (pl.limit < pd->image_printed_height) ? 2 : 1;
+  pthread_cond_destroy(&(pl.cond));
+  pthread_mutex_destroy(&(pl.lock));
+  for (i = 0; i < PIPELINE_DEPTH; i++)
+    {
+      stpi_channel_free_row(pl.rows[i].data);
+      if (pl.rows[i].cols)
+	{
+	  for (j = 0; j < pd->channels_in_use; j++)
+	    stp_free(pl.rows[i].cols[j]);
+	  stp_free(pl.rows[i].cols);
+	}
+    }
+  return 1;
+}
+#endif /* HAVE_PTHREAD_H */
+
 static int
 escp2_print_data(stp_vars_t *v, stp_image_t *image)
 {
@@ -4277,16 +4598,18 @@ escp2_print_data(stp_vars_t *v, stp_image_t *image)
   int errlast = -1;
   int errline  = 0;
   int y;
-  double outer_r_sq = 0;
-  double inner_r_sq = 0;
-  int x_center = pd->cd_x_offset * pd->res->printed_hres / pd->micro_units;
   unsigned char *cd_mask = NULL;
-  if (pd->cd_outer_radius > 0)
+
+#ifdef HAVE_PTHREAD_H
+  if (pd->threads > 1)
     {
-      cd_mask = stp_malloc(1 + (pd->image_printed_width + 7) / 8);
-      outer_r_sq = (double) pd->cd_outer_radius * (double) pd->cd_outer_radius;
-      inner_r_sq = (double) pd->cd_inner_radius * (double) pd->cd_inner_radius;
+      int status;
+      if (escp2_print_data_pipelined(v, image, &status))
+	return status;
     }
+#endif
+  if (pd->cd_outer_radius > 0)
+    cd_mask = stp_malloc(1 + (pd->image_printed_width + 7) / 8);
 
   for (y = 0; y < pd->image_printed_height; y ++)
     {
@@ -4302,30 +4625,7 @@ escp2_print_data(stp_vars_t *v, stp_image_t *image)
 	}
 
       if (cd_mask)
-	{
-	  int y_distance_from_center =
-	    pd->cd_outer_radius -
-	    ((y + pd->cd_y_offset) * pd->micro_units / pd->res->printed_vres);
-	  if (y_distance_from_center < 0)
-	    y_distance_from_center = -y_distance_from_center;
-	  memset(cd_mask, 0, (pd->image_printed_width + 7) / 8);
-	  if (y_distance_from_center < pd->cd_outer_radius)
-	    {
-	      double y_sq = (double) y_distance_from_center *
-		(double) y_distance_from_center;
-	      int x_where = sqrt(outer_r_sq - y_sq) + .5;
-	      int scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
-	      set_mask(cd_mask, x_center, scaled_x_where,
-		       pd->image_printed_width, 1, 0);
-	      if (y_distance_from_center < pd->cd_inner_radius)
-		{
-		  x_where = sqrt(inner_r_sq - y_sq) + .5;
-		  scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
-		  set_mask(cd_mask, x_center, scaled_x_where,
-			   pd->image_printed_width, 1, 1);
-		}
-	    }
-	}
+	fill_cd_mask(pd, cd_mask, y);
 
       stp_dither(v, y, duplicate_line, zero_mask, cd_mask);
 
@@ -4495,8 +4795,8 @@ escp2_do_print(stp_vars_t *v, stp_image_t *image, int print_op)
     {
       for (i = 0; i < pd->channels_in_use; i++)
 	if (pd->cols[i])
-	  stp_free(pd->cols[i]);
-      stp_free(pd->cols);
+	  stpi_arena_free(pd->cols[i]);
+      stpi_arena_free(pd->cols);
     }
   if (pd->media_settings)
     stp_vars_destroy(pd->media_settings);
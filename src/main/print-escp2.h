@@ -556,6 +556,7 @@ typedef struct
   int bidirectional_upper_limit; /* Max total resolution for auto-bidi */
   int duplex;
   int extra_vertical_feed;	/* Extra vertical feed */
+  int threads;			/* Rendering threads (1 = serial) */
 
   /* weave parameters */
   int horizontal_passes;	/* Number of horizontal passes required
@@ -44,8 +44,16 @@ struct stp_list_item
   void *data;			/*!< Data		*/
   struct stp_list_item *prev;	/*!< Previous node	*/
   struct stp_list_item *next;	/*!< Next node		*/
+  struct stp_list *list;	/*!< Owning list	*/
 };
 
+/** A slot in the name index. */
+typedef struct
+{
+  unsigned hash;		/*!< Hash of the node name	*/
+  struct stp_list_item *node;	/*!< Node, or NULL if empty	*/
+} name_slot_t;
+
 /** The internal representation of an stp_list_t list. */
 struct stp_list
 {
@@ -53,54 +61,195 @@ struct stp_list
   struct stp_list_item *start;			/*!< Start node				*/
   struct stp_list_item *end;			/*!< End node				*/
   struct stp_list_item *index_cache_node;	/*!< Cached node (for index)		*/
+  char index_cache_busy;			/*!< Index cache claimed by a lookup	*/
   int length;					/*!< Number of nodes			*/
   stp_node_freefunc freefunc;			/*!< Callback to free node data		*/
   stp_node_copyfunc copyfunc;			/*!< Callback to copy node		*/
   stp_node_namefunc namefunc;			/*!< Callback to get node name		*/
   stp_node_namefunc long_namefunc;		/*!< Callback to get node long name	*/
   stp_node_sortfunc sortfunc;			/*!< Callback to compare (sort) nodes	*/
-  char *name_cache;				/*!< Cached name			*/
   struct stp_list_item *name_cache_node;	/*!< Cached node (for name)		*/
-  char *long_name_cache;			/*!< Cached long name			*/
   struct stp_list_item *long_name_cache_node;	/*!< Cached node (for long name)	*/
+  name_slot_t *name_index;			/*!< Open addressed name index		*/
+  int name_index_size;				/*!< Slots in name index (power of 2)	*/
+  int name_index_disabled;			/*!< Duplicate names; don't index	*/
 };
 
+/*
+ * Lookups update the caches of a list they otherwise only read, and
+ * several threads may look things up in the same list at once (the
+ * threaded print pipeline does, and stp_vars_t copies share their
+ * parameter lists).  The name caches hold only a node pointer, read and
+ * written atomically; a cache hit is confirmed by comparing against the
+ * node's own name, so a lookup only ever sees a valid node or NULL.
+ * The index cache is a pair of an index and a node, so a lookup must
+ * claim it before using it; one that can't just walks the list.
+ * Without atomic operations lookups leave the caches alone.  Lists must
+ * still not be modified while they are being read.
+ */
+#ifdef __ATOMIC_RELAXED
+#define CACHE_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define CACHE_STORE(field, value) \
+  __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define INDEX_CACHE_CLAIM(list) \
+  (!__atomic_test_and_set(&((list)->index_cache_busy), __ATOMIC_ACQUIRE))
+#define INDEX_CACHE_RELEASE(list) \
+  __atomic_clear(&((list)->index_cache_busy), __ATOMIC_RELEASE)
+#else
+#define CACHE_LOAD(field) (field)
+#define CACHE_STORE(field, value) do { } while (0)
+#define INDEX_CACHE_CLAIM(list) 0
+#define INDEX_CACHE_RELEASE(list) do { } while (0)
+#endif
+
 /**
  * Cache a list node by its short name.
  * @param list the list to use.
- * @param name the short name.
  * @param cache the node to cache.
  */
-static void
-set_name_cache(stp_list_t *list,
-	       const char *name,
-	       stp_list_item_t *cache)
+static inline void
+set_name_cache(stp_list_t *list, stp_list_item_t *cache)
 {
-  if (list->name_cache)
-    stp_free(list->name_cache);
-  list->name_cache = NULL;
-  if (name)
-    list->name_cache = stp_strdup(name);
-  list->name_cache_node = cache;
+  CACHE_STORE(list->name_cache_node, cache);
 }
 
 /**
  * Cache a list node by its long name.
  * @param list the list to use.
- * @param long_name the long name.
  * @param cache the node to cache.
  */
+static inline void
+set_long_name_cache(stp_list_t *list, stp_list_item_t *cache)
+{
+  CACHE_STORE(list->long_name_cache_node, cache);
+}
+
+/*
+ * Lists with a name function and more than a handful of items keep an
+ * open addressed (linear probing) hash index of their nodes by name.
+ * The parameter lists in stp_vars_t are the main beneficiary: drivers
+ * and color converters look parameters up by name on every row.  The
+ * index is maintained as nodes are added and removed, so lookups never
+ * modify the list.  The key is the node's own name, so no copies are
+ * made.  A name can only map to one node, so a list that acquires two
+ * nodes with the same name stops using the index and falls back to
+ * searching in list order.
+ */
+#define NAME_INDEX_MIN_LENGTH 8
+
+unsigned
+stpi_hash_string(const char *name)
+{
+  /* FNV-1a */
+  unsigned hash = 2166136261u;
+  while (*name)
+    {
+      hash ^= (unsigned char) *name++;
+      hash *= 16777619u;
+    }
+  return hash;
+}
+
 static void
-set_long_name_cache(stp_list_t *list,
-		    const char *long_name,
-		    stp_list_item_t *cache)
+name_index_free(stp_list_t *list)
+{
+  if (list->name_index)
+    stp_free(list->name_index);
+  list->name_index = NULL;
+  list->name_index_size = 0;
+}
+
+static name_slot_t *
+name_index_find(const stp_list_t *list, const char *name, unsigned hash)
 {
-  if (list->long_name_cache)
-    stp_free(list->long_name_cache);
-  list->long_name_cache = NULL;
-  if (long_name)
-    list->long_name_cache = stp_strdup(long_name);
-  list->long_name_cache_node = cache;
+  unsigned mask = list->name_index_size - 1;
+  unsigned i = hash & mask;
+  while (list->name_index[i].node)
+    {
+      if (list->name_index[i].hash == hash &&
+	  strcmp(name, list->namefunc(list->name_index[i].node->data)) == 0)
+	return &(list->name_index[i]);
+      i = (i + 1) & mask;
+    }
+  return &(list->name_index[i]);
+}
+
+/* Returns 0 if the node was added, 1 if its name is already indexed */
+static int
+name_index_add(stp_list_t *list, stp_list_item_t *node)
+{
+  const char *name = list->namefunc(node->data);
+  unsigned hash = stpi_hash_string(name);
+  name_slot_t *slot = name_index_find(list, name, hash);
+  if (slot->node)
+    return 1;
+  slot->hash = hash;
+  slot->node = node;
+  return 0;
+}
+
+static void
+name_index_remove(stp_list_t *list, stp_list_item_t *node)
+{
+  unsigned mask = list->name_index_size - 1;
+  name_slot_t *slot =
+    name_index_find(list, list->namefunc(node->data),
+		    stpi_hash_string(list->namefunc(node->data)));
+  unsigned i, j;
+  if (slot->node != node)
+    return;
+  /* Backward shift deletion keeps every probe sequence unbroken */
+  i = slot - list->name_index;
+  j = i;
+  for (;;)
+    {
+      unsigned home;
+      list->name_index[i].node = NULL;
+      do
+	{
+	  j = (j + 1) & mask;
+	  if (!list->name_index[j].node)
+	    return;
+	  home = list->name_index[j].hash & mask;
+	}
+      while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+      list->name_index[i] = list->name_index[j];
+      i = j;
+    }
+}
+
+/*
+ * (Re)build the index from scratch, leaving it at most half full.  If
+ * two nodes share a name, indexing is disabled until the name function
+ * is changed.
+ */
+static void
+name_index_build(stp_list_t *list)
+{
+  stp_list_item_t *node;
+  int size = 16;
+  name_index_free(list);
+  if (!list->namefunc || list->name_index_disabled ||
+      list->length < NAME_INDEX_MIN_LENGTH)
+    return;
+  while (size < list->length * 4)
+    size *= 2;
+  list->name_index = stp_zalloc(sizeof(name_slot_t) * size);
+  list->name_index_size = size;
+  for (node = list->start; node; node = node->next)
+    {
+      const char *name = list->namefunc(node->data);
+      unsigned hash = stpi_hash_string(name);
+      name_slot_t *slot = name_index_find(list, name, hash);
+      if (slot->node)
+	{
+	  name_index_free(list);
+	  list->name_index_disabled = 1;
+	  return;
+	}
+      slot->hash = hash;
+      slot->node = node;
+    }
 }
 
 /**
@@ -112,8 +261,8 @@ clear_cache(stp_list_t *list)
 {
   list->index_cache = 0;
   list->index_cache_node = NULL;
-  set_name_cache(list, NULL, NULL);
-  set_long_name_cache(list, NULL, NULL);
+  list->name_cache_node = NULL;
+  list->long_name_cache_node = NULL;
 }
 
 void
@@ -143,15 +292,17 @@ stp_list_create(void)
   list->start = NULL;
   list->end = NULL;
   list->index_cache_node = NULL;
+  list->index_cache_busy = 0;
   list->freefunc = NULL;
   list->namefunc = NULL;
   list->long_namefunc = NULL;
   list->sortfunc = NULL;
   list->copyfunc = NULL;
-  list->name_cache = NULL;
   list->name_cache_node = NULL;
-  list->long_name_cache = NULL;
   list->long_name_cache_node = NULL;
+  list->name_index = NULL;
+  list->name_index_size = 0;
+  list->name_index_disabled = 0;
 
   stp_deprintf(STP_DBG_LIST, "stp_list_head constructor\n");
   return list;
@@ -195,6 +346,7 @@ stp_list_destroy(stp_list_t *list)
 
   check_list(list);
   clear_cache(list);
+  name_index_free(list);
   cur = list->start;
   while(cur)
     {
@@ -248,13 +400,16 @@ stp_list_get_item_by_index(const stp_list_t *list, int idx)
   int i; /* current index */
   int d = 0; /* direction of list traversal, 0=forward */
   int c = 0; /* use cache? */
+  int claimed;
   check_list(list);
 
   if (idx >= list->length)
     return NULL;
 
+  claimed = INDEX_CACHE_CLAIM(ulist);
+
   /* see if using the cache is worthwhile */
-  if (list->index_cache)
+  if (claimed && list->index_cache)
     {
       if (idx < (list->length/2))
 	{
@@ -312,8 +467,12 @@ stp_list_get_item_by_index(const stp_list_t *list, int idx)
     }
 
   /* update cache */
-  ulist->index_cache = i;
-  ulist->index_cache_node = node;
+  if (claimed)
+    {
+      ulist->index_cache = i;
+      CACHE_STORE(ulist->index_cache_node, node);
+      INDEX_CACHE_RELEASE(ulist);
+    }
 
   return node;
 }
@@ -349,43 +508,36 @@ stp_list_get_item_by_name(const stp_list_t *list, const char *name)
   if (!list->namefunc || !name)
     return NULL;
 
-  if (list->name_cache && list->name_cache_node)
+  if (list->name_index)
+    return name_index_find(list, name, stpi_hash_string(name))->node;
+
+  node = CACHE_LOAD(list->name_cache_node);
+  if (node)
     {
-      const char *new_name;
-      node = list->name_cache_node;
       /* Is this the item we've cached? */
-      if (strcmp(name, list->name_cache) == 0 &&
-	  strcmp(name, list->namefunc(node->data)) == 0)
+      if (strcmp(name, list->namefunc(node->data)) == 0)
 	return node;
 
       /* If not, check the next item in case we're searching the list */
       node = node->next;
-      if (node)
+      if (node && strcmp(name, list->namefunc(node->data)) == 0)
 	{
-	  new_name = list->namefunc(node->data);
-	  if (strcmp(name, new_name) == 0)
-	    {
-	      set_name_cache(ulist, new_name, node);
-	      return node;
-	    }
+	  set_name_cache(ulist, node);
+	  return node;
 	}
       /* If not, check the index cache */
-      node = list->index_cache_node;
-      if (node)
+      node = CACHE_LOAD(list->index_cache_node);
+      if (node && strcmp(name, list->namefunc(node->data)) == 0)
 	{
-	  new_name = list->namefunc(node->data);
-	  if (strcmp(name, new_name) == 0)
-	    {
-	      set_name_cache(ulist, new_name, node);
-	      return node;
-	    }
+	  set_name_cache(ulist, node);
+	  return node;
 	}
     }
 
   node = stp_list_get_item_by_name_internal(list, name);
 
   if (node)
-    set_name_cache(ulist, name, node);
+    set_name_cache(ulist, node);
 
   return node;
 }
@@ -423,43 +575,33 @@ stp_list_get_item_by_long_name(const stp_list_t *list, const char *long_name)
   if (!list->long_namefunc || !long_name)
     return NULL;
 
-  if (list->long_name_cache && list->long_name_cache_node)
+  node = CACHE_LOAD(list->long_name_cache_node);
+  if (node)
     {
-      const char *new_long_name;
-      node = list->long_name_cache_node;
       /* Is this the item we've cached? */
-      if (strcmp(long_name, list->long_name_cache) == 0 &&
-	  strcmp(long_name, list->long_namefunc(node->data)) == 0)
+      if (strcmp(long_name, list->long_namefunc(node->data)) == 0)
 	return node;
 
       /* If not, check the next item in case we're searching the list */
       node = node->next;
-      if (node)
+      if (node && strcmp(long_name, list->long_namefunc(node->data)) == 0)
 	{
-	  new_long_name = list->long_namefunc(node->data);
-	  if (strcmp(long_name, new_long_name) == 0)
-	    {
-	      set_long_name_cache(ulist, new_long_name, node);
-	      return node;
-	    }
+	  set_long_name_cache(ulist, node);
+	  return node;
 	}
       /* If not, check the index cache */
-      node = list->index_cache_node;
-      if (node)
+      node = CACHE_LOAD(list->index_cache_node);
+      if (node && strcmp(long_name, list->long_namefunc(node->data)) == 0)
 	{
-	  new_long_name = list->long_namefunc(node->data);
-	  if (strcmp(long_name, new_long_name) == 0)
-	    {
-	      set_long_name_cache(ulist, new_long_name, node);
-	      return node;
-	    }
+	  set_long_name_cache(ulist, node);
+	  return node;
 	}
     }
 
   node = stp_list_get_item_by_long_name_internal(list, long_name);
 
   if (node)
-    set_long_name_cache(ulist, long_name, node);
+    set_long_name_cache(ulist, node);
 
   return node;
 }
@@ -501,6 +643,8 @@ stp_list_set_namefunc(stp_list_t *list, stp_node_namefunc namefunc)
 {
   check_list(list);
   list->namefunc = namefunc;
+  list->name_index_disabled = 0;
+  name_index_build(list);
 }
 
 stp_node_namefunc
@@ -566,6 +710,7 @@ stp_list_item_create(stp_list_t *list,
 
   ln = stp_malloc(sizeof(stp_list_item_t));
   ln->prev = ln->next = NULL;
+  ln->list = list;
 
   if (data)
     ln->data = stpi_cast_safe(data);
@@ -646,6 +791,18 @@ stp_list_item_create(stp_list_t *list,
   /* increment reference count */
   list->length++;
 
+  /* keep the name index up to date */
+  if (list->namefunc && !list->name_index_disabled)
+    {
+      if (!list->name_index || list->length * 2 > list->name_index_size)
+	name_index_build(list);
+      else if (name_index_add(list, ln))
+	{
+	  name_index_free(list);
+	  list->name_index_disabled = 1;
+	}
+    }
+
   stp_deprintf(STP_DBG_LIST, "stp_list_node constructor\n");
   return 0;
 }
@@ -657,6 +814,8 @@ stp_list_item_destroy(stp_list_t *list, stp_list_item_t *item)
   check_list(list);
 
   clear_cache(list);
+  if (list->name_index)
+    name_index_remove(list, item);
   /* decrement reference count */
   list->length--;
 
@@ -703,7 +862,16 @@ stp_list_item_set_data(stp_list_item_t *item, void *data)
 {
   if (data)
     {
+      stp_list_t *list = item->list;
+      if (list->name_index)
+	name_index_remove(list, item);
       item->data = data;
+      if (list->name_index && name_index_add(list, item))
+	{
+	  name_index_free(list);
+	  list->name_index_disabled = 1;
+	}
+      clear_cache(list);
       return 0;
     }
   return 1; /* return error if data was NULL */
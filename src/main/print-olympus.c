@@ -37,6 +37,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <limits.h>
+#ifdef STPI_X86_SIMD
+#include <immintrin.h>
+#endif
 
 #ifdef __GNUC__
 #define inline __inline__
@@ -204,12 +207,17 @@ typedef struct {
   int plane_interlacing;
   int row_interlacing;
   unsigned char empty_byte[MAX_INK_CHANNELS];  /* one for each color plane */
-  unsigned short **image_data;
+  unsigned short *image_data;	/* The whole image, unless streaming */
+  size_t image_row_len;		/* Values in each row of image_data */
+  size_t image_bytes;
+  int image_mapped;		/* image_data is file backed */
+  int streaming;		/* Rows are converted as they are printed */
+  stp_image_t *image;
+  int image_row;		/* Row last converted when streaming */
   int outh_px, outw_px, outt_px, outb_px, outl_px, outr_px;
   int imgh_px, imgw_px;
   int prnh_px, prnw_px, prnt_px, prnb_px, prnl_px, prnr_px;
   int print_mode;	/* portrait or landscape */
-  int image_rows;
   int plane_lefttoright;
 } dyesub_print_vars_t;
 
@@ -5896,178 +5904,274 @@ dyesub_interpolate(int oldval, int oldsize, int newsize)
 }
 
 static void
-dyesub_free_image(dyesub_print_vars_t *pv, stp_image_t *image)
+dyesub_free_image(dyesub_print_vars_t *pv)
 {
-  unsigned short** image_data = pv->image_data;
-  int image_px_height = pv->image_rows;
-  int i;
-
-  for (i = 0; i< image_px_height; i++)
-    if (image_data[i])
-      stp_free(image_data[i]);
-  if (image_data)
-    stp_free(image_data);
+  stpi_page_buffer_free(pv->image_data, pv->image_bytes, pv->image_mapped);
+  pv->image_data = NULL;
 }
 
-static unsigned short **
+/*
+ * Portrait jobs that send all the inks of a row together are streamed:
+ * each image row is converted when it is first printed and printed
+ * straight from the channel's buffer, so only one row is held and
+ * output starts at once.  Rotated or plane interleaved jobs need the
+ * whole image, which is converted up front into a single buffer, held
+ * in a temporary file if it is larger than STP_IMAGE_BUFFER_MB (see
+ * buffer-image.c).  Returns 0 if the image can't be read.
+ */
+static int
 dyesub_read_image(stp_vars_t *v,
 		dyesub_print_vars_t *pv,
 		stp_image_t *image)
 {
   int image_px_width  = stp_image_width(image);
   int image_px_height = stp_image_height(image);
-  int row_size = image_px_width * pv->ink_channels * sizeof(short);
-  unsigned short **image_data;
   unsigned int zero_mask;
   int i;
 
-  image_data = stp_zalloc(image_px_height * sizeof(unsigned short *));
-  pv->image_rows = 0;
-  if (!image_data)
-    return NULL;	/* ? out of memory ? */
+  pv->image = image;
+  pv->image_row = -1;
+  pv->image_row_len = (size_t) image_px_width * pv->ink_channels;
+  pv->streaming = (pv->print_mode != DYESUB_LANDSCAPE &&
+		   !pv->plane_interlacing);
+  if (pv->streaming)
+    {
+      stp_deprintf(STP_DBG_DYESUB, "dyesub_read_image: streaming rows\n");
+      return 1;
+    }
+
+  pv->image_bytes =
+    pv->image_row_len * image_px_height * sizeof(unsigned short);
+  pv->image_data = stpi_page_buffer_allocate(pv->image_bytes,
+					     &(pv->image_mapped));
+  if (!pv->image_data)
+    return 0;	/* ? out of memory ? */
 
   for (i = 0; i < image_px_height; i++)
     {
+      unsigned short *row = pv->image_data + i * pv->image_row_len;
+      /* Once the channels are set up, convert straight into the buffer */
+      if (i > 0 && stpi_channel_get_output_size(v) == pv->image_row_len)
+	stpi_channel_set_row(v, row);
       if (stp_color_get_row(v, image, i, &zero_mask))
         {
 	  stp_deprintf(STP_DBG_DYESUB,
 	  	"dyesub_read_image: "
 		"stp_color_get_row(..., %d, ...) == 0\n", i);
-	  dyesub_free_image(pv, image);
-	  return NULL;
-	}	
-      image_data[i] = stp_malloc(row_size);
-      pv->image_rows = i+1;
-      if (!image_data[i])
-        {
+	  stpi_channel_set_row(v, NULL);
+	  dyesub_free_image(pv);
+	  return 0;
+	}
+      if (stp_channel_get_output(v) != row)
+	memcpy(row, stp_channel_get_output(v),
+	       pv->image_row_len * sizeof(unsigned short));
+    }
+  stpi_channel_set_row(v, NULL);
+  stp_deprintf(STP_DBG_DYESUB,
+	       "dyesub_read_image: %lu bytes in %s, peak RSS %ld kB\n",
+	       (unsigned long) pv->image_bytes,
+	       pv->image_mapped ? "temporary file" : "memory",
+	       stpi_peak_rss_kb());
+  return 1;
+}
+
+/*
+ * The converted data of an image row, or NULL if it can't be read.
+ */
+static const unsigned short *
+dyesub_image_row(stp_vars_t *v, dyesub_print_vars_t *pv, int row)
+{
+  unsigned int zero_mask;
+
+  if (!pv->streaming)
+    return pv->image_data + (size_t) row * pv->image_row_len;
+  if (row != pv->image_row)
+    {
+      if (stp_color_get_row(v, pv->image, row, &zero_mask))
+	{
 	  stp_deprintf(STP_DBG_DYESUB,
-	  	"dyesub_read_image: "
-		"(image_data[%d] = stp_malloc()) == NULL\n", i);
-	  dyesub_free_image(pv, image);
+		"dyesub_image_row: "
+		"stp_color_get_row(..., %d, ...) == 0\n", row);
 	  return NULL;
-	}	
-      memcpy(image_data[i], stp_channel_get_output(v), row_size);
+	}
+      pv->image_row = row;
     }
-  return image_data;
+  return stp_channel_get_output(v);
 }
 
-static int
-dyesub_print_pixel(stp_vars_t *v,
-		dyesub_print_vars_t *pv,
-		const dyesub_cap_t *caps,
-		int row,
-		int col,
-		int plane)
+/*
+ * Printed rows are produced a whole row at a time.  The image pixel for
+ * each output column is looked up once per plane; each row is gathered
+ * through that map into ink values in the order the printer wants them,
+ * converted to the printer's depth and byte order in one pass, and
+ * written with a single stp_zfwrite.
+ */
+typedef struct
 {
-  unsigned short ink[MAX_INK_CHANNELS], *out;
-  int i, j, b;
+  int *col_map;			/* Image pixel (portrait) or row (landscape) */
+  unsigned short *ink;		/* Ink values of one output row */
+  unsigned char *out;		/* The row as sent to the printer */
+} dyesub_row_t;
 
-  if (pv->print_mode == DYESUB_LANDSCAPE)
-    { /* "rotate" image */
-      dyesub_swap_ints(&col, &row);
-      row = (pv->imgw_px - 1) - row;
+static inline unsigned short
+dyesub_ink_value(const dyesub_print_vars_t *pv, int ycbcr,
+		 const unsigned short *out, int i)
+{
+  if (pv->out_channels == pv->ink_channels)
+    { /* copy out_channel (image) to equiv ink_channel (printer) */
+      if (ycbcr)
+	{
+	  /* Convert RGB -> YCbCr (JPEG YCbCr444 coefficients) */
+	  double R = out[0];
+	  double G = out[1];
+	  double B = out[2];
+	  switch (i)
+	    {
+	    case 0:
+	      return R *  0.29900 + G *  0.58700 + B *  0.11400;
+	    case 1:
+	      return R * -0.16874 + G * -0.33126 + B *  0.50000 + 32768;
+	    default:
+	      return R *  0.50000 + G * -0.41869 + B * -0.08131 + 32768;
+	    }
+	}
+      return out[i];
     }
+  else if (pv->out_channels < pv->ink_channels)
+    /* several ink_channels (printer) "share" same out_channel (image) */
+    return out[i * pv->out_channels / pv->ink_channels];
+  else /* (pv->out_channels > pv->ink_channels) */
+    { /* merge several out_channels (image) into ink_channel (printer) */
+      int avg = 0;
+      int j;
+      for (j = 0; j < pv->out_channels / pv->ink_channels; j++)
+	avg += out[j + i * pv->out_channels / pv->ink_channels];
+      return avg * pv->ink_channels / pv->out_channels;
+    }
+}
 
-  out = &(pv->image_data[row][col * pv->out_channels]);
-
-  for (i = 0; i < pv->ink_channels; i++)
+/*
+ * Downscale count 16 bit ink values to the output depth and byte order:
+ * 8 bit values are stored to out8, the others are converted in place.
+ * x / 257 is (x * 0xff01) >> 24 for every 16 bit x.
+ */
+#ifdef STPI_X86_SIMD
+STPI_TARGET("sse2") static int
+dyesub_convert_ink_sse2(const dyesub_print_vars_t *pv, unsigned short *ink,
+			unsigned char *out8, int count)
+{
+  const __m128i divisor = _mm_set1_epi16((short) 0xff01);
+  int i;
+  for (i = 0; i + 16 <= count; i += 16)
     {
-      if (pv->out_channels == pv->ink_channels)
-        { /* copy out_channel (image) to equiv ink_channel (printer) */
-		if (dyesub_feature(caps, DYESUB_FEATURE_RGBtoYCBCR)) {
-			/* Convert RGB -> YCbCr (JPEG YCbCr444 coefficients) */
-			double R, G, B;
-			double Y, Cr, Cb;
-			R = out[0];
-			G = out[1];
-			B = out[2];
-			
-			Y  = R *  0.29900 + G *  0.58700 + B *  0.11400;
-			Cb = R * -0.16874 + G * -0.33126 + B *  0.50000 + 32768;
-			Cr = R *  0.50000 + G * -0.41869 + B * -0.08131 + 32768;
-			
-			ink[0] = Y;
-			ink[1] = Cb;
-			ink[2] = Cr;
-
-			/* XXX this is sub-optimal; we compute the full YCbCr
-			   values and throw away 2/3 for each pixel printed
-			   if we are plane or row interleaved */
-		} else {
-			ink[i] = out[i];
-		}
-        }
-      else if (pv->out_channels < pv->ink_channels)
-        { /* several ink_channels (printer) "share" same out_channel (image) */
-          ink[i] = out[i * pv->out_channels / pv->ink_channels];
-        }
-      else /* (pv->out_channels > pv->ink_channels) */
-        { /* merge several out_channels (image) into ink_channel (printer) */
-          int avg = 0;
-          for (j = 0; j < pv->out_channels / pv->ink_channels; j++)
-            avg += out[j + i * pv->out_channels / pv->ink_channels];
-	  ink[i] = avg * pv->ink_channels / pv->out_channels;
+      __m128i a = _mm_loadu_si128((const __m128i *) (ink + i));
+      __m128i b = _mm_loadu_si128((const __m128i *) (ink + i + 8));
+      if (pv->bytes_per_ink_channel == 1)
+	{
+	  a = _mm_srli_epi16(_mm_mulhi_epu16(a, divisor), 8);
+	  b = _mm_srli_epi16(_mm_mulhi_epu16(b, divisor), 8);
+	  _mm_storeu_si128((__m128i *) (out8 + i), _mm_packus_epi16(a, b));
+	  continue;
+	}
+      if (pv->bits_per_ink_channel != 16)
+	{
+	  a = _mm_srli_epi16(a, 16 - pv->bits_per_ink_channel);
+	  b = _mm_srli_epi16(b, 16 - pv->bits_per_ink_channel);
 	}
+      if (pv->byteswap)
+	{
+	  a = _mm_or_si128(_mm_srli_epi16(a, 8), _mm_slli_epi16(a, 8));
+	  b = _mm_or_si128(_mm_srli_epi16(b, 8), _mm_slli_epi16(b, 8));
+	}
+      _mm_storeu_si128((__m128i *) (ink + i), a);
+      _mm_storeu_si128((__m128i *) (ink + i + 8), b);
     }
-   
-  /* Downscale 16bpp to output bpp */
+  return i;
+}
+#endif
+
+static void
+dyesub_convert_ink(const dyesub_print_vars_t *pv, unsigned short *ink,
+		   unsigned char *out8, int count)
+{
+  int i = 0;
+#ifdef STPI_X86_SIMD
+  if (stpi_cpu_features() & STPI_CPU_SSE2)
+    i = dyesub_convert_ink_sse2(pv, ink, out8, count);
+#endif
   /* FIXME:  Do we want to round? */
-  if (pv->bytes_per_ink_channel == 1) 
+  if (pv->bytes_per_ink_channel == 1)
     {
-      unsigned char *ink_u8 = (unsigned char *) ink;
-      for (i = 0; i < pv->ink_channels; i++) {
-#if 0
-             if (dyesub_feature(caps, DYESUB_FEATURE_RGBtoYCBCR))
-                     ink_u8[i] = ink[i] >> 8;
-             else
-#endif
-                     ink_u8[i] = ink[i] / 257;
-      }
-    } 
-  else if (pv->bits_per_ink_channel != 16)
+      for (; i < count; i++)
+	out8[i] = ink[i] / 257;
+      return;
+    }
+  for (; i < count; i++)
     {
-      for (i = 0; i < pv->ink_channels; i++)
-	ink[i] = ink[i] >> (16 - pv->bits_per_ink_channel);
+      unsigned short val = ink[i];
+      if (pv->bits_per_ink_channel != 16)
+	val >>= 16 - pv->bits_per_ink_channel;
+      if (pv->byteswap)
+	val = ((val >> 8) & 0xff) | ((val & 0xff) << 8);
+      ink[i] = val;
     }
-
-  /* Byteswap as needed */
-  if (pv->bytes_per_ink_channel == 2 && pv->byteswap)
-    for (i = 0; i < pv->ink_channels; i++)
-      ink[i] = ((ink[i] >> 8) & 0xff) | ((ink[i] & 0xff) << 8);
-
-  if (pv->plane_interlacing || pv->row_interlacing)
-    stp_zfwrite((char *) ink + (plane * pv->bytes_per_ink_channel), 
-		pv->bytes_per_ink_channel, 1, v);
-  else
-      /* print inks in correct order, eg. RGB  BGR */
-      for (b = 0; b < pv->ink_channels; b++)
-	stp_zfwrite((char *) ink + (pv->bytes_per_ink_channel * (pv->ink_order[b]-1)), 
-		    pv->bytes_per_ink_channel, 1, v);
-
-  return 1;
 }
 
 static int
 dyesub_print_row(stp_vars_t *v,
 		dyesub_print_vars_t *pv,
 		const dyesub_cap_t *caps,
+		const dyesub_row_t *r,
 		int row,
 		int plane)
 {
-  int ret = 0;
-  int w, col;
-  
+  int ycbcr = dyesub_feature(caps, DYESUB_FEATURE_RGBtoYCBCR);
+  int channel[MAX_INK_CHANNELS];
+  const unsigned short *image_row = NULL;
+  unsigned short *ink = r->ink;
+  int channels, count;
+  int w, b;
+
+  if (pv->print_mode != DYESUB_LANDSCAPE)
+    {
+      image_row = dyesub_image_row(v, pv, row);
+      if (!image_row)
+	return 0;
+    }
+
+  if (pv->plane_interlacing || pv->row_interlacing)
+    {
+      channels = 1;
+      channel[0] = plane;
+    }
+  else
+    {
+      /* print inks in correct order, eg. RGB  BGR */
+      channels = pv->ink_channels;
+      for (b = 0; b < channels; b++)
+	channel[b] = pv->ink_order[b] - 1;
+    }
+  count = pv->outw_px * channels;
+
   for (w = 0; w < pv->outw_px; w++)
     {
-      col = dyesub_interpolate(w, pv->outw_px, pv->imgw_px);
-      if (pv->plane_lefttoright)
-	      ret = dyesub_print_pixel(v, pv, caps, row, pv->imgw_px - col - 1, plane);
+      const unsigned short *out;
+      if (pv->print_mode == DYESUB_LANDSCAPE)
+	/* "rotate" image */
+	out = pv->image_data + (size_t) r->col_map[w] * pv->image_row_len
+	  + row * pv->out_channels;
       else
-	      ret = dyesub_print_pixel(v, pv, caps, row, col, plane);
-      if (ret > 1)
-      	break;
+	out = image_row + r->col_map[w];
+      for (b = 0; b < channels; b++)
+	*ink++ = dyesub_ink_value(pv, ycbcr, out, channel[b]);
     }
-  return ret;
+
+  dyesub_convert_ink(pv, r->ink, r->out, count);
+  if (pv->bytes_per_ink_channel == 1)
+    stp_zfwrite((const char *) r->out, count, 1, v);
+  else
+    stp_zfwrite((const char *) r->ink, count * 2, 1, v);
+  return 1;
 }
 
 static int
@@ -6076,10 +6180,26 @@ dyesub_print_plane(stp_vars_t *v,
 		const dyesub_cap_t *caps,
 		int plane)
 {
-  int ret = 0;
+  int ret = 1;
   int h, row, p;
   int out_bytes = ((pv->plane_interlacing || pv->row_interlacing) ? 1 : pv->ink_channels)
   					* pv->bytes_per_ink_channel;
+  dyesub_row_t r;
+  int w;
+
+  r.col_map = stp_malloc(pv->outw_px * sizeof(int));
+  r.ink = stp_malloc(pv->outw_px * pv->ink_channels * sizeof(unsigned short));
+  r.out = stp_malloc(pv->outw_px * pv->ink_channels);
+  for (w = 0; w < pv->outw_px; w++)
+    {
+      int col = dyesub_interpolate(w, pv->outw_px, pv->imgw_px);
+      if (pv->plane_lefttoright)
+	col = pv->imgw_px - col - 1;
+      if (pv->print_mode == DYESUB_LANDSCAPE)
+	r.col_map[w] = (pv->imgw_px - 1) - col;
+      else
+	r.col_map[w] = col * pv->out_channels;
+    }
 
   for (h = 0; h <= pv->prnb_px - pv->prnt_px; h++)
     {
@@ -6114,7 +6234,11 @@ dyesub_print_plane(stp_vars_t *v,
 	  					pv->outh_px, pv->imgh_px);
 	  stp_deprintf(STP_DBG_DYESUB,
 	  	"dyesub_print_plane: h = %d, row = %d\n", h, row);
-	  ret = dyesub_print_row(v, pv, caps, row, p);
+	  if (!dyesub_print_row(v, pv, caps, &r, row, p))
+	    {
+	      ret = 0;
+	      break;
+	    }
 
 	  if (dyesub_feature(caps, DYESUB_FEATURE_FULL_WIDTH)
 	  	&& pv->outr_px < pv->prnw_px)
@@ -6130,7 +6254,12 @@ dyesub_print_plane(stp_vars_t *v,
 	}
 
       } while (pv->row_interlacing && ++p < pv->ink_channels);
+      if (!ret)
+	break;
     }
+  stp_free(r.col_map);
+  stp_free(r.ink);
+  stp_free(r.out);
   return ret;
 }
 
@@ -6282,7 +6411,6 @@ dyesub_do_print(stp_vars_t *v, stp_image_t *image)
 #endif    
   }
 
-  pv.image_data = dyesub_read_image(v, &pv, image);
   if (ink_type) {
 	  if (dyesub_feature(caps, DYESUB_FEATURE_RGBtoYCBCR)) {
 		  pv.empty_byte[0] = 0xff; /* Y */
@@ -6307,7 +6435,7 @@ dyesub_do_print(stp_vars_t *v, stp_image_t *image)
   pv.row_interlacing = dyesub_feature(caps, DYESUB_FEATURE_ROW_INTERLACE);
   pv.plane_lefttoright = dyesub_feature(caps, DYESUB_FEATURE_PLANE_LEFTTORIGHT);
   pv.print_mode = page_mode;
-  if (!pv.image_data)
+  if (!dyesub_read_image(v, &pv, image))
     {
       stp_image_conclude(image);
       return 2;
@@ -6381,16 +6509,22 @@ dyesub_do_print(stp_vars_t *v, stp_image_t *image)
       /* plane init */
       dyesub_exec(v, caps->plane_init_func, "caps->plane_init");
   
-      dyesub_print_plane(v, &pv, caps, (int) pv.ink_order[pl] - 1);
+      if (!dyesub_print_plane(v, &pv, caps, (int) pv.ink_order[pl] - 1))
+	{
+	  /* A streamed image can fail part way through */
+	  status = 2;
+	  break;
+	}
 
       /* plane end */
       dyesub_exec(v, caps->plane_end_func, "caps->plane_end");
     }
 
   /* printer end */
-  dyesub_exec(v, caps->printer_end_func, "caps->printer_end");
+  if (status == 1)
+    dyesub_exec(v, caps->printer_end_func, "caps->printer_end");
 
-  dyesub_free_image(&pv, image);
+  dyesub_free_image(&pv);
   stp_image_conclude(image);
   return status;
 }
@@ -38,9 +38,42 @@
 #endif
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 static stp_list_t *paper_list = NULL;
 
+/*
+ * The papers are also kept in an index for lookups by size.
+ * paper_table holds them in list order, and paper_sizes holds their
+ * sizes sorted by width, height and position in the list, so that the
+ * papers of any size, or of any nearby size, are found by binary
+ * search.  The index is rebuilt each time a file of papers has been
+ * read, so lookups only ever read it; papers.xml itself is read once,
+ * by whichever lookup comes first.
+ */
+typedef struct
+{
+  int width;
+  int height;
+  int index;			/* In paper_table */
+} paper_size_key_t;
+
+static const stp_papersize_t **paper_table = NULL;
+static paper_size_key_t *paper_sizes = NULL;
+static int paper_count = 0;
+static pthread_once_t paper_list_once = PTHREAD_ONCE_INIT;
+
+/* Sizes differing by less than this are considered a match */
+#define PAPER_SIZE_SLOP 5
+
+static void
+paper_index_invalidate(void)
+{
+  STP_SAFE_FREE(paper_table);
+  STP_SAFE_FREE(paper_sizes);
+  paper_count = 0;
+}
+
 static void
 stpi_paper_freefunc(void *item)
 {
@@ -70,6 +103,7 @@ stpi_paper_list_init(void)
 {
   if (paper_list)
     stp_list_destroy(paper_list);
+  paper_index_invalidate();
   paper_list = stp_list_create();
   stp_list_set_freefunc(paper_list, stpi_paper_freefunc);
   stp_list_set_namefunc(paper_list, stpi_paper_namefunc);
@@ -79,8 +113,8 @@ stpi_paper_list_init(void)
   return 0;
 }
 
-static inline void
-check_paperlist(void)
+static void
+load_paperlist(void)
 {
   if (paper_list == NULL)
     {
@@ -93,6 +127,12 @@ check_paperlist(void)
     }
 }
 
+static inline void
+check_paperlist(void)
+{
+  pthread_once(&paper_list_once, load_paperlist);
+}
+
 static int
 stpi_paper_create(stp_papersize_t *p)
 {
@@ -106,19 +146,13 @@ stpi_paper_create(stp_papersize_t *p)
     }
 
   /* Check the paper does not already exist */
-  paper_item = stp_list_get_start(paper_list);
-  while (paper_item)
+  paper_item = stp_list_get_item_by_name(paper_list, p->name);
+  if (paper_item)
     {
-      const stp_papersize_t *ep =
-	(const stp_papersize_t *) stp_list_item_get_data(paper_item);
-      if (ep && !strcmp(p->name, ep->name))
-	{
-	  stp_erprintf("Duplicate paper size `%s'\n",
-		       p->name);
-	  stpi_paper_freefunc(p);
-	  return 1;
-	}
-      paper_item = stp_list_item_next(paper_item);
+      stp_erprintf("Duplicate paper size `%s'\n",
+		   p->name);
+      stpi_paper_freefunc(p);
+      return 1;
     }
 
   /* Add paper to list */
@@ -147,81 +181,159 @@ stp_get_papersize_by_name(const char *name)
     return (const stp_papersize_t *) stp_list_item_get_data(paper);
 }
 
+static int
+paper_size_compare(const void *a, const void *b)
+{
+  const paper_size_key_t *ka = (const paper_size_key_t *) a;
+  const paper_size_key_t *kb = (const paper_size_key_t *) b;
+  if (ka->width != kb->width)
+    return ka->width < kb->width ? -1 : 1;
+  if (ka->height != kb->height)
+    return ka->height < kb->height ? -1 : 1;
+  return ka->index - kb->index;
+}
+
+static void
+paper_index_build(void)
+{
+  stp_list_item_t *paper_item;
+  int i = 0;
+
+  paper_index_invalidate();
+  paper_count = stp_list_get_length(paper_list);
+  paper_table = stp_malloc(sizeof(stp_papersize_t *) * (paper_count + 1));
+  paper_sizes = stp_malloc(sizeof(paper_size_key_t) * (paper_count + 1));
+  for (paper_item = stp_list_get_start(paper_list); paper_item;
+       paper_item = stp_list_item_next(paper_item))
+    {
+      const stp_papersize_t *paper =
+	(const stp_papersize_t *) stp_list_item_get_data(paper_item);
+      paper_table[i] = paper;
+      paper_sizes[i].width = paper->width;
+      paper_sizes[i].height = paper->height;
+      paper_sizes[i].index = i;
+      i++;
+    }
+  qsort(paper_sizes, paper_count, sizeof(paper_size_key_t),
+	paper_size_compare);
+}
+
+/*
+ * The position in paper_sizes of the first paper at least w wide and,
+ * of those w wide, at least l high.
+ */
+static int
+paper_size_lower_bound(int l, int w)
+{
+  int lo = 0;
+  int hi = paper_count;
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (paper_sizes[mid].width < w ||
+	  (paper_sizes[mid].width == w && paper_sizes[mid].height < l))
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
 const stp_papersize_t *
 stp_get_papersize_by_index(int idx)
 {
-  stp_list_item_t *paper;
-
   check_paperlist();
-  paper = stp_list_get_item_by_index(paper_list, idx);
-  if (!paper)
+  if (idx < 0 || idx >= paper_count)
     return NULL;
-  else
-    return (const stp_papersize_t *) stp_list_item_get_data(paper);
+  return paper_table[idx];
 }
 
 static int
-paper_size_mismatch(int l, int w, const stp_papersize_t *val)
+paper_size_mismatch(int l, int w, const paper_size_key_t *val)
 {
-  int hdiff = abs(l - (int) val->height);
-  int vdiff = abs(w - (int) val->width);
+  int hdiff = abs(l - val->height);
+  int vdiff = abs(w - val->width);
   return hdiff > vdiff ? hdiff : vdiff;
 }
 
-const stp_papersize_t *
-stp_get_papersize_by_size(int l, int w)
+/*
+ * Of the papers exactly w x l, the first without margins, or failing
+ * that the last in the list.  Sets *last to the position in the list of
+ * the latter, or -1 if there are none.
+ */
+static const stp_papersize_t *
+paper_exact_match(int l, int w, int *last)
 {
-  int score = INT_MAX;
-  const stp_papersize_t *ref = NULL;
-  const stp_papersize_t *val = NULL;
   int i;
-  int sizes = stp_known_papersizes();
-  for (i = 0; i < sizes; i++)
+  *last = -1;
+  for (i = paper_size_lower_bound(l, w);
+       i < paper_count &&
+	 paper_sizes[i].width == w && paper_sizes[i].height == l; i++)
     {
-      val = stp_get_papersize_by_index(i);
+      const stp_papersize_t *val = paper_table[paper_sizes[i].index];
+      if (val->top == 0 && val->left == 0 &&
+	  val->bottom == 0 && val->right == 0)
+	return val;
+      *last = paper_sizes[i].index;
+    }
+  return NULL;
+}
 
-      if (val->width == w && val->height == l)
-	{
-	  if (val->top == 0 && val->left == 0 &&
-	      val->bottom == 0 && val->right == 0)
-	    return val;
-	  else
-	    ref = val;
-	}
-      else
+/*
+ * The paper of exactly this size or, failing that, the closest one
+ * differing by less than PAPER_SIZE_SLOP points in each direction.
+ * This gives the same answer as walking the list in order: a paper
+ * without margins of the exact size wins outright; otherwise the answer
+ * is whichever comes later in the list of the last exact match and the
+ * first of the closest near matches.
+ */
+const stp_papersize_t *
+stp_get_papersize_by_size(int l, int w)
+{
+  const stp_papersize_t *ref;
+  int exact;
+  int nearest = -1;
+  int score = PAPER_SIZE_SLOP;
+  int width;
+
+  check_paperlist();
+  ref = paper_exact_match(l, w, &exact);
+  if (ref)
+    return ref;
+  for (width = w - PAPER_SIZE_SLOP + 1; width < w + PAPER_SIZE_SLOP; width++)
+    {
+      int i;
+      for (i = paper_size_lower_bound(l - PAPER_SIZE_SLOP + 1, width);
+	   i < paper_count && paper_sizes[i].width == width &&
+	     paper_sizes[i].height < l + PAPER_SIZE_SLOP; i++)
 	{
+	  const paper_size_key_t *val = &(paper_sizes[i]);
 	  int myscore = paper_size_mismatch(l, w, val);
-	  if (myscore < score && myscore < 5)
+	  if (myscore == 0)
+	    continue;
+	  if (myscore < score || (myscore == score && val->index < nearest))
 	    {
-	      ref = val;
 	      score = myscore;
+	      nearest = val->index;
 	    }
 	}
     }
-  return ref;
+  if (exact < 0 && nearest < 0)
+    return NULL;
+  return paper_table[exact > nearest ? exact : nearest];
 }
 
 const stp_papersize_t *
 stp_get_papersize_by_size_exact(int l, int w)
 {
-  const stp_papersize_t *ref = NULL;
-  const stp_papersize_t *val = NULL;
-  int i;
-  int sizes = stp_known_papersizes();
-  for (i = 0; i < sizes; i++)
-    {
-      val = stp_get_papersize_by_index(i);
+  const stp_papersize_t *ref;
+  int last;
 
-      if (val->width == w && val->height == l)
-	{
-	  if (val->top == 0 && val->left == 0 &&
-	      val->bottom == 0 && val->right == 0)
-	    return val;
-	  else
-	    ref = val;
-	}
-    }
-  return ref;
+  check_paperlist();
+  ref = paper_exact_match(l, w, &last);
+  if (ref)
+    return ref;
+  return last < 0 ? NULL : paper_table[last];
 }
 
 void
@@ -426,6 +538,8 @@ stp_xml_process_paperdef(stp_mxml_node_t *paperdef, const char *file) /* The pap
 	}
       paper = paper->next;
     }
+  if (paper_list)
+    paper_index_build();
   return 1;
 }
 
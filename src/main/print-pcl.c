@@ -44,6 +44,7 @@
  */
 static void	pcl_mode0(stp_vars_t *, unsigned char *, int, int);
 static void	pcl_mode2(stp_vars_t *, unsigned char *, int, int);
+static void	pcl_mode_delta(stp_vars_t *, unsigned char *, int, int);
 
 #ifndef MAX
 #  define MAX(a, b) ((a) > (b) ? (a) : (b))
@@ -54,6 +55,12 @@ typedef struct
   int do_blank;
   int blank_lines;
   unsigned char *comp_buf;
+  unsigned char *delta_buf;	/* Mode 3 and mode 9 candidates */
+  unsigned char *seed_rows;	/* Last row sent of each plane */
+  int seed_planes;		/* Planes allocated in seed_rows */
+  int plane;			/* Plane of the current row being sent */
+  int comp_mode;		/* Current compression mode */
+  int use_mode9;		/* Printer accepts mode 9 */
   void (*writefunc)(stp_vars_t *, unsigned char *, int, int);	/* PCL output function */
   int do_cret;
   int do_cretb;
@@ -336,6 +343,8 @@ typedef struct {
 #define PCL_PRINTER_BLANKLINE	64	/* Blank line removal supported */
 #define PCL_PRINTER_DUPLEX	128	/* Printer can have duplexer */
 #define PCL_PRINTER_LABEL       256     /* Datamax-O'Neil PCL Label Printer */
+#define PCL_PRINTER_DELTA	512	/* Delta row compression (mode 3, and
+					   mode 9 on DeskJets) */
 
 /*
  * FIXME - the 520 shouldn't be lumped in with the 500 as it supports
@@ -976,7 +985,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {0, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMY,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -990,7 +999,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {0, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -1004,7 +1013,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {0, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK | PCL_COLOR_CMYKcm,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -1018,7 +1027,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {5, 33, 10, 10},
     PCL_COLOR_CMYK | PCL_COLOR_CMYK4,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -1032,7 +1041,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {0, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK | PCL_COLOR_CMYK4b,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -1046,7 +1055,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {5, 33, 10, 10},	/* Oliver Vecernik */
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DUPLEX |
+      PCL_PRINTER_DELTA,
     dj600_papersizes,
     basic_papertypes,
     emptylist,
@@ -1060,7 +1070,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {5, 33, 10, 10},
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj1220_papersizes,
     basic_papertypes,
     emptylist,
@@ -1074,7 +1084,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {5, 33, 10, 10},
     PCL_COLOR_CMYK | PCL_COLOR_CMYK4,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj1100_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -1088,7 +1098,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMY,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj1200_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -1102,7 +1112,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj1200_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -1116,7 +1126,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {0, 35, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj2000_papersizes,
     new_papertypes,
     dj_papersources,
@@ -1130,7 +1140,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMYK,
     PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_MEDIATYPE |
-      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE,
+      PCL_PRINTER_CUSTOM_SIZE | PCL_PRINTER_BLANKLINE | PCL_PRINTER_DELTA,
     dj2500_papersizes,
     new_papertypes,
     dj2500_papersources,
@@ -1286,7 +1296,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1299,7 +1310,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1313,7 +1325,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1327,7 +1339,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1341,7 +1353,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1355,7 +1367,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1369,7 +1381,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1383,7 +1395,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA,
     ljtabloid_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1397,7 +1409,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -3110,11 +3122,24 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
 
 /* Allocate buffer for pcl_mode2 tiff compression */
 
+  privdata.delta_buf = NULL;
+  privdata.seed_rows = NULL;
+  privdata.seed_planes = 0;
+  privdata.plane = 0;
+  privdata.comp_mode = 2;
   if ((caps->stp_printer_type & PCL_PRINTER_TIFF) == PCL_PRINTER_TIFF &&
       !(stp_get_debug_level() & STP_DBG_NO_COMPRESSION))
   {
     privdata.comp_buf = stp_malloc((privdata.height + 128 + 7) * 129 / 128);
-    privdata.writefunc = pcl_mode2;
+    if ((caps->stp_printer_type & PCL_PRINTER_DELTA) == PCL_PRINTER_DELTA)
+    {
+      privdata.delta_buf = stp_malloc(2 * (2 * privdata.height + 8));
+      privdata.use_mode9 =
+	((caps->stp_printer_type & PCL_PRINTER_DJ) == PCL_PRINTER_DJ);
+      privdata.writefunc = pcl_mode_delta;
+    }
+    else
+      privdata.writefunc = pcl_mode2;
   }
   else
   {
@@ -3311,6 +3336,10 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
 
   if (privdata.comp_buf != NULL)
     stp_free(privdata.comp_buf);
+  if (privdata.delta_buf != NULL)
+    stp_free(privdata.delta_buf);
+  if (privdata.seed_rows != NULL)
+    stp_free(privdata.seed_rows);
 
   if ((caps->stp_printer_type & PCL_PRINTER_NEW_ERG) == PCL_PRINTER_NEW_ERG)
     stp_puts("\033*rC", v);
@@ -3399,6 +3428,218 @@ pcl_mode2(stp_vars_t *v,		/* I - Print file or command */
 }
 
 
+/*
+ * Both delta row modes describe a row by the bytes that differ from the
+ * seed row, the last row sent for the same plane.  Offsets and counts
+ * too big for the command byte continue in extra bytes, each added to
+ * the field, until one is less than 255.
+ */
+
+static unsigned char *
+pcl_delta_extend(unsigned char *out, int value)
+{
+  while (value >= 255)
+    {
+      *out++ = 255;
+      value -= 255;
+    }
+  *out++ = value;
+  return out;
+}
+
+/*
+ * 'pcl_delta_row()' - Compress a row using mode 3 (delta row).
+ *
+ * Each command byte replaces 1-8 bytes, at a 5-bit offset from the end
+ * of the previous replacement.
+ */
+
+static int
+pcl_delta_row(const unsigned char *line,	/* I - Row to send */
+	      const unsigned char *seed,	/* I - Seed row */
+	      int           length,		/* I - Bytes in row */
+	      unsigned char *out)		/* O - Compressed row */
+{
+  unsigned char *start = out;
+  int i = 0;
+
+  while (i < length)
+    {
+      int first, count, offset;
+      for (first = i; i < length && line[i] == seed[i]; i++)
+	;
+      if (i == length)
+	break;
+      offset = i - first;
+      first = i;
+      do
+	i++;
+      while (i < length && i - first < 8 && line[i] != seed[i]);
+      count = i - first;
+      if (offset < 31)
+	*out++ = ((count - 1) << 5) | offset;
+      else
+	{
+	  *out++ = ((count - 1) << 5) | 31;
+	  out = pcl_delta_extend(out, offset - 31);
+	}
+      memcpy(out, line + first, count);
+      out += count;
+    }
+  return out - start;
+}
+
+/*
+ * 'pcl_delta_row_rle()' - Compress a row using mode 9 (replacement delta
+ * row).
+ *
+ * Like mode 3, but a command either replaces any number of bytes
+ * literally (4-bit offset, 3-bit count - 1) or with a run of one byte
+ * (high bit set, 2-bit offset, 5-bit count - 2).
+ */
+
+static int
+pcl_delta_row_rle(const unsigned char *line,	/* I - Row to send */
+		  const unsigned char *seed,	/* I - Seed row */
+		  int           length,		/* I - Bytes in row */
+		  unsigned char *out)		/* O - Compressed row */
+{
+  unsigned char *start = out;
+  int i = 0;
+
+  while (i < length)
+    {
+      int first, end, offset;
+      for (first = i; i < length && line[i] == seed[i]; i++)
+	;
+      if (i == length)
+	break;
+      offset = i - first;
+      for (end = i; end < length && line[end] != seed[end]; end++)
+	;
+
+      /* Split the changed bytes into literals and runs of 4 or more */
+      while (i < end)
+	{
+	  int literal = i;
+	  int run_end;
+	  while (i + 3 < end &&
+		 (line[i] != line[i + 1] || line[i] != line[i + 2] ||
+		  line[i] != line[i + 3]))
+	    i++;
+	  if (i + 3 >= end)
+	    i = end;
+	  if (i > literal)
+	    {
+	      int count = i - literal - 1;
+	      *out++ = ((offset < 15 ? offset : 15) << 3) |
+		(count < 7 ? count : 7);
+	      if (offset >= 15)
+		out = pcl_delta_extend(out, offset - 15);
+	      if (count >= 7)
+		out = pcl_delta_extend(out, count - 7);
+	      memcpy(out, line + literal, i - literal);
+	      out += i - literal;
+	      offset = 0;
+	    }
+	  if (i == end)
+	    break;
+	  for (run_end = i + 4; run_end < end && line[run_end] == line[i];
+	       run_end++)
+	    ;
+	  {
+	    int count = run_end - i - 2;
+	    *out++ = 0x80 | ((offset < 3 ? offset : 3) << 5) |
+	      (count < 31 ? count : 31);
+	    if (offset >= 3)
+	      out = pcl_delta_extend(out, offset - 3);
+	    if (count >= 31)
+	      out = pcl_delta_extend(out, count - 31);
+	    *out++ = line[i];
+	  }
+	  offset = 0;
+	  i = run_end;
+	}
+    }
+  return out - start;
+}
+
+
+/*
+ * 'pcl_mode_delta()' - Send PCL graphics using whichever of mode 2 (TIFF),
+ * mode 3 (delta row) or mode 9 (replacement delta row) is smallest.
+ *
+ * The printer keeps a seed row for each plane, updated by every row it
+ * receives whatever the mode, so a copy of each is kept here too.  They
+ * start out zero, as in the printer, and a blank line skip zeroes them
+ * in the printer; the row sent before the skip was blank anyway.
+ */
+
+static void
+pcl_mode_delta(stp_vars_t *v,		/* I - Print file or command */
+	       unsigned char *line,	/* I - Output bitmap data */
+	       int           height,	/* I - Height of bitmap data */
+	       int           last_plane) /* I - True if this is the last plane */
+{
+  pcl_privdata_t *privdata =
+    (pcl_privdata_t *) stp_get_component_data(v, "Driver");
+  unsigned char *comp_buf = privdata->comp_buf;
+  unsigned char *comp_ptr;
+  unsigned char *seed;
+  unsigned char *data;
+  int bytes;
+  int mode = 2;
+  int i;
+
+  if (privdata->plane >= privdata->seed_planes)
+    {
+      privdata->seed_rows =
+	stp_realloc(privdata->seed_rows, (privdata->plane + 1) * height);
+      memset(privdata->seed_rows + privdata->seed_planes * height, 0,
+	     (privdata->plane + 1 - privdata->seed_planes) * height);
+      privdata->seed_planes = privdata->plane + 1;
+    }
+  seed = privdata->seed_rows + privdata->plane * height;
+
+  stp_pack_tiff(v, line, height, comp_buf, &comp_ptr, NULL, NULL);
+  data = comp_buf;
+  bytes = comp_ptr - comp_buf;
+
+ /*
+  * Changing modes costs a 5 byte command, so only change for a gain.
+  */
+
+  for (i = 0; i < 2; i++)
+    {
+      int try_mode = i ? 9 : 3;
+      unsigned char *try_buf = privdata->delta_buf + i * (2 * height + 8);
+      int try_bytes;
+      if (try_mode == 9 && !privdata->use_mode9)
+	continue;
+      try_bytes = (try_mode == 3 ?
+		   pcl_delta_row(line, seed, height, try_buf) :
+		   pcl_delta_row_rle(line, seed, height, try_buf));
+      if (try_bytes + (try_mode == privdata->comp_mode ? 0 : 5) <
+	  bytes + (mode == privdata->comp_mode ? 0 : 5))
+	{
+	  mode = try_mode;
+	  data = try_buf;
+	  bytes = try_bytes;
+	}
+    }
+  memcpy(seed, line, height);
+  privdata->plane = last_plane ? 0 : privdata->plane + 1;
+
+  if (mode != privdata->comp_mode)
+    {
+      stp_zprintf(v, "\033*b%dM", mode);
+      privdata->comp_mode = mode;
+    }
+  stp_zprintf(v, "\033*b%d%c", bytes, last_plane ? 'W' : 'V');
+  stp_zfwrite((const char *)data, bytes, 1, v);
+}
+
+
 static stp_family_t print_pcl_module_data =
   {
     &print_pcl_printfuncs,
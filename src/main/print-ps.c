@@ -423,6 +423,8 @@ ps_parameters(const stp_vars_t *v, const char *name,
   char *locale = stp_strdup(setlocale(LC_ALL, NULL));
   setlocale(LC_ALL, "C");
 #endif
+  /* Descriptions point into the PPD file, which can be replaced */
+  stpi_describe_uncacheable();
   ps_parameters_internal(v, name, description);
 #ifdef HAVE_LOCALE_H
   setlocale(LC_ALL, locale);
@@ -0,0 +1,229 @@
+/*
+ * "$Id$"
+ *
+ *   Print pipeline statistics for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Statistics are collected when the STP_STATS environment variable is set
+ * or the job's STPIStatistics boolean parameter is true.  Each stage of the
+ * pipeline accumulates the time spent in it, the number of calls and the
+ * number of bytes it handled; times include any later stages a stage calls
+ * (the weave time includes packing and output, for example).  "output"
+ * counts the writes drivers make and "write" the calls to the
+ * application's output function after buffering.  The totals are written
+ * as JSON by stp_end_job(), to the file named by STP_STATS or, if that is
+ * empty or "-", on one line through the job's error function, along with
+ * the time from the start of the first page to the first write, the
+ * process's peak RSS, the job's scratch memory use (see arena.c) and the
+ * process's color lookup table cache counters (see lut-cache.c).
+ *
+ * The counters are process-wide.  Each stage only ever runs on one thread
+ * at a time, so they need no locking even when the pipeline is threaded.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_CLOCK_GETTIME
+#include <time.h>
+#else
+#include <sys/time.h>
+#endif
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+typedef struct
+{
+  unsigned long long nsec;
+  unsigned long long calls;
+  unsigned long long bytes;
+} stats_counter_t;
+
+static const char *const stage_names[STPI_STATS_STAGES] =
+{
+  "print",
+  "color",
+  "dither",
+  "weave",
+  "pack",
+  "output",
+  "write"
+};
+
+int stpi_stats_active = 0;
+static stats_counter_t counters[STPI_STATS_STAGES];
+static unsigned long long first_page_start; /* When stp_print() was entered */
+static unsigned long long first_write;	/* Time from then to the first write */
+
+unsigned long long
+stpi_stats_clock(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+  (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+  struct timeval tv;
+  (void) gettimeofday(&tv, NULL);
+  return (unsigned long long) tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000;
+#endif
+}
+
+void
+stpi_stats_record(stpi_stats_stage_t stage, unsigned long long start,
+		  size_t bytes)
+{
+  unsigned long long now = stpi_stats_clock();
+  counters[stage].nsec += now - start;
+  counters[stage].calls++;
+  counters[stage].bytes += bytes;
+  if (stage == STPI_STATS_WRITE && first_page_start && !first_write)
+    first_write = now - first_page_start;
+}
+
+/*
+ * Note the start of a page, so that the time from the start of the
+ * job's first page to its first output can be reported.  Drivers that
+ * must render a whole page before sending any of it show up here.
+ */
+void
+stpi_stats_start_page(unsigned long long start)
+{
+  if (!first_page_start)
+    first_page_start = start;
+}
+
+/* The process's peak resident set size in kilobytes, or -1 */
+long
+stpi_peak_rss_kb(void)
+{
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    return usage.ru_maxrss;
+#endif
+  return -1;
+}
+
+void
+stpi_stats_start_job(const stp_vars_t *v)
+{
+  if (stpi_stats_active)
+    return;
+  if (getenv("STP_STATS") ||
+      (stp_check_boolean_parameter(v, "STPIStatistics",
+				   STP_PARAMETER_DEFAULTED) &&
+       stp_get_boolean_parameter(v, "STPIStatistics")))
+    {
+      memset(counters, 0, sizeof(counters));
+      first_page_start = 0;
+      first_write = 0;
+      stpi_stats_active = 1;
+    }
+}
+
+void
+stpi_stats_end_job(const stp_vars_t *v)
+{
+  const char *file = getenv("STP_STATS");
+  FILE *fp = NULL;
+  stpi_lut_cache_stats_t lut_cache;
+  stpi_describe_cache_stats_t describe_cache;
+  char *json;
+  int i;
+
+  if (!stpi_stats_active)
+    return;
+  stpi_stats_active = 0;
+
+  stp_asprintf(&json, "{\n  \"driver\": \"%s\",\n  \"stages\": {\n",
+	       stp_get_driver(v));
+  for (i = 0; i < STPI_STATS_STAGES; i++)
+    stpi_catprintf(&json,
+		   "    \"%s\": { \"nsec\": %llu, \"calls\": %llu, "
+		   "\"bytes\": %llu }%s\n", stage_names[i],
+		   counters[i].nsec, counters[i].calls, counters[i].bytes,
+		   i < STPI_STATS_STAGES - 1 ? "," : "");
+  stpi_catprintf(&json, "  },\n  \"first_write_nsec\": %llu,\n"
+		 "  \"peak_rss_kb\": %ld", first_write, stpi_peak_rss_kb());
+  if (stpi_get_arena(v))
+    {
+      stpi_arena_stats_t arena;
+      stpi_arena_get_stats(stpi_get_arena(v), &arena);
+      stpi_catprintf(&json,
+		     ",\n  \"arena\": { \"allocations\": %lu, "
+		     "\"reused\": %lu, \"total_bytes\": %lu, "
+		     "\"peak_bytes\": %lu, \"reserved_bytes\": %lu }",
+		     arena.allocations, arena.reused, arena.total_bytes,
+		     arena.peak_bytes, arena.reserved_bytes);
+    }
+  stpi_lut_cache_get_stats(&lut_cache);
+  stpi_catprintf(&json,
+		 ",\n  \"lut_cache\": { \"hits\": %lu, \"disk_hits\": %lu, "
+		 "\"misses\": %lu, \"entries\": %lu, \"bytes\": %lu }",
+		 lut_cache.hits, lut_cache.disk_hits, lut_cache.misses,
+		 lut_cache.entries, lut_cache.bytes);
+  stpi_describe_cache_get_stats(&describe_cache);
+  stpi_catprintf(&json,
+		 ",\n  \"describe_cache\": { \"hits\": %lu, \"misses\": %lu, "
+		 "\"entries\": %lu }", describe_cache.hits,
+		 describe_cache.misses, describe_cache.entries);
+  stpi_catprintf(&json, "\n}\n");
+
+  if (file && file[0] && strcmp(file, "-") != 0)
+    {
+      fp = fopen(file, "a");
+      if (!fp)
+	stp_eprintf(v, "Cannot write statistics to %s\n", file);
+    }
+  if (fp)
+    {
+      fputs(json, fp);
+      fclose(fp);
+    }
+  else
+    {
+      /* Fold it onto one line, so it stays one message in a log */
+      char *in = json;
+      char *out = json;
+      while (*in)
+	{
+	  if (*in == '\n')
+	    {
+	      while (in[1] == ' ' || in[1] == '\n')
+		in++;
+	      if (in[1])
+		*out++ = ' ';
+	      in++;
+	    }
+	  else
+	    *out++ = *in++;
+	}
+      *out = '\0';
+      stp_eprintf(v, "%s\n", json);
+    }
+  stp_free(json);
+}
@@ -86,13 +86,132 @@ typedef struct
     }									\
 }
 
+/* Every byte sent to the printer goes through here */
+static void
+write_output(const stp_vars_t *v, const char *buf, size_t bytes)
+{
+  unsigned long long stats_start = STPI_STATS_BEGIN();
+  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), buf, bytes);
+  STPI_STATS_END(STPI_STATS_OUTPUT, stats_start, bytes);
+}
+
+/*
+ * Output buffering.  While a job call is running, the vars' output
+ * function is replaced by one that collects the data in a buffer and
+ * hands it to the application's function in large pieces.  Drivers
+ * that copy the vars pick up the same buffer, so the order of the
+ * output is preserved.
+ */
+#define DEFAULT_OUTPUT_BUFFER_SIZE 65536
+
+struct stpi_output_buffer
+{
+  stp_outfunc_t ofunc;
+  void *odata;
+  char *data;
+  size_t bytes;
+  size_t size;
+};
+
+static void
+output_buffer_flush(stpi_output_buffer_t *ob)
+{
+  if (ob->bytes > 0)
+    {
+      unsigned long long stats_start = STPI_STATS_BEGIN();
+      (ob->ofunc)(ob->odata, ob->data, ob->bytes);
+      STPI_STATS_END(STPI_STATS_WRITE, stats_start, ob->bytes);
+      ob->bytes = 0;
+    }
+}
+
+static void
+output_buffer_writefunc(void *priv, const char *buffer, size_t bytes)
+{
+  stpi_output_buffer_t *ob = (stpi_output_buffer_t *) priv;
+  if (ob->bytes + bytes > ob->size)
+    {
+      output_buffer_flush(ob);
+      if (bytes >= ob->size)
+	{
+	  unsigned long long stats_start = STPI_STATS_BEGIN();
+	  (ob->ofunc)(ob->odata, buffer, bytes);
+	  STPI_STATS_END(STPI_STATS_WRITE, stats_start, bytes);
+	  return;
+	}
+    }
+  memcpy(ob->data + ob->bytes, buffer, bytes);
+  ob->bytes += bytes;
+}
+
+/*
+ * Start buffering the output of v.  The size of the buffer is taken
+ * from the STPIOutputBufferSize parameter; zero turns buffering off.
+ * Returns NULL if there's nothing to do.
+ */
+stpi_output_buffer_t *
+stpi_output_buffer_begin(const stp_vars_t *v)
+{
+  stpi_output_buffer_t *ob;
+  size_t size = DEFAULT_OUTPUT_BUFFER_SIZE;
+  int verified_flag = stp_get_verified(v);
+  if (!stp_get_outfunc(v) || stp_get_outfunc(v) == output_buffer_writefunc)
+    return NULL;
+  if (stp_check_int_parameter(v, "STPIOutputBufferSize",
+			      STP_PARAMETER_DEFAULTED))
+    {
+      int param = stp_get_int_parameter(v, "STPIOutputBufferSize");
+      if (param <= 0)
+	return NULL;
+      size = param;
+    }
+  ob = stp_malloc(sizeof(stpi_output_buffer_t));
+  ob->ofunc = stp_get_outfunc(v);
+  ob->odata = stp_get_outdata(v);
+  ob->data = stp_malloc(size);
+  ob->bytes = 0;
+  ob->size = size;
+  stp_set_outfunc((stp_vars_t *) v, output_buffer_writefunc);
+  stp_set_outdata((stp_vars_t *) v, ob);
+  stp_set_verified((stp_vars_t *) v, verified_flag);
+  return ob;
+}
+
+/*
+ * Write out anything left in the buffer and give v back its own
+ * output function.
+ */
+void
+stpi_output_buffer_end(const stp_vars_t *v, stpi_output_buffer_t *ob)
+{
+  if (!ob)
+    return;
+  output_buffer_flush(ob);
+  if (stp_get_outdata(v) == ob)
+    {
+      int verified_flag = stp_get_verified(v);
+      stp_set_outfunc((stp_vars_t *) v, ob->ofunc);
+      stp_set_outdata((stp_vars_t *) v, ob->odata);
+      stp_set_verified((stp_vars_t *) v, verified_flag);
+    }
+  stp_free(ob->data);
+  stp_free(ob);
+}
+
+void
+stpi_flush_output(const stp_vars_t *v)
+{
+  if (stp_get_outfunc(v) == output_buffer_writefunc)
+    output_buffer_flush((stpi_output_buffer_t *) stp_get_outdata(v));
+}
+
 void
 stp_zprintf(const stp_vars_t *v, const char *format, ...)
 {
   char *result;
   int bytes;
   STPI_VASPRINTF(result, bytes, format);
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), result, bytes);
+  write_output(v, result, bytes);
   stp_free(result);
 }
 
@@ -117,24 +236,37 @@ stp_catprintf(char **strp, const char *format, ...)
   *strp = result2;
 }
 
+/* Like stp_catprintf(), but *strp is reallocated rather than leaked */
+void
+stpi_catprintf(char **strp, const char *format, ...)
+{
+  char *result;
+  int bytes;
+  size_t length = *strp ? strlen(*strp) : 0;
+  STPI_VASPRINTF(result, bytes, format);
+  *strp = stp_realloc(*strp, length + bytes + 1);
+  memcpy(*strp + length, result, bytes + 1);
+  stp_free(result);
+}
+
 
 void
 stp_zfwrite(const char *buf, size_t bytes, size_t nitems, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), buf, bytes * nitems);
+  write_output(v, buf, bytes * nitems);
 }
 
 void
 stp_write_raw(const stp_raw_t *raw, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), raw->data, raw->bytes);
+  write_output(v, raw->data, raw->bytes);
 }
 
 void
 stp_putc(int ch, const stp_vars_t *v)
 {
   unsigned char a = (unsigned char) ch;
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), (char *) &a, 1);
+  write_output(v, (char *) &a, 1);
 }
 
 #define BYTE(expr, byteno) (((expr) >> (8 * byteno)) & 0xff)
@@ -174,13 +306,13 @@ stp_put32_be(unsigned int in, const stp_vars_t *v)
 void
 stp_puts(const char *s, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), s, strlen(s));
+  write_output(v, s, strlen(s));
 }
 
 void
 stp_putraw(const stp_raw_t *r, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), r->data, r->bytes);
+  write_output(v, r->data, r->bytes);
 }
 
 void
@@ -376,6 +508,75 @@ stp_deprintf(unsigned long level, const char *format, ...)
   va_end(args);
 }
 
+/*
+ * CPU features available to the vectorized kernels.  Setting STP_NO_SIMD
+ * in the environment forces the portable code paths.
+ */
+static unsigned stpi_cpu_feature_mask = 0;
+
+#ifdef STPI_X86_SIMD
+/*
+ * AMD family 17h processors implement PDEP and PEXT in microcode, which
+ * makes them far slower than the SSE2 alternatives.
+ */
+static int
+stpi_fast_bmi2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("amdfam17h");
+}
+#endif
+
+static void
+stpi_init_cpu(void)
+{
+  static int cpu_initialized = 0;
+  if (!cpu_initialized)
+    {
+      cpu_initialized = 1;
+#ifdef STPI_X86_SIMD
+      if (!getenv("STP_NO_SIMD"))
+	{
+	  __builtin_cpu_init();
+	  if (__builtin_cpu_supports("sse2"))
+	    stpi_cpu_feature_mask |= STPI_CPU_SSE2;
+	  if (__builtin_cpu_supports("avx2"))
+	    stpi_cpu_feature_mask |= STPI_CPU_AVX2;
+	  if (stpi_fast_bmi2())
+	    stpi_cpu_feature_mask |= STPI_CPU_BMI2;
+	}
+#endif
+    }
+}
+
+unsigned
+stpi_cpu_features(void)
+{
+  stpi_init_cpu();
+  return stpi_cpu_feature_mask;
+}
+
+unsigned
+stpi_set_cpu_features(unsigned features)
+{
+  unsigned old_features;
+  stpi_init_cpu();
+  old_features = stpi_cpu_feature_mask;
+#ifdef STPI_X86_SIMD
+  if (!(features & STPI_CPU_SSE2))
+    features &= ~STPI_CPU_AVX2;
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("sse2"))
+    features &= ~STPI_CPU_SSE2;
+  if (!__builtin_cpu_supports("avx2"))
+    features &= ~STPI_CPU_AVX2;
+  if (!stpi_fast_bmi2())
+    features &= ~STPI_CPU_BMI2;
+  stpi_cpu_feature_mask = features;
+#endif
+  return old_features;
+}
+
 static void
 fill_buffer_writefunc(void *priv, const char *buffer, size_t bytes)
 {
@@ -484,6 +685,7 @@ stp_init(void)
       stp_free(locale);
 #endif
       stpi_init_debug();
+      stpi_init_cpu();
       stp_xml_preinit();
       stpi_init_printer();
       stpi_init_paper();
@@ -33,11 +33,19 @@
 #ifdef HAVE_LIMITS_H
 #include <limits.h>
 #endif
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_LOCALE_H
+#include <locale.h>
+#endif
 #include <gutenprint/gutenprint.h>
 #include "gutenprint-internal.h"
 #include <gutenprint/gutenprint-intl-internal.h>
 #include "generic-options.h"
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 typedef struct
 {
@@ -55,6 +63,18 @@ typedef struct
   } value;
 } value_t;
 
+/*
+ * Copies of a stp_vars_t share each of their parameter lists until one of
+ * them changes it; the first change gives that copy a list of its own
+ * (see writable_params()).  Copying a stp_vars_t thus only costs a
+ * reference per parameter type.
+ */
+typedef struct
+{
+  stp_list_t *list;
+  int refcount;
+} value_list_t;
+
 struct stp_compdata
 {
   char *name;
@@ -73,13 +93,14 @@ struct stp_vars			/* Plug-in variables */
   int	height;			/* ... */
   int	page_width;		/* Width of page in points */
   int	page_height;		/* Height of page in points */
-  stp_list_t *params[STP_PARAMETER_TYPE_INVALID];
+  value_list_t *params[STP_PARAMETER_TYPE_INVALID];
   stp_list_t *internal_data;
   void (*outfunc)(void *data, const char *buffer, size_t bytes);
   void *outdata;
   void (*errfunc)(void *data, const char *buffer, size_t bytes);
   void *errdata;
   int verified;			/* Ensure that params are OK! */
+  stpi_arena_t *arena;		/* Scratch memory for the current job */
 };
 
 static int standard_vars_initialized = 0;
@@ -218,6 +239,534 @@ copy_value_list(const stp_list_t *src)
   return ret;
 }
 
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t value_list_lock = PTHREAD_MUTEX_INITIALIZER;
+#define VALUE_LIST_LOCK() pthread_mutex_lock(&value_list_lock)
+#define VALUE_LIST_UNLOCK() pthread_mutex_unlock(&value_list_lock)
+#else
+#define VALUE_LIST_LOCK() do { } while (0)
+#define VALUE_LIST_UNLOCK() do { } while (0)
+#endif
+
+static value_list_t *
+create_value_list(stp_list_t *list)
+{
+  value_list_t *ret = stp_malloc(sizeof(value_list_t));
+  ret->list = list;
+  ret->refcount = 1;
+  return ret;
+}
+
+static value_list_t *
+value_list_ref(value_list_t *vl)
+{
+  VALUE_LIST_LOCK();
+  vl->refcount++;
+  VALUE_LIST_UNLOCK();
+  return vl;
+}
+
+static void
+value_list_unref(value_list_t *vl)
+{
+  int refcount;
+  if (!vl)
+    return;
+  VALUE_LIST_LOCK();
+  refcount = --vl->refcount;
+  VALUE_LIST_UNLOCK();
+  if (refcount > 0)
+    return;
+  stp_list_destroy(vl->list);
+  stp_free(vl);
+}
+
+/*
+ * Return the list of parameters of p_type, first copying it if it's
+ * shared with another stp_vars_t.  Anything that changes a parameter
+ * list must get it from here.
+ */
+static stp_list_t *
+writable_params(stp_vars_t *v, stp_parameter_type_t p_type)
+{
+  value_list_t *vl = v->params[p_type];
+  int shared;
+  VALUE_LIST_LOCK();
+  shared = vl->refcount > 1;
+  VALUE_LIST_UNLOCK();
+  if (shared)
+    {
+      v->params[p_type] = create_value_list(copy_value_list(vl->list));
+      value_list_unref(vl);
+    }
+  return v->params[p_type]->list;
+}
+
+/*
+ * Parameter descriptions are cached by printer driver, color module,
+ * parameter name and message locale (their text is translated).  While
+ * a description is computed, each parameter and page dimension that it
+ * reads from a stp_vars_t is recorded, along with the value that was
+ * read.  A cached description is reused only if all of those still have
+ * the same values in the vars being described.  Descriptions that
+ * depend on anything else call stpi_describe_uncacheable().
+ *
+ * STP_DESCRIBE_CACHE_SIZE sets the number of descriptions kept (default
+ * DESCRIBE_CACHE_DEFAULT_SIZE; 0 turns the cache off).
+ */
+
+#define DESCRIBE_CACHE_BUCKETS		256
+#define DESCRIBE_CACHE_DEFAULT_SIZE	4096
+
+typedef struct
+{
+  stp_parameter_type_t typ;	/* STP_PARAMETER_TYPE_INVALID for a field */
+  char *name;
+  value_t *value;		/* Copy of the value read; NULL if unset */
+  size_t field;			/* Offset of the (int) field read */
+  int ival;			/* ...and its value */
+} describe_dep_t;
+
+typedef struct
+{
+  const stp_vars_t *v;		/* Vars being described */
+  describe_dep_t *deps;
+  int count;
+  int size;
+  int uncacheable;
+} describe_frame_t;
+
+typedef struct describe_entry
+{
+  struct describe_entry *next;
+  unsigned hash;
+  char *driver;
+  char *color_conversion;
+  char *name;
+  char *locale;
+  describe_dep_t *deps;
+  int count;
+  stp_parameter_t desc;
+  int deflt_index;		/* Item of bounds.str that deflt.str names */
+} describe_entry_t;
+
+static describe_entry_t *describe_cache[DESCRIBE_CACHE_BUCKETS];
+static stpi_describe_cache_stats_t describe_cache_stats;
+static int describe_cache_size = -1;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t describe_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define DESCRIBE_CACHE_LOCK() pthread_mutex_lock(&describe_cache_lock)
+#define DESCRIBE_CACHE_UNLOCK() pthread_mutex_unlock(&describe_cache_lock)
+
+static pthread_key_t describe_frame_key;
+static pthread_once_t describe_frame_once = PTHREAD_ONCE_INIT;
+
+static void
+create_describe_frame_key(void)
+{
+  pthread_key_create(&describe_frame_key, NULL);
+}
+
+static describe_frame_t *
+current_describe_frame(void)
+{
+  pthread_once(&describe_frame_once, create_describe_frame_key);
+  return (describe_frame_t *) pthread_getspecific(describe_frame_key);
+}
+
+static void
+set_describe_frame(describe_frame_t *frame)
+{
+  pthread_once(&describe_frame_once, create_describe_frame_key);
+  pthread_setspecific(describe_frame_key, frame);
+}
+#else
+#define DESCRIBE_CACHE_LOCK() do { } while (0)
+#define DESCRIBE_CACHE_UNLOCK() do { } while (0)
+
+static describe_frame_t *describe_frame = NULL;
+
+static describe_frame_t *
+current_describe_frame(void)
+{
+  return describe_frame;
+}
+
+static void
+set_describe_frame(describe_frame_t *frame)
+{
+  describe_frame = frame;
+}
+#endif
+
+static void
+add_dependency(describe_frame_t *frame, stp_parameter_type_t typ,
+	       const char *name, const value_t *val, size_t field, int ival)
+{
+  describe_dep_t *dep;
+  int i;
+  for (i = 0; i < frame->count; i++)
+    {
+      dep = &(frame->deps[i]);
+      if (dep->typ == typ &&
+	  (typ == STP_PARAMETER_TYPE_INVALID ? dep->field == field :
+	   strcmp(dep->name, name) == 0))
+	return;
+    }
+  if (frame->count == frame->size)
+    {
+      frame->size = frame->size ? frame->size * 2 : 16;
+      frame->deps = stp_realloc(frame->deps,
+				frame->size * sizeof(describe_dep_t));
+    }
+  dep = &(frame->deps[frame->count++]);
+  dep->typ = typ;
+  dep->name = name ? stp_strdup(name) : NULL;
+  dep->value = val ? value_copy(val) : NULL;
+  dep->field = field;
+  dep->ival = ival;
+}
+
+static void
+free_dependencies(describe_dep_t *deps, int count)
+{
+  int i;
+  for (i = 0; i < count; i++)
+    {
+      STP_SAFE_FREE(deps[i].name);
+      if (deps[i].value)
+	value_freefunc(deps[i].value);
+    }
+  STP_SAFE_FREE(deps);
+}
+
+/*
+ * Record that the description being computed read this parameter.  Only
+ * reads from the vars being described count; drivers also keep settings
+ * of their own in stp_vars_t (e.g. per resolution), which don't change.
+ */
+static void
+note_parameter(const stp_vars_t *v, stp_parameter_type_t typ,
+	       const char *name, const stp_list_item_t *item)
+{
+  describe_frame_t *frame = current_describe_frame();
+  if (!frame || frame->v != v || frame->uncacheable)
+    return;
+  /* Comparing curves and arrays would cost about as much as describing */
+  if (item && (typ == STP_PARAMETER_TYPE_CURVE ||
+	       typ == STP_PARAMETER_TYPE_ARRAY))
+    frame->uncacheable = 1;
+  else
+    add_dependency(frame, typ, name,
+		   item ? (const value_t *) stp_list_item_get_data(item) : NULL,
+		   0, 0);
+}
+
+static void
+note_field(const stp_vars_t *v, size_t field, int ival)
+{
+  describe_frame_t *frame = current_describe_frame();
+  if (frame && frame->v == v && !frame->uncacheable)
+    add_dependency(frame, STP_PARAMETER_TYPE_INVALID, NULL, NULL, field, ival);
+}
+
+/* The description depends on which parameters are set at all */
+static void
+note_all_parameters(const stp_vars_t *v)
+{
+  describe_frame_t *frame = current_describe_frame();
+  if (frame && frame->v == v)
+    frame->uncacheable = 1;
+}
+
+void
+stpi_describe_uncacheable(void)
+{
+  describe_frame_t *frame = current_describe_frame();
+  if (frame)
+    frame->uncacheable = 1;
+}
+
+static int
+dependency_holds(const stp_vars_t *v, const describe_dep_t *dep)
+{
+  const stp_list_item_t *item;
+  const value_t *val;
+  if (dep->typ == STP_PARAMETER_TYPE_INVALID)
+    return *((const int *) ((const char *) v + dep->field)) == dep->ival;
+  item = stp_list_get_item_by_name(v->params[dep->typ]->list, dep->name);
+  if (!item || !dep->value)
+    return !item && !dep->value;
+  val = (const value_t *) stp_list_item_get_data(item);
+  if (val->active != dep->value->active)
+    return 0;
+  switch (dep->typ)
+    {
+    case STP_PARAMETER_TYPE_STRING_LIST:
+    case STP_PARAMETER_TYPE_FILE:
+    case STP_PARAMETER_TYPE_RAW:
+      return (val->value.rval.bytes == dep->value->value.rval.bytes &&
+	      (val->value.rval.bytes == 0 ||
+	       memcmp(val->value.rval.data, dep->value->value.rval.data,
+		      val->value.rval.bytes) == 0));
+    case STP_PARAMETER_TYPE_INT:
+    case STP_PARAMETER_TYPE_DIMENSION:
+    case STP_PARAMETER_TYPE_BOOLEAN:
+      return val->value.ival == dep->value->value.ival;
+    case STP_PARAMETER_TYPE_DOUBLE:
+      return val->value.dval == dep->value->value.dval;
+    default:
+      return 0;
+    }
+}
+
+/*
+ * Cached descriptions are handed out as copies.  A string list's default
+ * that isn't one of its own choices is interned, as it may point into
+ * memory that the driver frees; curve and array defaults point into the
+ * drivers' and color modules' own tables.  Raw and file parameters
+ * aren't cached.
+ */
+static int
+description_cacheable(const stp_parameter_t *desc, int *deflt_index)
+{
+  int i;
+  *deflt_index = -1;
+  switch (desc->p_type)
+    {
+    case STP_PARAMETER_TYPE_STRING_LIST:
+      if (desc->deflt.str && desc->bounds.str)
+	for (i = 0; i < stp_string_list_count(desc->bounds.str); i++)
+	  if (stp_string_list_param(desc->bounds.str, i)->name ==
+	      desc->deflt.str)
+	    {
+	      *deflt_index = i;
+	      break;
+	    }
+      return 1;
+    case STP_PARAMETER_TYPE_CURVE:
+      return !desc->bounds.curve || desc->deflt.curve != desc->bounds.curve;
+    case STP_PARAMETER_TYPE_ARRAY:
+      return !desc->bounds.array || desc->deflt.array != desc->bounds.array;
+    case STP_PARAMETER_TYPE_INVALID:
+    case STP_PARAMETER_TYPE_INT:
+    case STP_PARAMETER_TYPE_DIMENSION:
+    case STP_PARAMETER_TYPE_BOOLEAN:
+    case STP_PARAMETER_TYPE_DOUBLE:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+/* Called with the cache locked; interned strings are never freed */
+static const char *
+intern_string(const char *str)
+{
+  static stp_string_list_t *interned = NULL;
+  if (!interned)
+    interned = stp_string_list_create();
+  if (!stp_string_list_is_present(interned, str))
+    stp_string_list_add_string(interned, str, str);
+  return stp_string_list_find(interned, str)->name;
+}
+
+static void
+copy_description(stp_parameter_t *to, const stp_parameter_t *from,
+		 int deflt_index)
+{
+  *to = *from;
+  switch (from->p_type)
+    {
+    case STP_PARAMETER_TYPE_STRING_LIST:
+      if (from->bounds.str)
+	{
+	  to->bounds.str = stp_string_list_create_copy(from->bounds.str);
+	  if (deflt_index >= 0)
+	    to->deflt.str =
+	      stp_string_list_param(to->bounds.str, deflt_index)->name;
+	}
+      break;
+    case STP_PARAMETER_TYPE_CURVE:
+      if (from->bounds.curve)
+	to->bounds.curve = stp_curve_create_copy(from->bounds.curve);
+      break;
+    case STP_PARAMETER_TYPE_ARRAY:
+      if (from->bounds.array)
+	to->bounds.array = stp_array_create_copy(from->bounds.array);
+      break;
+    default:
+      break;
+    }
+}
+
+static unsigned
+describe_cache_hash(const char *driver, const char *color_conversion,
+		    const char *name, const char *locale)
+{
+  return (stpi_hash_string(name) ^ (stpi_hash_string(driver) * 31) ^
+	  (stpi_hash_string(color_conversion) * 961) ^
+	  (stpi_hash_string(locale) * 29791));
+}
+
+/*
+ * Everything gettext() looks at to pick a translation, so that an
+ * application that changes its locale after describing parameters
+ * doesn't get descriptions in the old language.
+ */
+static char *
+describe_cache_locale(void)
+{
+  const char *messages = NULL;
+  const char *language = NULL;
+  const char *codeset = NULL;
+  char *answer;
+#if defined(HAVE_LOCALE_H) && defined(LC_MESSAGES)
+  messages = setlocale(LC_MESSAGES, NULL);
+#endif
+#if defined(ENABLE_NLS) && !defined(DISABLE_NLS)
+  language = getenv("LANGUAGE");
+#if !defined(__APPLE__)
+  codeset = bind_textdomain_codeset(PACKAGE, NULL);
+#endif
+#endif
+  stp_asprintf(&answer, "%s:%s:%s", messages ? messages : "",
+	       language ? language : "", codeset ? codeset : "");
+  return answer;
+}
+
+static void
+free_describe_entry(describe_entry_t *entry)
+{
+  stp_free(entry->driver);
+  stp_free(entry->color_conversion);
+  stp_free(entry->name);
+  stp_free(entry->locale);
+  free_dependencies(entry->deps, entry->count);
+  stp_parameter_description_destroy(&(entry->desc));
+  stp_free(entry);
+}
+
+/* Called with the cache locked */
+static void
+flush_describe_cache(void)
+{
+  int i;
+  for (i = 0; i < DESCRIBE_CACHE_BUCKETS; i++)
+    while (describe_cache[i])
+      {
+	describe_entry_t *next = describe_cache[i]->next;
+	free_describe_entry(describe_cache[i]);
+	describe_cache[i] = next;
+      }
+  describe_cache_stats.entries = 0;
+}
+
+static int
+describe_cache_enabled(void)
+{
+  int enabled;
+  DESCRIBE_CACHE_LOCK();
+  if (describe_cache_size < 0)
+    {
+      const char *size = getenv("STP_DESCRIBE_CACHE_SIZE");
+      describe_cache_size = size ? atoi(size) : DESCRIBE_CACHE_DEFAULT_SIZE;
+      if (describe_cache_size < 0)
+	describe_cache_size = 0;
+    }
+  enabled = describe_cache_size > 0;
+  DESCRIBE_CACHE_UNLOCK();
+  return enabled;
+}
+
+/*
+ * Look for a cached description of name that's valid for v.  On a hit,
+ * whatever description asked for this one inherits its dependencies.
+ */
+static int
+find_description(const stp_vars_t *v, const char *driver,
+		 const char *color_conversion, const char *name,
+		 const char *locale, unsigned hash,
+		 stp_parameter_t *description)
+{
+  describe_entry_t **link;
+  DESCRIBE_CACHE_LOCK();
+  for (link = &(describe_cache[hash % DESCRIBE_CACHE_BUCKETS]); *link;
+       link = &((*link)->next))
+    {
+      describe_entry_t *entry = *link;
+      int i;
+      if (entry->hash != hash || strcmp(entry->name, name) != 0 ||
+	  strcmp(entry->driver, driver) != 0 ||
+	  strcmp(entry->color_conversion, color_conversion) != 0 ||
+	  strcmp(entry->locale, locale) != 0)
+	continue;
+      for (i = 0; i < entry->count; i++)
+	if (!dependency_holds(v, &(entry->deps[i])))
+	  break;
+      if (i < entry->count)
+	continue;
+      copy_description(description, &(entry->desc), entry->deflt_index);
+      if (current_describe_frame() && current_describe_frame()->v == v)
+	for (i = 0; i < entry->count; i++)
+	  {
+	    const describe_dep_t *dep = &(entry->deps[i]);
+	    add_dependency(current_describe_frame(), dep->typ, dep->name,
+			   dep->value, dep->field, dep->ival);
+	  }
+      /* Keep the most recently used first in its bucket */
+      *link = entry->next;
+      entry->next = describe_cache[hash % DESCRIBE_CACHE_BUCKETS];
+      describe_cache[hash % DESCRIBE_CACHE_BUCKETS] = entry;
+      describe_cache_stats.hits++;
+      DESCRIBE_CACHE_UNLOCK();
+      return 1;
+    }
+  describe_cache_stats.misses++;
+  DESCRIBE_CACHE_UNLOCK();
+  return 0;
+}
+
+/* Takes over the dependencies recorded in frame */
+static void
+add_description(const char *driver, const char *color_conversion,
+		const char *name, const char *locale, unsigned hash,
+		describe_frame_t *frame, const stp_parameter_t *description,
+		int deflt_index)
+{
+  describe_entry_t *entry = stp_malloc(sizeof(describe_entry_t));
+  entry->hash = hash;
+  entry->driver = stp_strdup(driver);
+  entry->color_conversion = stp_strdup(color_conversion);
+  entry->name = stp_strdup(name);
+  entry->locale = stp_strdup(locale);
+  entry->deps = frame->deps;
+  entry->count = frame->count;
+  copy_description(&(entry->desc), description, deflt_index);
+  entry->deflt_index = deflt_index;
+  frame->deps = NULL;
+  frame->count = 0;
+  DESCRIBE_CACHE_LOCK();
+  if (description->p_type == STP_PARAMETER_TYPE_STRING_LIST &&
+      description->deflt.str && deflt_index < 0)
+    entry->desc.deflt.str = intern_string(description->deflt.str);
+  if (describe_cache_stats.entries >= (unsigned long) describe_cache_size)
+    flush_describe_cache();
+  entry->next = describe_cache[hash % DESCRIBE_CACHE_BUCKETS];
+  describe_cache[hash % DESCRIBE_CACHE_BUCKETS] = entry;
+  describe_cache_stats.entries++;
+  DESCRIBE_CACHE_UNLOCK();
+}
+
+void
+stpi_describe_cache_get_stats(stpi_describe_cache_stats_t *stats)
+{
+  DESCRIBE_CACHE_LOCK();
+  *stats = describe_cache_stats;
+  DESCRIBE_CACHE_UNLOCK();
+}
+
 static const char *
 compdata_namefunc(const void *item)
 {
@@ -276,6 +825,22 @@ stp_destroy_component_data(stp_vars_t *v, const char *name)
     stp_list_item_destroy(v->internal_data, item);
 }
 
+stpi_arena_t *
+stpi_get_arena(const stp_vars_t *v)
+{
+  CHECK_VARS(v);
+  return v->arena;
+}
+
+/* Takes over the caller's reference to arena */
+void
+stpi_set_arena(stp_vars_t *v, stpi_arena_t *arena)
+{
+  CHECK_VARS(v);
+  stpi_arena_unref(v->arena);
+  v->arena = arena;
+}
+
 void *
 stp_get_component_data(const stp_vars_t *v, const char *name)
 {
@@ -317,7 +882,7 @@ initialize_standard_vars(void)
     {
       int i;
       for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
-	default_vars.params[i] = create_vars_list();
+	default_vars.params[i] = create_value_list(create_vars_list());
       default_vars.driver = stp_strdup("ps2");
       default_vars.color_conversion = stp_strdup("traditional");
       default_vars.internal_data = create_compdata_list();
@@ -335,11 +900,8 @@ stp_default_settings(void)
 stp_vars_t *
 stp_vars_create(void)
 {
-  int i;
   stp_vars_t *retval = stp_zalloc(sizeof(stp_vars_t));
   initialize_standard_vars();
-  for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
-    retval->params[i] = create_vars_list();
   retval->internal_data = create_compdata_list();
   stp_vars_copy(retval, (stp_vars_t *)&default_vars);
   return (retval);
@@ -351,8 +913,9 @@ stp_vars_destroy(stp_vars_t *v)
   int i;
   CHECK_VARS(v);
   for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
-    stp_list_destroy(v->params[i]);
+    value_list_unref(v->params[i]);
   stp_list_destroy(v->internal_data);
+  stpi_arena_unref(v->arena);
   STP_SAFE_FREE(v->driver);
   STP_SAFE_FREE(v->color_conversion);
   stp_free(v);
@@ -410,14 +973,32 @@ pre##_get_##s(const stp_vars_t *v)			\
   return v->s;						\
 }
 
+/* Descriptions may depend on the page geometry */
+#define DEF_GEOMETRY_FUNCS(s, pre)			\
+void							\
+pre##_set_##s(stp_vars_t *v, int val)			\
+{							\
+  CHECK_VARS(v);                                        \
+  v->verified = 0;					\
+  v->s = val;						\
+}							\
+							\
+int							\
+pre##_get_##s(const stp_vars_t *v)			\
+{							\
+  CHECK_VARS(v);                                        \
+  note_field(v, offsetof(stp_vars_t, s), v->s);		\
+  return v->s;						\
+}
+
 DEF_STRING_FUNCS(driver, stp)
 DEF_STRING_FUNCS(color_conversion, stp)
-DEF_FUNCS(left, int, stp)
-DEF_FUNCS(top, int, stp)
-DEF_FUNCS(width, int, stp)
-DEF_FUNCS(height, int, stp)
-DEF_FUNCS(page_width, int, stp)
-DEF_FUNCS(page_height, int, stp)
+DEF_GEOMETRY_FUNCS(left, stp)
+DEF_GEOMETRY_FUNCS(top, stp)
+DEF_GEOMETRY_FUNCS(width, stp)
+DEF_GEOMETRY_FUNCS(height, stp)
+DEF_GEOMETRY_FUNCS(page_width, stp)
+DEF_GEOMETRY_FUNCS(page_height, stp)
 DEF_FUNCS(outdata, void *, stp)
 DEF_FUNCS(errdata, void *, stp)
 DEF_FUNCS(outfunc, stp_outfunc_t, stp)
@@ -486,7 +1067,7 @@ void
 stp_set_string_parameter_n(stp_vars_t *v, const char *parameter,
 			   const char *value, size_t bytes)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_STRING_LIST];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_STRING_LIST);
   if (value)
     stp_deprintf(STP_DBG_VARS, "stp_set_string_parameter(0x%p, %s, %s)\n",
 		 (const void *) v, parameter, value);
@@ -515,7 +1096,7 @@ void
 stp_set_default_string_parameter_n(stp_vars_t *v, const char *parameter,
 				   const char *value, size_t bytes)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_STRING_LIST];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_STRING_LIST);
   stp_deprintf(STP_DBG_VARS, "stp_set_default_string_parameter(0x%p, %s, %s)\n",
 	       (const void *) v, parameter, value ? value : "NULL");
   set_default_raw_parameter(list, parameter, value, bytes,
@@ -543,12 +1124,13 @@ stp_clear_string_parameter(stp_vars_t *v, const char *parameter)
 const char *
 stp_get_string_parameter(const stp_vars_t *v, const char *parameter)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_STRING_LIST];
-  value_t *val;
-  stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_STRING_LIST]->list;
+  const value_t *val;
+  const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+  note_parameter(v, STP_PARAMETER_TYPE_STRING_LIST, parameter, item);
   if (item)
     {
-      val = (value_t *) stp_list_item_get_data(item);
+      val = (const value_t *) stp_list_item_get_data(item);
       return val->value.rval.data;
     }
   else
@@ -559,7 +1141,7 @@ void
 stp_set_raw_parameter(stp_vars_t *v, const char *parameter,
 		      const void *value, size_t bytes)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_RAW];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_RAW);
   set_raw_parameter(list, parameter, value, bytes, STP_PARAMETER_TYPE_RAW);
   stp_set_verified(v, 0);
 }
@@ -568,7 +1150,7 @@ void
 stp_set_default_raw_parameter(stp_vars_t *v, const char *parameter,
 			      const void *value, size_t bytes)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_RAW];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_RAW);
   set_default_raw_parameter(list, parameter, value, bytes,
 			    STP_PARAMETER_TYPE_RAW);
   stp_set_verified(v, 0);
@@ -583,9 +1165,10 @@ stp_clear_raw_parameter(stp_vars_t *v, const char *parameter)
 const stp_raw_t *
 stp_get_raw_parameter(const stp_vars_t *v, const char *parameter)
 {
-  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_RAW];
+  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_RAW]->list;
   const value_t *val;
   const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+  note_parameter(v, STP_PARAMETER_TYPE_RAW, parameter, item);
   if (item)
     {
       val = (const value_t *) stp_list_item_get_data(item);
@@ -599,7 +1182,7 @@ void
 stp_set_file_parameter(stp_vars_t *v, const char *parameter,
 		       const char *value)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_FILE];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_FILE);
   size_t byte_count = 0;
   if (value)
     byte_count = strlen(value);
@@ -614,7 +1197,7 @@ void
 stp_set_file_parameter_n(stp_vars_t *v, const char *parameter,
 			 const char *value, size_t byte_count)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_FILE];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_FILE);
   stp_deprintf(STP_DBG_VARS, "stp_set_file_parameter(0x%p, %s, %s)\n",
 	       (const void *) v, parameter, value ? value : "NULL");
   set_raw_parameter(list, parameter, value, byte_count,
@@ -626,7 +1209,7 @@ void
 stp_set_default_file_parameter(stp_vars_t *v, const char *parameter,
 			       const char *value)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_FILE];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_FILE);
   size_t byte_count = 0;
   if (value)
     byte_count = strlen(value);
@@ -641,7 +1224,7 @@ void
 stp_set_default_file_parameter_n(stp_vars_t *v, const char *parameter,
 				 const char *value, size_t byte_count)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_FILE];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_FILE);
   stp_deprintf(STP_DBG_VARS, "stp_set_default_file_parameter(0x%p, %s, %s)\n",
 	       (const void *) v, parameter, value ? value : "NULL");
   set_default_raw_parameter(list, parameter, value, byte_count,
@@ -658,9 +1241,10 @@ stp_clear_file_parameter(stp_vars_t *v, const char *parameter)
 const char *
 stp_get_file_parameter(const stp_vars_t *v, const char *parameter)
 {
-  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_FILE];
+  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_FILE]->list;
   const value_t *val;
   const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+  note_parameter(v, STP_PARAMETER_TYPE_FILE, parameter, item);
   if (item)
     {
       val = (const value_t *) stp_list_item_get_data(item);
@@ -674,7 +1258,7 @@ void
 stp_set_curve_parameter(stp_vars_t *v, const char *parameter,
 			const stp_curve_t *curve)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_CURVE];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_CURVE);
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_curve_parameter(0x%p, %s)\n",
 	       (const void *) v, parameter);
@@ -708,7 +1292,7 @@ void
 stp_set_default_curve_parameter(stp_vars_t *v, const char *parameter,
 				const stp_curve_t *curve)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_CURVE];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_CURVE);
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_default_curve_parameter(0x%p, %s)\n",
 	       (const void *) v, parameter);
@@ -737,9 +1321,10 @@ stp_clear_curve_parameter(stp_vars_t *v, const char *parameter)
 const stp_curve_t *
 stp_get_curve_parameter(const stp_vars_t *v, const char *parameter)
 {
-  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_CURVE];
+  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_CURVE]->list;
   const value_t *val;
   const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+  note_parameter(v, STP_PARAMETER_TYPE_CURVE, parameter, item);
   if (item)
     {
       val = (value_t *) stp_list_item_get_data(item);
@@ -753,7 +1338,7 @@ void
 stp_set_array_parameter(stp_vars_t *v, const char *parameter,
 			const stp_array_t *array)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_ARRAY];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_ARRAY);
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_array_parameter(0x%p, %s)\n",
 	       (const void *) v, parameter);
@@ -786,7 +1371,7 @@ void
 stp_set_default_array_parameter(stp_vars_t *v, const char *parameter,
 				const stp_array_t *array)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_ARRAY];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_ARRAY);
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_default_array_parameter(0x%p, %s)\n",
 	       (const void *) v, parameter);
@@ -815,9 +1400,10 @@ stp_clear_array_parameter(stp_vars_t *v, const char *parameter)
 const stp_array_t *
 stp_get_array_parameter(const stp_vars_t *v, const char *parameter)
 {
-  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_ARRAY];
+  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_ARRAY]->list;
   const value_t *val;
   const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+  note_parameter(v, STP_PARAMETER_TYPE_ARRAY, parameter, item);
   if (item)
     {
       val = (const value_t *) stp_list_item_get_data(item);
@@ -830,7 +1416,7 @@ stp_get_array_parameter(const stp_vars_t *v, const char *parameter)
 void
 stp_set_int_parameter(stp_vars_t *v, const char *parameter, int ival)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_INT];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_INT);
   value_t *val;
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_int_parameter(0x%p, %s, %d)\n",
@@ -856,7 +1442,7 @@ stp_set_int_parameter(stp_vars_t *v, const char *parameter, int ival)
 void
 stp_set_default_int_parameter(stp_vars_t *v, const char *parameter, int ival)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_INT];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_INT);
   value_t *val;
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_default_int_parameter(0x%p, %s, %d)\n",
@@ -876,7 +1462,7 @@ stp_set_default_int_parameter(stp_vars_t *v, const char *parameter, int ival)
 void
 stp_clear_int_parameter(stp_vars_t *v, const char *parameter)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_INT];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_INT);
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_clear_int_parameter(0x%p, %s)\n",
 	       (const void *) v, parameter);
@@ -888,8 +1474,9 @@ stp_clear_int_parameter(stp_vars_t *v, const char *parameter)
 int
 stp_get_int_parameter(const stp_vars_t *v, const char *parameter)
 {
-  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_INT];
+  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_INT]->list;
   const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+  note_parameter(v, STP_PARAMETER_TYPE_INT, parameter, item);
   if (item)
     {
       const value_t *val = (const value_t *) stp_list_item_get_data(item);
@@ -919,7 +1506,7 @@ stp_get_int_parameter(const stp_vars_t *v, const char *parameter)
 void
 stp_set_boolean_parameter(stp_vars_t *v, const char *parameter, int ival)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_BOOLEAN];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_BOOLEAN);
   value_t *val;
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_boolean_parameter(0x%p, %s, %d)\n",
@@ -949,7 +1536,7 @@ void
 stp_set_default_boolean_parameter(stp_vars_t *v, const char *parameter,
 				  int ival)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_BOOLEAN];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_BOOLEAN);
   value_t *val;
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_default_boolean_parameter(0x%p, %s, %d)\n",
@@ -972,7 +1559,7 @@ stp_set_default_boolean_parameter(stp_vars_t *v, const char *parameter,
 void
 stp_clear_boolean_parameter(stp_vars_t *v, const char *parameter)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_BOOLEAN];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_BOOLEAN);
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_clear_boolean_parameter(0x%p, %s)\n",
 	       (const void *) v, parameter);
@@ -984,8 +1571,9 @@ stp_clear_boolean_parameter(stp_vars_t *v, const char *parameter)
 int
 stp_get_boolean_parameter(const stp_vars_t *v, const char *parameter)
 {
-  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_BOOLEAN];
+  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_BOOLEAN]->list;
   const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+  note_parameter(v, STP_PARAMETER_TYPE_BOOLEAN, parameter, item);
   if (item)
     {
       const value_t *val = (const value_t *) stp_list_item_get_data(item);
@@ -1015,7 +1603,7 @@ stp_get_boolean_parameter(const stp_vars_t *v, const char *parameter)
 void
 stp_set_dimension_parameter(stp_vars_t *v, const char *parameter, int ival)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_DIMENSION];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_DIMENSION);
   value_t *val;
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_dimension_parameter(0x%p, %s, %d)\n",
@@ -1041,7 +1629,7 @@ stp_set_dimension_parameter(stp_vars_t *v, const char *parameter, int ival)
 void
 stp_set_default_dimension_parameter(stp_vars_t *v, const char *parameter, int ival)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_DIMENSION];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_DIMENSION);
   value_t *val;
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_default_dimension_parameter(0x%p, %s, %d)\n",
@@ -1061,7 +1649,7 @@ stp_set_default_dimension_parameter(stp_vars_t *v, const char *parameter, int iv
 void
 stp_clear_dimension_parameter(stp_vars_t *v, const char *parameter)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_DIMENSION];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_DIMENSION);
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_clear_dimension_parameter(0x%p, %s)\n",
 	       (const void *) v, parameter);
@@ -1073,8 +1661,9 @@ stp_clear_dimension_parameter(stp_vars_t *v, const char *parameter)
 int
 stp_get_dimension_parameter(const stp_vars_t *v, const char *parameter)
 {
-  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_DIMENSION];
+  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_DIMENSION]->list;
   const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+  note_parameter(v, STP_PARAMETER_TYPE_DIMENSION, parameter, item);
   if (item)
     {
       const value_t *val = (const value_t *) stp_list_item_get_data(item);
@@ -1104,7 +1693,7 @@ stp_get_dimension_parameter(const stp_vars_t *v, const char *parameter)
 void
 stp_set_float_parameter(stp_vars_t *v, const char *parameter, double dval)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_DOUBLE];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_DOUBLE);
   value_t *val;
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_float_parameter(0x%p, %s, %f)\n",
@@ -1131,7 +1720,7 @@ void
 stp_set_default_float_parameter(stp_vars_t *v, const char *parameter,
 				double dval)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_DOUBLE];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_DOUBLE);
   value_t *val;
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_set_default_float_parameter(0x%p, %s, %f)\n",
@@ -1151,7 +1740,7 @@ stp_set_default_float_parameter(stp_vars_t *v, const char *parameter,
 void
 stp_clear_float_parameter(stp_vars_t *v, const char *parameter)
 {
-  stp_list_t *list = v->params[STP_PARAMETER_TYPE_DOUBLE];
+  stp_list_t *list = writable_params(v, STP_PARAMETER_TYPE_DOUBLE);
   stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
   stp_deprintf(STP_DBG_VARS, "stp_clear_float_parameter(0x%p, %s)\n",
 	       (const void *) v, parameter);
@@ -1163,8 +1752,9 @@ stp_clear_float_parameter(stp_vars_t *v, const char *parameter)
 double
 stp_get_float_parameter(const stp_vars_t *v, const char *parameter)
 {
-  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_DOUBLE];
+  const stp_list_t *list = v->params[STP_PARAMETER_TYPE_DOUBLE]->list;
   const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+  note_parameter(v, STP_PARAMETER_TYPE_DOUBLE, parameter, item);
   if (item)
     {
       const value_t *val = (value_t *) stp_list_item_get_data(item);
@@ -1262,8 +1852,9 @@ stp_check_parameter(const stp_vars_t *v,
   if (p_type >= STP_PARAMETER_TYPE_STRING_LIST &&
       p_type < STP_PARAMETER_TYPE_INVALID)
     {
-      const stp_list_t *list = v->params[p_type];
+      const stp_list_t *list = v->params[p_type]->list;
       const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+      note_parameter(v, p_type, parameter, item);
       if (item &&
 	  active <= ((const value_t *) stp_list_item_get_data(item))->active)
 	return 1;
@@ -1297,8 +1888,9 @@ stp_list_parameters(const stp_vars_t *v, stp_parameter_type_t p_type)
   if (p_type >= STP_PARAMETER_TYPE_STRING_LIST &&
       p_type < STP_PARAMETER_TYPE_INVALID)
     {
-      const stp_list_t *list = v->params[p_type];
+      const stp_list_t *list = v->params[p_type]->list;
       stp_string_list_t *answer = stp_string_list_create();
+      note_all_parameters(v);
       const stp_list_item_t *li = stp_list_get_start(list);
       while (li)
 	{
@@ -1335,8 +1927,9 @@ stp_get_parameter_active(const stp_vars_t *v, const char *parameter,
   if (p_type >= STP_PARAMETER_TYPE_STRING_LIST &&
       p_type < STP_PARAMETER_TYPE_INVALID)
     {
-      const stp_list_t *list = v->params[p_type];
+      const stp_list_t *list = v->params[p_type]->list;
       const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
+      note_parameter(v, p_type, parameter, item);
       if (item)
 	return ((const value_t *) stp_list_item_get_data(item))->active;
       else
@@ -1371,7 +1964,7 @@ stp_set_parameter_active(stp_vars_t *v,
   if (p_type >= STP_PARAMETER_TYPE_STRING_LIST &&
       p_type < STP_PARAMETER_TYPE_INVALID)
     {
-      const stp_list_t *list = v->params[p_type];
+      const stp_list_t *list = writable_params(v, p_type);
       const stp_list_item_t *item = stp_list_get_item_by_name(list, parameter);
       if (item && (active == STP_PARAMETER_ACTIVE ||
 		   active == STP_PARAMETER_INACTIVE))
@@ -1445,11 +2038,13 @@ stp_vars_copy(stp_vars_t *vd, const stp_vars_t *vs)
   stp_set_errfunc(vd, stp_get_errfunc(vs));
   for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
     {
-      stp_list_destroy(vd->params[i]);
-      vd->params[i] = copy_value_list(vs->params[i]);
+      value_list_t *vl = value_list_ref(vs->params[i]);
+      value_list_unref(vd->params[i]);
+      vd->params[i] = vl;
     }
   stp_list_destroy(vd->internal_data);
   vd->internal_data = copy_compdata_list(vs->internal_data);
+  stpi_set_arena(vd, stpi_arena_ref(vs->arena));
   stp_set_verified(vd, stp_get_verified(vs));
 }
 
@@ -1480,7 +2075,7 @@ stpi_vars_print_error(const stp_vars_t *v, const char *prefix)
   for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
     {
       const stp_list_item_t *item =
-	stp_list_get_start((const stp_list_t *) v->params[i]);
+	stp_list_get_start((const stp_list_t *) v->params[i]->list);
       while (item)
 	{
 	  char *crep;
@@ -1542,7 +2137,7 @@ stp_prune_inactive_options(stp_vars_t *v)
   int i;
   for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
     {
-      stp_list_t *list = v->params[i];
+      stp_list_t *list = writable_params(v, i);
       stp_list_item_t *item = stp_list_get_start(list);
       while (item)
 	{
@@ -1676,9 +2271,9 @@ debug_print_parameter_description(const stp_parameter_t *desc, const char *who,
     }
 }
 
-void
-stp_describe_parameter(const stp_vars_t *v, const char *name,
-		       stp_parameter_t *description)
+static void
+describe_parameter(const stp_vars_t *v, const char *name,
+		   stp_parameter_t *description)
 {
   description->p_type = STP_PARAMETER_TYPE_INVALID;
 /* Set these to NULL in case stpi_*_describe_parameter() doesn't */
@@ -1709,6 +2304,62 @@ stp_describe_parameter(const stp_vars_t *v, const char *name,
     stp_deprintf(STP_DBG_VARS, "Describing invalid parameter %s\n", name);
 }
 
+void
+stp_describe_parameter(const stp_vars_t *v, const char *name,
+		       stp_parameter_t *description)
+{
+  const char *driver = v->driver ? v->driver : "";
+  const char *color_conversion =
+    v->color_conversion ? v->color_conversion : "";
+  describe_frame_t frame;
+  describe_frame_t *parent;
+  char *locale;
+  unsigned hash;
+  int deflt_index;
+
+  if (!name || !describe_cache_enabled())
+    {
+      describe_parameter(v, name, description);
+      return;
+    }
+
+  locale = describe_cache_locale();
+  hash = describe_cache_hash(driver, color_conversion, name, locale);
+  if (find_description(v, driver, color_conversion, name, locale, hash,
+		       description))
+    {
+      debug_print_parameter_description(description, "cache", v);
+      stp_free(locale);
+      return;
+    }
+
+  parent = current_describe_frame();
+  memset(&frame, 0, sizeof(frame));
+  frame.v = v;
+  set_describe_frame(&frame);
+  describe_parameter(v, name, description);
+  set_describe_frame(parent);
+
+  if (parent && parent->v == v)
+    {
+      int i;
+      if (frame.uncacheable)
+	parent->uncacheable = 1;
+      else
+	for (i = 0; i < frame.count; i++)
+	  {
+	    const describe_dep_t *dep = &(frame.deps[i]);
+	    add_dependency(parent, dep->typ, dep->name, dep->value,
+			   dep->field, dep->ival);
+	  }
+    }
+  if (!frame.uncacheable && description_cacheable(description, &deflt_index))
+    add_description(driver, color_conversion, name, locale, hash, &frame,
+		    description, deflt_index);
+  free_dependencies(frame.deps, frame.count);
+  stp_free(locale);
+}
+
 stp_string_list_t *
 stp_parameter_get_categories(const stp_vars_t *v, const stp_parameter_t *desc)
 {
@@ -1891,7 +2542,7 @@ stp_copy_vars_from(stp_vars_t *to, const stp_vars_t *from)
   for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
     {
       const stp_list_item_t *item =
-	stp_list_get_start((const stp_list_t *) from->params[i]);
+	stp_list_get_start((const stp_list_t *) from->params[i]->list);
       while (item)
 	{
 	  const value_t *val = (const value_t *) stp_list_item_get_data(item);
@@ -101,6 +101,7 @@ typedef struct stpi_softweave
   stp_fillfunc *fillfunc;
   stp_packfunc *pack;
   stp_compute_linewidth_func *compute_linewidth;
+  stpi_arena_t *arena;		/* Where the weave's buffers come from */
 } stpi_softweave_t;
 
 /* RAW WEAVE */
@@ -347,6 +348,15 @@ typedef struct cooked {
 	int *stagger_premap;
 	int *pass_postmap;
 	int *stagger_postmap;
+
+	/*
+	 * The raw weave repeats every separation * jets rows, with the
+	 * pass numbers advancing by separation * oversampling.  The
+	 * schedule for one period is kept here, indexed by row within
+	 * the period and subpass, and filled in as rows are looked up.
+	 */
+	int *schedule_pass;		/* Pass for the row in band 1 */
+	short *schedule_jet;		/* Jet, or -1 if not known yet */
 } cooked_t;
 
 typedef struct startmap {
@@ -594,8 +604,12 @@ initialize_weave_params(int separation,		/* I - jet separation */
 {
 	cooked_t *w = stp_malloc(sizeof(cooked_t));
 	if (w) {
+		int entries = separation * jets * oversample;
 		initialize_raw_weave(&w->rw, separation, jets, oversample, strategy, v);
 		calculate_pass_map(v, w, pageheight, firstrow, lastrow);
+		w->schedule_pass = stp_malloc(entries * sizeof(int));
+		w->schedule_jet = stp_malloc(entries * sizeof(short));
+		memset(w->schedule_jet, -1, entries * sizeof(short));
 	}
 	return w;
 }
@@ -609,13 +623,45 @@ stpi_destroy_weave_params(void *vw)
 	if (w->stagger_premap) stp_free(w->stagger_premap);
 	if (w->pass_postmap) stp_free(w->pass_postmap);
 	if (w->stagger_postmap) stp_free(w->stagger_postmap);
+	stp_free(w->schedule_pass);
+	stp_free(w->schedule_jet);
 	stp_free(w);
 }
 
+/*
+ * calculate_raw_row_parameters() for a row at least one period down the
+ * page, from the schedule.
+ */
+static void
+schedule_raw_row_parameters(cooked_t *w,	/* I - weave parameters */
+                            int row,		/* I - row number */
+                            int subpass,	/* I - subpass number */
+                            int *pass,		/* O - pass number */
+                            int *jet,		/* O - jet number in pass */
+                            int *startrow)	/* O - starting row of pass */
+{
+	int period = w->rw.separation * w->rw.jets;
+	int index = (row % period) * w->rw.oversampling + subpass;
+
+	if (w->schedule_jet[index] < 0) {
+		int raw_pass, raw_jet, raw_startrow;
+		calculate_raw_row_parameters(&w->rw, row % period + period,
+		                             subpass, &raw_pass, &raw_jet,
+		                             &raw_startrow);
+		w->schedule_pass[index] = raw_pass;
+		w->schedule_jet[index] = raw_jet;
+	}
+	*jet = w->schedule_jet[index];
+	*pass = w->schedule_pass[index] + (row / period - 1)
+	          * w->rw.separation * w->rw.oversampling;
+	*startrow = row - *jet * w->rw.separation;
+}
+
 static void
 stpi_calculate_row_parameters(void *vw,		/* I - weave parameters */
 			      int row,		/* I - row number */
 			      int subpass,	/* I - subpass */
+			      int direct,	/* I - bypass the schedule */
 			      int *pass,	/* O - pass containing row */
 			      int *jetnum,	/* O - jet number of row */
 			      int *startingrow,	/* O - phys start of pass */
@@ -629,9 +675,16 @@ stpi_calculate_row_parameters(void *vw,		/* I - weave parameters */
 
 	STPI_ASSERT(row >= w->first_row_printed, w->rw.v);
 	STPI_ASSERT(row <= w->last_row_printed, w->rw.v);
-	calculate_raw_row_parameters(&w->rw,
-	                             row + w->rw.separation * w->rw.jets,
-	                             subpass, &raw_pass, &jet, &startrow);
+	if (!direct && row >= 0 && subpass >= 0 &&
+	    subpass < w->rw.oversampling)
+		schedule_raw_row_parameters(w,
+		                            row + w->rw.separation * w->rw.jets,
+		                            subpass, &raw_pass, &jet, &startrow);
+	else
+		calculate_raw_row_parameters(&w->rw,
+		                             row + w->rw.separation * w->rw.jets,
+		                             subpass, &raw_pass, &jet,
+		                             &startrow);
 	startrow -= w->rw.separation * w->rw.jets;
 	jetsused = w->rw.jets;
 	phantomrows = 0;
@@ -883,67 +936,72 @@ stpi_calculate_row_parameters(void *vw,		/* I - weave parameters */
  */
 
 static stp_lineoff_t *
-allocate_lineoff(int count, int ncolors)
+allocate_lineoff(stpi_arena_t *arena, int count, int ncolors)
 {
   int i;
-  stp_lineoff_t *retval = stp_malloc(count * sizeof(stp_lineoff_t));
+  stp_lineoff_t *retval =
+    stpi_arena_malloc(arena, count * sizeof(stp_lineoff_t));
   for (i = 0; i < count; i++)
     {
       retval[i].ncolors = ncolors;
-      retval[i].v = stp_zalloc(ncolors * sizeof(unsigned long));
+      retval[i].v = stpi_arena_zalloc(arena, ncolors * sizeof(unsigned long));
     }
   return (retval);
 }
 
 static stp_lineactive_t *
-allocate_lineactive(int count, int ncolors)
+allocate_lineactive(stpi_arena_t *arena, int count, int ncolors)
 {
   int i;
-  stp_lineactive_t *retval = stp_malloc(count * sizeof(stp_lineactive_t));
+  stp_lineactive_t *retval =
+    stpi_arena_malloc(arena, count * sizeof(stp_lineactive_t));
   for (i = 0; i < count; i++)
     {
       retval[i].ncolors = ncolors;
-      retval[i].v = stp_zalloc(ncolors * sizeof(char));
+      retval[i].v = stpi_arena_zalloc(arena, ncolors * sizeof(char));
     }
   return (retval);
 }
 
 static stp_linecount_t *
-allocate_linecount(int count, int ncolors)
+allocate_linecount(stpi_arena_t *arena, int count, int ncolors)
 {
   int i;
-  stp_linecount_t *retval = stp_malloc(count * sizeof(stp_linecount_t));
+  stp_linecount_t *retval =
+    stpi_arena_malloc(arena, count * sizeof(stp_linecount_t));
   for (i = 0; i < count; i++)
     {
       retval[i].ncolors = ncolors;
-      retval[i].v = stp_zalloc(ncolors * sizeof(int));
+      retval[i].v = stpi_arena_zalloc(arena, ncolors * sizeof(int));
     }
   return (retval);
 }
 
 static stp_linebounds_t *
-allocate_linebounds(int count, int ncolors)
+allocate_linebounds(stpi_arena_t *arena, int count, int ncolors)
 {
   int i;
-  stp_linebounds_t *retval = stp_malloc(count * sizeof(stp_linebounds_t));
+  stp_linebounds_t *retval =
+    stpi_arena_malloc(arena, count * sizeof(stp_linebounds_t));
   for (i = 0; i < count; i++)
     {
       retval[i].ncolors = ncolors;
-      retval[i].start_pos = stp_zalloc(ncolors * sizeof(int));
-      retval[i].end_pos = stp_zalloc(ncolors * sizeof(int));
+      retval[i].start_pos = stpi_arena_zalloc(arena, ncolors * sizeof(int));
+      retval[i].end_pos = stpi_arena_zalloc(arena, ncolors * sizeof(int));
     }
   return (retval);
 }
 
 static stp_linebufs_t *
-allocate_linebuf(int count, int ncolors)
+allocate_linebuf(stpi_arena_t *arena, int count, int ncolors)
 {
   int i;
-  stp_linebufs_t *retval = stp_malloc(count * sizeof(stp_linebufs_t));
+  stp_linebufs_t *retval =
+    stpi_arena_malloc(arena, count * sizeof(stp_linebufs_t));
   for (i = 0; i < count; i++)
     {
       retval[i].ncolors = ncolors;
-      retval[i].v = stp_zalloc(ncolors * sizeof(unsigned char *));
+      retval[i].v = stpi_arena_zalloc(arena, ncolors * sizeof(unsigned char *));
     }
   return (retval);
 }
@@ -968,34 +1026,34 @@ stpi_destroy_weave(void *vsw)
 {
   int i, j;
   stpi_softweave_t *sw = (stpi_softweave_t *) vsw;
-  stp_free(sw->passes);
+  stpi_arena_free(sw->passes);
   if (sw->fold_buf)
-    stp_free(sw->fold_buf);
+    stpi_arena_free(sw->fold_buf);
   if (sw->comp_buf)
-    stp_free(sw->comp_buf);
+    stpi_arena_free(sw->comp_buf);
   for (i = 0; i < STP_MAX_WEAVE; i++)
     if (sw->s[i])
-      stp_free(sw->s[i]);
+      stpi_arena_free(sw->s[i]);
   for (i = 0; i < sw->vmod; i++)
     {
       for (j = 0; j < sw->ncolors; j++)
 	{
 	  if (sw->linebases[i].v[j])
-	    stp_free(sw->linebases[i].v[j]);
+	    stpi_arena_free(sw->linebases[i].v[j]);
 	}
-      stp_free(sw->linecounts[i].v);
-      stp_free(sw->linebases[i].v);
-      stp_free(sw->lineactive[i].v);
-      stp_free(sw->lineoffsets[i].v);
-      stp_free(sw->linebounds[i].start_pos);
-      stp_free(sw->linebounds[i].end_pos);
+      stpi_arena_free(sw->linecounts[i].v);
+      stpi_arena_free(sw->linebases[i].v);
+      stpi_arena_free(sw->lineactive[i].v);
+      stpi_arena_free(sw->lineoffsets[i].v);
+      stpi_arena_free(sw->linebounds[i].start_pos);
+      stpi_arena_free(sw->linebounds[i].end_pos);
     }
-  stp_free(sw->linecounts);
-  stp_free(sw->lineactive);
-  stp_free(sw->lineoffsets);
-  stp_free(sw->linebases);
-  stp_free(sw->linebounds);
-  stp_free(sw->head_offset);
+  stpi_arena_free(sw->linecounts);
+  stpi_arena_free(sw->lineactive);
+  stpi_arena_free(sw->lineoffsets);
+  stpi_arena_free(sw->linebases);
+  stpi_arena_free(sw->linebounds);
+  stpi_arena_free(sw->head_offset);
   stpi_destroy_weave_params(sw->weaveparm);
   stp_free(vsw);
 }
@@ -1080,7 +1138,8 @@ stp_initialize_weave(stp_vars_t *v,
    * setup printhead offsets.
    * for monochrome (bw) printing, the offsets are 0.
    */
-  sw->head_offset = stp_zalloc(ncolors * sizeof(int));
+  sw->arena = stpi_get_arena(v);
+  sw->head_offset = stpi_arena_zalloc(sw->arena, ncolors * sizeof(int));
   if (ncolors > 1)
     for(i = 0; i < ncolors; i++)
       sw->head_offset[i] = head_offset[i];
@@ -1116,12 +1175,12 @@ stp_initialize_weave(stp_vars_t *v,
   sw->ncolors = ncolors;
   sw->linewidth = linewidth;
   sw->vertical_height = line_count;
-  sw->lineoffsets = allocate_lineoff(sw->vmod, ncolors);
-  sw->lineactive = allocate_lineactive(sw->vmod, ncolors);
-  sw->linebases = allocate_linebuf(sw->vmod, ncolors);
-  sw->linebounds = allocate_linebounds(sw->vmod, ncolors);
-  sw->passes = stp_zalloc(sw->vmod * sizeof(stp_pass_t));
-  sw->linecounts = allocate_linecount(sw->vmod, ncolors);
+  sw->lineoffsets = allocate_lineoff(sw->arena, sw->vmod, ncolors);
+  sw->lineactive = allocate_lineactive(sw->arena, sw->vmod, ncolors);
+  sw->linebases = allocate_linebuf(sw->arena, sw->vmod, ncolors);
+  sw->linebounds = allocate_linebounds(sw->arena, sw->vmod, ncolors);
+  sw->passes = stpi_arena_zalloc(sw->arena, sw->vmod * sizeof(stp_pass_t));
+  sw->linecounts = allocate_linecount(sw->arena, sw->vmod, ncolors);
   sw->rcache = -2;
   sw->vcache = -2;
   sw->fillfunc = fillfunc;
@@ -1188,7 +1247,7 @@ weave_parameters_by_row(const stp_vars_t *v, stpi_softweave_t *sw,
   sw->vcache = vertical_subpass;
 
   w->row = row;
-  stpi_calculate_row_parameters(sw->weaveparm, row, vertical_subpass,
+  stpi_calculate_row_parameters(sw->weaveparm, row, vertical_subpass, 0,
 				&w->pass, &w->jet, &w->logicalpassstart,
 				&w->missingstartrows, &jetsused);
 
@@ -1217,6 +1276,27 @@ stp_weave_parameters_by_row(const stp_vars_t *v, int row,
   weave_parameters_by_row(v, sw, row, vertical_subpass, w);
 }
 
+/*
+ * The same as stp_weave_parameters_by_row(), but calculated from
+ * scratch rather than from the weave schedule, for testing.
+ */
+void
+stpi_weave_parameters_by_row_direct(const stp_vars_t *v, int row,
+				    int vertical_subpass, stp_weave_t *w)
+{
+  stpi_softweave_t *sw = get_sw(v);
+  int jetsused;
+  int sub_repeat_count = vertical_subpass % sw->repeat_count;
+  vertical_subpass /= sw->repeat_count;
+  w->row = row;
+  stpi_calculate_row_parameters(sw->weaveparm, row, vertical_subpass, 1,
+				&w->pass, &w->jet, &w->logicalpassstart,
+				&w->missingstartrows, &jetsused);
+  w->physpassstart = w->logicalpassstart + sw->separation * w->missingstartrows;
+  w->physpassend = w->physpassstart + sw->separation * (jetsused - 1);
+  w->pass = (w->pass * sw->repeat_count) + sub_repeat_count;
+}
+
 
 static stp_lineoff_t *
 stpi_get_lineoffsets(const stp_vars_t *v, stpi_softweave_t *sw,
@@ -1315,7 +1395,8 @@ check_linebases(stp_vars_t *v, stpi_softweave_t *sw,
     (stp_linebufs_t *) stpi_get_linebases(v, sw, row, cpass, head_offset);
   if (!(bufs->v[color]))
     bufs->v[color] =
-      stp_zalloc (sw->virtual_jets * sw->bitwidth * sw->horizontal_width);
+      stpi_arena_zalloc(sw->arena, (sw->virtual_jets * sw->bitwidth *
+				    sw->horizontal_width));
 }
 
 /*
@@ -1561,6 +1642,7 @@ stpi_flush_passes(stp_vars_t *v, int flushall)
       if (pass->pass < 0 || (!flushall && pass->physpassend >= sw->lineno))
 	return;
       (sw->flushfunc)(v, pass->pass, pass->subpass);
+      stpi_flush_output(v);
       sw->last_pass = pass->pass;
       pass->pass = -1;
     }
@@ -1613,6 +1695,8 @@ stp_write_weave(stp_vars_t *v, unsigned char *const cols[])
   int setactive;
   int h_passes = sw->horizontal_weave * sw->vertical_subpasses;
   int cpass = sw->current_vertical_subpass * h_passes;
+  unsigned long long stats_start = STPI_STATS_BEGIN();
+  size_t stats_bytes = 0;
 
   if (!sw->fold_buf)
     {
@@ -1622,15 +1706,15 @@ stp_write_weave(stp_vars_t *v, unsigned char *const cols[])
       stp_dprintf(STP_DBG_WEAVE_PARAMS, v,
 		  "Allocating fold buf %d * %d (%d)\n", ylength, sw->bitwidth,
 		  sw->bitwidth * ylength);
-      sw->fold_buf = stp_zalloc(sw->bitwidth * ylength);
+      sw->fold_buf = stpi_arena_zalloc(sw->arena, sw->bitwidth * ylength);
     }
   if (!sw->comp_buf)
     {
       stp_dprintf(STP_DBG_WEAVE_PARAMS, v,
 		  "Allocating compression buffer based on %d, %d\n",
 		  sw->bitwidth, ylength);
-      sw->comp_buf = stp_zalloc(sw->bitwidth *
-				(sw->compute_linewidth)(v,ylength));
+      sw->comp_buf = stpi_arena_zalloc(sw->arena, sw->bitwidth *
+				       (sw->compute_linewidth)(v,ylength));
     }
   if (sw->current_vertical_subpass == 0)
     initialize_row(v, sw, sw->lineno, xlength, cols);
@@ -1642,13 +1726,14 @@ stp_write_weave(stp_vars_t *v, unsigned char *const cols[])
 	  const unsigned char *in;
 	  int idx;
 
+	  stats_bytes += length * sw->bitwidth;
 	  for (i = 0; i < h_passes; i++)
 	    {
 	      int offset = sw->head_offset[j];
 	      int pass = cpass + i;
 	      if (!sw->s[i])
-		sw->s[i] = stp_zalloc(sw->bitwidth *
-				      (sw->compute_linewidth)(v, ylength));
+		sw->s[i] = stpi_arena_zalloc(sw->arena, sw->bitwidth *
+					     (sw->compute_linewidth)(v, ylength));
 	      linebounds[i] =
 		stpi_get_linebounds(v, sw, sw->lineno, pass, offset);
 	    }
@@ -1691,6 +1776,7 @@ stp_write_weave(stp_vars_t *v, unsigned char *const cols[])
       sw->lineno++;
       sw->current_vertical_subpass = 0;
     }
+  STPI_STATS_END(STPI_STATS_WEAVE, stats_start, stats_bytes);
 }
 
 #if 0
@@ -86,9 +86,133 @@ stpi_init_printvars_list(void)
     }
 }
 
+/*
+ * Indexes of the printer list by each of the keys printers are looked
+ * up by, other than the driver name, which the list itself indexes.
+ * Driver names are also indexed to give each printer's position in
+ * the list.  The indexes are open addressed hash tables, rebuilt
+ * whenever printers are registered or unregistered, so that lookups
+ * only ever read them.  Where two printers share a key the first in
+ * the list wins, as it did with a linear search.
+ */
+typedef enum
+{
+  PRINTER_KEY_DRIVER,
+  PRINTER_KEY_LONG_NAME,
+  PRINTER_KEY_DEVICE_ID,
+  PRINTER_KEY_FOOMATIC_ID,
+  PRINTER_KEYS
+} printer_key_t;
+
+typedef struct
+{
+  const stp_printer_t *printer;
+  unsigned hash;
+  int index;
+} printer_slot_t;
+
+static printer_slot_t *printer_index[PRINTER_KEYS];
+static int printer_index_size = 0;
+
+static const char *
+printer_key(const stp_printer_t *printer, printer_key_t key)
+{
+  switch (key)
+    {
+    case PRINTER_KEY_DRIVER:
+      return printer->driver;
+    case PRINTER_KEY_LONG_NAME:
+      return printer->long_name;
+    case PRINTER_KEY_DEVICE_ID:
+      return printer->device_id;
+    case PRINTER_KEY_FOOMATIC_ID:
+      return printer->foomatic_id;
+    default:
+      return NULL;
+    }
+}
+
+static void
+printer_index_invalidate(void)
+{
+  int i;
+  for (i = 0; i < PRINTER_KEYS; i++)
+    {
+      STP_SAFE_FREE(printer_index[i]);
+    }
+  printer_index_size = 0;
+}
+
+static printer_slot_t *
+printer_index_find(printer_key_t key, const char *name, unsigned hash)
+{
+  printer_slot_t *slots = printer_index[key];
+  unsigned mask = printer_index_size - 1;
+  unsigned i = hash & mask;
+  while (slots[i].printer)
+    {
+      if (slots[i].hash == hash &&
+	  strcmp(name, printer_key(slots[i].printer, key)) == 0)
+	break;
+      i = (i + 1) & mask;
+    }
+  return &(slots[i]);
+}
+
+static void
+printer_index_build(void)
+{
+  stp_list_item_t *item;
+  int count = stp_list_get_length(printer_list);
+  int idx = 0;
+  int i;
+
+  printer_index_invalidate();
+  if (count == 0)
+    return;
+  printer_index_size = 16;
+  while (printer_index_size < count * 2)
+    printer_index_size *= 2;
+  for (i = 0; i < PRINTER_KEYS; i++)
+    printer_index[i] = stp_zalloc(sizeof(printer_slot_t) * printer_index_size);
+
+  for (item = stp_list_get_start(printer_list); item;
+       item = stp_list_item_next(item), idx++)
+    {
+      const stp_printer_t *printer =
+	(const stp_printer_t *) stp_list_item_get_data(item);
+      for (i = 0; i < PRINTER_KEYS; i++)
+	{
+	  const char *name = printer_key(printer, i);
+	  if (name && name[0])
+	    {
+	      unsigned hash = stpi_hash_string(name);
+	      printer_slot_t *slot = printer_index_find(i, name, hash);
+	      if (!slot->printer)
+		{
+		  slot->printer = printer;
+		  slot->hash = hash;
+		  slot->index = idx;
+		}
+	    }
+	}
+    }
+}
+
+static const printer_slot_t *
+printer_index_lookup(printer_key_t key, const char *name)
+{
+  const printer_slot_t *slot;
+  if (!name || !name[0] || printer_index_size == 0)
+    return NULL;
+  slot = printer_index_find(key, name, stpi_hash_string(name));
+  return slot->printer ? slot : NULL;
+}
+
 static int
 stpi_init_printer_list(void)
 {
+  printer_index_invalidate();
   if(printer_list)
     stp_list_destroy(printer_list);
   printer_list = stp_list_create();
@@ -231,17 +355,15 @@ stpi_get_printfuncs(const stp_printer_t *printer)
 const stp_printer_t *
 stp_get_printer_by_long_name(const char *long_name)
 {
-  stp_list_item_t *printer_item;
+  const printer_slot_t *slot;
   if (printer_list == NULL)
     {
       stp_erprintf("No printer drivers found: "
 		   "are STP_DATA_PATH and STP_MODULE_PATH correct?\n");
       stpi_init_printer_list();
     }
-  printer_item = stp_list_get_item_by_long_name(printer_list, long_name);
-  if (!printer_item)
-    return NULL;
-  return (const stp_printer_t *) stp_list_item_get_data(printer_item);
+  slot = printer_index_lookup(PRINTER_KEY_LONG_NAME, long_name);
+  return slot ? slot->printer : NULL;
 }
 
 const stp_printer_t *
@@ -263,63 +385,44 @@ stp_get_printer_by_driver(const char *driver)
 const stp_printer_t *
 stp_get_printer_by_device_id(const char *device_id)
 {
-  stp_list_item_t *printer_item;
+  const printer_slot_t *slot;
   if (printer_list == NULL)
     {
       stp_erprintf("No printer drivers found: "
 		   "are STP_DATA_PATH and STP_MODULE_PATH correct?\n");
       stpi_init_printer_list();
     }
-  if (! device_id || strcmp(device_id, "") == 0)
-    return NULL;
-
-  printer_item = stp_list_get_start(printer_list);
-  while (printer_item)
-    {
-      if (strcmp(((const stp_printer_t *) stp_list_item_get_data(printer_item))->device_id,
-		 device_id) == 0)
-	return ((const stp_printer_t *) stp_list_item_get_data(printer_item));
-      printer_item = stp_list_item_next(printer_item);
-    }
-  return NULL;
+  slot = printer_index_lookup(PRINTER_KEY_DEVICE_ID, device_id);
+  return slot ? slot->printer : NULL;
 }
 
 const stp_printer_t *
 stp_get_printer_by_foomatic_id(const char *foomatic_id)
 {
-  stp_list_item_t *printer_item;
+  const printer_slot_t *slot;
   if (printer_list == NULL)
     {
       stp_erprintf("No printer drivers found: "
 		   "are STP_DATA_PATH and STP_MODULE_PATH correct?\n");
       stpi_init_printer_list();
     }
-  if (! foomatic_id || strcmp(foomatic_id, "") == 0)
-    return NULL;
-
-  printer_item = stp_list_get_start(printer_list);
-  while (printer_item)
-    {
-      if (strcmp(((const stp_printer_t *) stp_list_item_get_data(printer_item))->foomatic_id,
-		 foomatic_id) == 0)
-	return ((const stp_printer_t *) stp_list_item_get_data(printer_item));
-      printer_item = stp_list_item_next(printer_item);
-    }
-  return NULL;
+  slot = printer_index_lookup(PRINTER_KEY_FOOMATIC_ID, foomatic_id);
+  return slot ? slot->printer : NULL;
 }
 
 int
 stp_get_printer_index_by_driver(const char *driver)
 {
   /* There should be no need to ever know the index! */
-  int idx = 0;
-  for (idx = 0; idx < stp_printer_model_count(); idx++)
+  const printer_slot_t *slot;
+  if (printer_list == NULL)
     {
-      const stp_printer_t *printer = stp_get_printer_by_index(idx);
-      if (!strcmp(stp_printer_get_driver(printer), driver))
-	return idx;
+      stp_erprintf("No printer drivers found: "
+		   "are STP_DATA_PATH and STP_MODULE_PATH correct?\n");
+      stpi_init_printer_list();
     }
-  return -1;
+  slot = printer_index_lookup(PRINTER_KEY_DRIVER, driver);
+  return slot ? slot->index : -1;
 }
 
 const stp_printer_t *
@@ -544,7 +647,18 @@ stp_print(const stp_vars_t *v, stp_image_t *image)
 {
   const stp_printfuncs_t *printfuncs =
     stpi_get_printfuncs(stp_get_printer(v));
-  return (printfuncs->print)(v, image);
+  stpi_output_buffer_t *ob;
+  unsigned long long stats_start;
+  int status;
+  stpi_stats_start_job(v);
+  stats_start = STPI_STATS_BEGIN();
+  if (stats_start)
+    stpi_stats_start_page(stats_start);
+  ob = stpi_output_buffer_begin(v);
+  status = (printfuncs->print)(v, image);
+  stpi_output_buffer_end(v, ob);
+  STPI_STATS_END(STPI_STATS_PRINT, stats_start, 0);
+  return status;
 }
 
 int
@@ -552,13 +666,19 @@ stp_start_job(const stp_vars_t *v, stp_image_t *image)
 {
   const stp_printfuncs_t *printfuncs =
     stpi_get_printfuncs(stp_get_printer(v));
+  stpi_output_buffer_t *ob;
+  int status;
+  stpi_stats_start_job(v);
+  stpi_arena_start_job(v);
   if (!stp_get_string_parameter(v, "JobMode") ||
       strcmp(stp_get_string_parameter(v, "JobMode"), "Page") == 0)
     return 1;
-  if (printfuncs->start_job)
-    return (printfuncs->start_job)(v, image);
-  else
+  if (!printfuncs->start_job)
     return 1;
+  ob = stpi_output_buffer_begin(v);
+  status = (printfuncs->start_job)(v, image);
+  stpi_output_buffer_end(v, ob);
+  return status;
 }
 
 int
@@ -566,13 +686,19 @@ stp_end_job(const stp_vars_t *v, stp_image_t *image)
 {
   const stp_printfuncs_t *printfuncs =
     stpi_get_printfuncs(stp_get_printer(v));
-  if (!stp_get_string_parameter(v, "JobMode") ||
-      strcmp(stp_get_string_parameter(v, "JobMode"), "Page") == 0)
-    return 1;
-  if (printfuncs->end_job)
-    return (printfuncs->end_job)(v, image);
-  else
-    return 1;
+  stpi_output_buffer_t *ob;
+  int status = 1;
+  if (stp_get_string_parameter(v, "JobMode") &&
+      strcmp(stp_get_string_parameter(v, "JobMode"), "Page") != 0 &&
+      printfuncs->end_job)
+    {
+      ob = stpi_output_buffer_begin(v);
+      status = (printfuncs->end_job)(v, image);
+      stpi_output_buffer_end(v, ob);
+    }
+  stpi_stats_end_job(v);
+  stpi_arena_end_job(v);
+  return status;
 }
 
 stp_string_list_t *
@@ -981,6 +1107,7 @@ stp_family_register(stp_list_t *family)
 {
   stp_list_item_t *printer_item;
   const stp_printer_t *printer;
+  int changed = 0;
 
   if (printer_list == NULL)
     {
@@ -998,13 +1125,18 @@ stp_family_register(stp_list_t *family)
 	{
 	  printer = (const stp_printer_t *) stp_list_item_get_data(printer_item);
 	  if (!stp_list_get_item_by_name(printer_list, printer->driver))
-	    stp_list_item_create(printer_list, NULL, printer);
+	    {
+	      stp_list_item_create(printer_list, NULL, printer);
+	      changed = 1;
+	    }
 	  else
 	    stp_erprintf("Duplicate printer entry `%s' (%s)\n",
 			 printer->driver, printer->long_name);
 	  printer_item = stp_list_item_next(printer_item);
 	}
     }
+  if (changed)
+    printer_index_build();
 
   return 0;
 }
@@ -1015,6 +1147,7 @@ stp_family_unregister(stp_list_t *family)
   stp_list_item_t *printer_item;
   stp_list_item_t *old_printer_item;
   const stp_printer_t *printer;
+  int changed = 0;
 
   if (printer_list == NULL)
     {
@@ -1035,10 +1168,15 @@ stp_family_unregister(stp_list_t *family)
 	    stp_list_get_item_by_name(printer_list, printer->driver);
 
 	  if (old_printer_item)
-	    stp_list_item_destroy(printer_list, old_printer_item);
+	    {
+	      stp_list_item_destroy(printer_list, old_printer_item);
+	      changed = 1;
+	    }
 	  printer_item = stp_list_item_next(printer_item);
 	}
     }
+  if (changed)
+    printer_index_build();
   return 0;
 }
 
@@ -0,0 +1,213 @@
+/*
+ * "$Id$"
+ *
+ *   Pool of worker threads for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * stpi_worker_pool_run() runs tasks 0 through ntasks - 1 of a job on the
+ * pool's threads and the calling thread, and returns when they have all
+ * finished.  Tasks are started in order, so a task may wait for one with
+ * a lower number to make progress (with stpi_worker_pool_wait()) without
+ * risk of deadlock.  A NULL pool runs the tasks one after another on the
+ * calling thread, where such waits are always already satisfied.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+struct stpi_worker_pool
+{
+  pthread_mutex_t lock;
+  pthread_cond_t work;		/* Signalled when a job is posted */
+  pthread_cond_t done;		/* Signalled when a job finishes */
+  pthread_cond_t progress;	/* Signalled by stpi_worker_pool_post() */
+  pthread_t *threads;
+  int nthreads;
+  int shutdown;
+  stpi_worker_func_t func;
+  void *arg;
+  int ntasks;
+  int next_task;
+  int tasks_done;
+};
+
+/* Run tasks of the current job until there are none left to start */
+static void
+run_tasks(stpi_worker_pool_t *pool)
+{
+  while (pool->next_task < pool->ntasks)
+    {
+      int task = pool->next_task++;
+      stpi_worker_func_t func = pool->func;
+      void *arg = pool->arg;
+      pthread_mutex_unlock(&(pool->lock));
+      (*func)(arg, task);
+      pthread_mutex_lock(&(pool->lock));
+      if (++pool->tasks_done == pool->ntasks)
+	pthread_cond_broadcast(&(pool->done));
+    }
+}
+
+static void *
+worker_thread(void *arg)
+{
+  stpi_worker_pool_t *pool = (stpi_worker_pool_t *) arg;
+  pthread_mutex_lock(&(pool->lock));
+  while (!pool->shutdown)
+    {
+      run_tasks(pool);
+      if (!pool->shutdown)
+	pthread_cond_wait(&(pool->work), &(pool->lock));
+    }
+  pthread_mutex_unlock(&(pool->lock));
+  return NULL;
+}
+#endif
+
+/*
+ * Create a pool that runs jobs on up to threads threads, counting the
+ * one that calls stpi_worker_pool_run().  Returns NULL if that would be
+ * fewer than two or threads aren't available.
+ */
+stpi_worker_pool_t *
+stpi_worker_pool_create(int threads)
+{
+#ifdef HAVE_PTHREAD_H
+  stpi_worker_pool_t *pool;
+  if (threads < 2)
+    return NULL;
+  pool = stp_zalloc(sizeof(stpi_worker_pool_t));
+  pool->threads = stp_zalloc(sizeof(pthread_t) * (threads - 1));
+  pthread_mutex_init(&(pool->lock), NULL);
+  pthread_cond_init(&(pool->work), NULL);
+  pthread_cond_init(&(pool->done), NULL);
+  pthread_cond_init(&(pool->progress), NULL);
+  for (pool->nthreads = 0; pool->nthreads < threads - 1; pool->nthreads++)
+    if (pthread_create(&(pool->threads[pool->nthreads]), NULL,
+		       worker_thread, pool) != 0)
+      break;
+  if (pool->nthreads == 0)
+    {
+      stpi_worker_pool_destroy(pool);
+      return NULL;
+    }
+  return pool;
+#else
+  return NULL;
+#endif
+}
+
+void
+stpi_worker_pool_destroy(stpi_worker_pool_t *pool)
+{
+#ifdef HAVE_PTHREAD_H
+  int i;
+  if (!pool)
+    return;
+  pthread_mutex_lock(&(pool->lock));
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&(pool->work));
+  pthread_mutex_unlock(&(pool->lock));
+  for (i = 0; i < pool->nthreads; i++)
+    pthread_join(pool->threads[i], NULL);
+  pthread_cond_destroy(&(pool->progress));
+  pthread_cond_destroy(&(pool->done));
+  pthread_cond_destroy(&(pool->work));
+  pthread_mutex_destroy(&(pool->lock));
+  stp_free(pool->threads);
+  stp_free(pool);
+#endif
+}
+
+void
+stpi_worker_pool_run(stpi_worker_pool_t *pool, int ntasks,
+		     stpi_worker_func_t func, void *arg)
+{
+#ifdef HAVE_PTHREAD_H
+  if (pool && ntasks > 1)
+    {
+      pthread_mutex_lock(&(pool->lock));
+      pool->func = func;
+      pool->arg = arg;
+      pool->ntasks = ntasks;
+      pool->next_task = 0;
+      pool->tasks_done = 0;
+      pthread_cond_broadcast(&(pool->work));
+      run_tasks(pool);
+      while (pool->tasks_done < ntasks)
+	pthread_cond_wait(&(pool->done), &(pool->lock));
+      pool->ntasks = 0;
+      pthread_mutex_unlock(&(pool->lock));
+      return;
+    }
+#endif
+  {
+    int task;
+    for (task = 0; task < ntasks; task++)
+      (*func)(arg, task);
+  }
+}
+
+/*
+ * Progress counters let one task follow another through its work.
+ * stpi_worker_pool_post() sets a counter, and stpi_worker_pool_wait()
+ * waits until it reaches at least value and returns what it is.
+ */
+void
+stpi_worker_pool_post(stpi_worker_pool_t *pool, int *counter, int value)
+{
+#ifdef HAVE_PTHREAD_H
+  if (pool)
+    {
+      pthread_mutex_lock(&(pool->lock));
+      *counter = value;
+      pthread_cond_broadcast(&(pool->progress));
+      pthread_mutex_unlock(&(pool->lock));
+      return;
+    }
+#endif
+  *counter = value;
+}
+
+int
+stpi_worker_pool_wait(stpi_worker_pool_t *pool, const int *counter,
+		      int value)
+{
+  int answer;
+#ifdef HAVE_PTHREAD_H
+  if (pool)
+    {
+      pthread_mutex_lock(&(pool->lock));
+      while (*counter < value)
+	pthread_cond_wait(&(pool->progress), &(pool->lock));
+      answer = *counter;
+      pthread_mutex_unlock(&(pool->lock));
+      return answer;
+    }
+#endif
+  answer = *counter;
+  return answer;
+}
@@ -0,0 +1,297 @@
+/*
+ * "$Id$"
+ *
+ *   Binary cache of parsed XML data files.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Every process that initializes Gutenprint parses the same XML data
+ * files.  The parsed trees are kept in the on-disk cache in a compact
+ * binary form, from which a tree can be rebuilt without parsing.  Each
+ * node is a type byte followed by
+ *
+ *   element:  name, attribute count, (name, value) pairs, child count,
+ *             children
+ *   text:     whitespace flag byte, string
+ *   opaque:   string
+ *   integer:  int
+ *   real:     double
+ *
+ * Counts are unsigned ints; strings are an unsigned length followed by
+ * that many bytes and a terminating NUL.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#define XML_CACHE_KIND		"xml1"
+#define XML_CACHE_NULL_STRING	0xffffffffu
+
+typedef struct
+{
+  unsigned char *data;
+  size_t length;
+  size_t size;
+} xml_cache_buffer_t;
+
+typedef struct
+{
+  const unsigned char *data;
+  const unsigned char *end;
+} xml_cache_reader_t;
+
+/*
+ * Writing
+ */
+
+static void
+put_bytes(xml_cache_buffer_t *buf, const void *data, size_t length)
+{
+  if (buf->length + length > buf->size)
+    {
+      buf->size = (buf->length + length) * 2;
+      buf->data = stp_realloc(buf->data, buf->size);
+    }
+  memcpy(buf->data + buf->length, data, length);
+  buf->length += length;
+}
+
+static void
+put_unsigned(xml_cache_buffer_t *buf, unsigned val)
+{
+  put_bytes(buf, &val, sizeof(unsigned));
+}
+
+static void
+put_string(xml_cache_buffer_t *buf, const char *str)
+{
+  if (!str)
+    put_unsigned(buf, XML_CACHE_NULL_STRING);
+  else
+    {
+      unsigned length = strlen(str);
+      put_unsigned(buf, length);
+      put_bytes(buf, str, length + 1);
+    }
+}
+
+static void
+put_node(xml_cache_buffer_t *buf, stp_mxml_node_t *node)
+{
+  unsigned char type = node->type;
+  stp_mxml_node_t *child;
+  unsigned count = 0;
+  int i;
+
+  put_bytes(buf, &type, 1);
+  switch (node->type)
+    {
+    case STP_MXML_ELEMENT:
+      put_string(buf, node->value.element.name);
+      put_unsigned(buf, node->value.element.num_attrs);
+      for (i = 0; i < node->value.element.num_attrs; i++)
+	{
+	  put_string(buf, node->value.element.attrs[i].name);
+	  put_string(buf, node->value.element.attrs[i].value);
+	}
+      for (child = node->child; child; child = child->next)
+	count++;
+      put_unsigned(buf, count);
+      for (child = node->child; child; child = child->next)
+	put_node(buf, child);
+      break;
+    case STP_MXML_TEXT:
+      type = node->value.text.whitespace ? 1 : 0;
+      put_bytes(buf, &type, 1);
+      put_string(buf, node->value.text.string);
+      break;
+    case STP_MXML_OPAQUE:
+      put_string(buf, node->value.opaque);
+      break;
+    case STP_MXML_INTEGER:
+      put_bytes(buf, &(node->value.integer), sizeof(int));
+      break;
+    case STP_MXML_REAL:
+      put_bytes(buf, &(node->value.real), sizeof(double));
+      break;
+    }
+}
+
+/*
+ * Reading.  The data is checked as it's decoded; any inconsistency
+ * makes the caller fall back to parsing the XML.
+ */
+
+static int
+get_bytes(xml_cache_reader_t *r, void *data, size_t length)
+{
+  if (r->end - r->data < length)
+    return 0;
+  memcpy(data, r->data, length);
+  r->data += length;
+  return 1;
+}
+
+static int
+get_unsigned(xml_cache_reader_t *r, unsigned *val)
+{
+  return get_bytes(r, val, sizeof(unsigned));
+}
+
+static int
+get_string(xml_cache_reader_t *r, const char **str)
+{
+  unsigned length;
+  if (!get_unsigned(r, &length))
+    return 0;
+  if (length == XML_CACHE_NULL_STRING)
+    {
+      *str = NULL;
+      return 1;
+    }
+  if (r->end - r->data <= length || r->data[length] != '\0')
+    return 0;
+  *str = (const char *) r->data;
+  r->data += length + 1;
+  return 1;
+}
+
+static stp_mxml_node_t *
+get_node(xml_cache_reader_t *r, stp_mxml_node_t *parent)
+{
+  unsigned char type;
+  stp_mxml_node_t *node = NULL;
+  const char *str;
+  unsigned count;
+  unsigned i;
+
+  if (!get_bytes(r, &type, 1))
+    return NULL;
+  switch (type)
+    {
+    case STP_MXML_ELEMENT:
+      if (!get_string(r, &str) || !str || !get_unsigned(r, &count))
+	return NULL;
+      node = stp_mxmlNewElement(parent, str);
+      for (i = 0; i < count; i++)
+	{
+	  const char *name;
+	  if (!get_string(r, &name) || !name || !get_string(r, &str))
+	    return NULL;
+	  stp_mxmlElementSetAttr(node, name, str);
+	}
+      if (!get_unsigned(r, &count))
+	return NULL;
+      for (i = 0; i < count; i++)
+	if (!get_node(r, node))
+	  return NULL;
+      break;
+    case STP_MXML_TEXT:
+      if (!get_bytes(r, &type, 1) || !get_string(r, &str))
+	return NULL;
+      node = stp_mxmlNewText(parent, type, str);
+      break;
+    case STP_MXML_OPAQUE:
+      if (!get_string(r, &str))
+	return NULL;
+      node = stp_mxmlNewOpaque(parent, str);
+      break;
+    case STP_MXML_INTEGER:
+      {
+	int val;
+	if (!get_bytes(r, &val, sizeof(int)))
+	  return NULL;
+	node = stp_mxmlNewInteger(parent, val);
+      }
+      break;
+    case STP_MXML_REAL:
+      {
+	double val;
+	if (!get_bytes(r, &val, sizeof(double)))
+	  return NULL;
+	node = stp_mxmlNewReal(parent, val);
+      }
+      break;
+    default:
+      return NULL;
+    }
+  return node;
+}
+
+static stp_mxml_node_t *
+xml_cache_decode(const unsigned char *data, size_t length)
+{
+  xml_cache_reader_t r;
+  stp_mxml_node_t *doc;
+  stp_mxml_node_t *answer;
+
+  r.data = data;
+  r.end = data + length;
+  doc = stp_mxmlNewElement(NULL, "cache");
+  if (!get_node(&r, doc) || r.data != r.end)
+    {
+      stp_mxmlDelete(doc);
+      return NULL;
+    }
+  /* Detach the real document from the placeholder parent */
+  answer = doc->child;
+  stp_mxmlRemove(answer);
+  stp_mxmlDelete(doc);
+  return answer;
+}
+
+/*
+ * Load an XML file the way stp_mxmlLoadFromFile() does, using the cache
+ * when possible.  Returns NULL if the file can't be read or parsed.
+ */
+stp_mxml_node_t *
+stpi_xml_load_file(const char *file)
+{
+  stp_mxml_node_t *doc = NULL;
+  stpi_cache_entry_t entry;
+
+  if (access(file, R_OK) != 0)
+    return NULL;
+  if (stpi_cache_load(XML_CACHE_KIND, file, file, &entry))
+    {
+      doc = xml_cache_decode(entry.data, entry.bytes);
+      stpi_cache_release(&entry);
+    }
+  if (!doc)
+    {
+      doc = stp_mxmlLoadFromFile(NULL, file, STP_MXML_NO_CALLBACK);
+      if (doc)
+	{
+	  xml_cache_buffer_t buf;
+	  memset(&buf, 0, sizeof(buf));
+	  put_node(&buf, doc);
+	  stpi_cache_store(XML_CACHE_KIND, file, file, buf.data, buf.length);
+	  stp_free(buf.data);
+	}
+    }
+  return doc;
+}
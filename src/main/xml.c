@@ -33,6 +33,9 @@
 #include <string.h>
 #include <math.h>
 #include <errno.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #ifdef HAVE_LIMITS_H
 #include <limits.h>
 #endif
@@ -249,12 +252,10 @@ stp_xml_parse_file(const char *file) /* File to parse */
 {
   stp_mxml_node_t *doc;
   stp_mxml_node_t *cur;
-  FILE *fp;
 
   stp_deprintf(STP_DBG_XML, "stp_xml_parse_file: reading  `%s'...\n", file);
 
-  fp = fopen(file, "r");
-  if (!fp)
+  if (access(file, R_OK) != 0)
     {
       stp_erprintf("stp_xml_parse_file: unable to open %s: %s\n", file,
 		   strerror(errno));
@@ -263,8 +264,13 @@ stp_xml_parse_file(const char *file) /* File to parse */
 
   stp_xml_init();
 
-  doc = stp_mxmlLoadFile(NULL, fp, STP_MXML_NO_CALLBACK);
-  fclose(fp);
+  doc = stpi_xml_load_file(file);
+  if (!doc)
+    {
+      stp_erprintf("stp_xml_parse_file: %s: parse error\n", file);
+      stp_xml_exit();
+      return 1;
+    }
 
   cur = doc->child;
   while (cur &&
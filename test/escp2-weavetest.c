@@ -97,7 +97,8 @@ const char header[] = "Legend:\n"
 "P  Physical row number out of bounds.\n"
 "Q  Pass starts earlier than a prior pass.\n"
 "R  Pass is never flushed.\n"
-"S  Pass is flushed but not created.\n";
+"S  Pass is flushed but not created.\n"
+"T  The weave schedule does not agree with the direct calculation.\n";
 
 int *passes_flushed;
 
@@ -232,7 +233,9 @@ run_one_weavetest(int physjets, int physsep, int hpasses, int vpasses,
       for (j = 0; j < hpasses * vpasses * subpasses; j++)
 	{
 	  int physrow;
+	  stp_weave_t direct;
 	  stp_weave_parameters_by_row(v, i+first_line, j, &w);
+	  stpi_weave_parameters_by_row_direct(v, i+first_line, j, &direct);
 	  physrow = w.logicalpassstart + physsep * w.jet;
 
 	  errcodes[0] = (w.pass < 0 ? (errors[0]++, 'A') : ' ');
@@ -277,11 +280,17 @@ run_one_weavetest(int physjets, int physsep, int hpasses, int vpasses,
 			  (w.logicalpassstart + physsep * (physjets - 1) >=
 			   phys_lines) ?
 			  (errors[15]++, 'P') : ' ');
-	  errcodes[16] = '\0';
+	  errcodes[16] = (w.pass != direct.pass || w.jet != direct.jet ||
+			  w.missingstartrows != direct.missingstartrows ||
+			  w.logicalpassstart != direct.logicalpassstart ||
+			  w.physpassstart != direct.physpassstart ||
+			  w.physpassend != direct.physpassend ?
+			  (errors[19]++, 'T') : ' ');
+	  errcodes[17] = '\0';
 
 	  if (!quiet)
 	    {
-	      printf("%15s%5d %5d %5d %10d %10d %10d %10d\n",
+	      printf("%17s%5d %5d %5d %10d %10d %10d %10d\n",
 		     errcodes, w.row, w.pass, w.jet, w.missingstartrows,
 		     w.logicalpassstart, w.physpassstart, w.physpassend);
 	      fflush(stdout);
@@ -0,0 +1,340 @@
+/*
+ * "$Id$"
+ *
+ *   Fold and unpack equivalence test and benchmark for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Runs every fold and unpack with each implementation the CPU supports
+ * and compares the results with the portable code.  Each bit of the
+ * output depends on exactly one bit of the input, so feeding every pair
+ * of byte values through every pair of planes (or every pair of adjacent
+ * input bytes, for unpacks) covers every combination that can interact.
+ * Every length up to MAX_LENGTH is also tried on random data to exercise
+ * the partial blocks at the end of a line.  Finally each implementation
+ * is timed on lines of typical width.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define PAIRS		65536
+#define MAX_LENGTH	300
+#define GUARD		64
+#define BENCH_LENGTH	1440	/* One plane of an 8in 1440dpi line */
+#define BENCH_PASSES	200
+
+typedef void (*fold_func_t)(const unsigned char *line, int single_length,
+			    unsigned char *outbuf);
+
+static const struct
+{
+  const char *name;
+  fold_func_t fold;
+  int planes;
+} folds[] =
+  {
+    { "fold", stp_fold, 2 },
+    { "fold_3bit", stp_fold_3bit, 3 },
+    { "fold_4bit", stp_fold_4bit, 4 },
+    { "fold_8bit", stp_fold_8bit, 8 },
+  };
+
+static const struct
+{
+  int bits;
+  int n;
+} unpacks[] =
+  {
+    { 1, 2 }, { 1, 4 }, { 1, 8 }, { 1, 16 },
+    { 2, 2 }, { 2, 4 }, { 2, 8 }, { 2, 16 },
+  };
+
+static const struct
+{
+  const char *name;
+  unsigned features;
+} implementations[] =
+  {
+    { "portable", 0 },
+    { "sse2", STPI_CPU_SSE2 },
+    { "bmi2", STPI_CPU_SSE2 | STPI_CPU_BMI2 },
+  };
+
+#define COUNT(x) (sizeof(x) / sizeof(x[0]))
+
+static double
+compute_interval(struct timeval *tv1, struct timeval *tv2)
+{
+  return ((double) tv2->tv_sec + (double) tv2->tv_usec / 1000000.) -
+    ((double) tv1->tv_sec + (double) tv1->tv_usec / 1000000.);
+}
+
+static void
+fill_random(unsigned char *data, size_t bytes)
+{
+  size_t i;
+  for (i = 0; i < bytes; i++)
+    data[i] = rand() >> 7;
+}
+
+/* Bytes of input consumed by an unpack of length units */
+static int
+unpack_input_bytes(int bits, int n, int length)
+{
+  return (bits == 2 || n == 16) ? length * 2 : length;
+}
+
+/*
+ * Run a fold with the given features and with the portable code and
+ * compare the output, including the guard bytes after it.
+ */
+static int
+check_fold(int which, unsigned features, const unsigned char *line,
+	   int length)
+{
+  size_t bytes = length * folds[which].planes + GUARD;
+  unsigned char *expected = stp_malloc(bytes);
+  unsigned char *result = stp_malloc(bytes);
+  int status;
+  memset(expected, 0xa5, bytes);
+  memset(result, 0xa5, bytes);
+  stpi_set_cpu_features(0);
+  (*folds[which].fold)(line, length, expected);
+  stpi_set_cpu_features(features);
+  (*folds[which].fold)(line, length, result);
+  status = memcmp(expected, result, bytes) == 0;
+  stp_free(expected);
+  stp_free(result);
+  return status;
+}
+
+static int
+check_unpack(int which, unsigned features, const unsigned char *in,
+	     int length)
+{
+  int n = unpacks[which].n;
+  int out_bytes =
+    (unpack_input_bytes(unpacks[which].bits, n, length) + n - 1) / n;
+  size_t bytes = (out_bytes + GUARD) * n;
+  unsigned char *expected = stp_malloc(bytes);
+  unsigned char *result = stp_malloc(bytes);
+  unsigned char *outs[16];
+  int status;
+  int i;
+  memset(expected, 0xa5, bytes);
+  memset(result, 0xa5, bytes);
+  stpi_set_cpu_features(0);
+  for (i = 0; i < n; i++)
+    outs[i] = expected + i * (out_bytes + GUARD);
+  stp_unpack(length, unpacks[which].bits, n, in, outs);
+  stpi_set_cpu_features(features);
+  for (i = 0; i < n; i++)
+    outs[i] = result + i * (out_bytes + GUARD);
+  stp_unpack(length, unpacks[which].bits, n, in, outs);
+  status = memcmp(expected, result, bytes) == 0;
+  stp_free(expected);
+  stp_free(result);
+  return status;
+}
+
+static int
+test_folds(unsigned features)
+{
+  unsigned char *line = stp_malloc(PAIRS * 8);
+  int failures = 0;
+  int i, p, q, length;
+
+  for (i = 0; i < COUNT(folds); i++)
+    {
+      int planes = folds[i].planes;
+      for (p = 0; p < planes; p++)
+	for (q = p + 1; q < planes; q++)
+	  {
+	    int k;
+	    fill_random(line, PAIRS * planes);
+	    for (k = 0; k < PAIRS; k++)
+	      {
+		line[p * PAIRS + k] = k & 0xff;
+		line[q * PAIRS + k] = k >> 8;
+	      }
+	    if (!check_fold(i, features, line, PAIRS))
+	      {
+		printf("  %s differs for byte pairs in planes %d and %d\n",
+		       folds[i].name, p, q);
+		failures++;
+	      }
+	  }
+      for (length = 0; length <= MAX_LENGTH; length++)
+	{
+	  fill_random(line, length * planes);
+	  if (!check_fold(i, features, line, length))
+	    {
+	      printf("  %s differs at length %d\n", folds[i].name, length);
+	      failures++;
+	      break;
+	    }
+	}
+    }
+  stp_free(line);
+  return failures;
+}
+
+static int
+test_unpacks(unsigned features)
+{
+  unsigned char *in = stp_malloc(PAIRS * 2 + 2);
+  int failures = 0;
+  int i, k, length;
+
+  /* Every pair of values, at both even and odd offsets */
+  for (k = 0; k < PAIRS; k++)
+    {
+      in[k * 2] = k >> 8;
+      in[k * 2 + 1] = k & 0xff;
+    }
+  in[PAIRS * 2] = 0;
+  in[PAIRS * 2 + 1] = 0;
+
+  for (i = 0; i < COUNT(unpacks); i++)
+    {
+      int bits = unpacks[i].bits;
+      int n = unpacks[i].n;
+      int units = unpack_input_bytes(bits, n, 1);
+      int offset;
+      for (offset = 0; offset < 2; offset++)
+	if (!check_unpack(i, features, in + offset, PAIRS * 2 / units))
+	  {
+	    printf("  unpack %d bit %d channels differs for byte pairs\n",
+		   bits, n);
+	    failures++;
+	  }
+      for (length = 0; length <= MAX_LENGTH; length++)
+	{
+	  unsigned char random_in[MAX_LENGTH * 2];
+	  fill_random(random_in, unpack_input_bytes(bits, n, length));
+	  if (!check_unpack(i, features, random_in, length))
+	    {
+	      printf("  unpack %d bit %d channels differs at length %d\n",
+		     bits, n, length);
+	      failures++;
+	      break;
+	    }
+	}
+    }
+  stp_free(in);
+  return failures;
+}
+
+static void
+benchmark(unsigned features, double *times)
+{
+  unsigned char *line = stp_malloc(BENCH_LENGTH * 16);
+  unsigned char *out = stp_malloc(BENCH_LENGTH * 16);
+  unsigned char *outs[16];
+  struct timeval tv1, tv2;
+  int i, j, pass;
+
+  fill_random(line, BENCH_LENGTH * 16);
+  stpi_set_cpu_features(features);
+  for (i = 0; i < COUNT(folds); i++)
+    {
+      (void) gettimeofday(&tv1, NULL);
+      for (pass = 0; pass < BENCH_PASSES; pass++)
+	(*folds[i].fold)(line, BENCH_LENGTH, out);
+      (void) gettimeofday(&tv2, NULL);
+      *times++ = compute_interval(&tv1, &tv2);
+    }
+  for (i = 0; i < COUNT(unpacks); i++)
+    {
+      int n = unpacks[i].n;
+      int length = BENCH_LENGTH * n / unpack_input_bytes(unpacks[i].bits,
+							  n, 1);
+      (void) gettimeofday(&tv1, NULL);
+      for (pass = 0; pass < BENCH_PASSES; pass++)
+	{
+	  for (j = 0; j < n; j++)
+	    outs[j] = out + j * BENCH_LENGTH;
+	  stp_unpack(length, unpacks[i].bits, n, line, outs);
+	}
+      (void) gettimeofday(&tv2, NULL);
+      *times++ = compute_interval(&tv1, &tv2);
+    }
+  stp_free(line);
+  stp_free(out);
+}
+
+int
+main(int argc, char **argv)
+{
+  double times[COUNT(implementations)][COUNT(folds) + COUNT(unpacks)];
+  int supported[COUNT(implementations)];
+  unsigned available;
+  int failures = 0;
+  int i, j;
+
+  stp_init();
+  available = stpi_cpu_features();
+  srand(1);
+
+  for (i = 0; i < COUNT(implementations); i++)
+    {
+      supported[i] = (implementations[i].features & available) ==
+	implementations[i].features;
+      if (!supported[i])
+	printf("%-10s not supported\n", implementations[i].name);
+      else if (i > 0)
+	{
+	  int f = test_folds(implementations[i].features) +
+	    test_unpacks(implementations[i].features);
+	  printf("%-10s %s\n", implementations[i].name,
+		 f ? "FAILED" : "matches portable code");
+	  failures += f;
+	}
+    }
+
+  for (i = 0; i < COUNT(implementations); i++)
+    if (supported[i])
+      benchmark(implementations[i].features, times[i]);
+  printf("\n%-20s", "usec/line");
+  for (i = 0; i < COUNT(implementations); i++)
+    if (supported[i])
+      printf(" %10s", implementations[i].name);
+  printf("\n");
+  for (j = 0; j < COUNT(folds) + COUNT(unpacks); j++)
+    {
+      char name[32];
+      if (j < COUNT(folds))
+	strcpy(name, folds[j].name);
+      else
+	sprintf(name, "unpack %d bit x %d", unpacks[j - COUNT(folds)].bits,
+		unpacks[j - COUNT(folds)].n);
+      printf("%-20s", name);
+      for (i = 0; i < COUNT(implementations); i++)
+	if (supported[i])
+	  printf(" %10.2f", times[i][j] * 1000000.0 / BENCH_PASSES);
+      printf("\n");
+    }
+
+  stpi_set_cpu_features(available);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,403 @@
+/*
+ * "$Id$"
+ *
+ *   Channel post-processing test for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Runs random rows through stp_channel_convert() for a few channel
+ * layouts, with the portable code and with each vector kernel the CPU
+ * supports, and checks the output against a floating point model of the
+ * gray component reduction, density scaling, ink limiting and gloss
+ * generation.  The fixed point code may differ from the model by 1 for
+ * each step that rounds (GCR and ink limiting); the kernels must agree
+ * with the portable code exactly.  Reports the time
+ * per row.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define WIDTH		1037	/* Odd, to leave partial vectors */
+#define ROWS		64
+#define BENCH_WIDTH	5760
+#define BENCH_ROWS	500
+#define MAX_ERROR	2
+
+typedef struct
+{
+  const char *name;
+  int channels;
+  double densities[16];
+  double ink_limit;		/* 0 for none */
+  int gcr;			/* Black is channel 0 and GCR is done */
+  int gloss_channel;		/* -1 for none */
+  double gloss_limit;
+} layout_t;
+
+static const layout_t layouts[] =
+  {
+    { "cmyk", 4, { 1.0, 0.8, 0.7, 0.5 }, 2.0, 1, -1, 0 },
+    { "cmyk-full", 4, { 1.0, 1.0, 1.0, 1.0 }, 0, 1, -1, 0 },
+    { "gloss", 7, { 1.0, 0.9, 0.8, 0.6, 0.75, 0.5, 1.0 }, 2.5, 0, 6, 1.5 },
+    { "gloss-mid", 6, { 0.9, 0.9, 1.0, 0.6, 1.0, 0.5 }, 0, 0, 2, 1.2 },
+    { "wide", 10,
+      { 1.0, 0.95, 0.9, 0.85, 0.8, 0.75, 0.7, 0.65, 0.6, 0.55 }, 3.0, 0, -1, 0 },
+    { "wide-gloss", 9,
+      { 1.0, 0.9, 0.8, 0.7, 0.6, 0.5, 0.4, 0.3, 1.0 }, 3.5, 0, 8, 2.0 },
+  };
+
+static const struct
+{
+  const char *name;
+  unsigned features;
+} kernels[] =
+  {
+    { "sse2", STPI_CPU_SSE2 },
+  };
+
+#define COUNT(x) (sizeof(x) / sizeof(x[0]))
+
+static const double balances[3] = { 0.9, 0.8, 0.7 };
+
+static int width;
+static unsigned seed = 1;
+
+static unsigned
+random_value(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+static int
+image_width(stp_image_t *image)
+{
+  return width;
+}
+
+static stp_image_t theImage =
+{
+  NULL,
+  NULL,
+  image_width,
+  NULL,
+  NULL,
+  NULL,
+};
+
+static void
+writefunc(void *file, const char *buf, size_t bytes)
+{
+  FILE *prn = (FILE *)file;
+  fwrite(buf, 1, bytes, prn);
+}
+
+static stp_curve_t *
+gcr_curve(void)
+{
+  stp_curve_t *curve = stp_curve_create(STP_CURVE_WRAP_NONE);
+  double data[256];
+  int i;
+  for (i = 0; i < 256; i++)
+    data[i] = i < 64 ? 0 : 65535.0 * (i - 64) / 255.0;
+  stp_curve_set_bounds(curve, 0, 65535);
+  stp_curve_set_data(curve, 256, data);
+  return curve;
+}
+
+static stp_vars_t *
+setup(const layout_t *l, int w)
+{
+  stp_vars_t *v = stp_vars_create();
+  int i;
+  width = w;
+  stp_set_driver(v, "escp2-ex");
+  stp_set_outfunc(v, writefunc);
+  stp_set_errfunc(v, writefunc);
+  stp_set_outdata(v, stdout);
+  stp_set_errdata(v, stderr);
+  stp_set_string_parameter(v, "STPIOutputType", "CMYK");
+  stp_set_string_parameter(v, "ColorCorrection", "Accurate");
+  stp_set_float_parameter(v, "CyanBalance", balances[0]);
+  stp_set_float_parameter(v, "MagentaBalance", balances[1]);
+  stp_set_float_parameter(v, "YellowBalance", balances[2]);
+  for (i = 0; i < l->channels; i++)
+    {
+      stp_channel_add(v, i, 0, 1.0);
+      stp_channel_set_density_adjustment(v, i, 0, l->densities[i]);
+    }
+  if (l->ink_limit)
+    stp_channel_set_ink_limit(v, l->ink_limit);
+  if (l->gcr)
+    {
+      stp_curve_t *curve = gcr_curve();
+      stp_channel_set_black_channel(v, 0);
+      stp_channel_set_gcr_curve(v, curve);
+      stp_curve_destroy(curve);
+    }
+  if (l->gloss_channel >= 0)
+    {
+      stp_channel_set_gloss_channel(v, l->gloss_channel);
+      stp_channel_set_gloss_limit(v, l->gloss_limit);
+    }
+  stp_channel_initialize(v, &theImage,
+			 l->gloss_channel >= 0 ? l->channels - 1 : l->channels);
+  return v;
+}
+
+/*
+ * Random rows with runs of repeated pixels, blank and solid stretches,
+ * and heavy coverage, so that the ink limit is hit often.
+ */
+static void
+fill_row(unsigned short *data, int channels, int pixels)
+{
+  int i, c;
+  for (i = 0; i < pixels; i++)
+    {
+      int mode = (i / 37) % 5;
+      for (c = 0; c < channels; c++)
+	{
+	  unsigned value = random_value();
+	  switch (mode)
+	    {
+	    case 0:
+	      break;
+	    case 1:
+	      value = 0;
+	      break;
+	    case 2:
+	      value = 65535;
+	      break;
+	    case 3:
+	      value = 65535 - (value & 0x3fff);
+	      break;
+	    default:
+	      if (i > 0)
+		value = data[(i - 1) * channels + c];
+	      break;
+	    }
+	  data[i * channels + c] = value;
+	}
+    }
+}
+
+/*
+ * The channel code as it was done in floating point.  in holds the input
+ * row and out the output buffer as it was before conversion.
+ */
+static void
+model(const layout_t *l, const unsigned short *gcr_lookup,
+      const unsigned short *in, unsigned short *out)
+{
+  int in_channels = l->gloss_channel >= 0 ? l->channels - 1 : l->channels;
+  unsigned ink_limit = l->ink_limit * 65535;
+  unsigned gloss_limit = l->gloss_limit * 65535;
+  unsigned max_density = 0;
+  int i, c;
+
+  for (c = 0; c < l->channels; c++)
+    max_density += (unsigned short) (l->densities[c] * 65535);
+  for (i = 0; i < width; i++)
+    {
+      unsigned short *o = out + i * l->channels;
+      const unsigned short *p = in + i * in_channels;
+      unsigned total = 0;
+      if (l->gloss_channel >= 0)
+	for (c = 0; c < l->channels; c++)
+	  o[c] = c == l->gloss_channel ? 0 : *p++;
+      if (l->gcr && o[0] > 0)
+	{
+	  unsigned k = o[0];
+	  int kk = gcr_lookup[k];
+	  int ck;
+	  if (kk > k)
+	    kk = k;
+	  ck = k - kk;
+	  o[0] = kk;
+	  for (c = 0; c < 3; c++)
+	    o[c + 1] += ck * balances[c];
+	}
+      for (c = 0; c < l->channels; c++)
+	if (c != l->gloss_channel)
+	  {
+	    unsigned density = (unsigned short) (l->densities[c] * 65535);
+	    o[c] = (32767u + o[c] * density) / 65535u;
+	  }
+      for (c = 0; c < l->channels; c++)
+	total += o[c];
+      if (ink_limit && ink_limit < max_density && total > ink_limit)
+	{
+	  double ratio = (double) ink_limit / (double) total;
+	  for (c = 0; c < l->channels; c++)
+	    o[c] *= ratio;
+	}
+      if (l->gloss_channel >= 0)
+	{
+	  unsigned sum = 0;
+	  o[l->gloss_channel] = 0;
+	  for (c = 0; c < l->channels; c++)
+	    sum += o[c];
+	  o[l->gloss_channel] = sum < gloss_limit ?
+	    (gloss_limit - sum > 65535 ? 65535 : gloss_limit - sum) : 0;
+	}
+    }
+}
+
+/*
+ * Convert ROWS random rows with the given CPU features, leaving the
+ * outputs and zero masks in out and masks.  Returns the number of values
+ * more than MAX_ERROR away from the model.
+ */
+static int
+run_layout(const layout_t *l, unsigned features, unsigned short *out,
+	   unsigned *masks)
+{
+  int in_channels = l->gloss_channel >= 0 ? l->channels - 1 : l->channels;
+  size_t out_size = (size_t) WIDTH * l->channels;
+  unsigned short *before = stp_malloc(out_size * sizeof(unsigned short));
+  unsigned short *in = stp_malloc(WIDTH * in_channels * sizeof(unsigned short));
+  const unsigned short *gcr_lookup = NULL;
+  stp_curve_t *curve = NULL;
+  stp_vars_t *v;
+  int failures = 0;
+  int r;
+  size_t i;
+
+  stpi_set_cpu_features(features);
+  v = setup(l, WIDTH);
+  if (l->gcr)
+    {
+      size_t count;
+      curve = gcr_curve();
+      stp_curve_resample(curve, 65536);
+      gcr_lookup = stp_curve_get_ushort_data(curve, &count);
+    }
+  seed = 1;
+  for (r = 0; r < ROWS; r++)
+    {
+      unsigned short *o = out + r * out_size;
+      fill_row(stp_channel_get_input(v), in_channels, width);
+      memcpy(in, stp_channel_get_input(v),
+	     width * in_channels * sizeof(unsigned short));
+      /* Leave junk in the output, which mustn't affect the result */
+      if (l->gloss_channel >= 0)
+	fill_row(stp_channel_get_output(v), l->channels, width);
+      memcpy(before, stp_channel_get_output(v),
+	     out_size * sizeof(unsigned short));
+      stp_channel_convert(v, &(masks[r]));
+      memcpy(o, stp_channel_get_output(v), out_size * sizeof(unsigned short));
+      model(l, gcr_lookup, in, before);
+      for (i = 0; i < out_size; i++)
+	{
+	  unsigned short diff = o[i] - before[i];
+	  if (diff > MAX_ERROR && diff < 65536 - MAX_ERROR)
+	    {
+	      if (failures < 10)
+		printf("%s %s: row %d pixel %lu channel %lu: %u, expected %u\n",
+		       l->name, features ? "vector" : "scalar", r,
+		       (unsigned long) (i / l->channels),
+		       (unsigned long) (i % l->channels), o[i], before[i]);
+	      failures++;
+	    }
+	}
+    }
+  if (curve)
+    stp_curve_destroy(curve);
+  stp_vars_destroy(v);
+  stp_free(before);
+  stp_free(in);
+  return failures;
+}
+
+static double
+time_layout(const layout_t *l, unsigned features)
+{
+  int in_channels = l->gloss_channel >= 0 ? l->channels - 1 : l->channels;
+  unsigned short *row;
+  struct timeval tv1, tv2;
+  stp_vars_t *v;
+  unsigned mask;
+  int r;
+
+  stpi_set_cpu_features(features);
+  v = setup(l, BENCH_WIDTH);
+  row = stp_malloc(BENCH_WIDTH * in_channels * sizeof(unsigned short));
+  fill_row(row, in_channels, BENCH_WIDTH);
+  (void) gettimeofday(&tv1, NULL);
+  for (r = 0; r < BENCH_ROWS; r++)
+    {
+      memcpy(stp_channel_get_input(v), row,
+	     BENCH_WIDTH * in_channels * sizeof(unsigned short));
+      stp_channel_convert(v, &mask);
+    }
+  (void) gettimeofday(&tv2, NULL);
+  stp_vars_destroy(v);
+  stp_free(row);
+  return (((double) tv2.tv_sec + (double) tv2.tv_usec / 1000000.) -
+	  ((double) tv1.tv_sec + (double) tv1.tv_usec / 1000000.)) *
+    1000000.0 / BENCH_ROWS;
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned available;
+  int failures = 0;
+  int i, k;
+
+  stp_init();
+  available = stpi_cpu_features();
+  printf("%-12s %-8s %10s\n", "layout", "kernel", "usec/row");
+  for (i = 0; i < COUNT(layouts); i++)
+    {
+      const layout_t *l = &(layouts[i]);
+      size_t size = (size_t) ROWS * WIDTH * l->channels;
+      unsigned short *reference = stp_malloc(size * sizeof(unsigned short));
+      unsigned short *output = stp_malloc(size * sizeof(unsigned short));
+      unsigned reference_masks[ROWS];
+      unsigned masks[ROWS];
+
+      failures += run_layout(l, 0, reference, reference_masks);
+      printf("%-12s %-8s %10.3f\n", l->name, "scalar", time_layout(l, 0));
+      for (k = 0; k < COUNT(kernels); k++)
+	{
+	  if ((available & kernels[k].features) != kernels[k].features)
+	    continue;
+	  failures += run_layout(l, kernels[k].features, output, masks);
+	  if (memcmp(reference, output, size * sizeof(unsigned short)) != 0 ||
+	      memcmp(reference_masks, masks, sizeof(masks)) != 0)
+	    {
+	      printf("%s kernel output differs with %s layout\n",
+		     kernels[k].name, l->name);
+	      failures++;
+	    }
+	  printf("%-12s %-8s %10.3f\n", l->name, kernels[k].name,
+		 time_layout(l, kernels[k].features));
+	}
+      stp_free(reference);
+      stp_free(output);
+    }
+  stpi_set_cpu_features(available);
+  return failures ? 1 : 0;
+}
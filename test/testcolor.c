@@ -0,0 +1,151 @@
+/*
+ * "$Id$"
+ *
+ *   Color conversion benchmark for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Converts a 16-bit RGB test image to KCMY with each color correction
+ * mode and reports the time spent per row.  Narrow images emphasize the
+ * per-row setup cost, wide ones the per-pixel cost.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include <gutenprint/channel.h>
+#include <gutenprint/color.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define CHANNELS	4
+
+static int image_width;
+static int image_height;
+
+static double
+compute_interval(struct timeval *tv1, struct timeval *tv2)
+{
+  return ((double) tv2->tv_sec + (double) tv2->tv_usec / 1000000.) -
+    ((double) tv1->tv_sec + (double) tv1->tv_usec / 1000000.);
+}
+
+static int
+image_get_width(stp_image_t *image)
+{
+  return image_width;
+}
+
+static int
+image_get_height(stp_image_t *image)
+{
+  return image_height;
+}
+
+/*
+ * A horizontal hue sweep, darkening down the page, with a little noise so
+ * that adjacent pixels usually differ.
+ */
+static stp_image_status_t
+image_get_row(stp_image_t *image, unsigned char *data, size_t byte_limit,
+	      int row)
+{
+  unsigned short *s = (unsigned short *) data;
+  int i;
+  for (i = 0; i < image_width; i++)
+    {
+      unsigned noise = (unsigned) rand() & 0xff;
+      s[3 * i] = (unsigned) (65535.0 * i / image_width) ^ noise;
+      s[3 * i + 1] = (unsigned) (65535.0 * row / image_height) ^ noise;
+      s[3 * i + 2] = ((i ^ row) * 977) & 0xffff;
+    }
+  return STP_IMAGE_STATUS_OK;
+}
+
+static stp_image_t theImage =
+{
+  NULL,
+  NULL,
+  image_get_width,
+  image_get_height,
+  image_get_row,
+  NULL,
+  NULL,
+  NULL
+};
+
+static double
+convert_image(const char *correction, int width, int height)
+{
+  stp_vars_t *v = stp_vars_create();
+  struct timeval tv1, tv2;
+  int i;
+
+  image_width = width;
+  image_height = height;
+  srand(1);
+  stp_set_driver(v, "escp2-ex");
+  stp_set_printer_defaults(v, stp_get_printer(v));
+  stp_set_string_parameter(v, "PrintingMode", "Color");
+  stp_set_string_parameter(v, "InputImageType", "RGB");
+  stp_set_string_parameter(v, "ChannelBitDepth", "16");
+  stp_set_string_parameter(v, "STPIOutputType", "KCMY");
+  stp_set_string_parameter(v, "ColorCorrection", correction);
+  stp_set_float_parameter(v, "Saturation", 1.2);
+  stp_channel_reset(v);
+  for (i = 0; i < CHANNELS; i++)
+    stp_channel_add(v, i, 0, 1.0);
+  stp_color_init(v, &theImage, 65536);
+
+  (void) gettimeofday(&tv1, NULL);
+  for (i = 0; i < height; i++)
+    stp_color_get_row(v, &theImage, i, NULL);
+  (void) gettimeofday(&tv2, NULL);
+  stp_vars_destroy(v);
+  return compute_interval(&tv1, &tv2);
+}
+
+int
+main(int argc, char **argv)
+{
+  static const char *corrections[] =
+    {
+      "Uncorrected", "Accurate", "Bright", "Hue", "Desaturated"
+    };
+  static const struct
+  {
+    int width;
+    int height;
+  } sizes[] =
+    {
+      { 16, 50000 },
+      { 4800, 1000 },
+    };
+  int i, j;
+
+  stp_init();
+  for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+    for (i = 0; i < sizeof(corrections) / sizeof(corrections[0]); i++)
+      {
+	double t = convert_image(corrections[i], sizes[j].width,
+				 sizes[j].height);
+	printf("%-12s width %5d: %.3f sec %8.2f usec/row\n", corrections[i],
+	       sizes[j].width, t, t * 1000000.0 / sizes[j].height);
+      }
+  return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * "$Id$"
+ *
+ *   Ordered dither benchmark for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Dithers a page of 8 channel rows (three black shades, two cyan, two
+ * magenta and yellow) with the ordered dither, once with the per pixel
+ * code and once with each vector kernel the CPU supports, with both
+ * single and variable dot sizes.  The output bitmaps must be identical.
+ * Reports the time per row.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define IMAGE_WIDTH	5760	/* 8in * 720dpi */
+#define IMAGE_HEIGHT	1440	/* 2in * 720dpi */
+#define CHANNELS	8
+#define ROW_BYTES	((IMAGE_WIDTH + 7) / 8)
+#define PLANE_BYTES	(ROW_BYTES * 2)
+
+#define SHADE(density, name)					\
+{  density, sizeof(name)/sizeof(stp_dotsize_t), name  }
+
+static const stp_dotsize_t single_dotsize[] =
+{
+  { 0x1, 1.0 }
+};
+
+static const stp_dotsize_t variable_dotsizes[] =
+{
+  { 0x1, 0.28 },
+  { 0x2, 0.58 },
+  { 0x3, 1.0  }
+};
+
+static const stp_shade_t black_1bit_shades[] =
+{
+  SHADE(0.16, single_dotsize),
+  SHADE(0.4, single_dotsize),
+  SHADE(1.0, single_dotsize)
+};
+
+static const stp_shade_t photo_1bit_shades[] =
+{
+  SHADE(0.33, single_dotsize),
+  SHADE(1.0, single_dotsize)
+};
+
+static const stp_shade_t normal_1bit_shades[] =
+{
+  SHADE(1.0, single_dotsize)
+};
+
+static const stp_shade_t black_2bit_shades[] =
+{
+  SHADE(0.16, variable_dotsizes),
+  SHADE(0.4, variable_dotsizes),
+  SHADE(1.0, variable_dotsizes)
+};
+
+static const stp_shade_t photo_2bit_shades[] =
+{
+  SHADE(0.33, variable_dotsizes),
+  SHADE(1.0, variable_dotsizes)
+};
+
+static const stp_shade_t normal_2bit_shades[] =
+{
+  SHADE(1.0, variable_dotsizes)
+};
+
+static const struct
+{
+  int color;
+  int subchannel;
+} channels[CHANNELS] =
+  {
+    { STP_ECOLOR_K, 0 }, { STP_ECOLOR_K, 1 }, { STP_ECOLOR_K, 2 },
+    { STP_ECOLOR_C, 0 }, { STP_ECOLOR_C, 1 },
+    { STP_ECOLOR_M, 0 }, { STP_ECOLOR_M, 1 },
+    { STP_ECOLOR_Y, 0 },
+  };
+
+static const struct
+{
+  const char *name;
+  unsigned features;
+} kernels[] =
+  {
+    { "sse2", STPI_CPU_SSE2 },
+  };
+
+#define COUNT(x) (sizeof(x) / sizeof(x[0]))
+
+static unsigned short rows[4][IMAGE_WIDTH * CHANNELS];
+
+static double
+compute_interval(struct timeval *tv1, struct timeval *tv2)
+{
+  return ((double) tv2->tv_sec + (double) tv2->tv_usec / 1000000.) -
+    ((double) tv1->tv_sec + (double) tv1->tv_usec / 1000000.);
+}
+
+static void
+writefunc(void *file, const char *buf, size_t bytes)
+{
+  FILE *prn = (FILE *)file;
+  fwrite(buf, 1, bytes, prn);
+}
+
+static int
+image_width(stp_image_t *image)
+{
+  return IMAGE_WIDTH;
+}
+
+static stp_image_t theImage =
+{
+  NULL,
+  NULL,
+  image_width,
+  NULL,
+  NULL,
+  NULL,
+};
+
+/*
+ * A few rows of ramps and noise, with blank stretches and full
+ * coverage, so that every segment of every channel gets exercised.
+ */
+static void
+image_init(void)
+{
+  unsigned seed = 1;
+  int r, x, c;
+  for (r = 0; r < COUNT(rows); r++)
+    for (x = 0; x < IMAGE_WIDTH; x++)
+      for (c = 0; c < CHANNELS; c++)
+	{
+	  unsigned short val;
+	  seed = seed * 1103515245 + 12345;
+	  switch ((x / 720 + r + c) % 4)
+	    {
+	    case 0:
+	      val = x * 65535 / (IMAGE_WIDTH - 1);
+	      break;
+	    case 1:
+	      val = seed >> 16;
+	      break;
+	    case 2:
+	      val = (x & 512) ? 65535 : 0;
+	      break;
+	    default:
+	      val = ((seed >> 16) & 0x3ff) * (c + 1);
+	      break;
+	    }
+	  rows[r][x * CHANNELS + c] = val;
+	}
+}
+
+/*
+ * Dither the page with the given CPU features and return the time per
+ * row in microseconds.  The output bitmaps are concatenated into out.
+ */
+static double
+run_ordered(unsigned features, int dither_bits, unsigned char *out)
+{
+  unsigned char *planes[CHANNELS];
+  stp_vars_t *v;
+  struct timeval tv1, tv2;
+  int i, c;
+
+  stpi_set_cpu_features(features);
+  v = stp_vars_create();
+  stp_set_driver(v, "escp2-ex");
+  stp_set_outfunc(v, writefunc);
+  stp_set_errfunc(v, writefunc);
+  stp_set_outdata(v, stdout);
+  stp_set_errdata(v, stderr);
+  stp_set_string_parameter(v, "DitherAlgorithm", "Ordered");
+  stp_set_string_parameter(v, "ChannelBitDepth", "8");
+  stp_set_string_parameter(v, "PrintingMode", "Color");
+  stp_set_string_parameter(v, "InputImageType", "CMYK");
+
+  stp_dither_init(v, &theImage, IMAGE_WIDTH, 1, 1);
+  for (c = 0; c < CHANNELS; c++)
+    {
+      planes[c] = stp_zalloc(PLANE_BYTES);
+      stp_dither_add_channel(v, planes[c], channels[c].color,
+			     channels[c].subchannel);
+    }
+  if (dither_bits == 1)
+    {
+      stp_dither_set_inks_full(v, STP_ECOLOR_K, 3, black_1bit_shades, 1.0, 1.0);
+      stp_dither_set_inks_full(v, STP_ECOLOR_C, 2, photo_1bit_shades, 1.0, 0.65);
+      stp_dither_set_inks_full(v, STP_ECOLOR_M, 2, photo_1bit_shades, 1.0, 0.6);
+      stp_dither_set_inks_full(v, STP_ECOLOR_Y, 1, normal_1bit_shades, 1.0, 0.08);
+    }
+  else
+    {
+      stp_dither_set_transition(v, 0.7);
+      stp_dither_set_inks_full(v, STP_ECOLOR_K, 3, black_2bit_shades, 1.0, 1.0);
+      stp_dither_set_inks_full(v, STP_ECOLOR_C, 2, photo_2bit_shades, 1.0, 0.65);
+      stp_dither_set_inks_full(v, STP_ECOLOR_M, 2, photo_2bit_shades, 1.0, 0.6);
+      stp_dither_set_inks_full(v, STP_ECOLOR_Y, 1, normal_2bit_shades, 1.0, 0.08);
+    }
+
+  (void) gettimeofday(&tv1, NULL);
+  for (i = 0; i < IMAGE_HEIGHT; i++)
+    {
+      stp_dither_internal(v, i, rows[i % COUNT(rows)], 0, 0, NULL);
+      for (c = 0; c < CHANNELS; c++)
+	{
+	  memcpy(out, planes[c], PLANE_BYTES);
+	  out += PLANE_BYTES;
+	}
+    }
+  (void) gettimeofday(&tv2, NULL);
+
+  stp_vars_destroy(v);
+  for (c = 0; c < CHANNELS; c++)
+    stp_free(planes[c]);
+  return compute_interval(&tv1, &tv2) * 1000000.0 / IMAGE_HEIGHT;
+}
+
+int
+main(int argc, char **argv)
+{
+  size_t size = (size_t) IMAGE_HEIGHT * CHANNELS * PLANE_BYTES;
+  unsigned char *reference = stp_malloc(size);
+  unsigned char *output = stp_malloc(size);
+  unsigned available;
+  int failures = 0;
+  int bits, k;
+
+  stp_init();
+  image_init();
+  available = stpi_cpu_features();
+
+  printf("%-8s %5s %10s\n", "kernel", "bits", "usec/row");
+  for (bits = 1; bits <= 2; bits++)
+    {
+      printf("%-8s %5d %10.3f\n", "scalar", bits,
+	     run_ordered(0, bits, reference));
+      for (k = 0; k < COUNT(kernels); k++)
+	{
+	  double usec;
+	  if ((available & kernels[k].features) != kernels[k].features)
+	    continue;
+	  usec = run_ordered(kernels[k].features, bits, output);
+	  if (memcmp(reference, output, size) != 0)
+	    {
+	      printf("%s kernel output differs with %d bit inks\n",
+		     kernels[k].name, bits);
+	      failures++;
+	    }
+	  printf("%-8s %5d %10.3f\n", kernels[k].name, bits, usec);
+	}
+    }
+  stpi_set_cpu_features(available);
+  stp_free(reference);
+  stp_free(output);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,245 @@
+/*
+ * "$Id$"
+ *
+ *   Packbits encoder benchmark for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Dithers a test page the same way testdither does, then compresses every
+ * dithered row with stp_pack_tiff using the portable encoder and using
+ * each vectorized encoder the CPU supports.  The compressed output of
+ * every encoder must be identical.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "../src/main/gutenprint-internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define IMAGE_WIDTH	5760	/* 8in * 720dpi */
+#define IMAGE_HEIGHT	800
+#define ROW_BYTES	((IMAGE_WIDTH + 7) / 8)
+#define CHANNELS	4
+#define PASSES		20
+
+static const stp_dotsize_t single_dotsize[] =
+{
+  { 0x1, 1.0 }
+};
+
+static const stp_shade_t normal_1bit_shades[] =
+{
+  { 1.0, 1, single_dotsize }
+};
+
+static unsigned char *rows;
+
+static double
+compute_interval(struct timeval *tv1, struct timeval *tv2)
+{
+  return ((double) tv2->tv_sec + (double) tv2->tv_usec / 1000000.) -
+    ((double) tv1->tv_sec + (double) tv1->tv_usec / 1000000.);
+}
+
+static int
+image_width(stp_image_t *image)
+{
+  return IMAGE_WIDTH;
+}
+
+static stp_image_t theImage =
+{
+  NULL,
+  NULL,
+  image_width,
+  NULL,
+  NULL,
+  NULL,
+};
+
+/*
+ * Bands of white, flat color, a gradient, and noise, which between them
+ * exercise empty rows, long repeats and short literal runs.
+ */
+static void
+image_get_row(unsigned short *data, int row)
+{
+  int i, j;
+  for (i = 0; i < IMAGE_WIDTH; i++)
+    for (j = 0; j < CHANNELS; j++)
+      {
+	unsigned short val;
+	switch ((row / 100) & 3)
+	  {
+	  case 0:
+	    val = (i < IMAGE_WIDTH / 3) ? 0 : 65535 * j / 4;
+	    break;
+	  case 1:
+	    val = 65535 * ((i / 90 + j) & 63) / 63;
+	    break;
+	  case 2:
+	    val = (unsigned) (65535.0 * i / IMAGE_WIDTH) * (j + 1) / CHANNELS;
+	    break;
+	  default:
+	    val = 65535 * (rand() & 255) / 255;
+	    break;
+	  }
+	*data++ = val;
+      }
+}
+
+static void
+dither_rows(void)
+{
+  unsigned char *channels[CHANNELS];
+  unsigned short *input = stp_malloc(sizeof(unsigned short) *
+				     IMAGE_WIDTH * CHANNELS);
+  stp_vars_t *v = stp_vars_create();
+  int i, j;
+
+  stp_set_driver(v, "escp2-ex");
+  stp_set_string_parameter(v, "PrintingMode", "Color");
+  stp_set_string_parameter(v, "InputImageType", "CMYK");
+  stp_set_string_parameter(v, "ChannelBitDepth", "8");
+  stp_set_string_parameter(v, "DitherAlgorithm", "EvenTone");
+  stp_dither_init(v, &theImage, IMAGE_WIDTH, 1, 1);
+  for (j = 0; j < CHANNELS; j++)
+    channels[j] = stp_zalloc(ROW_BYTES);
+  stp_dither_add_channel(v, channels[0], STP_ECOLOR_C, 0);
+  stp_dither_add_channel(v, channels[1], STP_ECOLOR_M, 0);
+  stp_dither_add_channel(v, channels[2], STP_ECOLOR_Y, 0);
+  stp_dither_add_channel(v, channels[3], STP_ECOLOR_K, 0);
+  stp_dither_set_inks_full(v, STP_ECOLOR_C, 1, normal_1bit_shades, 1.0, 0.65);
+  stp_dither_set_inks_full(v, STP_ECOLOR_M, 1, normal_1bit_shades, 1.0, 0.6);
+  stp_dither_set_inks_full(v, STP_ECOLOR_Y, 1, normal_1bit_shades, 1.0, 0.08);
+  stp_dither_set_inks_full(v, STP_ECOLOR_K, 1, normal_1bit_shades, 1.0, 1.0);
+
+  rows = stp_malloc(ROW_BYTES * CHANNELS * IMAGE_HEIGHT);
+  for (i = 0; i < IMAGE_HEIGHT; i++)
+    {
+      image_get_row(input, i);
+      stp_dither_internal(v, i, input, 0, 0, NULL);
+      for (j = 0; j < CHANNELS; j++)
+	memcpy(rows + (i * CHANNELS + j) * ROW_BYTES, channels[j], ROW_BYTES);
+    }
+  for (j = 0; j < CHANNELS; j++)
+    stp_free(channels[j]);
+  stp_free(input);
+  stp_vars_destroy(v);
+}
+
+/*
+ * Compress every row PASSES times and keep the output of the last pass.
+ */
+static double
+pack_rows(unsigned char *out, size_t *out_bytes)
+{
+  unsigned char comp_buf[ROW_BYTES * 2];
+  struct timeval tv1, tv2;
+  int pass, i;
+
+  (void) gettimeofday(&tv1, NULL);
+  for (pass = 0; pass < PASSES; pass++)
+    {
+      size_t bytes = 0;
+      for (i = 0; i < IMAGE_HEIGHT * CHANNELS; i++)
+	{
+	  unsigned char *comp_ptr;
+	  int first, last;
+	  stp_pack_tiff(NULL, rows + i * ROW_BYTES, ROW_BYTES, comp_buf,
+			&comp_ptr, &first, &last);
+	  if (pass == PASSES - 1)
+	    {
+	      memcpy(out + bytes, comp_buf, comp_ptr - comp_buf);
+	      bytes += comp_ptr - comp_buf;
+	      memcpy(out + bytes, &first, sizeof(int));
+	      bytes += sizeof(int);
+	      memcpy(out + bytes, &last, sizeof(int));
+	      bytes += sizeof(int);
+	    }
+	}
+      *out_bytes = bytes;
+    }
+  (void) gettimeofday(&tv2, NULL);
+  return compute_interval(&tv1, &tv2);
+}
+
+int
+main(int argc, char **argv)
+{
+  static const struct
+  {
+    const char *name;
+    unsigned features;
+  } encoders[] =
+    {
+      { "portable", 0 },
+      { "sse2", STPI_CPU_SSE2 },
+      { "avx2", STPI_CPU_SSE2 | STPI_CPU_AVX2 },
+    };
+  size_t out_size = (ROW_BYTES * 2 + 2 * sizeof(int)) * IMAGE_HEIGHT * CHANNELS;
+  unsigned char *reference = stp_malloc(out_size);
+  unsigned char *result = stp_malloc(out_size);
+  size_t reference_bytes = 0;
+  unsigned available;
+  double base_time = 0;
+  int failures = 0;
+  int i;
+
+  stp_init();
+  dither_rows();
+  available = stpi_cpu_features();
+
+  for (i = 0; i < sizeof(encoders) / sizeof(encoders[0]); i++)
+    {
+      size_t bytes;
+      double t;
+      if ((encoders[i].features & available) != encoders[i].features)
+	{
+	  printf("%-10s not supported\n", encoders[i].name);
+	  continue;
+	}
+      stpi_set_cpu_features(encoders[i].features);
+      if (i == 0)
+	{
+	  t = pack_rows(reference, &reference_bytes);
+	  base_time = t;
+	}
+      else
+	{
+	  t = pack_rows(result, &bytes);
+	  if (bytes != reference_bytes ||
+	      memcmp(result, reference, bytes) != 0)
+	    {
+	      printf("%-10s output differs from portable encoder!\n",
+		     encoders[i].name);
+	      failures++;
+	    }
+	}
+      printf("%-10s %.3f sec %.1f MB/sec %.2fx\n", encoders[i].name, t,
+	     (double) ROW_BYTES * CHANNELS * IMAGE_HEIGHT * PASSES / t / 1e6,
+	     base_time / t);
+    }
+  stpi_set_cpu_features(available);
+  stp_free(rows);
+  stp_free(reference);
+  stp_free(result);
+  return failures ? 1 : 0;
+}
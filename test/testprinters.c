@@ -0,0 +1,148 @@
+/*
+ * "$Id$"
+ *
+ *   Printer lookup benchmark for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Enumerates every printer model and looks each one up again by driver
+ * name, long name, IEEE 1284 device ID, Foomatic ID and index, the way
+ * genppd and printer autodetection do.  Each lookup must find the first
+ * model in the list with that key.  Reports the time per lookup.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define PASSES 20
+
+typedef const char *(*key_func_t)(const stp_printer_t *printer);
+typedef const stp_printer_t *(*lookup_func_t)(const char *key);
+
+static const struct
+{
+  const char *name;
+  key_func_t key;
+  lookup_func_t lookup;
+} lookups[] =
+  {
+    { "driver", stp_printer_get_driver, stp_get_printer_by_driver },
+    { "long name", stp_printer_get_long_name, stp_get_printer_by_long_name },
+    { "device ID", stp_printer_get_device_id, stp_get_printer_by_device_id },
+    { "foomatic ID", stp_printer_get_foomatic_id,
+      stp_get_printer_by_foomatic_id },
+  };
+
+#define COUNT(x) (sizeof(x) / sizeof(x[0]))
+
+static double
+compute_interval(struct timeval *tv1, struct timeval *tv2)
+{
+  return ((double) tv2->tv_sec + (double) tv2->tv_usec / 1000000.) -
+    ((double) tv1->tv_sec + (double) tv1->tv_usec / 1000000.);
+}
+
+/* The first printer with the given key, found the slow way */
+static const stp_printer_t *
+first_with_key(int which, const char *key)
+{
+  int i;
+  for (i = 0; i < stp_printer_model_count(); i++)
+    {
+      const stp_printer_t *printer = stp_get_printer_by_index(i);
+      const char *pkey = (*lookups[which].key)(printer);
+      if (pkey && strcmp(pkey, key) == 0)
+	return printer;
+    }
+  return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct timeval tv1, tv2;
+  int count;
+  int failures = 0;
+  int i, j, pass;
+
+  stp_init();
+  count = stp_printer_model_count();
+  if (count == 0)
+    {
+      fprintf(stderr, "No printers found\n");
+      return 1;
+    }
+
+  for (j = 0; j < COUNT(lookups); j++)
+    for (i = 0; i < count; i++)
+      {
+	const char *key =
+	  (*lookups[j].key)(stp_get_printer_by_index(i));
+	if (key && key[0] &&
+	    (*lookups[j].lookup)(key) != first_with_key(j, key))
+	  {
+	    printf("%s lookup of %s found the wrong printer\n",
+		   lookups[j].name, key);
+	    failures++;
+	  }
+      }
+  for (i = 0; i < count; i++)
+    {
+      const char *driver = stp_printer_get_driver(stp_get_printer_by_index(i));
+      if (stp_get_printer_index_by_driver(driver) != i)
+	{
+	  printf("index lookup of %s is wrong\n", driver);
+	  failures++;
+	}
+    }
+  printf("%d printers, %d lookups failed\n", count, failures);
+
+  printf("\n%-12s %10s\n", "lookup", "usec");
+  for (j = 0; j < COUNT(lookups); j++)
+    {
+      int lookups_done = 0;
+      (void) gettimeofday(&tv1, NULL);
+      for (pass = 0; pass < PASSES; pass++)
+	for (i = 0; i < count; i++)
+	  {
+	    const char *key =
+	      (*lookups[j].key)(stp_get_printer_by_index(i));
+	    if (key)
+	      {
+		(void) (*lookups[j].lookup)(key);
+		lookups_done++;
+	      }
+	  }
+      (void) gettimeofday(&tv2, NULL);
+      printf("%-12s %10.3f\n", lookups[j].name, lookups_done ?
+	     compute_interval(&tv1, &tv2) * 1000000.0 / lookups_done : 0.0);
+    }
+  (void) gettimeofday(&tv1, NULL);
+  for (pass = 0; pass < PASSES; pass++)
+    for (i = 0; i < count; i++)
+      (void) stp_get_printer_index_by_driver
+	(stp_printer_get_driver(stp_get_printer_by_index(i)));
+  (void) gettimeofday(&tv2, NULL);
+  printf("%-12s %10.3f\n", "index",
+	 compute_interval(&tv1, &tv2) * 1000000.0 / (PASSES * count));
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * "$Id$"
+ *
+ *   Startup time benchmark for Gutenprint.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Measures what a print filter pays before it can start printing: stp_init,
+ * loading an ESC/P2 model and loading a dither matrix.  Since stp_init can
+ * only run once per process, each sample is a fresh child process.  Runs
+ * once parsing the XML data every time and once using the binary XML cache
+ * in a scratch directory.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include <gutenprint/dither.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define SAMPLES		20
+
+static const char *printer = "escp2-r2400";
+
+static double
+compute_interval(struct timeval *tv1, struct timeval *tv2)
+{
+  return ((double) tv2->tv_sec + (double) tv2->tv_usec / 1000000.) -
+    ((double) tv1->tv_sec + (double) tv1->tv_usec / 1000000.);
+}
+
+static void
+start_up(void)
+{
+  stp_vars_t *v;
+  stp_parameter_t desc;
+  stp_array_t *matrix;
+
+  stp_init();
+  v = stp_vars_create();
+  stp_set_driver(v, printer);
+  stp_set_printer_defaults(v, stp_get_printer(v));
+  stp_describe_parameter(v, "Resolution", &desc);
+  stp_parameter_description_destroy(&desc);
+  matrix = stp_find_standard_dither_array(1, 1);
+  if (matrix)
+    stp_array_destroy(matrix);
+  stp_vars_destroy(v);
+}
+
+static double
+time_startups(int samples)
+{
+  struct timeval tv1, tv2;
+  int i;
+
+  (void) gettimeofday(&tv1, NULL);
+  for (i = 0; i < samples; i++)
+    {
+      int status;
+      pid_t pid = fork();
+      if (pid == 0)
+	{
+	  start_up();
+	  _exit(0);
+	}
+      if (pid < 0 || waitpid(pid, &status, 0) != pid ||
+	  !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+	  fprintf(stderr, "teststartup: child failed\n");
+	  exit(1);
+	}
+    }
+  (void) gettimeofday(&tv2, NULL);
+  return compute_interval(&tv1, &tv2) / samples;
+}
+
+int
+main(int argc, char **argv)
+{
+  char cache_dir[] = "/tmp/stpcacheXXXXXX";
+  char command[64];
+  double cold, cached;
+
+  if (argc > 1)
+    printer = argv[1];
+  if (!mkdtemp(cache_dir))
+    {
+      perror("teststartup: mkdtemp");
+      return 1;
+    }
+
+  setenv("STP_CACHE_DIR", "", 1);
+  cold = time_startups(SAMPLES);
+
+  setenv("STP_CACHE_DIR", cache_dir, 1);
+  (void) time_startups(1);	/* Populate the cache */
+  cached = time_startups(SAMPLES);
+
+  printf("%s: XML %.2f msec, cached %.2f msec, %.2fx\n", printer,
+	 cold * 1000, cached * 1000, cold / cached);
+
+  (void) sprintf(command, "rm -rf %s", cache_dir);
+  return system(command) == 0 ? 0 : 1;
+}